@@ -84,6 +84,26 @@ int main(void)
     PICO_INFO("This uses JSON format - great for log parsers");
     picoLogPopFormat();
 
+    picoLogPushFormat(PICO_LOG_FORMAT_LOGFMT);
+    PICO_INFO("This uses LOGFMT format - key=value pairs");
+    picoLogPopFormat();
+
+    // structured fields become JSON members or logfmt pairs instead of message text
+    picoLogPushFormat(PICO_LOG_FORMAT_JSON);
+    PICO_INFO_FIELDS("Request served", PICO_LOG_FIELD_STRING("path", "/index.html"), PICO_LOG_FIELD_INT("status", 200),
+                     PICO_LOG_FIELD_DURATION_MS("elapsed", 1.25), PICO_LOG_FIELD_BOOL("cached", true));
+    picoLogPopFormat();
+    PICO_INFO_FIELDS("Fields are appended to other formats", PICO_LOG_FIELD_FLOAT("ratio", 0.75));
+
+    // only the first 3 of these get through, the rest are counted and reported
+    // the next time this call site is let through
+    for (int i = 0; i < 1000; i++) {
+        PICO_WARN_RATE_LIMITED(3, 1000, "Rate limited warning %d", i);
+    }
+    for (int i = 0; i < 1000; i++) {
+        PICO_DEBUG_SAMPLED(0.005, "Sampled debug message %d", i);
+    }
+
     PICO_DEBUG("You can see DEBUG");
     PICO_INFO("You can see INFO");
     PICO_WARN("You can see WARN");
@@ -108,6 +128,32 @@ int main(void)
     picoLogPopFileLogger();
     PICO_INFO("File logging stopped - this goes to console only");
 
+    // binary logs are decoded later with examples/picoLogDecode
+    const char *binaryLogFile = "test_log.bin";
+    picoLogPushBinaryLogger(binaryLogFile);
+    picoLogPushTarget(PICO_LOG_TARGET_BINARY);
+    for (int i = 0; i < 10; i++) {
+        PICO_INFO("Binary record %d of %d, value %.3f, name %s", i + 1, 10, i * 0.5, "picoLog");
+    }
+    picoLogPopTarget();
+    picoLogPopBinaryLogger();
+    PICO_INFO("Wrote 10 binary records to %s", binaryLogFile);
+
+    // the crash ring keeps DEBUG detail in memory while the console only shows
+    // WARN and up, picoLogInstallCrashHandler would dump it when the process faults
+    const char *crashDumpFile = "test_log_crash.txt";
+    picoLogStartCrashRing(16 * 1024, NULL);
+    picoLogPushTarget(PICO_LOG_TARGET_CONSOLE | PICO_LOG_TARGET_RING);
+    picoLogSetTargetLevels(PICO_LOG_TARGET_CONSOLE, PICO_LOG_LEVEL_WARN | PICO_LOG_LEVEL_ERROR);
+    for (int i = 0; i < 100; i++) {
+        PICO_DEBUG("Crash ring detail %d", i);
+    }
+    PICO_WARN("Something looks wrong, dumping the crash ring to %s", crashDumpFile);
+    picoLogDumpCrashRing(crashDumpFile);
+    picoLogSetTargetLevels(PICO_LOG_TARGET_CONSOLE, PICO_LOG_LEVEL_ALL);
+    picoLogPopTarget();
+    picoLogStopCrashRing();
+
     int customLoggerCallCount = 0;
     picoLogPushCustomLogger(myCustomLogger, &customLoggerCallCount);
     picoLogPushTarget(PICO_LOG_TARGET_CUSTOM | PICO_LOG_TARGET_CONSOLE);
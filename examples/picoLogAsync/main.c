@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PICO_LOG_ASYNC
+#define PICO_IMPLEMENTATION
+#include "pico/picoLog.h"
+#include "pico/picoThreads.h"
+
+// Several producer threads log through the async writer while the main thread
+// keeps changing the configuration, every message has to come out exactly once.
+// Tags live on the heap and are freed right after each call, the writer must
+// only ever see its own copies.
+
+#define PRODUCER_COUNT         8
+#define MESSAGES_PER_PRODUCER  20000
+#define CONFIG_CHANGE_INTERVAL 1 // ms
+
+typedef struct {
+    int producerId;
+} ProducerData;
+
+// only ever touched by the writer thread
+static uint32_t receivedCounts[PRODUCER_COUNT];
+static uint32_t nextExpected[PRODUCER_COUNT];
+static uint32_t outOfOrder;
+
+static void countMessage(picoLogLevel level, const char *tag, const char *message,
+                         picoLogCodeLocation location, picoLogTimeStamp timestamp, void *userData)
+{
+    (void)level;
+    (void)location;
+    (void)timestamp;
+    (void)userData;
+
+    int producerId = -1;
+    unsigned index = 0;
+    if (strncmp(tag, "producer-", 9) != 0 || sscanf(message, "producer %d message %u", &producerId, &index) != 2 ||
+        producerId < 0 || producerId >= PRODUCER_COUNT || atoi(tag + 9) != producerId) {
+        return;
+    }
+
+    // one producer's messages keep their order through the queue
+    if (index != nextExpected[producerId]) {
+        outOfOrder++;
+    }
+    nextExpected[producerId] = index + 1;
+    receivedCounts[producerId]++;
+}
+
+static void producer(void *arg)
+{
+    ProducerData *data = (ProducerData *)arg;
+    for (unsigned i = 0; i < MESSAGES_PER_PRODUCER; i++) {
+        char *tag = (char *)malloc(16);
+        if (tag == NULL) {
+            continue;
+        }
+        snprintf(tag, 16, "producer-%d", data->producerId);
+        picoLog(PICO_LOG_LEVEL_INFO, tag, PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE, "producer %d message %u", data->producerId, i);
+        free(tag);
+    }
+}
+
+int main(void)
+{
+    if (!picoLogContextCreate()) {
+        fprintf(stderr, "failed to create the log context\n");
+        return 1;
+    }
+
+    picoLogPushTarget(PICO_LOG_TARGET_CUSTOM);
+    picoLogPushFormat(PICO_LOG_FORMAT_MESSAGE_ONLY);
+    picoLogPushCustomLogger(countMessage, NULL);
+
+    if (!picoLogStartAsync(PICO_LOG_ASYNC_OVERFLOW_BLOCK)) {
+        fprintf(stderr, "failed to start the async writer\n");
+        picoLogShutdown();
+        return 1;
+    }
+
+    ProducerData data[PRODUCER_COUNT];
+    picoThread threads[PRODUCER_COUNT];
+    for (int i = 0; i < PRODUCER_COUNT; i++) {
+        data[i].producerId = i;
+        threads[i]         = picoThreadCreate(producer, &data[i]);
+    }
+
+    // the producers filter against snapshots, swap them out from under them
+    for (int i = 0; i < 200; i++) {
+        picoLogPushTagFilter("producer-0,producer-1,producer-2,producer-3,producer-4,producer-5,producer-6,producer-7");
+        picoLogPushLevel(PICO_LOG_LEVEL_ALL);
+        picoThreadSleep(CONFIG_CHANGE_INTERVAL);
+        picoLogPopLevel();
+        picoLogPopTagFilter();
+    }
+
+    for (int i = 0; i < PRODUCER_COUNT; i++) {
+        if (threads[i] != NULL) {
+            picoThreadJoin(threads[i], PICO_THREAD_INFINITE);
+            picoThreadDestroy(threads[i]);
+        }
+    }
+
+    // drains the queue and joins the writer, the counts are final after this
+    picoLogStopAsync();
+
+    int failed = 0;
+    for (int i = 0; i < PRODUCER_COUNT; i++) {
+        printf("producer %d: %u of %u messages\n", i, receivedCounts[i], MESSAGES_PER_PRODUCER);
+        if (receivedCounts[i] != MESSAGES_PER_PRODUCER) {
+            failed = 1;
+        }
+    }
+    if (outOfOrder != 0) {
+        printf("%u messages arrived out of order\n", outOfOrder);
+        failed = 1;
+    }
+    // the queue blocks when full, nothing may have been lost
+    uint64_t dropped = picoLogGetDroppedCount();
+    printf("dropped: %llu\n", (unsigned long long)dropped);
+    if (dropped != 0) {
+        failed = 1;
+    }
+    printf("%s\n", failed ? "FAILED" : "all messages arrived");
+
+    picoLogShutdown();
+    return failed;
+}
@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PICO_IMPLEMENTATION
+#include "pico/picoLog.h"
+
+// Renders a binary log written with picoLogPushBinaryLogger as text
+// usage: picoLogDecode <file.bin> [DEFAULT|SHORT|MESSAGE_ONLY|VERBOSE|JSON]
+
+static void printMessage(picoLogLevel level, const char *tag, const char *message,
+                         picoLogCodeLocation location, picoLogTimeStamp timestamp, void *userData)
+{
+    (void)level;
+    (void)tag;
+    (void)location;
+    (void)timestamp;
+
+    fprintf((FILE *)userData, "%s\n", message);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file.bin> [DEFAULT|SHORT|MESSAGE_ONLY|VERBOSE|JSON]\n", argv[0]);
+        return 1;
+    }
+
+    picoLogFormat format = argc > 2 ? picoLogStringToFormat(argv[2]) : PICO_LOG_FORMAT_DEFAULT;
+    if (!picoLogDecodeBinary(argv[1], format, printMessage, stdout)) {
+        fprintf(stderr, "failed to decode %s, the file is missing, truncated or not a picoLog binary log\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
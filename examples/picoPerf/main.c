@@ -5,8 +5,14 @@
 #include <string.h>
 #include <math.h>
 
+#define PICO_PERF_STREAMING
+#define PICO_PERF_SAMPLING
+#define PICO_PERF_TRACK_ALLOCATIONS // picoThreads below allocates through picoPerf as well
 #define PICO_IMPLEMENTATION
 #include "pico/picoPerf.h"
+#include "pico/picoThreads.h"
+
+#define WORKER_COUNT 4
 
 void simulateMatrixMultiplication(int size)
 {
@@ -51,10 +57,13 @@ void simulateDataProcessing(int iterations)
     for (int i = 0; i < iterations; i++) {
         PICO_PERF_PUSH_SCOPE("ProcessBatch");
         
-        double sum = 0.0;
+        double *batch = (double *)PICO_MALLOC(10000 * sizeof(double));
+        double sum    = 0.0;
         for (int j = 0; j < 10000; j++) {
-            sum += sqrt((double)(i * j + 1));
+            batch[j] = sqrt((double)(i * j + 1));
+            sum += batch[j];
         }
+        PICO_FREE(batch);
         
         if (sum > 1e10) {
             printf("Batch result: %f\n", sum);
@@ -164,6 +173,24 @@ void simulateServerRequest(void)
     PICO_PERF_POP_SCOPE();
 }
 
+void workerThread(void *arg)
+{
+    int workerId = *(int *)arg;
+
+    char threadName[32];
+    snprintf(threadName, sizeof(threadName), "Worker %d", workerId);
+    PICO_PERF_SET_THREAD_NAME(threadName);
+
+    // each thread keeps its own scope stack, nesting does not mix across threads
+    PICO_PERF_PUSH_SCOPE("WorkerThread");
+    PICO_PERF_FLOW_END("Dispatch", (uint64_t)workerId);
+    for (int i = 0; i < 3; i++) {
+        simulateFFT(20 + workerId * 10);
+        simulateDataProcessing(2);
+    }
+    PICO_PERF_POP_SCOPE();
+}
+
 void dumpReportToFile(const char *filename, picoPerfReportFormat format)
 {
     FILE *file = fopen(filename, "w");
@@ -182,6 +209,12 @@ int main(void)
     printf("Hello, Pico!\n");
 
     PICO_PERF_CREATE_CONTEXT();
+    PICO_PERF_ENABLE_ALLOCS(true);
+
+    // everything below is also streamed, decode it with picoPerfDecode perf_stream.bin
+    if (!picoPerfStartStreamingToFile("perf_stream.bin")) {
+        fprintf(stderr, "Failed to start streaming to perf_stream.bin\n");
+    }
 
     picoPerfTimeStamp ts = picoPerfGetCurrentTimestamp();
     printf("Current Timestamp: %04d-%02d-%02d %02d:%02d:%02d.%03d\n",
@@ -192,6 +225,8 @@ int main(void)
     picoPerfTime end = picoPerfNow();
     
     printf("Frequency: %llu ticks/second\n", (unsigned long long)picoPerfFrequency());
+    // build with PICO_PERF_HW_COUNTERS on Linux to get cycles, IPC and cache misses per scope
+    printf("Hardware counters: %s\n", picoPerfHwCountersAvailable() ? "available" : "unavailable");
     printf("Sleep 100ms duration:\n");
     printf("  - Seconds: %.6f\n", picoPerfDurationSeconds(start, end));
     printf("  - Milliseconds: %.3f\n", picoPerfDurationMilliseconds(start, end));
@@ -201,6 +236,11 @@ int main(void)
     picoPerfFormatDuration(end - start, durationStr, sizeof(durationStr));
     printf("  - Formatted: %s\n\n", durationStr);
 
+    // the sampler needs no scopes, it sees every function that burns CPU until it is stopped
+    if (!picoPerfStartSampling(1000)) {
+        printf("Sampling unavailable on this platform\n");
+    }
+
     PICO_PERF_BEGIN_RECORD();
     
     simulateMatrixMultiplication(100);
@@ -224,6 +264,17 @@ int main(void)
     
     PICO_PERF_END_RECORD();
 
+    picoPerfStopSampling();
+    uint64_t droppedSamples = 0;
+    uint64_t samples        = picoPerfGetSampleCount(&droppedSamples);
+    FILE *stacksFile        = fopen("perf_stacks.folded", "w");
+    if (stacksFile) {
+        // render with flamegraph.pl perf_stacks.folded > perf_flame.svg
+        picoPerfWriteFoldedStacks(stacksFile);
+        fclose(stacksFile);
+        printf("Wrote %llu samples to perf_stacks.folded, dropped %llu\n", (unsigned long long)samples, (unsigned long long)droppedSamples);
+    }
+
     PICO_PERF_BEGIN_RECORD();
     
     for (int i = 0; i < 3; i++) {
@@ -257,14 +308,47 @@ int main(void)
     
     PICO_PERF_END_RECORD();
 
+    PICO_PERF_SET_THREAD_NAME("Main");
+    PICO_PERF_BEGIN_RECORD();
+
+    PICO_PERF_PUSH_SCOPE("ParallelWorkload");
+    picoThread workers[WORKER_COUNT];
+    int workerIds[WORKER_COUNT];
+    for (int i = 0; i < WORKER_COUNT; i++) {
+        workerIds[i] = i;
+        PICO_PERF_FLOW_BEGIN("Dispatch", (uint64_t)i);
+        PICO_PERF_COUNTER("WorkersStarted", i + 1);
+        workers[i] = picoThreadCreate(workerThread, &workerIds[i]);
+    }
+    for (int i = 0; i < WORKER_COUNT; i++) {
+        picoThreadJoin(workers[i], PICO_THREAD_INFINITE);
+        picoThreadDestroy(workers[i]);
+    }
+    PICO_PERF_POP_SCOPE();
+
+    PICO_PERF_END_RECORD();
+
+    // stats mode keeps only per site aggregates, fit for scopes that run in hot loops
+    PICO_PERF_ENABLE_STATS(true);
+    for (int i = 0; i < 1000; i++) {
+        simulateFFT(1);
+    }
+    PICO_PERF_ENABLE_STATS(false);
+
+    picoPerfStopStreaming();
+    printf("Streamed to perf_stream.bin, dropped %llu entries\n", (unsigned long long)picoPerfGetStreamDroppedCount());
+
     printf("Generating performance reports in all formats...\n");
     
     dumpReportToFile("perf_report.txt", PICO_PERF_REPORT_FORMAT_TEXT);
     dumpReportToFile("perf_report.csv", PICO_PERF_REPORT_FORMAT_CSV);
     dumpReportToFile("perf_report.json", PICO_PERF_REPORT_FORMAT_JSON);
     dumpReportToFile("perf_report.xml", PICO_PERF_REPORT_FORMAT_XML);
+    dumpReportToFile("perf_trace.json", PICO_PERF_REPORT_FORMAT_CHROME_TRACE);
     
     PICO_PERF_GET_REPORT(stdout, PICO_PERF_REPORT_FORMAT_TEXT);
+    PICO_PERF_GET_STATS_REPORT(stdout, PICO_PERF_REPORT_FORMAT_TEXT);
+    PICO_PERF_GET_ALLOC_REPORT(stdout, PICO_PERF_REPORT_FORMAT_TEXT);
 
     PICO_PERF_DESTROY_CONTEXT();
 
@@ -0,0 +1,121 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PICO_IMPLEMENTATION
+#include "pico/picoPerf.h"
+
+// Renders a stream written with picoPerfStartStreaming as text or as a Chrome trace
+// usage: picoPerfDecode <file.bin> [TEXT|TRACE]
+
+typedef struct {
+    FILE *output;
+    bool trace;
+    bool first;
+} decodeState_t;
+
+static void printJsonString(FILE *output, const char *str)
+{
+    fputc('"', output);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fprintf(output, "\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            fprintf(output, "\\u%04x", (unsigned char)*str);
+        } else {
+            fputc(*str, output);
+        }
+    }
+    fputc('"', output);
+}
+
+static void printTraceEvent(decodeState_t *state, const picoPerfStreamEvent_t *event)
+{
+    static const char *flowPhases[] = {"s", "t", "f"};
+    FILE *output                    = state->output;
+
+    fprintf(output, "%s\n{\"name\":", state->first ? "" : ",");
+    state->first = false;
+    printJsonString(output, event->name);
+    fprintf(output, ",\"pid\":1,\"tid\":%" PRIu64 ",\"ts\":%.3f", event->threadId, (double)event->timeNs / 1000.0);
+
+    switch (event->type) {
+        case PICO_PERF_STREAM_EVENT_SCOPE:
+            fprintf(output, ",\"ph\":\"X\",\"dur\":%.3f,\"args\":{\"function\":", (double)event->durationNs / 1000.0);
+            printJsonString(output, event->location.function);
+            fprintf(output, ",\"line\":%u}}", event->location.line);
+            break;
+        case PICO_PERF_STREAM_EVENT_COUNTER:
+            fprintf(output, ",\"ph\":\"C\",\"args\":{\"value\":%.17g}}", event->counterValue);
+            break;
+        case PICO_PERF_STREAM_EVENT_FLOW:
+            fprintf(output, ",\"ph\":\"%s\",\"cat\":\"flow\",\"id\":%" PRIu64 "%s}", flowPhases[event->flowPhase], event->flowId,
+                    event->flowPhase == PICO_PERF_FLOW_PHASE_BEGIN ? "" : ",\"bp\":\"e\"");
+            break;
+        case PICO_PERF_STREAM_EVENT_DROPPED:
+            fprintf(output, ",\"ph\":\"i\",\"s\":\"t\",\"args\":{\"count\":%" PRIu64 "}}", event->droppedCount);
+            break;
+    }
+}
+
+static void printEvent(const picoPerfStreamEvent_t *event, void *userData)
+{
+    decodeState_t *state = (decodeState_t *)userData;
+    if (state->trace) {
+        printTraceEvent(state, event);
+        return;
+    }
+
+    fprintf(state->output, "%04d-%02d-%02d %02d:%02d:%02d.%03d [%" PRIu64 "%s%s] ",
+            event->timestamp.year, event->timestamp.month, event->timestamp.day,
+            event->timestamp.hour, event->timestamp.minute, event->timestamp.second, event->timestamp.millisecond,
+            event->threadId, event->threadName[0] ? " " : "", event->threadName);
+
+    switch (event->type) {
+        case PICO_PERF_STREAM_EVENT_SCOPE:
+            fprintf(state->output, "%*s%s %.3f ms (parent %s) at %s:%u", (int)event->depth * 2, "", event->name,
+                    (double)event->durationNs / 1e6, event->parentName, event->location.file, event->location.line);
+            if (event->counters[PICO_PERF_HW_COUNTER_CYCLES] > 0) {
+                fprintf(state->output, " IPC %.2f", (double)event->counters[PICO_PERF_HW_COUNTER_INSTRUCTIONS] /
+                                                       (double)event->counters[PICO_PERF_HW_COUNTER_CYCLES]);
+            }
+            fprintf(state->output, "\n");
+            break;
+        case PICO_PERF_STREAM_EVENT_COUNTER:
+            fprintf(state->output, "counter %s = %g\n", event->name, event->counterValue);
+            break;
+        case PICO_PERF_STREAM_EVENT_FLOW:
+            fprintf(state->output, "flow %s #%" PRIu64 " %s\n", event->name, event->flowId,
+                    event->flowPhase == PICO_PERF_FLOW_PHASE_BEGIN ? "begin" : (event->flowPhase == PICO_PERF_FLOW_PHASE_STEP ? "step" : "end"));
+            break;
+        case PICO_PERF_STREAM_EVENT_DROPPED:
+            fprintf(state->output, "dropped %" PRIu64 " entries\n", event->droppedCount);
+            break;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <file.bin> [TEXT|TRACE]\n", argv[0]);
+        return 1;
+    }
+
+    decodeState_t state = {stdout, argc > 2 && strcmp(argv[2], "TRACE") == 0, true};
+    if (state.trace) {
+        fprintf(stdout, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    }
+
+    bool ok = picoPerfDecodeStream(argv[1], printEvent, &state);
+
+    if (state.trace) {
+        fprintf(stdout, "\n]}\n");
+    }
+    if (!ok) {
+        fprintf(stderr, "failed to decode %s, the file is missing, truncated or not a picoPerf stream\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}
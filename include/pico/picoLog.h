@@ -31,14 +31,88 @@ SOFTWARE.
 #define PICO_LOG_IF_ENABLED(...) __VA_ARGS__
 #endif
 
+// Async mode moves formatting and target I/O to a background writer thread,
+// it needs the thread safe build
+#if defined(PICO_LOG_ASYNC) && !defined(PICO_LOG_THREAD_SAFE)
+#define PICO_LOG_THREAD_SAFE
+#endif
+
+#ifndef PICO_LOG_ASYNC_QUEUE_SIZE
+#define PICO_LOG_ASYNC_QUEUE_SIZE 1024 // must be a power of two
+#endif
+
+#ifndef PICO_LOG_ASYNC_MAX_MESSAGE_LENGTH
+#define PICO_LOG_ASYNC_MAX_MESSAGE_LENGTH 512
+#endif
+
+// room for the copies of tag, file and function each record carries
+#ifndef PICO_LOG_ASYNC_MAX_LOCATION_LENGTH
+#define PICO_LOG_ASYNC_MAX_LOCATION_LENGTH 256
+#endif
+
+#ifndef PICO_LOG_ASYNC_BATCH_SIZE
+#define PICO_LOG_ASYNC_BATCH_SIZE 64
+#endif
+
+#ifndef PICO_LOG_ASYNC_POLL_INTERVAL_MS
+#define PICO_LOG_ASYNC_POLL_INTERVAL_MS 1
+#endif
+
+// File loggers keep their handle open and write through a buffer of this size,
+// the buffer is flushed when it fills up, when a message of one of the
+// PICO_LOG_FILE_FLUSH_LEVELS is written, on the first message written after
+// PICO_LOG_FILE_FLUSH_INTERVAL_MS has passed since the last flush, by
+// picoLogFlush and at shutdown. There is no timer, an idle process keeps its
+// last lines buffered until then, only the async writer also flushes expired
+// buffers whenever its queue runs empty.
+#ifndef PICO_LOG_FILE_BUFFER_SIZE
+#define PICO_LOG_FILE_BUFFER_SIZE (64 * 1024)
+#endif
+
+#ifndef PICO_LOG_FILE_FLUSH_INTERVAL_MS
+#define PICO_LOG_FILE_FLUSH_INTERVAL_MS 1000
+#endif
+
+#ifndef PICO_LOG_FILE_FLUSH_LEVELS
+#define PICO_LOG_FILE_FLUSH_LEVELS PICO_LOG_LEVEL_ERROR
+#endif
+
+// Binary loggers remember every call site they have seen, sites past this
+// limit are still logged but fall back to preformatted text
+#ifndef PICO_LOG_BINARY_MAX_SITES
+#define PICO_LOG_BINARY_MAX_SITES 4096 // must be a power of two
+#endif
+
+#ifndef PICO_LOG_BINARY_MAX_ARGS
+#define PICO_LOG_BINARY_MAX_ARGS 32
+#endif
+
+#ifndef PICO_LOG_BINARY_MAX_RECORD_SIZE
+#define PICO_LOG_BINARY_MAX_RECORD_SIZE 4096
+#endif
+
+// Maximum depth of the configuration stacks, they start small and grow on demand
 #ifndef PICO_LOG_CONFIG_STACK_SIZE
 #define PICO_LOG_CONFIG_STACK_SIZE 1024
 #endif
 
+#ifndef PICO_LOG_THREAD_STACK_SIZE
+#define PICO_LOG_THREAD_STACK_SIZE 16
+#endif
+
 #ifndef PICO_LOG_MAX_MESSAGE_LENGTH
 #define PICO_LOG_MAX_MESSAGE_LENGTH 4096
 #endif
 
+// Alternate signal stack picoLogInstallCrashHandler sets up for the calling thread
+#ifndef PICO_LOG_CRASH_STACK_SIZE
+#define PICO_LOG_CRASH_STACK_SIZE 65536
+#endif
+
+// Define PICO_LOG_USE_COARSE_CLOCK to timestamp messages with CLOCK_REALTIME_COARSE
+// where it is available, it is much cheaper to read but only as precise as the
+// kernel tick
+
 #ifndef PICO_MALLOC
 #define PICO_MALLOC(sz) malloc(sz)
 #define PICO_FREE(ptr)  free(ptr)
@@ -71,17 +145,146 @@ SOFTWARE.
 #define PICO_LOG_TAG PICO_LOG_FILENAME
 #endif
 
-#define PICO_LOG(level, ...) PICO_LOG_IF_ENABLED(picoLog(level, PICO_LOG_TAG, PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE, __VA_ARGS__))
-#define PICO_DEBUG(...)      PICO_LOG(PICO_LOG_LEVEL_DEBUG, __VA_ARGS__)
-#define PICO_VERBOSE(...)    PICO_LOG(PICO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
-#define PICO_INFO(...)       PICO_LOG(PICO_LOG_LEVEL_INFO, __VA_ARGS__)
-#define PICO_WARN(...)       PICO_LOG(PICO_LOG_LEVEL_WARN, __VA_ARGS__)
-#define PICO_ERROR(...)      PICO_LOG(PICO_LOG_LEVEL_ERROR, __VA_ARGS__)
+// Compile time threshold, the level macros below it expand to dead code so
+// neither the call nor its arguments survive. Takes the numeric level values
+// as the preprocessor cannot see the enum:
+// 0x01 DEBUG, 0x02 VERBOSE, 0x04 INFO, 0x08 WARN, 0x10 ERROR
+#ifndef PICO_LOG_MIN_LEVEL
+#define PICO_LOG_MIN_LEVEL 0x01
+#endif
+
+// Call site state is shared between threads without the lock, a stale value
+// only costs one extra refresh
+#if defined(PICO_LOG_THREAD_SAFE) && (defined(__GNUC__) || defined(__clang__))
+#define PICO_LOG_RELAXED_LOAD(var)         __atomic_load_n(&(var), __ATOMIC_RELAXED)
+#define PICO_LOG_RELAXED_STORE(var, value) __atomic_store_n(&(var), (value), __ATOMIC_RELAXED)
+#else
+#define PICO_LOG_RELAXED_LOAD(var)         (var)
+#define PICO_LOG_RELAXED_STORE(var, value) ((var) = (value))
+#endif
+
+// Every call site caches whether it is enabled together with the generation of
+// the configuration it was computed against. Pushing or popping a level or tag
+// filter bumps the generation, until then a disabled site costs one compare.
+#define PICO_LOG_AT_SITE(level, call) PICO_LOG_IF_ENABLED(do {                                                                              \
+    static volatile uint32_t __picoLogSiteState = 0;                                                                                      \
+    uint32_t __picoLogSiteCached                = PICO_LOG_RELAXED_LOAD(__picoLogSiteState);                                              \
+    uint32_t __picoLogSiteEnabled               = (PICO_LOG_RELAXED_LOAD(*__picoLogGeneration) << 1) | 1u;                                \
+    if (__picoLogSiteCached == __picoLogSiteEnabled ||                                                                                    \
+        ((__picoLogSiteCached | 1u) != __picoLogSiteEnabled && picoLogRefreshCallSite(&__picoLogSiteState, level, PICO_LOG_TAG))) {      \
+        call;                                                                                                                             \
+    }                                                                                                                                     \
+} while (0))
+#define PICO_LOG_STRIPPED_AT_SITE(call) PICO_LOG_IF_ENABLED(do { \
+    if (0) {                                                    \
+        call;                                                   \
+    }                                                           \
+} while (0))
+
+#define PICO_LOG(level, ...)          PICO_LOG_AT_SITE(level, picoLog(level, PICO_LOG_TAG, PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE, __VA_ARGS__))
+#define PICO_LOG_STRIPPED(level, ...) PICO_LOG_STRIPPED_AT_SITE(picoLog(level, PICO_LOG_TAG, PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE, __VA_ARGS__))
+
+// Structured logging, takes a plain message followed by one or more PICO_LOG_FIELD_* values:
+// PICO_INFO_FIELDS("request done", PICO_LOG_FIELD_INT("status", 200), PICO_LOG_FIELD_DURATION_MS("elapsed", 1.5));
+#define __PICO_LOG_FIELD_ARRAY(...) ((const picoLogField_t[]){__VA_ARGS__})
+#define __PICO_LOG_FIELD_COUNT(...) ((uint32_t)(sizeof((picoLogField_t[]){__VA_ARGS__}) / sizeof(picoLogField_t)))
+#define PICO_LOG_FIELDS(level, message, ...) \
+    PICO_LOG_AT_SITE(level, picoLogFields(level, PICO_LOG_TAG, PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE, message, __PICO_LOG_FIELD_ARRAY(__VA_ARGS__), __PICO_LOG_FIELD_COUNT(__VA_ARGS__)))
+#define PICO_LOG_FIELDS_STRIPPED(level, message, ...) \
+    PICO_LOG_STRIPPED_AT_SITE(picoLogFields(level, PICO_LOG_TAG, PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE, message, __PICO_LOG_FIELD_ARRAY(__VA_ARGS__), __PICO_LOG_FIELD_COUNT(__VA_ARGS__)))
+
+#define PICO_LOG_FIELD_INT(key, v)         ((picoLogField_t){(key), PICO_LOG_FIELD_TYPE_INT, {.intValue = (int64_t)(v)}})
+#define PICO_LOG_FIELD_UINT(key, v)        ((picoLogField_t){(key), PICO_LOG_FIELD_TYPE_UINT, {.uintValue = (uint64_t)(v)}})
+#define PICO_LOG_FIELD_FLOAT(key, v)       ((picoLogField_t){(key), PICO_LOG_FIELD_TYPE_FLOAT, {.floatValue = (double)(v)}})
+#define PICO_LOG_FIELD_BOOL(key, v)        ((picoLogField_t){(key), PICO_LOG_FIELD_TYPE_BOOL, {.boolValue = (v) != 0}})
+#define PICO_LOG_FIELD_STRING(key, v)      ((picoLogField_t){(key), PICO_LOG_FIELD_TYPE_STRING, {.stringValue = (v)}})
+#define PICO_LOG_FIELD_DURATION_NS(key, v) ((picoLogField_t){(key), PICO_LOG_FIELD_TYPE_DURATION, {.durationNs = __picoLogDurationNs((double)(v))}})
+#define PICO_LOG_FIELD_DURATION_US(key, v) PICO_LOG_FIELD_DURATION_NS(key, (v) * 1000.0)
+#define PICO_LOG_FIELD_DURATION_MS(key, v) PICO_LOG_FIELD_DURATION_NS(key, (v) * 1000000.0)
+
+// Rate limited logging lets each call site through at most maxCount times per
+// intervalMs, the number of messages held back is logged once the site is let
+// through again. Sampled logging lets a message through with the given
+// probability (0.0 - 1.0) using a cheap per thread random number generator.
+#define PICO_LOG_RATE_LIMITED(level, maxCount, intervalMs, ...) PICO_LOG_AT_SITE(level, {                                                       \
+    static picoLogRateLimit_t __picoLogRateLimit = {0};                                                                                         \
+    if (picoLogRateLimitAcquire(&__picoLogRateLimit, maxCount, intervalMs, level, PICO_LOG_TAG, PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE)) { \
+        picoLog(level, PICO_LOG_TAG, PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE, __VA_ARGS__);                                                 \
+    }                                                                                                                                           \
+})
+#define PICO_LOG_SAMPLED(level, probability, ...) PICO_LOG_AT_SITE(level, {                     \
+    if (picoLogSample(probability)) {                                                           \
+        picoLog(level, PICO_LOG_TAG, PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE, __VA_ARGS__); \
+    }                                                                                           \
+})
+#define PICO_LOG_RATE_LIMITED_STRIPPED(level, maxCount, intervalMs, ...) PICO_LOG_STRIPPED(level, __VA_ARGS__)
+#define PICO_LOG_SAMPLED_STRIPPED(level, probability, ...)                 PICO_LOG_STRIPPED(level, __VA_ARGS__)
+
+#if PICO_LOG_MIN_LEVEL <= 0x01
+#define PICO_DEBUG(...)              PICO_LOG(PICO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define PICO_DEBUG_FIELDS(...)       PICO_LOG_FIELDS(PICO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define PICO_DEBUG_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED(PICO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define PICO_DEBUG_SAMPLED(...)      PICO_LOG_SAMPLED(PICO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define PICO_DEBUG(...)              PICO_LOG_STRIPPED(PICO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define PICO_DEBUG_FIELDS(...)       PICO_LOG_FIELDS_STRIPPED(PICO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define PICO_DEBUG_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED_STRIPPED(PICO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define PICO_DEBUG_SAMPLED(...)      PICO_LOG_SAMPLED_STRIPPED(PICO_LOG_LEVEL_DEBUG, __VA_ARGS__)
+#endif
+
+#if PICO_LOG_MIN_LEVEL <= 0x02
+#define PICO_VERBOSE(...)              PICO_LOG(PICO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#define PICO_VERBOSE_FIELDS(...)       PICO_LOG_FIELDS(PICO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#define PICO_VERBOSE_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED(PICO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#define PICO_VERBOSE_SAMPLED(...)      PICO_LOG_SAMPLED(PICO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#else
+#define PICO_VERBOSE(...)              PICO_LOG_STRIPPED(PICO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#define PICO_VERBOSE_FIELDS(...)       PICO_LOG_FIELDS_STRIPPED(PICO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#define PICO_VERBOSE_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED_STRIPPED(PICO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#define PICO_VERBOSE_SAMPLED(...)      PICO_LOG_SAMPLED_STRIPPED(PICO_LOG_LEVEL_VERBOSE, __VA_ARGS__)
+#endif
+
+#if PICO_LOG_MIN_LEVEL <= 0x04
+#define PICO_INFO(...)              PICO_LOG(PICO_LOG_LEVEL_INFO, __VA_ARGS__)
+#define PICO_INFO_FIELDS(...)       PICO_LOG_FIELDS(PICO_LOG_LEVEL_INFO, __VA_ARGS__)
+#define PICO_INFO_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED(PICO_LOG_LEVEL_INFO, __VA_ARGS__)
+#define PICO_INFO_SAMPLED(...)      PICO_LOG_SAMPLED(PICO_LOG_LEVEL_INFO, __VA_ARGS__)
+#else
+#define PICO_INFO(...)              PICO_LOG_STRIPPED(PICO_LOG_LEVEL_INFO, __VA_ARGS__)
+#define PICO_INFO_FIELDS(...)       PICO_LOG_FIELDS_STRIPPED(PICO_LOG_LEVEL_INFO, __VA_ARGS__)
+#define PICO_INFO_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED_STRIPPED(PICO_LOG_LEVEL_INFO, __VA_ARGS__)
+#define PICO_INFO_SAMPLED(...)      PICO_LOG_SAMPLED_STRIPPED(PICO_LOG_LEVEL_INFO, __VA_ARGS__)
+#endif
+
+#if PICO_LOG_MIN_LEVEL <= 0x08
+#define PICO_WARN(...)              PICO_LOG(PICO_LOG_LEVEL_WARN, __VA_ARGS__)
+#define PICO_WARN_FIELDS(...)       PICO_LOG_FIELDS(PICO_LOG_LEVEL_WARN, __VA_ARGS__)
+#define PICO_WARN_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED(PICO_LOG_LEVEL_WARN, __VA_ARGS__)
+#define PICO_WARN_SAMPLED(...)      PICO_LOG_SAMPLED(PICO_LOG_LEVEL_WARN, __VA_ARGS__)
+#else
+#define PICO_WARN(...)              PICO_LOG_STRIPPED(PICO_LOG_LEVEL_WARN, __VA_ARGS__)
+#define PICO_WARN_FIELDS(...)       PICO_LOG_FIELDS_STRIPPED(PICO_LOG_LEVEL_WARN, __VA_ARGS__)
+#define PICO_WARN_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED_STRIPPED(PICO_LOG_LEVEL_WARN, __VA_ARGS__)
+#define PICO_WARN_SAMPLED(...)      PICO_LOG_SAMPLED_STRIPPED(PICO_LOG_LEVEL_WARN, __VA_ARGS__)
+#endif
+
+#if PICO_LOG_MIN_LEVEL <= 0x10
+#define PICO_ERROR(...)              PICO_LOG(PICO_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define PICO_ERROR_FIELDS(...)       PICO_LOG_FIELDS(PICO_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define PICO_ERROR_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED(PICO_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define PICO_ERROR_SAMPLED(...)      PICO_LOG_SAMPLED(PICO_LOG_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define PICO_ERROR(...)              PICO_LOG_STRIPPED(PICO_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define PICO_ERROR_FIELDS(...)       PICO_LOG_FIELDS_STRIPPED(PICO_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define PICO_ERROR_RATE_LIMITED(...) PICO_LOG_RATE_LIMITED_STRIPPED(PICO_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define PICO_ERROR_SAMPLED(...)      PICO_LOG_SAMPLED_STRIPPED(PICO_LOG_LEVEL_ERROR, __VA_ARGS__)
+#endif
 
 #define PICO_LOG_INIT()      PICO_LOG_IF_ENABLED(picoLogContextCreate())
 #define PICO_LOG_SHUTDOWN()  PICO_LOG_IF_ENABLED(picoLogShutdown())
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef enum {
@@ -98,7 +301,9 @@ typedef enum {
     PICO_LOG_TARGET_CONSOLE = 0x01,
     PICO_LOG_TARGET_FILE    = 0x02,
     PICO_LOG_TARGET_CUSTOM  = 0x04,
-    PICO_LOG_TARGET_ALL     = 0x07
+    PICO_LOG_TARGET_BINARY  = 0x08,
+    PICO_LOG_TARGET_RING    = 0x10,
+    PICO_LOG_TARGET_ALL     = 0x1F
 } picoLogTarget;
 
 typedef enum {
@@ -107,8 +312,38 @@ typedef enum {
     PICO_LOG_FORMAT_MESSAGE_ONLY = 0x04, // MESSAGE
     PICO_LOG_FORMAT_VERBOSE      = 0x08, // [YYYY-MM-DD HH:MM:SS.mmm] [FILE:LINE] [FUNCTION] [LEVEL] [TAG]: MESSAGE
     PICO_LOG_FORMAT_JSON         = 0x10, // {"time": "YYYY-MM-DD HH:MM:SS.mmm", "file": "...", "line": ..., "function": "...", "level": "...", "tag": "...", "message": "..."}
+    PICO_LOG_FORMAT_LOGFMT       = 0x20, // time=YYYY-MM-DDTHH:MM:SS.mmm level=LEVEL tag=TAG file=FILE line=LINE function=FUNCTION msg="MESSAGE"
 } picoLogFormat;
 
+typedef enum {
+    PICO_LOG_FIELD_TYPE_INT,
+    PICO_LOG_FIELD_TYPE_UINT,
+    PICO_LOG_FIELD_TYPE_FLOAT,
+    PICO_LOG_FIELD_TYPE_BOOL,
+    PICO_LOG_FIELD_TYPE_STRING,
+    PICO_LOG_FIELD_TYPE_DURATION, // nanoseconds, JSON writes the integer, logfmt a value like 1.5ms
+} picoLogFieldType;
+
+typedef struct {
+    const char *key;
+    picoLogFieldType type;
+    union {
+        int64_t intValue;
+        uint64_t uintValue;
+        double floatValue;
+        bool boolValue;
+        const char *stringValue;
+        uint64_t durationNs;
+    } value;
+} picoLogField_t;
+typedef picoLogField_t *picoLogField;
+
+// Used by the PICO_LOG_FIELD_DURATION macros, negative and NaN durations log as 0
+static inline uint64_t __picoLogDurationNs(double ns)
+{
+    return ns > 0.0 ? (ns < 18446744073709551616.0 ? (uint64_t)ns : UINT64_MAX) : 0;
+}
+
 typedef struct {
     uint32_t year;
     uint32_t month;
@@ -127,8 +362,44 @@ typedef struct {
 } picoLogCodeLocation_t;
 typedef picoLogCodeLocation_t *picoLogCodeLocation;
 
+typedef enum {
+    PICO_LOG_ASYNC_OVERFLOW_BLOCK,         // wait for the writer to free a slot, the writer's own messages are dropped
+    PICO_LOG_ASYNC_OVERFLOW_DROP,          // drop the message silently
+    PICO_LOG_ASYNC_OVERFLOW_COUNT_DROPPED, // drop the message and have the writer log how many were lost
+} picoLogAsyncOverflowPolicy;
+
+typedef enum {
+    PICO_LOG_ROTATE_NEVER  = 0x00,
+    PICO_LOG_ROTATE_HOURLY = 0x01,
+    PICO_LOG_ROTATE_DAILY  = 0x02,
+} picoLogRotateInterval;
+
+// Compresses sourcePath into destinationPath, returns false on failure in which
+// case the uncompressed file is kept. Runs on a background thread in the thread
+// safe build and inline during rotation otherwise. Rotation never waits for the
+// compressor, a file rotated while the previous one is still being compressed
+// stays in the chain uncompressed until the compressor gets to it.
+typedef bool (*picoLogFileCompressor)(const char *sourcePath, const char *destinationPath, void *userData);
+
+typedef struct {
+    uint64_t maxBytes;              // rotate once the live file reaches this size, 0 to disable
+    picoLogRotateInterval interval; // rotate when the hour or day of the log timestamps changes
+    uint32_t keepFiles;             // rotated files kept as path.1 (newest) .. path.N, 0 keeps none
+    picoLogFileCompressor compressor;
+    const char *compressedSuffix; // appended to rotated file names by the compressor, e.g. ".gz"
+    void *compressorUserData;
+} picoLogFileRotation_t;
+typedef picoLogFileRotation_t *picoLogFileRotation;
+
 typedef void (*picoLogCustomLogger)(picoLogLevel level, const char *tag, const char *message, picoLogCodeLocation location, picoLogTimeStamp timestamp, void *userData);
 
+// Per call site state of the rate limited macros
+typedef struct {
+    uint64_t windowStartMs;
+    uint32_t count;
+    uint32_t suppressed;
+} picoLogRateLimit_t;
+
 typedef struct picoLogContext_t picoLogContext_t;
 typedef picoLogContext_t *picoLogContext;
 
@@ -136,6 +407,11 @@ bool picoLogContextCreate(void);
 void picoLogShutdown(void);
 void picoLogPushLevel(picoLogLevel level);
 void picoLogPopLevel(void);
+// Tags are separated by commas, semicolons, '|' or whitespace and matched exactly.
+// "-tag" denies a tag, "prefix*" matches every tag starting with prefix and "*"
+// matches everything. Denies always win. If there are allow rules a tag has to
+// match one of them, a filter made only of denies lets everything else through.
+// An empty filter disables tag filtering.
 void picoLogPushTagFilter(const char *tags);
 void picoLogPopTagFilter(void);
 void picoLogPushTarget(picoLogTarget target);
@@ -145,11 +421,81 @@ void picoLogPopFormat(void);
 void picoLogPushCustomLogger(picoLogCustomLogger logger, void *userData);
 void picoLogPopCustomLogger(void);
 void picoLogPushFileLogger(const char *filePath);
+// Same as picoLogPushFileLogger but rotates the file according to the given policy,
+// rotation may be NULL
+void picoLogPushFileLoggerEx(const char *filePath, const picoLogFileRotation_t *rotation);
 void picoLogPopFileLogger(void);
 void picoLogPushFromEnvironment(void);
 
+// Thread local overrides of the level and tag filter. They apply to the calling
+// thread only, take no lock and must be popped by the thread that pushed them.
+// While any thread has an override active call sites stop caching the disabled
+// state and every call goes through the full check in picoLog. With
+// PICO_LOG_THREAD_SAFE on POSIX a thread that exits with overrides still pushed
+// has them undone, elsewhere pop them before the thread ends.
+void picoLogPushThreadLevel(picoLogLevel level);
+void picoLogPopThreadLevel(void);
+void picoLogPushThreadTagFilter(const char *tags);
+void picoLogPopThreadTagFilter(void);
+// Binary loggers store a call site id, a timestamp and the raw argument bytes
+// instead of text, the format string of each site is written once. The file is
+// truncated when pushed. Use picoLogDecodeBinary to turn it back into text.
+void picoLogPushBinaryLogger(const char *filePath);
+void picoLogPopBinaryLogger(void);
+// Reads a binary log and hands every message, rendered in the given format, to callback
+bool picoLogDecodeBinary(const char *filePath, picoLogFormat format, picoLogCustomLogger callback, void *userData);
+// Writes out anything still sitting in the file and binary logger buffers
+void picoLogFlush(void);
+// Limits the given targets to a subset of the levels that pass the current level,
+// e.g. keep DEBUG in the crash ring while the console and files only get WARN and
+// ERROR. Every target takes all levels by default.
+void picoLogSetTargetLevels(picoLogTarget targets, picoLogLevel levels);
+
+// The crash ring keeps the last sizeBytes of formatted PICO_LOG_TARGET_RING
+// messages in a preallocated buffer. With a backingPath the buffer is a shared
+// mapping of that file, so its contents survive even if the process is killed
+// outright, picoLogDumpCrashRingFile turns such a file into text.
+bool picoLogStartCrashRing(size_t sizeBytes, const char *backingPath);
+void picoLogStopCrashRing(void);
+// Writes the ring, oldest message first, to path. Only async signal safe calls
+// are used so it can run from a signal handler.
+bool picoLogDumpCrashRing(const char *path);
+bool picoLogDumpCrashRingFile(const char *ringPath, const char *outputPath);
+// Dumps the ring to dumpPath on SIGSEGV, SIGABRT, SIGBUS, SIGFPE and SIGILL (and
+// unhandled exceptions on Windows), then passes the fault on to the previous handler.
+// The handler runs on an alternate signal stack so a stack overflow can still be
+// dumped, but sigaltstack is per thread and only the calling thread gets one. Other
+// threads that may overflow their stack need their own sigaltstack.
+bool picoLogInstallCrashHandler(const char *dumpPath);
+
+#ifdef PICO_LOG_ASYNC
+// Starts the background writer. From then on picoLog checks level, tag and target
+// against a lock-free snapshot of the configuration, formats the message text (or
+// encodes the binary arguments) and pushes a record into a lock-free queue, records
+// are truncated to PICO_LOG_ASYNC_MAX_MESSAGE_LENGTH. Tag, file and function are
+// copied into the record, binary records keep the pointers as binary sites always
+// do. picoLogShutdown stops the writer as well.
+bool picoLogStartAsync(picoLogAsyncOverflowPolicy overflowPolicy);
+// Drains the queue and joins the writer thread
+void picoLogStopAsync(void);
+// Messages dropped on overflow since the context was created, still valid after picoLogStopAsync
+uint64_t picoLogGetDroppedCount(void);
+#endif
+
+// Used by the PICO_LOG macros, recomputes a call site's cached enabled state
+bool picoLogRefreshCallSite(volatile uint32_t *siteState, picoLogLevel level, const char *tag);
+extern volatile uint32_t *__picoLogGeneration;
+// Used by the rate limited macros, returns true if the call site may log and
+// reports the messages suppressed since it last could
+bool picoLogRateLimitAcquire(picoLogRateLimit_t *rateLimit, uint32_t maxCount, uint32_t intervalMs, picoLogLevel level, const char *tag, const char *file, const char *function, uint32_t line);
+// Used by the sampled macros, returns true with the given probability
+bool picoLogSample(double probability);
+
 // Main logging function
 void picoLog(picoLogLevel level, const char *tag, const char *file, const char *function, uint32_t line, const char *format, ...);
+// Structured logging function, the JSON and LOGFMT formats write the fields as
+// their own members, every other format appends them to the message as key=value
+void picoLogFields(picoLogLevel level, const char *tag, const char *file, const char *function, uint32_t line, const char *message, const picoLogField_t *fields, uint32_t fieldCount);
 
 // For DLLs
 picoLogContext picoLogGetContext(void);
@@ -173,15 +519,23 @@ picoLogTarget picoLogStringToTarget(const char *targetStr);
 #include <Windows.h>
 #define PICO_LOG_MAX_PATH MAX_PATH
 #else
+#include <fcntl.h>
 #include <limits.h>
+#include <sys/mman.h>
 #include <sys/time.h>
+#include <unistd.h>
 #ifdef PICO_LOG_THREAD_SAFE
 #include <pthread.h>
+// a pthread key destructor undoes the overrides of an exiting thread
+#define PICO_LOG_HAS_THREAD_EXIT
 #endif
 #define PICO_LOG_MAX_PATH PATH_MAX
 #endif
 
+#include <errno.h>
+#include <signal.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -209,29 +563,327 @@ picoLogTarget picoLogStringToTarget(const char *targetStr);
 #define PICO_LOG_END_CRITICAL_SECTION(mutex)   (void)0
 #endif
 
+#ifdef PICO_LOG_THREAD_SAFE
+#if defined(_WIN32) || defined(_WIN64)
+#define PICO_LOG_THREAD_TYPE                    HANDLE
+#define PICO_LOG_THREAD_RETURN_TYPE             DWORD WINAPI
+#define PICO_LOG_THREAD_RETURN_VALUE            0
+#define PICO_LOG_THREAD_CREATE(thread, fn, arg) (((thread) = CreateThread(NULL, 0, (fn), (arg), 0, NULL)) != NULL)
+#define PICO_LOG_THREAD_JOIN(thread)            (WaitForSingleObject((thread), INFINITE), CloseHandle(thread))
+#else
+#define PICO_LOG_THREAD_TYPE                    pthread_t
+#define PICO_LOG_THREAD_RETURN_TYPE             void *
+#define PICO_LOG_THREAD_RETURN_VALUE            NULL
+#define PICO_LOG_THREAD_CREATE(thread, fn, arg) (pthread_create(&(thread), NULL, (fn), (arg)) == 0)
+#define PICO_LOG_THREAD_JOIN(thread)            pthread_join((thread), NULL)
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define PICO_LOG_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+#define PICO_LOG_THREAD_LOCAL __thread
+#else
+#define PICO_LOG_THREAD_LOCAL _Thread_local
+#endif
+
+#if !defined(PICO_LOG_THREAD_SAFE)
+#define PICO_LOG_ATOMIC_ADD32(ptr, value) (*(ptr) += (value))
+#define PICO_LOG_ATOMIC_LOAD32(ptr)       (*(ptr))
+#elif defined(_WIN32) || defined(_WIN64)
+#define PICO_LOG_ATOMIC_ADD32(ptr, value) InterlockedExchangeAdd((volatile LONG *)(ptr), (LONG)(value))
+#define PICO_LOG_ATOMIC_LOAD32(ptr)       ((uint32_t)InterlockedCompareExchange((volatile LONG *)(ptr), 0, 0))
+#else
+#define PICO_LOG_ATOMIC_ADD32(ptr, value) __atomic_fetch_add((ptr), (value), __ATOMIC_SEQ_CST)
+#define PICO_LOG_ATOMIC_LOAD32(ptr)       __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#endif
+
+#ifdef PICO_LOG_ASYNC
+#if defined(_WIN32) || defined(_WIN64)
+#define PICO_LOG_SLEEP_MS(ms)                       Sleep(ms)
+#define PICO_LOG_ATOMIC_LOAD(ptr)                   ((uint64_t)InterlockedCompareExchange64((volatile LONG64 *)(ptr), 0, 0))
+#define PICO_LOG_ATOMIC_STORE(ptr, value)           InterlockedExchange64((volatile LONG64 *)(ptr), (LONG64)(value))
+#define PICO_LOG_ATOMIC_ADD(ptr, value)             InterlockedExchangeAdd64((volatile LONG64 *)(ptr), (LONG64)(value))
+#define PICO_LOG_ATOMIC_CAS(ptr, expected, desired) (InterlockedCompareExchange64((volatile LONG64 *)(ptr), (LONG64)(desired), (LONG64)(expected)) == (LONG64)(expected))
+#define PICO_LOG_ATOMIC_LOAD_PTR(ptr)               InterlockedCompareExchangePointer((PVOID volatile *)(ptr), NULL, NULL)
+#define PICO_LOG_ATOMIC_STORE_PTR(ptr, value)       InterlockedExchangePointer((PVOID volatile *)(ptr), (PVOID)(value))
+#else
+#define PICO_LOG_SLEEP_MS(ms)                       usleep((ms) * 1000)
+#define PICO_LOG_ATOMIC_LOAD(ptr)                   __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define PICO_LOG_ATOMIC_STORE(ptr, value)           __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#define PICO_LOG_ATOMIC_ADD(ptr, value)             __atomic_fetch_add((ptr), (value), __ATOMIC_ACQ_REL)
+#define PICO_LOG_ATOMIC_CAS(ptr, expected, desired) __sync_bool_compare_and_swap((ptr), (expected), (desired))
+#define PICO_LOG_ATOMIC_LOAD_PTR(ptr)               __atomic_load_n((ptr), __ATOMIC_SEQ_CST)
+#define PICO_LOG_ATOMIC_STORE_PTR(ptr, value)       __atomic_store_n((ptr), (value), __ATOMIC_SEQ_CST)
+#endif
+
+typedef struct {
+    volatile uint64_t sequence;
+    picoLogLevel level;
+    picoLogFormat format;
+    picoLogTarget target; // PICO_LOG_TARGET_BINARY alone for binary records
+    const char *tag;      // points into location, binary records keep the call site's own
+    const char *file;
+    const char *function;
+    uint32_t line;
+    picoLogTimeStamp_t timestamp;
+    // binary records only, message holds the encoded arguments
+    const char *binaryFormat;
+    uint64_t microseconds;
+    uint32_t payloadSize;
+    bool preformatted;
+    char location[PICO_LOG_ASYNC_MAX_LOCATION_LENGTH];
+    char message[PICO_LOG_ASYNC_MAX_MESSAGE_LENGTH];
+} __picoLogAsyncRecord_t;
+
+// Bounded MPSC ring. Every slot carries a sequence number so producers claim
+// slots with a single CAS and the writer never needs a lock to dequeue.
+typedef struct {
+    __picoLogAsyncRecord_t records[PICO_LOG_ASYNC_QUEUE_SIZE];
+    volatile uint64_t enqueuePosition;
+    volatile uint64_t dequeuePosition;
+    volatile uint64_t running;
+    uint64_t reportedDropCount; // of the context's asyncDroppedCount
+    picoLogAsyncOverflowPolicy overflowPolicy;
+    PICO_LOG_THREAD_TYPE writerThread;
+    char formattedMessage[PICO_LOG_MAX_MESSAGE_LENGTH * 2];
+} __picoLogAsyncState_t;
+#endif // PICO_LOG_ASYNC
+
+#ifndef PICO_LOG_MAX_COMPRESSED_SUFFIX
+#define PICO_LOG_MAX_COMPRESSED_SUFFIX 16
+#endif
+
+// room for the rotation index and the compressed suffix
+#define PICO_LOG_MAX_ROTATED_PATH (PICO_LOG_MAX_PATH + PICO_LOG_MAX_COMPRESSED_SUFFIX + 16)
+
+typedef struct {
+    picoLogFileRotation_t policy;
+    char compressedSuffix[PICO_LOG_MAX_COMPRESSED_SUFFIX];
+    uint64_t currentBytes;
+    uint32_t currentPeriod;
+    char filePath[PICO_LOG_MAX_PATH];
+    // the compressor only sees these two, outside the path.N chain, the result is
+    // moved into the chain by the logging side once the compressor is done
+    char compressSource[PICO_LOG_MAX_ROTATED_PATH];
+    char compressDestination[PICO_LOG_MAX_ROTATED_PATH];
+    uint32_t compressSlot;   // chain index the file being compressed belongs at
+    uint32_t compressQueued; // path.1 .. path.N still waiting to be compressed
+    bool compressSucceeded;
+#ifdef PICO_LOG_THREAD_SAFE
+    PICO_LOG_THREAD_TYPE compressThread;
+    bool compressPending;
+    volatile uint32_t compressDone; // set by the compressor thread as its last step
+#endif
+} __picoLogFileRotationState_t;
+
+#define PICO_LOG_BINARY_MAGIC          0x474F4C50 // "PLOG"
+#define PICO_LOG_BINARY_VERSION        1
+#define PICO_LOG_BINARY_BYTE_ORDER     0x01020304
+#define PICO_LOG_BINARY_RECORD_SITE    0x01
+#define PICO_LOG_BINARY_RECORD_MESSAGE 0x02
+#define PICO_LOG_BINARY_UNKNOWN_SITE   0xFFFFFFFF
+
+typedef enum {
+    __PICO_LOG_ARG_NONE,
+    __PICO_LOG_ARG_INVALID,
+    __PICO_LOG_ARG_INT,
+    __PICO_LOG_ARG_LONG,
+    __PICO_LOG_ARG_LLONG,
+    __PICO_LOG_ARG_INTMAX,
+    __PICO_LOG_ARG_SIZE,
+    __PICO_LOG_ARG_PTRDIFF,
+    __PICO_LOG_ARG_DOUBLE,
+    __PICO_LOG_ARG_LONG_DOUBLE,
+    __PICO_LOG_ARG_STRING,
+    __PICO_LOG_ARG_WIDE_STRING,
+    __PICO_LOG_ARG_POINTER,
+} __picoLogArgType;
+
+typedef enum {
+    __PICO_LOG_MODIFIER_NONE,
+    __PICO_LOG_MODIFIER_HH,
+    __PICO_LOG_MODIFIER_H,
+    __PICO_LOG_MODIFIER_L,
+    __PICO_LOG_MODIFIER_LL,
+    __PICO_LOG_MODIFIER_J,
+    __PICO_LOG_MODIFIER_Z,
+    __PICO_LOG_MODIFIER_T,
+    __PICO_LOG_MODIFIER_BIG_L,
+} __picoLogLengthModifier;
+
+typedef struct {
+    __picoLogLengthModifier modifier;
+    __picoLogArgType argType;
+    char conversion;
+    bool widthStar;
+    bool precisionStar;
+} __picoLogFormatSpec_t;
+
+typedef struct {
+    const char *format;
+    const char *tag;
+    const char *file;
+    const char *function;
+    uint32_t line;
+    uint32_t id;
+    uint32_t argCount;
+    bool preformatted;
+    uint8_t argTypes[PICO_LOG_BINARY_MAX_ARGS];
+} __picoLogBinarySite_t;
+
+typedef struct {
+    __picoLogBinarySite_t table[PICO_LOG_BINARY_MAX_SITES * 2];
+    __picoLogBinarySite_t *ordered[PICO_LOG_BINARY_MAX_SITES];
+    uint32_t count;
+} __picoLogBinarySites_t;
+
+#define PICO_LOG_TAG_RULE_ALLOW  0x01
+#define PICO_LOG_TAG_RULE_DENY   0x02
+#define PICO_LOG_TAG_RULE_PREFIX 0x04
+
+typedef struct {
+    const char *text;
+    uint32_t length;
+    uint32_t hash;
+    uint32_t flags;
+} __picoLogTagRule_t;
+
+// A tag filter compiled into an open addressing hash set. Prefix rules live in the
+// same set, the tag is probed once for every distinct prefix length.
+typedef struct {
+    __picoLogTagRule_t *slots;
+    uint32_t slotMask;
+    uint32_t *prefixLengths; // ascending
+    uint32_t prefixLengthCount;
+    bool hasAllowRules;
+} __picoLogTagFilter_t;
+
+typedef struct {
+    picoLogCustomLogger logger;
+    void *userData;
+} __picoLogCustomLogger_t;
+
+typedef struct {
+    char *path;
+    FILE *handle;
+    char *buffer;
+    uint64_t lastFlushMs;
+    __picoLogFileRotationState_t *rotation;
+} __picoLogFileLogger_t;
+
+typedef struct {
+    FILE *handle;
+    char *buffer;
+    uint64_t lastFlushMs;
+} __picoLogBinaryLogger_t;
+
+// Every stack is allocated on demand and doubles when it fills up, up to
+// PICO_LOG_CONFIG_STACK_SIZE entries
+#define PICO_LOG_TARGET_COUNT 5
+
+#define PICO_LOG_CRASH_RING_MAGIC "PICORNG1"
+
+// The header sits in front of the data so a file backed ring describes itself
+typedef struct {
+    char magic[8];
+    uint64_t size;
+    volatile uint64_t writePosition; // total bytes ever written
+} __picoLogCrashRingHeader_t;
+
+typedef struct {
+    __picoLogCrashRingHeader_t *header;
+    uint8_t *data;
+    size_t mappingSize;
+    bool mapped;
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int file;
+#endif
+} __picoLogCrashRing_t;
+
+#ifdef PICO_LOG_ASYNC
+// What async producers filter against, rebuilt under the lock after every
+// configuration change and read without it. Replaced snapshots are retired,
+// along with a popped tag filter, and freed once no producer is in flight.
+typedef struct __picoLogConfig_t {
+    struct __picoLogConfig_t *retiredNext;
+    __picoLogTagFilter_t *releasedTagFilter;
+    picoLogLevel level;
+    const __picoLogTagFilter_t *tagFilter;
+    picoLogTarget target;
+    picoLogFormat format;
+    picoLogLevel targetLevels[PICO_LOG_TARGET_COUNT];
+} __picoLogConfig_t;
+#endif
+
 struct picoLogContext_t {
-    picoLogLevel levelStack[PICO_LOG_CONFIG_STACK_SIZE];
+    picoLogLevel *levelStack;
     uint32_t levelStackTop;
+    uint32_t levelStackCapacity;
 
-    char tagFilterStack[PICO_LOG_CONFIG_STACK_SIZE][256];
+    __picoLogTagFilter_t **tagFilterStack; // NULL entries mean no filter
     uint32_t tagFilterStackTop;
+    uint32_t tagFilterStackCapacity;
 
-    picoLogTarget targetStack[PICO_LOG_CONFIG_STACK_SIZE];
+    picoLogTarget *targetStack;
     uint32_t targetStackTop;
+    uint32_t targetStackCapacity;
 
-    picoLogFormat formatStack[PICO_LOG_CONFIG_STACK_SIZE];
+    picoLogFormat *formatStack;
     uint32_t formatStackTop;
+    uint32_t formatStackCapacity;
 
-    picoLogCustomLogger customLoggerStack[PICO_LOG_CONFIG_STACK_SIZE];
-    void *customLoggerUserDataStack[PICO_LOG_CONFIG_STACK_SIZE];
+    __picoLogCustomLogger_t *customLoggerStack;
     uint32_t customLoggerStackTop;
+    uint32_t customLoggerStackCapacity;
+
+    __picoLogFileLogger_t *fileLoggerStack;
+    uint32_t fileLoggerStackTop;
+    uint32_t fileLoggerStackCapacity;
 
-    char logFilePaths[PICO_LOG_CONFIG_STACK_SIZE][PICO_LOG_MAX_PATH];
-    uint32_t logFilesStackTop;
+    __picoLogBinaryLogger_t *binaryLoggerStack;
+    uint32_t binaryLoggerStackTop;
+    uint32_t binaryLoggerStackCapacity;
+    __picoLogBinarySites_t *binarySites;
+
+    // shared with every module on this context, the crash handler reads it without locking
+    __picoLogCrashRing_t *volatile crashRing;
+
+#ifdef PICO_LOG_ASYNC
+    __picoLogAsyncState_t *volatile async;
+    __picoLogConfig_t *volatile config; // NULL sends producers down the locked path
+    __picoLogConfig_t *retiredConfigs;
+    // producers between picking up async and config and finishing their push
+    volatile uint32_t asyncProducers;
+    // kept here rather than in the queue so the total outlives picoLogStopAsync
+    volatile uint64_t asyncDroppedCount;
+#endif
+
+    // levels each target accepts, indexed by the bit of the target
+    picoLogLevel targetLevels[PICO_LOG_TARGET_COUNT];
+
+    // bumped whenever a change can flip the enabled state of a call site
+    volatile uint32_t generation;
+    // number of thread local overrides currently pushed across all threads
+    volatile uint32_t activeThreadOverrides;
 
     PICO_LOG_MUTEX_TYPE mutex;
 };
 
+typedef struct {
+    picoLogLevel levelStack[PICO_LOG_THREAD_STACK_SIZE];
+    uint32_t levelStackTop;
+
+    __picoLogTagFilter_t *tagFilterStack[PICO_LOG_THREAD_STACK_SIZE];
+    uint32_t tagFilterStackTop;
+
+    // the context the pushed overrides are counted in
+    picoLogContext context;
+} __picoLogThreadOverrides_t;
+
 typedef struct
 {
     picoLogLevel level;
@@ -244,504 +896,3117 @@ typedef picoLogEntry_t *picoLogEntry;
 
 picoLogContext __picoLogGlobalContext = NULL;
 
-static picoLogTimeStamp __picoLogGetCurrentTimestamp(void)
+// scratch buffers of the synchronous path, only used under the context lock
+static char __picoLogMessageBuffer[PICO_LOG_MAX_MESSAGE_LENGTH];
+static char __picoLogFormattedMessage[PICO_LOG_MAX_MESSAGE_LENGTH * 2];
+
+// Sites evaluated without a context are tagged with this generation. A new
+// context always starts past it so nothing cached earlier is taken as current.
+static volatile uint32_t __picoLogDetachedGeneration = 0;
+volatile uint32_t *__picoLogGeneration               = &__picoLogDetachedGeneration;
+
+static PICO_LOG_THREAD_LOCAL __picoLogThreadOverrides_t __picoLogThreadOverrides;
+
+static void __picoLogInvalidateCallSites(void)
+{
+    PICO_LOG_ATOMIC_ADD32(&__picoLogGlobalContext->generation, 1);
+}
+
+#ifdef PICO_LOG_ASYNC
+static void __picoLogReclaimConfigs(void)
+{
+    // the count goes up before a producer loads the snapshot, see __picoLogAsyncBegin
+    if (PICO_LOG_ATOMIC_LOAD32(&__picoLogGlobalContext->asyncProducers) != 0) {
+        return;
+    }
+    while (__picoLogGlobalContext->retiredConfigs != NULL) {
+        __picoLogConfig_t *config              = __picoLogGlobalContext->retiredConfigs;
+        __picoLogGlobalContext->retiredConfigs = config->retiredNext;
+        PICO_FREE(config->releasedTagFilter);
+        PICO_FREE(config);
+    }
+}
+
+// Called with the lock held after the context stacks changed, released is a tag
+// filter that was just popped and may still be in use by a producer
+static void __picoLogPublishConfig(__picoLogTagFilter_t *released)
+{
+    picoLogContext context    = __picoLogGlobalContext;
+    __picoLogConfig_t *config = (__picoLogConfig_t *)PICO_MALLOC(sizeof(__picoLogConfig_t));
+    if (config != NULL) {
+        memset(config, 0, sizeof(__picoLogConfig_t));
+        config->level     = context->levelStackTop > 0 ? context->levelStack[context->levelStackTop - 1] : PICO_LOG_LEVEL_NONE;
+        config->tagFilter = context->tagFilterStackTop > 0 ? context->tagFilterStack[context->tagFilterStackTop - 1] : NULL;
+        config->target    = context->targetStackTop > 0 ? context->targetStack[context->targetStackTop - 1] : PICO_LOG_TARGET_CONSOLE;
+        config->format    = context->formatStackTop > 0 ? context->formatStack[context->formatStackTop - 1] : PICO_LOG_FORMAT_DEFAULT;
+        memcpy(config->targetLevels, context->targetLevels, sizeof(config->targetLevels));
+    }
+
+    // without a snapshot producers fall back to the locked path until the next change
+    __picoLogConfig_t *previous = (__picoLogConfig_t *)PICO_LOG_ATOMIC_LOAD_PTR(&context->config);
+    PICO_LOG_ATOMIC_STORE_PTR(&context->config, config);
+    if (previous != NULL) {
+        previous->releasedTagFilter = released;
+        previous->retiredNext       = context->retiredConfigs;
+        context->retiredConfigs     = previous;
+    } else if (released != NULL) {
+        // nothing to retire it with, wait out the producers that may still hold an older snapshot
+        while (PICO_LOG_ATOMIC_LOAD32(&context->asyncProducers) != 0) {
+            PICO_LOG_SLEEP_MS(0);
+        }
+        PICO_FREE(released);
+    }
+    __picoLogReclaimConfigs();
+}
+#else
+static void __picoLogPublishConfig(__picoLogTagFilter_t *released)
+{
+    PICO_FREE(released);
+}
+#endif
+
+static bool __picoLogGrowStack(void **stack, uint32_t *capacity, uint32_t top, size_t itemSize)
+{
+    if (top < *capacity) {
+        return true;
+    }
+    if (top >= PICO_LOG_CONFIG_STACK_SIZE) {
+        return false;
+    }
+
+    uint32_t newCapacity = *capacity ? *capacity * 2 : 8;
+    newCapacity          = newCapacity < PICO_LOG_CONFIG_STACK_SIZE ? newCapacity : PICO_LOG_CONFIG_STACK_SIZE;
+    void *grown          = PICO_MALLOC(itemSize * newCapacity);
+    if (grown == NULL) {
+        return false;
+    }
+    if (*stack != NULL) {
+        memcpy(grown, *stack, itemSize * top);
+        PICO_FREE(*stack);
+    }
+    *stack    = grown;
+    *capacity = newCapacity;
+    return true;
+}
+
+// makes room for one more entry on a context stack
+#define __PICO_LOG_GROW_STACK(name) \
+    __picoLogGrowStack((void **)&__picoLogGlobalContext->name, &__picoLogGlobalContext->name##Capacity, __picoLogGlobalContext->name##Top, sizeof(*__picoLogGlobalContext->name))
+
+// per thread clock cache, the broken down time only changes once per second so
+// localtime and the date/time text are only recomputed when the second rolls over
+typedef struct {
+    bool valid;
+    int64_t second;
+    picoLogTimeStamp_t time;
+    bool textValid;
+    picoLogTimeStamp_t textTime;
+    char text[24];
+} __picoLogClockCache_t;
+
+static PICO_LOG_THREAD_LOCAL __picoLogClockCache_t __picoLogClockCache;
+
+static void __picoLogGetCurrentTimestamp(picoLogTimeStamp timestamp)
 {
-    static picoLogTimeStamp_t timestamp = {0};
+    __picoLogClockCache_t *cache = &__picoLogClockCache;
 #if defined(_WIN32) || defined(_WIN64)
-    SYSTEMTIME st;
-    GetSystemTime(&st);
-    timestamp.year        = st.wYear;
-    timestamp.month       = st.wMonth;
-    timestamp.day         = st.wDay;
-    timestamp.hour        = st.wHour;
-    timestamp.minute      = st.wMinute;
-    timestamp.second      = st.wSecond;
-    timestamp.millisecond = st.wMilliseconds;
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    uint64_t ticks       = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    int64_t second       = (int64_t)(ticks / 10000000ULL);
+    uint32_t millisecond = (uint32_t)((ticks / 10000ULL) % 1000ULL);
+    if (!cache->valid || cache->second != second) {
+        SYSTEMTIME st;
+        FileTimeToSystemTime(&ft, &st);
+        cache->time.year   = st.wYear;
+        cache->time.month  = st.wMonth;
+        cache->time.day    = st.wDay;
+        cache->time.hour   = st.wHour;
+        cache->time.minute = st.wMinute;
+        cache->time.second = st.wSecond;
+        cache->second      = second;
+        cache->valid       = true;
+    }
 #elif defined(__unix__) || defined(__APPLE__)
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    struct tm *tm         = localtime(&tv.tv_sec);
-    timestamp.year        = tm->tm_year + 1900;
-    timestamp.month       = tm->tm_mon + 1;
-    timestamp.day         = tm->tm_mday;
-    timestamp.hour        = tm->tm_hour;
-    timestamp.minute      = tm->tm_min;
-    timestamp.second      = tm->tm_sec;
-    timestamp.millisecond = tv.tv_usec / 1000;
+    struct timespec ts;
+#if defined(PICO_LOG_USE_COARSE_CLOCK) && defined(CLOCK_REALTIME_COARSE)
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+    int64_t second       = (int64_t)ts.tv_sec;
+    uint32_t millisecond = (uint32_t)(ts.tv_nsec / 1000000);
+    if (!cache->valid || cache->second != second) {
+        struct tm tm;
+        localtime_r(&ts.tv_sec, &tm);
+        cache->time.year   = tm.tm_year + 1900;
+        cache->time.month  = tm.tm_mon + 1;
+        cache->time.day    = tm.tm_mday;
+        cache->time.hour   = tm.tm_hour;
+        cache->time.minute = tm.tm_min;
+        cache->time.second = tm.tm_sec;
+        cache->second      = second;
+        cache->valid       = true;
+    }
 #else
 #error "Unsupported platform for time functions"
 #endif
-    return &timestamp;
+    *timestamp             = cache->time;
+    timestamp->millisecond = millisecond;
+}
+
+// renders "YYYY-MM-DD HH:MM:SS.mmm", the date/time part is reused as long as
+// the second matches and only the milliseconds are patched in
+static const char *__picoLogFormatTimestamp(picoLogTimeStamp timestamp)
+{
+    __picoLogClockCache_t *cache = &__picoLogClockCache;
+    picoLogTimeStamp_t *last     = &cache->textTime;
+    if (!cache->textValid ||
+        last->second != timestamp->second || last->minute != timestamp->minute || last->hour != timestamp->hour ||
+        last->day != timestamp->day || last->month != timestamp->month || last->year != timestamp->year) {
+        snprintf(cache->text, sizeof(cache->text), "%04u-%02u-%02u %02u:%02u:%02u",
+                 timestamp->year % 10000, timestamp->month % 100, timestamp->day % 100,
+                 timestamp->hour % 100, timestamp->minute % 100, timestamp->second % 100);
+        *last            = *timestamp;
+        cache->textValid = true;
+    }
+
+    uint32_t millisecond = timestamp->millisecond % 1000;
+    cache->text[19]      = '.';
+    cache->text[20]      = (char)('0' + millisecond / 100);
+    cache->text[21]      = (char)('0' + (millisecond / 10) % 10);
+    cache->text[22]      = (char)('0' + millisecond % 10);
+    cache->text[23]      = '\0';
+    return cache->text;
+}
+
+static uint64_t __picoLogGetMonotonicMs(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return (uint64_t)GetTickCount64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+#endif
 }
 
 static picoLogLevel __picoLogGetCurrentLevel(void)
 {
+    if (__picoLogThreadOverrides.levelStackTop > 0) {
+        return __picoLogThreadOverrides.levelStack[__picoLogThreadOverrides.levelStackTop - 1];
+    }
     if (__picoLogGlobalContext == NULL || __picoLogGlobalContext->levelStackTop == 0) {
         return PICO_LOG_LEVEL_NONE;
     }
     return __picoLogGlobalContext->levelStack[__picoLogGlobalContext->levelStackTop - 1];
 }
 
-static const char *__picoLogGetCurrentTagFilter(void)
+static const __picoLogTagFilter_t *__picoLogGetCurrentTagFilter(void)
 {
+    if (__picoLogThreadOverrides.tagFilterStackTop > 0) {
+        return __picoLogThreadOverrides.tagFilterStack[__picoLogThreadOverrides.tagFilterStackTop - 1];
+    }
     if (__picoLogGlobalContext == NULL || __picoLogGlobalContext->tagFilterStackTop == 0) {
-        return "";
+        return NULL;
     }
     return __picoLogGlobalContext->tagFilterStack[__picoLogGlobalContext->tagFilterStackTop - 1];
 }
 
-static picoLogTarget __picoLogGetCurrentTarget(void)
+#define PICO_LOG_FNV_OFFSET_BASIS 2166136261u
+#define PICO_LOG_FNV_PRIME        16777619u
+
+static uint32_t __picoLogHashTag(const char *text, uint32_t length)
 {
-    if (__picoLogGlobalContext == NULL || __picoLogGlobalContext->targetStackTop == 0) {
-        return PICO_LOG_TARGET_CONSOLE;
+    uint32_t hash = PICO_LOG_FNV_OFFSET_BASIS;
+    for (uint32_t i = 0; i < length; i++) {
+        hash = (hash ^ (uint8_t)text[i]) * PICO_LOG_FNV_PRIME;
     }
-    return __picoLogGlobalContext->targetStack[__picoLogGlobalContext->targetStackTop - 1];
+    return hash;
 }
 
-static picoLogFormat __picoLogGetCurrentFormat(void)
+static const __picoLogTagRule_t *__picoLogTagFilterFind(const __picoLogTagFilter_t *filter, const char *text, uint32_t length, uint32_t hash, uint32_t kind)
 {
-    if (__picoLogGlobalContext == NULL || __picoLogGlobalContext->formatStackTop == 0) {
-        return PICO_LOG_FORMAT_DEFAULT;
+    for (uint32_t slot = hash & filter->slotMask;; slot = (slot + 1) & filter->slotMask) {
+        const __picoLogTagRule_t *rule = &filter->slots[slot];
+        if (rule->text == NULL) {
+            return NULL;
+        }
+        if (rule->hash == hash && rule->length == length && (rule->flags & PICO_LOG_TAG_RULE_PREFIX) == kind &&
+            memcmp(rule->text, text, length) == 0) {
+            return rule;
+        }
     }
-    return __picoLogGlobalContext->formatStack[__picoLogGlobalContext->formatStackTop - 1];
 }
 
-static void __picoLogDispatchToCustomLoggers(picoLogEntry entry)
+static bool __picoLogTagFilterAllows(const __picoLogTagFilter_t *filter, const char *tag)
 {
-    if (__picoLogGlobalContext == NULL) {
-        return;
-    }
+    uint32_t length = (uint32_t)strlen(tag);
+    bool allowed    = !filter->hasAllowRules;
 
-    if (!(__picoLogGetCurrentTarget() & PICO_LOG_TARGET_CUSTOM)) {
-        return;
+    const __picoLogTagRule_t *rule = __picoLogTagFilterFind(filter, tag, length, __picoLogHashTag(tag, length), 0);
+    if (rule != NULL) {
+        if (rule->flags & PICO_LOG_TAG_RULE_DENY) {
+            return false;
+        }
+        allowed = true;
     }
 
-    for (uint32_t i = 0; i < __picoLogGlobalContext->customLoggerStackTop; i++) {
-        picoLogCustomLogger logger = __picoLogGlobalContext->customLoggerStack[i];
-        void *userData             = __picoLogGlobalContext->customLoggerUserDataStack[i];
-        if (logger != NULL) {
-            logger(entry->level, entry->tag, entry->message, entry->location, entry->timestamp, userData);
+    // the prefix hash is extended incrementally, one pass over the tag covers every prefix length
+    uint32_t hash   = PICO_LOG_FNV_OFFSET_BASIS;
+    uint32_t hashed = 0;
+    for (uint32_t i = 0; i < filter->prefixLengthCount && filter->prefixLengths[i] <= length; i++) {
+        for (; hashed < filter->prefixLengths[i]; hashed++) {
+            hash = (hash ^ (uint8_t)tag[hashed]) * PICO_LOG_FNV_PRIME;
+        }
+        rule = __picoLogTagFilterFind(filter, tag, hashed, hash, PICO_LOG_TAG_RULE_PREFIX);
+        if (rule != NULL) {
+            if (rule->flags & PICO_LOG_TAG_RULE_DENY) {
+                return false;
+            }
+            allowed = true;
         }
     }
+    return allowed;
 }
 
-static void __picoLogDispatchToFileLoggers(picoLogEntry entry)
+static bool __picoLogIsTagAllowed(const char *tag)
 {
-    // loop through all file loggers and write the log entry to each file
-    if (__picoLogGlobalContext == NULL) {
-        return;
-    }
+    const __picoLogTagFilter_t *filter = __picoLogGetCurrentTagFilter();
+    return filter == NULL || tag == NULL || __picoLogTagFilterAllows(filter, tag);
+}
 
-    if (!(__picoLogGetCurrentTarget() & PICO_LOG_TARGET_FILE)) {
-        return;
-    }
+static bool __picoLogIsTagSeparator(char c)
+{
+    return c == ',' || c == ';' || c == '|' || c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
 
-    for (uint32_t i = 0; i < __picoLogGlobalContext->logFilesStackTop; i++) {
-        const char *filePath = __picoLogGlobalContext->logFilePaths[i];
-        if (filePath[0] == '\0') {
-            continue;
-        }
-        FILE *file = fopen(filePath, "a+");
-        if (file != NULL) {
-            fprintf(file, "%s\n", entry->message);
-            fclose(file);
-        } else {
-            PICO_ERROR("Failed to open log file: %s", filePath);
+// Returns NULL with *failed unset for an empty filter
+static __picoLogTagFilter_t *__picoLogCompileTagFilter(const char *tags, bool *failed)
+{
+    *failed = false;
+
+    uint32_t ruleCount = 0;
+    size_t textLength  = strlen(tags);
+    for (size_t i = 0; i < textLength; i++) {
+        if (!__picoLogIsTagSeparator(tags[i]) && (i == 0 || __picoLogIsTagSeparator(tags[i - 1]))) {
+            ruleCount++;
         }
     }
-}
+    if (ruleCount == 0) {
+        return NULL;
+    }
 
-static void __picoLogDispatchToConsoleLoggers(picoLogEntry entry)
-{
-    if (__picoLogGlobalContext == NULL) {
-        return;
+    uint32_t slotCount = 4;
+    while (slotCount < ruleCount * 2) {
+        slotCount <<= 1;
     }
 
-    if (!(__picoLogGetCurrentTarget() & PICO_LOG_TARGET_CONSOLE)) {
-        return;
+    // header, slots, prefix lengths and the tokenised text share one allocation
+    size_t size = sizeof(__picoLogTagFilter_t) + sizeof(__picoLogTagRule_t) * slotCount + sizeof(uint32_t) * ruleCount + textLength + 1;
+    __picoLogTagFilter_t *filter = (__picoLogTagFilter_t *)PICO_MALLOC(size);
+    if (filter == NULL) {
+        *failed = true;
+        return NULL;
     }
+    memset(filter, 0, size);
+    filter->slots         = (__picoLogTagRule_t *)(filter + 1);
+    filter->slotMask      = slotCount - 1;
+    filter->prefixLengths = (uint32_t *)(filter->slots + slotCount);
+    char *text            = (char *)(filter->prefixLengths + ruleCount);
+    memcpy(text, tags, textLength + 1);
 
-    // color coding for different log levels
-#if defined(_WIN32) || defined(_WIN64)
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    WORD color;
+    for (size_t i = 0; i < textLength;) {
+        if (__picoLogIsTagSeparator(text[i])) {
+            text[i++] = '\0';
+            continue;
+        }
 
-    switch (entry->level) {
-        case PICO_LOG_LEVEL_DEBUG:
-            color = FOREGROUND_BLUE | FOREGROUND_GREEN | FOREGROUND_INTENSITY;
-            break;
-        case PICO_LOG_LEVEL_VERBOSE:
-            color = FOREGROUND_BLUE | FOREGROUND_INTENSITY;
-            break;
-        case PICO_LOG_LEVEL_INFO:
-            color = FOREGROUND_GREEN | FOREGROUND_INTENSITY;
-            break;
-        case PICO_LOG_LEVEL_WARN:
-            color = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY;
-            break;
-        case PICO_LOG_LEVEL_ERROR:
-            color = FOREGROUND_RED | FOREGROUND_INTENSITY;
-            break;
-        default:
-            color = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
-            break;
+        size_t end = i;
+        while (end < textLength && !__picoLogIsTagSeparator(text[end])) {
+            end++;
+        }
+
+        const char *token = text + i;
+        uint32_t length   = (uint32_t)(end - i);
+        uint32_t flags    = PICO_LOG_TAG_RULE_ALLOW;
+        if (token[0] == '-' || token[0] == '!') {
+            flags = PICO_LOG_TAG_RULE_DENY;
+            token++;
+            length--;
+        }
+        if (length > 0 && token[length - 1] == '*') {
+            flags |= PICO_LOG_TAG_RULE_PREFIX;
+            length--;
+        }
+        i = end;
+
+        // a lone "-" is not a rule, a lone "*" is a prefix rule of length zero
+        if (length == 0 && !(flags & PICO_LOG_TAG_RULE_PREFIX)) {
+            continue;
+        }
+
+        uint32_t hash = __picoLogHashTag(token, length);
+        uint32_t kind = flags & PICO_LOG_TAG_RULE_PREFIX;
+        uint32_t slot = hash & filter->slotMask;
+        while (filter->slots[slot].text != NULL) {
+            __picoLogTagRule_t *existing = &filter->slots[slot];
+            if (existing->hash == hash && existing->length == length && (existing->flags & PICO_LOG_TAG_RULE_PREFIX) == kind &&
+                memcmp(existing->text, token, length) == 0) {
+                break;
+            }
+            slot = (slot + 1) & filter->slotMask;
+        }
+
+        __picoLogTagRule_t *rule = &filter->slots[slot];
+        if (rule->text != NULL) {
+            // the same tag listed twice, a deny beats an allow
+            rule->flags |= flags & PICO_LOG_TAG_RULE_DENY;
+            continue;
+        }
+        rule->text   = token;
+        rule->length = length;
+        rule->hash   = hash;
+        rule->flags  = flags;
+
+        if (flags & PICO_LOG_TAG_RULE_ALLOW) {
+            filter->hasAllowRules = true;
+        }
+        if (kind) {
+            uint32_t at = 0;
+            while (at < filter->prefixLengthCount && filter->prefixLengths[at] < length) {
+                at++;
+            }
+            if (at == filter->prefixLengthCount || filter->prefixLengths[at] != length) {
+                memmove(filter->prefixLengths + at + 1, filter->prefixLengths + at, sizeof(uint32_t) * (filter->prefixLengthCount - at));
+                filter->prefixLengths[at] = length;
+                filter->prefixLengthCount++;
+            }
+        }
     }
 
-    if (entry->level & PICO_LOG_LEVEL_ERROR) {
-        SetConsoleTextAttribute(hConsole, color);
-        fprintf(stderr, "%s\n", entry->message);
-        SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
-    } else {
-        SetConsoleTextAttribute(hConsole, color);
-        fprintf(stdout, "%s\n", entry->message);
-        SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+    return filter;
+}
+
+static picoLogTarget __picoLogGetCurrentTarget(void)
+{
+    if (__picoLogGlobalContext == NULL || __picoLogGlobalContext->targetStackTop == 0) {
+        return PICO_LOG_TARGET_CONSOLE;
     }
+    return __picoLogGlobalContext->targetStack[__picoLogGlobalContext->targetStackTop - 1];
+}
 
-#elif defined(__unix__) || defined(__APPLE__)
-    const char *colorReset  = "\033[0m";
-    const char *colorRed    = "\033[31m";
-    const char *colorYellow = "\033[33m";
-    const char *colorGreen  = "\033[32m";
-    const char *colorCyan   = "\033[36m";
-    const char *colorBlue   = "\033[34m";
+static picoLogFormat __picoLogGetCurrentFormat(void)
+{
+    if (__picoLogGlobalContext == NULL || __picoLogGlobalContext->formatStackTop == 0) {
+        return PICO_LOG_FORMAT_DEFAULT;
+    }
+    return __picoLogGlobalContext->formatStack[__picoLogGlobalContext->formatStackTop - 1];
+}
 
-    switch (entry->level) {
-        case PICO_LOG_LEVEL_DEBUG:
-            fprintf(stdout, "%s%s%s\n", colorCyan, entry->message, colorReset);
-            break;
-        case PICO_LOG_LEVEL_VERBOSE:
-            fprintf(stdout, "%s%s%s\n", colorBlue, entry->message, colorReset);
-            break;
-        case PICO_LOG_LEVEL_INFO:
-            fprintf(stdout, "%s%s%s\n", colorGreen, entry->message, colorReset);
-            break;
-        case PICO_LOG_LEVEL_WARN:
-            fprintf(stdout, "%s%s%s\n", colorYellow, entry->message, colorReset);
-            break;
-        case PICO_LOG_LEVEL_ERROR:
-            fprintf(stderr, "%s%s%s\n", colorRed, entry->message, colorReset);
-            break;
-        default:
-            fprintf(stdout, "%s\n", entry->message);
-            break;
+static void __picoLogDispatchToCustomLoggers(picoLogEntry entry, picoLogTarget target)
+{
+    if (__picoLogGlobalContext == NULL) {
+        return;
     }
-#else
-#warning "Unsupported platform for console colors"
-    if (entry->level & PICO_LOG_LEVEL_ERROR) {
-        fprintf(stderr, "%s", entry->message);
-    } else {
-        fprintf(stdout, "%s", entry->message);
+
+    if (!(target & PICO_LOG_TARGET_CUSTOM)) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < __picoLogGlobalContext->customLoggerStackTop; i++) {
+        picoLogCustomLogger logger = __picoLogGlobalContext->customLoggerStack[i].logger;
+        void *userData             = __picoLogGlobalContext->customLoggerStack[i].userData;
+        if (logger != NULL) {
+            logger(entry->level, entry->tag, entry->message, entry->location, entry->timestamp, userData);
+        }
     }
-#endif
 }
 
-static const char *__picoLogFormatMessage(picoLogEntry entry)
+static bool __picoLogOpenFileLogger(uint32_t index)
 {
-    static char formattedMessage[PICO_LOG_MAX_MESSAGE_LENGTH * 2] = {0};
-    picoLogFormat format                                          = __picoLogGetCurrentFormat();
-    switch (format) {
-        case PICO_LOG_FORMAT_DEFAULT:
-            snprintf(formattedMessage, sizeof(formattedMessage), "[%04u-%02u-%02u %02u:%02u:%02u.%03u] [%s] [%s:%u]: %s",
-                     entry->timestamp->year, entry->timestamp->month, entry->timestamp->day,
-                     entry->timestamp->hour, entry->timestamp->minute, entry->timestamp->second, entry->timestamp->millisecond,
-                     picoLogLevelToString(entry->level),
-                     entry->tag ? entry->tag : "NO_TAG",
-                     entry->location ? entry->location->line : 0,
-                     entry->message);
-            break;
-        case PICO_LOG_FORMAT_SHORT:
-            snprintf(formattedMessage, sizeof(formattedMessage), "[%s] [%s:%u]: %s",
-                     picoLogLevelToString(entry->level),
-                     entry->tag ? entry->tag : "NO_TAG",
-                     entry->location ? entry->location->line : 0,
-                     entry->message);
-            break;
-        case PICO_LOG_FORMAT_MESSAGE_ONLY:
-            snprintf(formattedMessage, sizeof(formattedMessage), "%s", entry->message);
-            break;
-        case PICO_LOG_FORMAT_VERBOSE:
-            snprintf(formattedMessage, sizeof(formattedMessage), "[%04u-%02u-%02u %02u:%02u:%02u.%03u] [%s:%u] [%s] [%s] [%s]: %s",
-                     entry->timestamp->year, entry->timestamp->month, entry->timestamp->day,
-                     entry->timestamp->hour, entry->timestamp->minute, entry->timestamp->second, entry->timestamp->millisecond,
-                     entry->location ? entry->location->file : "NO_FILE",
-                     entry->location ? entry->location->line : 0,
-                     entry->location ? entry->location->function : "NO_FUNCTION",
-                     picoLogLevelToString(entry->level),
-                     entry->tag ? entry->tag : "NO_TAG",
-                     entry->message);
-            break;
-        case PICO_LOG_FORMAT_JSON:
-            snprintf(formattedMessage, sizeof(formattedMessage),
-                     "{\"time\": \"%04u-%02u-%02u %02u:%02u:%02u.%03u\", \"file\": \"%s\", \"line\": %u, \"function\": \"%s\", \"level\": \"%s\", \"tag\": \"%s\", \"message\": \"%s\"}",
-                     entry->timestamp->year, entry->timestamp->month, entry->timestamp->day,
-                     entry->timestamp->hour, entry->timestamp->minute, entry->timestamp->second, entry->timestamp->millisecond,
-                     entry->location ? entry->location->file : "NO_FILE",
-                     entry->location ? entry->location->line : 0,
-                     entry->location ? entry->location->function : "NO_FUNCTION",
-                     picoLogLevelToString(entry->level),
-                     entry->tag ? entry->tag : "NO_TAG",
-                     entry->message);
-            break;
-        default:
-            snprintf(formattedMessage, sizeof(formattedMessage), "%s", entry->message);
-            break;
+    const char *filePath = __picoLogGlobalContext->fileLoggerStack[index].path;
+    FILE *file           = fopen(filePath, "a");
+    if (file == NULL) {
+        // not through picoLog, this runs with the context lock held
+        fprintf(stderr, "picoLog: failed to open log file: %s\n", filePath);
+        return false;
     }
 
-    return formattedMessage;
+    char *buffer = (char *)PICO_MALLOC(PICO_LOG_FILE_BUFFER_SIZE);
+    if (buffer != NULL) {
+        setvbuf(file, buffer, _IOFBF, PICO_LOG_FILE_BUFFER_SIZE);
+    }
+
+    __picoLogGlobalContext->fileLoggerStack[index].handle     = file;
+    __picoLogGlobalContext->fileLoggerStack[index].buffer     = buffer;
+    __picoLogGlobalContext->fileLoggerStack[index].lastFlushMs = __picoLogGetMonotonicMs();
+
+    __picoLogFileRotationState_t *rotation = __picoLogGlobalContext->fileLoggerStack[index].rotation;
+    if (rotation != NULL) {
+        fseek(file, 0, SEEK_END);
+        long size              = ftell(file);
+        rotation->currentBytes = size > 0 ? (uint64_t)size : 0;
+    }
+    return true;
 }
 
-bool picoLogContextCreate(void)
+static void __picoLogCloseFileLogger(uint32_t index)
 {
-    if (__picoLogGlobalContext != NULL) {
-        PICO_WARN("picoLogContextCreate called but context already exists");
-        return true;
+    if (__picoLogGlobalContext->fileLoggerStack[index].handle != NULL) {
+        fclose(__picoLogGlobalContext->fileLoggerStack[index].handle);
+        __picoLogGlobalContext->fileLoggerStack[index].handle = NULL;
     }
-    __picoLogGlobalContext = (picoLogContext)PICO_MALLOC(sizeof(picoLogContext_t));
-    if (__picoLogGlobalContext == NULL) {
-        return false;
+    // the buffer belongs to the stream until fclose returns
+    if (__picoLogGlobalContext->fileLoggerStack[index].buffer != NULL) {
+        PICO_FREE(__picoLogGlobalContext->fileLoggerStack[index].buffer);
+        __picoLogGlobalContext->fileLoggerStack[index].buffer = NULL;
     }
-    memset(__picoLogGlobalContext, 0, sizeof(picoLogContext_t));
+}
 
-    // Initialize stacks
-    __picoLogGlobalContext->levelStack[0] = PICO_LOG_LEVEL_ALL;
-    __picoLogGlobalContext->levelStackTop = 1;
+static void __picoLogRunCompressor(__picoLogFileRotationState_t *rotation)
+{
+    rotation->compressSucceeded = rotation->policy.compressor(rotation->compressSource, rotation->compressDestination, rotation->policy.compressorUserData);
+}
 
-    __picoLogGlobalContext->tagFilterStack[0][0] = '\0'; // Empty string means no filter
-    __picoLogGlobalContext->tagFilterStackTop    = 1;
+// Moves the result of the last compression into the chain, or back uncompressed
+// if the compressor failed. A file pushed past keepFiles meanwhile is dropped.
+static void __picoLogFinishCompression(__picoLogFileRotationState_t *rotation)
+{
+    char to[PICO_LOG_MAX_ROTATED_PATH];
+    if (rotation->compressSlot > rotation->policy.keepFiles) {
+        remove(rotation->compressDestination);
+        remove(rotation->compressSource);
+    } else if (rotation->compressSucceeded) {
+        snprintf(to, sizeof(to), "%s.%u%s", rotation->filePath, rotation->compressSlot, rotation->compressedSuffix);
+        rename(rotation->compressDestination, to);
+        remove(rotation->compressSource);
+    } else {
+        snprintf(to, sizeof(to), "%s.%u", rotation->filePath, rotation->compressSlot);
+        remove(rotation->compressDestination);
+        rename(rotation->compressSource, to);
+    }
+}
 
-    __picoLogGlobalContext->targetStack[0] = PICO_LOG_TARGET_CONSOLE;
-    __picoLogGlobalContext->targetStackTop = 1;
+#ifdef PICO_LOG_THREAD_SAFE
+static PICO_LOG_THREAD_RETURN_TYPE __picoLogCompressorMain(void *arg)
+{
+    __picoLogFileRotationState_t *rotation = (__picoLogFileRotationState_t *)arg;
+    __picoLogRunCompressor(rotation);
+    PICO_LOG_ATOMIC_ADD32(&rotation->compressDone, 1);
+    return PICO_LOG_THREAD_RETURN_VALUE;
+}
+#endif
 
-    __picoLogGlobalContext->formatStack[0] = PICO_LOG_FORMAT_DEFAULT;
-    __picoLogGlobalContext->formatStackTop = 1;
+static bool __picoLogCompressorBusy(__picoLogFileRotationState_t *rotation)
+{
+#ifdef PICO_LOG_THREAD_SAFE
+    return rotation->compressPending;
+#else
+    (void)rotation;
+    return false;
+#endif
+}
 
-    PICO_LOG_INIT_MUTEX(__picoLogGlobalContext->mutex);
+// Compresses the queued files oldest first, each is parked outside the chain
+// while the compressor works on it
+static void __picoLogStartCompression(__picoLogFileRotationState_t *rotation)
+{
+    while (rotation->compressQueued > 0 && !__picoLogCompressorBusy(rotation)) {
+        char from[PICO_LOG_MAX_ROTATED_PATH];
+        rotation->compressSlot = rotation->compressQueued--;
+        snprintf(from, sizeof(from), "%s.%u", rotation->filePath, rotation->compressSlot);
+        snprintf(rotation->compressSource, sizeof(rotation->compressSource), "%s.compressing", rotation->filePath);
+        snprintf(rotation->compressDestination, sizeof(rotation->compressDestination), "%s.compressing%s", rotation->filePath, rotation->compressedSuffix);
+        if (rename(from, rotation->compressSource) != 0) {
+            continue;
+        }
+#ifdef PICO_LOG_THREAD_SAFE
+        rotation->compressDone    = 0;
+        rotation->compressPending = PICO_LOG_THREAD_CREATE(rotation->compressThread, __picoLogCompressorMain, rotation);
+        if (rotation->compressPending) {
+            continue;
+        }
+#endif
+        __picoLogRunCompressor(rotation);
+        __picoLogFinishCompression(rotation);
+    }
+}
 
-    return true;
+// Picks up a finished compression and starts the next queued one, the thread
+// is only joined once it has finished so this never blocks the logging path
+static void __picoLogReapCompressor(__picoLogFileRotationState_t *rotation)
+{
+#ifdef PICO_LOG_THREAD_SAFE
+    if (rotation->compressPending) {
+        if (PICO_LOG_ATOMIC_LOAD32(&rotation->compressDone) == 0) {
+            return;
+        }
+        PICO_LOG_THREAD_JOIN(rotation->compressThread);
+        rotation->compressPending = false;
+        __picoLogFinishCompression(rotation);
+        __picoLogStartCompression(rotation);
+    }
+#else
+    (void)rotation;
+#endif
 }
 
-void picoLogShutdown(void)
+// Blocks until every queued file is compressed, never call it with the lock held
+static void __picoLogWaitForCompressor(__picoLogFileRotationState_t *rotation)
 {
-    if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogShutdown called but context is NULL");
-        return;
+#ifdef PICO_LOG_THREAD_SAFE
+    while (rotation->compressPending) {
+        PICO_LOG_THREAD_JOIN(rotation->compressThread);
+        rotation->compressPending = false;
+        __picoLogFinishCompression(rotation);
+        __picoLogStartCompression(rotation);
     }
+#else
+    (void)rotation;
+#endif
+}
 
-    PICO_LOG_DESTROY_MUTEX(__picoLogGlobalContext->mutex);
+static uint32_t __picoLogGetRotationPeriod(picoLogRotateInterval interval, picoLogTimeStamp timestamp)
+{
+    uint32_t day = timestamp->year * 10000 + timestamp->month * 100 + timestamp->day;
+    switch (interval) {
+        case PICO_LOG_ROTATE_HOURLY:
+            return day * 100 + timestamp->hour;
+        case PICO_LOG_ROTATE_DAILY:
+            return day;
+        default:
+            return 0;
+    }
+}
 
-    PICO_FREE(__picoLogGlobalContext);
-    __picoLogGlobalContext = NULL;
+static void __picoLogRotateFileLogger(uint32_t index)
+{
+    __picoLogFileRotationState_t *rotation = __picoLogGlobalContext->fileLoggerStack[index].rotation;
+    const char *filePath                   = __picoLogGlobalContext->fileLoggerStack[index].path;
+    const char *suffix                     = rotation->compressedSuffix;
+    uint32_t keepFiles                     = rotation->policy.keepFiles;
+
+    __picoLogReapCompressor(rotation);
+    __picoLogCloseFileLogger(index);
+
+    if (keepFiles == 0) {
+        remove(filePath);
+    } else {
+        char from[PICO_LOG_MAX_ROTATED_PATH];
+        char to[PICO_LOG_MAX_ROTATED_PATH];
+
+        snprintf(from, sizeof(from), "%s.%u", filePath, keepFiles);
+        remove(from);
+        snprintf(from, sizeof(from), "%s.%u%s", filePath, keepFiles, suffix);
+        remove(from);
+
+        for (uint32_t i = keepFiles - 1; i >= 1; i--) {
+            snprintf(from, sizeof(from), "%s.%u", filePath, i);
+            snprintf(to, sizeof(to), "%s.%u", filePath, i + 1);
+            rename(from, to);
+            if (suffix[0] != '\0') {
+                snprintf(from, sizeof(from), "%s.%u%s", filePath, i, suffix);
+                snprintf(to, sizeof(to), "%s.%u%s", filePath, i + 1, suffix);
+                rename(from, to);
+            }
+        }
+        // the file still being compressed moves down the chain with the rest
+        if (__picoLogCompressorBusy(rotation)) {
+            rotation->compressSlot++;
+        }
+
+        // rename is atomic, the live path never points at a half rotated file
+        snprintf(to, sizeof(to), "%s.1", filePath);
+        if (rename(filePath, to) == 0 && rotation->policy.compressor != NULL) {
+            rotation->compressQueued = rotation->compressQueued < keepFiles ? rotation->compressQueued + 1 : keepFiles;
+            __picoLogStartCompression(rotation);
+        }
+    }
+
+    __picoLogOpenFileLogger(index);
 }
 
-picoLogContext picoLogGetContext(void)
+// Returns the rotation state, the caller waits for its compressor and frees it
+// once the lock is released
+static __picoLogFileRotationState_t *__picoLogReleaseFileLogger(uint32_t index)
 {
-    return __picoLogGlobalContext;
+    __picoLogCloseFileLogger(index);
+    PICO_FREE(__picoLogGlobalContext->fileLoggerStack[index].path);
+    __picoLogGlobalContext->fileLoggerStack[index].path = NULL;
+
+    __picoLogFileRotationState_t *rotation                  = __picoLogGlobalContext->fileLoggerStack[index].rotation;
+    __picoLogGlobalContext->fileLoggerStack[index].rotation = NULL;
+    return rotation;
 }
 
-void picoLogSetContext(picoLogContext context)
+static void __picoLogFreeFileRotation(__picoLogFileRotationState_t *rotation)
 {
-    if (__picoLogGlobalContext != NULL) {
-        PICO_WARN("picoLogSetContext called but context already exists");
-        return;
+    if (rotation != NULL) {
+        __picoLogWaitForCompressor(rotation);
+        PICO_FREE(rotation);
     }
+}
 
-    __picoLogGlobalContext = context;
+static void __picoLogFlushFileLoggers(bool onlyExpired)
+{
+    uint64_t now = __picoLogGetMonotonicMs();
+    for (uint32_t i = 0; i < __picoLogGlobalContext->fileLoggerStackTop; i++) {
+        FILE *file = __picoLogGlobalContext->fileLoggerStack[i].handle;
+        if (file == NULL) {
+            continue;
+        }
+        if (onlyExpired && now - __picoLogGlobalContext->fileLoggerStack[i].lastFlushMs < PICO_LOG_FILE_FLUSH_INTERVAL_MS) {
+            continue;
+        }
+        fflush(file);
+        __picoLogGlobalContext->fileLoggerStack[i].lastFlushMs = now;
+    }
+
+    for (uint32_t i = 0; i < __picoLogGlobalContext->binaryLoggerStackTop; i++) {
+        FILE *file = __picoLogGlobalContext->binaryLoggerStack[i].handle;
+        if (file == NULL) {
+            continue;
+        }
+        if (onlyExpired && now - __picoLogGlobalContext->binaryLoggerStack[i].lastFlushMs < PICO_LOG_FILE_FLUSH_INTERVAL_MS) {
+            continue;
+        }
+        fflush(file);
+        __picoLogGlobalContext->binaryLoggerStack[i].lastFlushMs = now;
+    }
 }
 
-void picoLogPushLevel(picoLogLevel level)
+static void __picoLogDispatchToFileLoggers(picoLogEntry entry, picoLogTarget target)
 {
+    // loop through all file loggers and write the log entry to each file
     if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPushLevel called but context is NULL");
         return;
     }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->levelStackTop >= PICO_LOG_CONFIG_STACK_SIZE) {
-        PICO_ERROR("picoLogPushLevel stack overflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+
+    if (!(target & PICO_LOG_TARGET_FILE)) {
         return;
     }
-    __picoLogGlobalContext->levelStack[__picoLogGlobalContext->levelStackTop++] = level;
+
+    bool flushNow = (entry->level & (PICO_LOG_FILE_FLUSH_LEVELS)) != 0;
+    uint64_t now  = __picoLogGetMonotonicMs();
+
+    for (uint32_t i = 0; i < __picoLogGlobalContext->fileLoggerStackTop; i++) {
+        if (__picoLogGlobalContext->fileLoggerStack[i].path[0] == '\0') {
+            continue;
+        }
+        __picoLogFileRotationState_t *rotation = __picoLogGlobalContext->fileLoggerStack[i].rotation;
+        if (rotation != NULL) {
+            __picoLogReapCompressor(rotation);
+        }
+        if (rotation != NULL && rotation->policy.interval != PICO_LOG_ROTATE_NEVER) {
+            uint32_t period = __picoLogGetRotationPeriod(rotation->policy.interval, entry->timestamp);
+            if (rotation->currentPeriod != 0 && rotation->currentPeriod != period) {
+                __picoLogRotateFileLogger(i);
+            }
+            rotation->currentPeriod = period;
+        }
+
+        // a logger whose file could not be opened retries on every message
+        if (__picoLogGlobalContext->fileLoggerStack[i].handle == NULL && !__picoLogOpenFileLogger(i)) {
+            continue;
+        }
+
+        FILE *file    = __picoLogGlobalContext->fileLoggerStack[i].handle;
+        size_t length = strlen(entry->message);
+        fwrite(entry->message, 1, length, file);
+        fputc('\n', file);
+
+        if (rotation != NULL) {
+            rotation->currentBytes += length + 1;
+            if (rotation->policy.maxBytes != 0 && rotation->currentBytes >= rotation->policy.maxBytes) {
+                __picoLogRotateFileLogger(i);
+                continue;
+            }
+        }
+
+        if (flushNow || now - __picoLogGlobalContext->fileLoggerStack[i].lastFlushMs >= PICO_LOG_FILE_FLUSH_INTERVAL_MS) {
+            fflush(file);
+            __picoLogGlobalContext->fileLoggerStack[i].lastFlushMs = now;
+        }
+    }
+}
+
+static void __picoLogCrashRingWrite(__picoLogCrashRing_t *ring, const char *bytes, size_t count)
+{
+    uint64_t size     = ring->header->size;
+    uint64_t position = ring->header->writePosition;
+    if (count > size) {
+        bytes += count - size;
+        position += count - size;
+        count = (size_t)size;
+    }
+
+    size_t offset = (size_t)(position % size);
+    size_t first  = count < size - offset ? count : (size_t)(size - offset);
+    memcpy(ring->data + offset, bytes, first);
+    memcpy(ring->data, bytes + first, count - first);
+    ring->header->writePosition = position + count;
+}
+
+static void __picoLogDispatchToCrashRing(picoLogEntry entry, picoLogTarget target)
+{
+    __picoLogCrashRing_t *ring = __picoLogGlobalContext->crashRing;
+    if (ring == NULL || !(target & PICO_LOG_TARGET_RING)) {
+        return;
+    }
+
+    __picoLogCrashRingWrite(ring, entry->message, strlen(entry->message));
+    __picoLogCrashRingWrite(ring, "\n", 1);
+}
+
+typedef bool (*__picoLogCrashRingSink)(void *userData, const void *bytes, size_t count);
+
+// Hands the ring to sink oldest byte first. Once it has wrapped around the
+// partly overwritten oldest line is skipped.
+static bool __picoLogCrashRingUnroll(const __picoLogCrashRingHeader_t *header, const uint8_t *data, __picoLogCrashRingSink sink, void *userData)
+{
+    uint64_t size     = header->size;
+    uint64_t position = header->writePosition;
+    if (position <= size) {
+        return sink(userData, data, (size_t)position);
+    }
+
+    size_t start = (size_t)(position % size);
+    size_t skip  = 0;
+    while (skip < size && data[(start + skip) % size] != '\n') {
+        skip++;
+    }
+    skip = skip < size ? skip + 1 : 0;
+
+    start            = (size_t)((start + skip) % size);
+    size_t remaining = (size_t)(size - skip);
+    size_t first     = remaining < size - start ? remaining : (size_t)(size - start);
+    return sink(userData, data + start, first) && sink(userData, data, remaining - first);
+}
+
+static bool __picoLogCrashRingFileSink(void *userData, const void *bytes, size_t count)
+{
+    return fwrite(bytes, 1, count, (FILE *)userData) == count;
+}
+
+#if defined(_WIN32) || defined(_WIN64)
+static bool __picoLogCrashRingHandleSink(void *userData, const void *bytes, size_t count)
+{
+    const uint8_t *data = (const uint8_t *)bytes;
+    while (count > 0) {
+        DWORD written = 0;
+        DWORD chunk   = count > 0x40000000 ? 0x40000000 : (DWORD)count;
+        if (!WriteFile((HANDLE)userData, data, chunk, &written, NULL) || written == 0) {
+            return false;
+        }
+        data += written;
+        count -= written;
+    }
+    return true;
+}
+#else
+static bool __picoLogCrashRingDescriptorSink(void *userData, const void *bytes, size_t count)
+{
+    int file            = *(int *)userData;
+    const uint8_t *data = (const uint8_t *)bytes;
+    while (count > 0) {
+        ssize_t written = write(file, data, count);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        count -= (size_t)written;
+    }
+    return true;
+}
+#endif
+
+static void __picoLogReleaseCrashRing(__picoLogCrashRing_t *ring)
+{
+    if (ring->header != NULL) {
+        if (!ring->mapped) {
+            PICO_FREE(ring->header);
+        } else {
+#if defined(_WIN32) || defined(_WIN64)
+            UnmapViewOfFile(ring->header);
+#else
+            munmap(ring->header, ring->mappingSize);
+#endif
+        }
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    if (ring->mapping != NULL) {
+        CloseHandle(ring->mapping);
+    }
+    if (ring->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(ring->file);
+    }
+#else
+    if (ring->file >= 0) {
+        close(ring->file);
+    }
+#endif
+    PICO_FREE(ring);
+}
+
+static char __picoLogCrashDumpPath[PICO_LOG_MAX_PATH];
+
+#if defined(_WIN32) || defined(_WIN64)
+static LPTOP_LEVEL_EXCEPTION_FILTER __picoLogPreviousExceptionFilter = NULL;
+static void(__cdecl *__picoLogPreviousAbortHandler)(int)             = NULL;
+
+static LONG WINAPI __picoLogCrashExceptionFilter(EXCEPTION_POINTERS *exception)
+{
+    picoLogDumpCrashRing(__picoLogCrashDumpPath);
+    if (__picoLogPreviousExceptionFilter != NULL) {
+        return __picoLogPreviousExceptionFilter(exception);
+    }
+    return EXCEPTION_CONTINUE_SEARCH;
+}
+
+static void __cdecl __picoLogCrashAbortHandler(int signalNumber)
+{
+    picoLogDumpCrashRing(__picoLogCrashDumpPath);
+    signal(signalNumber, __picoLogPreviousAbortHandler != SIG_ERR ? __picoLogPreviousAbortHandler : SIG_DFL);
+    raise(signalNumber);
+}
+#else
+static const int __picoLogCrashSignals[] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+static struct sigaction __picoLogPreviousCrashActions[sizeof(__picoLogCrashSignals) / sizeof(__picoLogCrashSignals[0])];
+
+static void __picoLogCrashSignalHandler(int signalNumber)
+{
+    picoLogDumpCrashRing(__picoLogCrashDumpPath);
+
+    // put the previous handler back and let it see the same fault
+    for (size_t i = 0; i < sizeof(__picoLogCrashSignals) / sizeof(__picoLogCrashSignals[0]); i++) {
+        if (__picoLogCrashSignals[i] == signalNumber) {
+            sigaction(signalNumber, &__picoLogPreviousCrashActions[i], NULL);
+        }
+    }
+    raise(signalNumber);
+}
+#endif
+
+static void __picoLogDispatchToConsoleLoggers(picoLogEntry entry, picoLogTarget target)
+{
+    if (__picoLogGlobalContext == NULL) {
+        return;
+    }
+
+    if (!(target & PICO_LOG_TARGET_CONSOLE)) {
+        return;
+    }
+
+    // color coding for different log levels
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    WORD color;
+
+    switch (entry->level) {
+        case PICO_LOG_LEVEL_DEBUG:
+            color = FOREGROUND_BLUE | FOREGROUND_GREEN | FOREGROUND_INTENSITY;
+            break;
+        case PICO_LOG_LEVEL_VERBOSE:
+            color = FOREGROUND_BLUE | FOREGROUND_INTENSITY;
+            break;
+        case PICO_LOG_LEVEL_INFO:
+            color = FOREGROUND_GREEN | FOREGROUND_INTENSITY;
+            break;
+        case PICO_LOG_LEVEL_WARN:
+            color = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY;
+            break;
+        case PICO_LOG_LEVEL_ERROR:
+            color = FOREGROUND_RED | FOREGROUND_INTENSITY;
+            break;
+        default:
+            color = FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE;
+            break;
+    }
+
+    if (entry->level & PICO_LOG_LEVEL_ERROR) {
+        SetConsoleTextAttribute(hConsole, color);
+        fprintf(stderr, "%s\n", entry->message);
+        SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+    } else {
+        SetConsoleTextAttribute(hConsole, color);
+        fprintf(stdout, "%s\n", entry->message);
+        SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+    }
+
+#elif defined(__unix__) || defined(__APPLE__)
+    const char *colorReset  = "\033[0m";
+    const char *colorRed    = "\033[31m";
+    const char *colorYellow = "\033[33m";
+    const char *colorGreen  = "\033[32m";
+    const char *colorCyan   = "\033[36m";
+    const char *colorBlue   = "\033[34m";
+
+    switch (entry->level) {
+        case PICO_LOG_LEVEL_DEBUG:
+            fprintf(stdout, "%s%s%s\n", colorCyan, entry->message, colorReset);
+            break;
+        case PICO_LOG_LEVEL_VERBOSE:
+            fprintf(stdout, "%s%s%s\n", colorBlue, entry->message, colorReset);
+            break;
+        case PICO_LOG_LEVEL_INFO:
+            fprintf(stdout, "%s%s%s\n", colorGreen, entry->message, colorReset);
+            break;
+        case PICO_LOG_LEVEL_WARN:
+            fprintf(stdout, "%s%s%s\n", colorYellow, entry->message, colorReset);
+            break;
+        case PICO_LOG_LEVEL_ERROR:
+            fprintf(stderr, "%s%s%s\n", colorRed, entry->message, colorReset);
+            break;
+        default:
+            fprintf(stdout, "%s\n", entry->message);
+            break;
+    }
+#else
+#warning "Unsupported platform for console colors"
+    if (entry->level & PICO_LOG_LEVEL_ERROR) {
+        fprintf(stderr, "%s", entry->message);
+    } else {
+        fprintf(stdout, "%s", entry->message);
+    }
+#endif
+}
+
+// Appends to a fixed buffer, output past the end is cut off and the buffer
+// always stays NUL terminated
+typedef struct {
+    char *data;
+    size_t capacity;
+    size_t length;
+} __picoLogWriter_t;
+
+static void __picoLogWriterInit(__picoLogWriter_t *writer, char *buffer, size_t capacity)
+{
+    writer->data     = buffer;
+    writer->capacity = capacity;
+    writer->length   = 0;
+    buffer[0]        = '\0';
+}
+
+static void __picoLogWriteBytes(__picoLogWriter_t *writer, const char *bytes, size_t count)
+{
+    size_t available = writer->capacity - 1 - writer->length;
+    if (count > available) {
+        count = available;
+    }
+    memcpy(writer->data + writer->length, bytes, count);
+    writer->length += count;
+    writer->data[writer->length] = '\0';
+}
+
+static void __picoLogWriteString(__picoLogWriter_t *writer, const char *str)
+{
+    __picoLogWriteBytes(writer, str, strlen(str));
+}
+
+static void __picoLogWriteChar(__picoLogWriter_t *writer, char c)
+{
+    __picoLogWriteBytes(writer, &c, 1);
+}
+
+static void __picoLogWriteUint(__picoLogWriter_t *writer, uint64_t value)
+{
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - 1 - count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    __picoLogWriteBytes(writer, digits + sizeof(digits) - count, count);
+}
+
+static void __picoLogWriteInt(__picoLogWriter_t *writer, int64_t value)
+{
+    if (value < 0) {
+        __picoLogWriteChar(writer, '-');
+        __picoLogWriteUint(writer, 0 - (uint64_t)value);
+    } else {
+        __picoLogWriteUint(writer, (uint64_t)value);
+    }
+}
+
+// Up to 6 fractional digits with trailing zeros trimmed, values too large for
+// that fall back to snprintf
+static void __picoLogWriteFloat(__picoLogWriter_t *writer, double value, bool json)
+{
+    if (value != value) {
+        __picoLogWriteString(writer, json ? "null" : "NaN");
+        return;
+    }
+
+    bool negative    = value < 0.0;
+    double magnitude = negative ? -value : value;
+    if (magnitude >= 1e15) {
+        char text[32];
+        if (magnitude > 1.7976931348623157e308) {
+            snprintf(text, sizeof(text), "%s", json ? "null" : (negative ? "-Inf" : "+Inf"));
+        } else {
+            snprintf(text, sizeof(text), "%.17g", value);
+        }
+        __picoLogWriteString(writer, text);
+        return;
+    }
+
+    uint64_t integer  = (uint64_t)magnitude;
+    uint64_t fraction = (uint64_t)((magnitude - (double)integer) * 1000000.0 + 0.5);
+    if (fraction >= 1000000) {
+        integer++;
+        fraction -= 1000000;
+    }
+
+    if (negative && (integer != 0 || fraction != 0)) {
+        __picoLogWriteChar(writer, '-');
+    }
+    __picoLogWriteUint(writer, integer);
+    if (fraction != 0) {
+        char digits[7] = {'.'};
+        size_t count   = 7;
+        for (size_t i = 6; i > 0; i--) {
+            digits[i] = (char)('0' + fraction % 10);
+            fraction /= 10;
+        }
+        while (digits[count - 1] == '0') {
+            count--;
+        }
+        __picoLogWriteBytes(writer, digits, count);
+    }
+}
+
+// Writes a quoted string with JSON escapes, logfmt values use the same rules
+static void __picoLogWriteQuoted(__picoLogWriter_t *writer, const char *str)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    __picoLogWriteChar(writer, '"');
+    const char *run = str;
+    for (; *str != '\0'; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        __picoLogWriteBytes(writer, run, (size_t)(str - run));
+        run = str + 1;
+        switch (c) {
+            case '"':
+                __picoLogWriteBytes(writer, "\\\"", 2);
+                break;
+            case '\\':
+                __picoLogWriteBytes(writer, "\\\\", 2);
+                break;
+            case '\n':
+                __picoLogWriteBytes(writer, "\\n", 2);
+                break;
+            case '\r':
+                __picoLogWriteBytes(writer, "\\r", 2);
+                break;
+            case '\t':
+                __picoLogWriteBytes(writer, "\\t", 2);
+                break;
+            default: {
+                char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0x0F]};
+                __picoLogWriteBytes(writer, escape, sizeof(escape));
+                break;
+            }
+        }
+    }
+    __picoLogWriteBytes(writer, run, (size_t)(str - run));
+    __picoLogWriteChar(writer, '"');
+}
+
+// logfmt only quotes values that would not survive as a bare word
+static void __picoLogWriteLogfmtValue(__picoLogWriter_t *writer, const char *str)
+{
+    const char *c = str;
+    while (*c != '\0' && (unsigned char)*c > 0x20 && *c != '=' && *c != '"' && *c != '\\') {
+        c++;
+    }
+
+    if (*c == '\0' && c != str) {
+        __picoLogWriteBytes(writer, str, (size_t)(c - str));
+    } else {
+        __picoLogWriteQuoted(writer, str);
+    }
+}
+
+static void __picoLogWriteDuration(__picoLogWriter_t *writer, uint64_t durationNs, bool json)
+{
+    if (json) {
+        __picoLogWriteUint(writer, durationNs);
+        return;
+    }
+
+    if (durationNs < 1000ULL) {
+        __picoLogWriteUint(writer, durationNs);
+        __picoLogWriteString(writer, "ns");
+    } else if (durationNs < 1000000ULL) {
+        __picoLogWriteFloat(writer, (double)durationNs / 1e3, false);
+        __picoLogWriteString(writer, "us");
+    } else if (durationNs < 1000000000ULL) {
+        __picoLogWriteFloat(writer, (double)durationNs / 1e6, false);
+        __picoLogWriteString(writer, "ms");
+    } else {
+        __picoLogWriteFloat(writer, (double)durationNs / 1e9, false);
+        __picoLogWriteChar(writer, 's');
+    }
+}
+
+static void __picoLogWriteFieldValue(__picoLogWriter_t *writer, const picoLogField_t *field, bool json)
+{
+    switch (field->type) {
+        case PICO_LOG_FIELD_TYPE_INT:
+            __picoLogWriteInt(writer, field->value.intValue);
+            break;
+        case PICO_LOG_FIELD_TYPE_UINT:
+            __picoLogWriteUint(writer, field->value.uintValue);
+            break;
+        case PICO_LOG_FIELD_TYPE_FLOAT:
+            __picoLogWriteFloat(writer, field->value.floatValue, json);
+            break;
+        case PICO_LOG_FIELD_TYPE_BOOL:
+            __picoLogWriteString(writer, field->value.boolValue ? "true" : "false");
+            break;
+        case PICO_LOG_FIELD_TYPE_STRING: {
+            const char *value = field->value.stringValue ? field->value.stringValue : "";
+            if (json) {
+                __picoLogWriteQuoted(writer, value);
+            } else {
+                __picoLogWriteLogfmtValue(writer, value);
+            }
+            break;
+        }
+        case PICO_LOG_FIELD_TYPE_DURATION:
+            __picoLogWriteDuration(writer, field->value.durationNs, json);
+            break;
+        default:
+            __picoLogWriteString(writer, json ? "null" : "\"\"");
+            break;
+    }
+}
+
+// " key=value" for every field
+static void __picoLogWriteLogfmtFields(__picoLogWriter_t *writer, const picoLogField_t *fields, uint32_t fieldCount)
+{
+    for (uint32_t i = 0; i < fieldCount; i++) {
+        __picoLogWriteChar(writer, ' ');
+        __picoLogWriteString(writer, fields[i].key ? fields[i].key : "NO_KEY");
+        __picoLogWriteChar(writer, '=');
+        __picoLogWriteFieldValue(writer, &fields[i], false);
+    }
+}
+
+// Writes a whole JSON or logfmt record, the fields follow the built in members
+static void __picoLogWriteRecord(__picoLogWriter_t *writer, picoLogEntry entry, picoLogFormat format, const picoLogField_t *fields, uint32_t fieldCount)
+{
+    const char *file     = entry->location ? entry->location->file : "NO_FILE";
+    const char *function = entry->location ? entry->location->function : "NO_FUNCTION";
+    uint32_t line        = entry->location ? entry->location->line : 0;
+    const char *tag      = entry->tag ? entry->tag : "NO_TAG";
+
+    if (format == PICO_LOG_FORMAT_LOGFMT) {
+        char time[24];
+        memcpy(time, __picoLogFormatTimestamp(entry->timestamp), sizeof(time));
+        time[10] = 'T';
+
+        __picoLogWriteString(writer, "time=");
+        __picoLogWriteString(writer, time);
+        __picoLogWriteString(writer, " level=");
+        __picoLogWriteString(writer, picoLogLevelToString(entry->level));
+        __picoLogWriteString(writer, " tag=");
+        __picoLogWriteLogfmtValue(writer, tag);
+        __picoLogWriteString(writer, " file=");
+        __picoLogWriteLogfmtValue(writer, file);
+        __picoLogWriteString(writer, " line=");
+        __picoLogWriteUint(writer, line);
+        __picoLogWriteString(writer, " function=");
+        __picoLogWriteLogfmtValue(writer, function);
+        __picoLogWriteString(writer, " msg=");
+        __picoLogWriteQuoted(writer, entry->message);
+        __picoLogWriteLogfmtFields(writer, fields, fieldCount);
+        return;
+    }
+
+    __picoLogWriteString(writer, "{\"time\": \"");
+    __picoLogWriteString(writer, __picoLogFormatTimestamp(entry->timestamp));
+    __picoLogWriteString(writer, "\", \"file\": ");
+    __picoLogWriteQuoted(writer, file);
+    __picoLogWriteString(writer, ", \"line\": ");
+    __picoLogWriteUint(writer, line);
+    __picoLogWriteString(writer, ", \"function\": ");
+    __picoLogWriteQuoted(writer, function);
+    __picoLogWriteString(writer, ", \"level\": \"");
+    __picoLogWriteString(writer, picoLogLevelToString(entry->level));
+    __picoLogWriteString(writer, "\", \"tag\": ");
+    __picoLogWriteQuoted(writer, tag);
+    __picoLogWriteString(writer, ", \"message\": ");
+    __picoLogWriteQuoted(writer, entry->message);
+    for (uint32_t i = 0; i < fieldCount; i++) {
+        __picoLogWriteString(writer, ", ");
+        __picoLogWriteQuoted(writer, fields[i].key ? fields[i].key : "NO_KEY");
+        __picoLogWriteString(writer, ": ");
+        __picoLogWriteFieldValue(writer, &fields[i], true);
+    }
+    __picoLogWriteChar(writer, '}');
+}
+
+static const char *__picoLogFormatMessage(picoLogEntry entry, picoLogFormat format, char *formattedMessage, size_t formattedMessageSize)
+{
+    switch (format) {
+        case PICO_LOG_FORMAT_DEFAULT:
+            snprintf(formattedMessage, formattedMessageSize, "[%s] [%s] [%s:%u]: %s",
+                     __picoLogFormatTimestamp(entry->timestamp),
+                     picoLogLevelToString(entry->level),
+                     entry->tag ? entry->tag : "NO_TAG",
+                     entry->location ? entry->location->line : 0,
+                     entry->message);
+            break;
+        case PICO_LOG_FORMAT_SHORT:
+            snprintf(formattedMessage, formattedMessageSize, "[%s] [%s:%u]: %s",
+                     picoLogLevelToString(entry->level),
+                     entry->tag ? entry->tag : "NO_TAG",
+                     entry->location ? entry->location->line : 0,
+                     entry->message);
+            break;
+        case PICO_LOG_FORMAT_MESSAGE_ONLY:
+            snprintf(formattedMessage, formattedMessageSize, "%s", entry->message);
+            break;
+        case PICO_LOG_FORMAT_VERBOSE:
+            snprintf(formattedMessage, formattedMessageSize, "[%s] [%s:%u] [%s] [%s] [%s]: %s",
+                     __picoLogFormatTimestamp(entry->timestamp),
+                     entry->location ? entry->location->file : "NO_FILE",
+                     entry->location ? entry->location->line : 0,
+                     entry->location ? entry->location->function : "NO_FUNCTION",
+                     picoLogLevelToString(entry->level),
+                     entry->tag ? entry->tag : "NO_TAG",
+                     entry->message);
+            break;
+        case PICO_LOG_FORMAT_JSON:
+        case PICO_LOG_FORMAT_LOGFMT: {
+            __picoLogWriter_t writer;
+            __picoLogWriterInit(&writer, formattedMessage, formattedMessageSize);
+            __picoLogWriteRecord(&writer, entry, format, NULL, 0);
+            break;
+        }
+        default:
+            snprintf(formattedMessage, formattedMessageSize, "%s", entry->message);
+            break;
+    }
+
+    return formattedMessage;
+}
+
+static uint64_t __picoLogGetWallClockMicroseconds(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    uint64_t ticks = ((uint64_t)ft.dwHighDateTime << 32) | ft.dwLowDateTime;
+    return ticks / 10 - 11644473600000000ULL; // 100ns since 1601 to us since 1970
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+#endif
+}
+
+// Parses the conversion spec following a '%', returns a pointer past it
+static const char *__picoLogParseFormatSpec(const char *cursor, __picoLogFormatSpec_t *spec)
+{
+    memset(spec, 0, sizeof(__picoLogFormatSpec_t));
+
+    while (*cursor && strchr("-+ #0'", *cursor)) {
+        cursor++;
+    }
+    if (*cursor == '*') {
+        spec->widthStar = true;
+        cursor++;
+    }
+    while (*cursor >= '0' && *cursor <= '9') {
+        cursor++;
+    }
+    if (*cursor == '.') {
+        cursor++;
+        if (*cursor == '*') {
+            spec->precisionStar = true;
+            cursor++;
+        }
+        while (*cursor >= '0' && *cursor <= '9') {
+            cursor++;
+        }
+    }
+
+    switch (*cursor) {
+        case 'h':
+            spec->modifier = cursor[1] == 'h' ? __PICO_LOG_MODIFIER_HH : __PICO_LOG_MODIFIER_H;
+            cursor += cursor[1] == 'h' ? 2 : 1;
+            break;
+        case 'l':
+            spec->modifier = cursor[1] == 'l' ? __PICO_LOG_MODIFIER_LL : __PICO_LOG_MODIFIER_L;
+            cursor += cursor[1] == 'l' ? 2 : 1;
+            break;
+        case 'j':
+            spec->modifier = __PICO_LOG_MODIFIER_J;
+            cursor++;
+            break;
+        case 'z':
+            spec->modifier = __PICO_LOG_MODIFIER_Z;
+            cursor++;
+            break;
+        case 't':
+            spec->modifier = __PICO_LOG_MODIFIER_T;
+            cursor++;
+            break;
+        case 'L':
+            spec->modifier = __PICO_LOG_MODIFIER_BIG_L;
+            cursor++;
+            break;
+        default:
+            break;
+    }
+
+    spec->conversion = *cursor;
+    if (*cursor) {
+        cursor++;
+    }
+
+    switch (spec->conversion) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            switch (spec->modifier) {
+                case __PICO_LOG_MODIFIER_L:
+                    spec->argType = __PICO_LOG_ARG_LONG;
+                    break;
+                case __PICO_LOG_MODIFIER_LL:
+                    spec->argType = __PICO_LOG_ARG_LLONG;
+                    break;
+                case __PICO_LOG_MODIFIER_J:
+                    spec->argType = __PICO_LOG_ARG_INTMAX;
+                    break;
+                case __PICO_LOG_MODIFIER_Z:
+                    spec->argType = __PICO_LOG_ARG_SIZE;
+                    break;
+                case __PICO_LOG_MODIFIER_T:
+                    spec->argType = __PICO_LOG_ARG_PTRDIFF;
+                    break;
+                default:
+                    spec->argType = __PICO_LOG_ARG_INT;
+                    break;
+            }
+            break;
+        case 'c':
+            spec->argType = __PICO_LOG_ARG_INT;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec->argType = spec->modifier == __PICO_LOG_MODIFIER_BIG_L ? __PICO_LOG_ARG_LONG_DOUBLE : __PICO_LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            spec->argType = spec->modifier == __PICO_LOG_MODIFIER_L ? __PICO_LOG_ARG_WIDE_STRING : __PICO_LOG_ARG_STRING;
+            break;
+        case 'p':
+        case 'n':
+            spec->argType = __PICO_LOG_ARG_POINTER;
+            break;
+        case '%':
+            spec->argType = __PICO_LOG_ARG_NONE;
+            break;
+        default:
+            spec->argType = __PICO_LOG_ARG_INVALID;
+            break;
+    }
+
+    return cursor;
+}
+
+// Builds the argument signature of a format string, false if the format cannot
+// be encoded and the call site has to fall back to preformatted text
+static bool __picoLogBinaryBuildSignature(const char *format, uint8_t *argTypes, uint32_t *argCount)
+{
+    *argCount = 0;
+    for (const char *cursor = format; *cursor;) {
+        if (*cursor++ != '%') {
+            continue;
+        }
+
+        __picoLogFormatSpec_t spec;
+        cursor = __picoLogParseFormatSpec(cursor, &spec);
+        if (spec.argType == __PICO_LOG_ARG_INVALID) {
+            return false;
+        }
+        if (spec.argType == __PICO_LOG_ARG_NONE) {
+            continue;
+        }
+
+        uint32_t needed = 1 + (spec.widthStar ? 1 : 0) + (spec.precisionStar ? 1 : 0);
+        if (*argCount + needed > PICO_LOG_BINARY_MAX_ARGS) {
+            return false;
+        }
+        if (spec.widthStar) {
+            argTypes[(*argCount)++] = __PICO_LOG_ARG_INT;
+        }
+        if (spec.precisionStar) {
+            argTypes[(*argCount)++] = __PICO_LOG_ARG_INT;
+        }
+        argTypes[(*argCount)++] = (uint8_t)spec.argType;
+    }
+    return true;
+}
+
+static uint8_t *__picoLogBinaryWriteU32(uint8_t *out, uint32_t value)
+{
+    memcpy(out, &value, sizeof(value));
+    return out + sizeof(value);
+}
+
+static uint8_t *__picoLogBinaryWriteU64(uint8_t *out, uint64_t value)
+{
+    memcpy(out, &value, sizeof(value));
+    return out + sizeof(value);
+}
+
+static void __picoLogBinaryWriteString(FILE *file, const char *str)
+{
+    uint32_t length = str ? (uint32_t)strlen(str) : 0;
+    fwrite(&length, sizeof(length), 1, file);
+    if (length > 0) {
+        fwrite(str, 1, length, file);
+    }
+}
+
+static void __picoLogBinaryWriteSite(FILE *file, const __picoLogBinarySite_t *site)
+{
+    uint8_t header[12];
+    header[0] = PICO_LOG_BINARY_RECORD_SITE;
+    header[1] = site->preformatted ? 1 : 0;
+    header[2] = 0;
+    header[3] = 0;
+    __picoLogBinaryWriteU32(__picoLogBinaryWriteU32(header + 4, site->id), site->line);
+    fwrite(header, 1, sizeof(header), file);
+    __picoLogBinaryWriteString(file, site->format);
+    __picoLogBinaryWriteString(file, site->tag);
+    __picoLogBinaryWriteString(file, site->file);
+    __picoLogBinaryWriteString(file, site->function);
+}
+
+static bool __picoLogBinaryOpenLogger(uint32_t index, const char *filePath)
+{
+    FILE *file = fopen(filePath, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "picoLog: failed to open binary log file: %s\n", filePath);
+        return false;
+    }
+
+    char *buffer = (char *)PICO_MALLOC(PICO_LOG_FILE_BUFFER_SIZE);
+    if (buffer != NULL) {
+        setvbuf(file, buffer, _IOFBF, PICO_LOG_FILE_BUFFER_SIZE);
+    }
+
+    uint32_t header[3] = {PICO_LOG_BINARY_MAGIC, PICO_LOG_BINARY_VERSION, PICO_LOG_BINARY_BYTE_ORDER};
+    fwrite(header, sizeof(header), 1, file);
+
+    // the file has to be self describing, replay every site seen so far
+    __picoLogBinarySites_t *sites = __picoLogGlobalContext->binarySites;
+    for (uint32_t i = 0; sites != NULL && i < sites->count; i++) {
+        __picoLogBinaryWriteSite(file, sites->ordered[i]);
+    }
+
+    __picoLogGlobalContext->binaryLoggerStack[index].handle = file;
+    __picoLogGlobalContext->binaryLoggerStack[index].buffer = buffer;
+    __picoLogGlobalContext->binaryLoggerStack[index].lastFlushMs = __picoLogGetMonotonicMs();
+    return true;
+}
+
+static void __picoLogBinaryCloseLogger(uint32_t index)
+{
+    if (__picoLogGlobalContext->binaryLoggerStack[index].handle != NULL) {
+        fclose(__picoLogGlobalContext->binaryLoggerStack[index].handle);
+        __picoLogGlobalContext->binaryLoggerStack[index].handle = NULL;
+    }
+    if (__picoLogGlobalContext->binaryLoggerStack[index].buffer != NULL) {
+        PICO_FREE(__picoLogGlobalContext->binaryLoggerStack[index].buffer);
+        __picoLogGlobalContext->binaryLoggerStack[index].buffer = NULL;
+    }
+}
+
+static __picoLogBinarySite_t *__picoLogBinaryGetSite(picoLogEntry entry, const char *format)
+{
+    __picoLogBinarySites_t *sites = __picoLogGlobalContext->binarySites;
+    if (sites == NULL) {
+        sites = (__picoLogBinarySites_t *)PICO_MALLOC(sizeof(__picoLogBinarySites_t));
+        if (sites == NULL) {
+            return NULL;
+        }
+        memset(sites, 0, sizeof(__picoLogBinarySites_t));
+        __picoLogGlobalContext->binarySites = sites;
+    }
+
+    // call sites are keyed by the addresses of their string literals
+    uintptr_t hash = (uintptr_t)format ^ ((uintptr_t)entry->location->file * 31) ^ ((uintptr_t)entry->tag * 17) ^ (uintptr_t)entry->location->line;
+    hash ^= hash >> 17;
+    hash *= 0x9E3779B1u;
+
+    uint32_t slot = (uint32_t)(hash ^ (hash >> 16)) & (PICO_LOG_BINARY_MAX_SITES * 2 - 1);
+    for (;;) {
+        __picoLogBinarySite_t *site = &sites->table[slot];
+        if (site->format == NULL) {
+            break;
+        }
+        if (site->format == format && site->file == entry->location->file && site->tag == entry->tag && site->line == entry->location->line) {
+            return site;
+        }
+        slot = (slot + 1) & (PICO_LOG_BINARY_MAX_SITES * 2 - 1);
+    }
+
+    if (sites->count >= PICO_LOG_BINARY_MAX_SITES) {
+        return NULL;
+    }
+
+    __picoLogBinarySite_t *site = &sites->table[slot];
+    site->id                    = sites->count;
+    site->format                = format;
+    site->tag                   = entry->tag;
+    site->file                  = entry->location->file;
+    site->function              = entry->location->function;
+    site->line                  = entry->location->line;
+    site->preformatted          = !__picoLogBinaryBuildSignature(format, site->argTypes, &site->argCount);
+    sites->ordered[sites->count++] = site;
+
+    for (uint32_t i = 0; i < __picoLogGlobalContext->binaryLoggerStackTop; i++) {
+        if (__picoLogGlobalContext->binaryLoggerStack[i].handle != NULL) {
+            __picoLogBinaryWriteSite(__picoLogGlobalContext->binaryLoggerStack[i].handle, site);
+        }
+    }
+    return site;
+}
+
+static uint8_t *__picoLogBinaryEncodeString(uint8_t *out, const uint8_t *end, const char *str)
+{
+    // the caller reserves room for the length of every remaining argument
+    if (end - out < (ptrdiff_t)sizeof(uint32_t)) {
+        return out;
+    }
+    size_t length    = str ? strlen(str) : 0;
+    size_t available = (size_t)(end - out) - sizeof(uint32_t);
+    if (length > available) {
+        length = available;
+    }
+    out = __picoLogBinaryWriteU32(out, (uint32_t)length);
+    if (length > 0) {
+        memcpy(out, str, length);
+    }
+    return out + length;
+}
+
+// Encodes the arguments of one message, the formatted text when the format has
+// no signature. end must leave room for PICO_LOG_BINARY_MAX_ARGS raw arguments.
+static uint8_t *__picoLogBinaryEncodePayload(uint8_t *out, const uint8_t *end, const char *format, const uint8_t *argTypes, uint32_t argCount, bool preformatted, va_list args)
+{
+    if (preformatted) {
+        char message[PICO_LOG_MAX_MESSAGE_LENGTH];
+        vsnprintf(message, sizeof(message), format, args);
+        out = __picoLogBinaryEncodeString(out, end, message);
+    } else {
+        // raw argument bytes only, the decoder redoes the formatting
+        for (uint32_t i = 0; i < argCount; i++) {
+            switch (argTypes[i]) {
+                case __PICO_LOG_ARG_INT:
+                    out = __picoLogBinaryWriteU64(out, (uint64_t)(int64_t)va_arg(args, int));
+                    break;
+                case __PICO_LOG_ARG_LONG:
+                    out = __picoLogBinaryWriteU64(out, (uint64_t)(int64_t)va_arg(args, long));
+                    break;
+                case __PICO_LOG_ARG_LLONG:
+                    out = __picoLogBinaryWriteU64(out, (uint64_t)va_arg(args, long long));
+                    break;
+                case __PICO_LOG_ARG_INTMAX:
+                    out = __picoLogBinaryWriteU64(out, (uint64_t)va_arg(args, intmax_t));
+                    break;
+                case __PICO_LOG_ARG_SIZE:
+                    out = __picoLogBinaryWriteU64(out, (uint64_t)va_arg(args, size_t));
+                    break;
+                case __PICO_LOG_ARG_PTRDIFF:
+                    out = __picoLogBinaryWriteU64(out, (uint64_t)(int64_t)va_arg(args, ptrdiff_t));
+                    break;
+                case __PICO_LOG_ARG_DOUBLE:
+                case __PICO_LOG_ARG_LONG_DOUBLE: {
+                    double value = argTypes[i] == __PICO_LOG_ARG_DOUBLE ? va_arg(args, double) : (double)va_arg(args, long double);
+                    memcpy(out, &value, sizeof(value));
+                    out += sizeof(value);
+                    break;
+                }
+                case __PICO_LOG_ARG_STRING:
+                    out = __picoLogBinaryEncodeString(out, end - (argCount - i - 1) * sizeof(uint64_t), va_arg(args, const char *));
+                    break;
+                case __PICO_LOG_ARG_WIDE_STRING:
+                    (void)va_arg(args, void *);
+                    out = __picoLogBinaryEncodeString(out, end, "");
+                    break;
+                case __PICO_LOG_ARG_POINTER:
+                    out = __picoLogBinaryWriteU64(out, (uint64_t)(uintptr_t)va_arg(args, void *));
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    return out;
+}
+
+// type, level, two reserved bytes, site id, microseconds and the payload size
+#define PICO_LOG_BINARY_MESSAGE_HEADER_SIZE 20
+
+static void __picoLogBinaryWriteMessage(picoLogLevel level, uint32_t siteId, uint64_t microseconds, const uint8_t *payload, uint32_t payloadSize)
+{
+    uint8_t header[PICO_LOG_BINARY_MESSAGE_HEADER_SIZE];
+    uint8_t *out = header;
+    *out++       = PICO_LOG_BINARY_RECORD_MESSAGE;
+    *out++       = (uint8_t)level;
+    *out++       = 0;
+    *out++       = 0;
+    out          = __picoLogBinaryWriteU32(out, siteId);
+    out          = __picoLogBinaryWriteU64(out, microseconds);
+    __picoLogBinaryWriteU32(out, payloadSize);
+
+    bool flushNow = (level & (PICO_LOG_FILE_FLUSH_LEVELS)) != 0;
+    uint64_t now  = __picoLogGetMonotonicMs();
+    for (uint32_t i = 0; i < __picoLogGlobalContext->binaryLoggerStackTop; i++) {
+        FILE *file = __picoLogGlobalContext->binaryLoggerStack[i].handle;
+        if (file == NULL) {
+            continue;
+        }
+        fwrite(header, 1, sizeof(header), file);
+        fwrite(payload, 1, payloadSize, file);
+        if (flushNow || now - __picoLogGlobalContext->binaryLoggerStack[i].lastFlushMs >= PICO_LOG_FILE_FLUSH_INTERVAL_MS) {
+            fflush(file);
+            __picoLogGlobalContext->binaryLoggerStack[i].lastFlushMs = now;
+        }
+    }
+}
+
+static void __picoLogDispatchToBinaryLoggers(picoLogEntry entry, const char *format, va_list args)
+{
+    static uint8_t payload[PICO_LOG_BINARY_MAX_RECORD_SIZE - PICO_LOG_BINARY_MESSAGE_HEADER_SIZE];
+
+    if (__picoLogGlobalContext->binaryLoggerStackTop == 0) {
+        return;
+    }
+
+    __picoLogBinarySite_t *site = __picoLogBinaryGetSite(entry, format);
+    uint8_t *end                = __picoLogBinaryEncodePayload(payload, payload + sizeof(payload), format,
+                                                               site ? site->argTypes : NULL, site ? site->argCount : 0,
+                                                               site == NULL || site->preformatted, args);
+    __picoLogBinaryWriteMessage(entry->level, site ? site->id : PICO_LOG_BINARY_UNKNOWN_SITE,
+                                __picoLogGetWallClockMicroseconds(), payload, (uint32_t)(end - payload));
+}
+
+static bool __picoLogBinaryReadString(FILE *file, char **out)
+{
+    uint32_t length = 0;
+    if (fread(&length, sizeof(length), 1, file) != 1 || length > PICO_LOG_BINARY_MAX_RECORD_SIZE) {
+        return false;
+    }
+    *out = (char *)PICO_MALLOC(length + 1);
+    if (*out == NULL) {
+        return false;
+    }
+    if (length > 0 && fread(*out, 1, length, file) != length) {
+        PICO_FREE(*out);
+        *out = NULL;
+        return false;
+    }
+    (*out)[length] = '\0';
+    return true;
+}
+
+static size_t __picoLogBinaryRenderMessage(const __picoLogBinarySite_t *site, const uint8_t *payload, size_t payloadSize, char *out, size_t outSize)
+{
+    const uint8_t *in    = payload;
+    const uint8_t *inEnd = payload + payloadSize;
+    size_t written       = 0;
+
+#define __PICO_LOG_BINARY_READ(type, dst)                      \
+    do {                                                       \
+        memset(&(dst), 0, sizeof(dst));                        \
+        if ((size_t)(inEnd - in) >= sizeof(type)) {            \
+            memcpy(&(dst), in, sizeof(type));                  \
+            in += sizeof(type);                                \
+        }                                                      \
+    } while (0)
+
+    if (site == NULL || site->preformatted) {
+        uint32_t length = 0;
+        __PICO_LOG_BINARY_READ(uint32_t, length);
+        if (length > (size_t)(inEnd - in)) {
+            length = (uint32_t)(inEnd - in);
+        }
+        written = length < outSize - 1 ? length : outSize - 1;
+        memcpy(out, in, written);
+        out[written] = '\0';
+        return written;
+    }
+
+    for (const char *cursor = site->format; *cursor && written < outSize - 1;) {
+        if (*cursor != '%') {
+            out[written++] = *cursor++;
+            continue;
+        }
+
+        const char *specStart = cursor;
+        __picoLogFormatSpec_t spec;
+        cursor = __picoLogParseFormatSpec(cursor + 1, &spec);
+        if (spec.argType == __PICO_LOG_ARG_NONE) {
+            out[written++] = '%';
+            continue;
+        }
+
+        int32_t width = 0, precision = 0;
+        uint64_t raw  = 0;
+        if (spec.widthStar) {
+            __PICO_LOG_BINARY_READ(uint64_t, raw);
+            width = (int32_t)(int64_t)raw;
+        }
+        if (spec.precisionStar) {
+            __PICO_LOG_BINARY_READ(uint64_t, raw);
+            precision = (int32_t)(int64_t)raw;
+        }
+
+        // rebuild the spec with the star values filled in and without modifiers
+        // that no longer match the decoded value type
+        char specText[64];
+        size_t specLength   = 0;
+        size_t rawLength    = (size_t)(cursor - specStart);
+        size_t modifierSize = spec.modifier == __PICO_LOG_MODIFIER_NONE ? 0 : (spec.modifier == __PICO_LOG_MODIFIER_HH || spec.modifier == __PICO_LOG_MODIFIER_LL ? 2 : 1);
+        bool dropModifier   = spec.argType == __PICO_LOG_ARG_LONG_DOUBLE || spec.argType == __PICO_LOG_ARG_WIDE_STRING || spec.conversion == 'c';
+        size_t i            = 0;
+        for (; i < rawLength && specLength < sizeof(specText) - 16; i++) {
+            char c = specStart[i];
+            if (dropModifier && i >= rawLength - 1 - modifierSize && i < rawLength - 1) {
+                continue;
+            }
+            if (c == '*' && i > 0 && specStart[i - 1] == '.') {
+                if (precision < 0) {
+                    specLength--; // a negative precision is taken as if it was omitted
+                } else {
+                    specLength += (size_t)snprintf(specText + specLength, sizeof(specText) - specLength, "%d", precision);
+                }
+            } else if (c == '*') {
+                specLength += (size_t)snprintf(specText + specLength, sizeof(specText) - specLength, "%d", width);
+            } else {
+                specText[specLength++] = c;
+            }
+        }
+        // a spec too long for the buffer keeps only its length modifier and
+        // conversion, the value still prints and consumes the right bytes
+        if (i < rawLength) {
+            size_t tail = dropModifier ? 1 : modifierSize + 1;
+            specText[0] = '%';
+            memcpy(specText + 1, specStart + rawLength - tail, tail);
+            specLength = tail + 1;
+        }
+        specText[specLength] = '\0';
+
+        bool isSigned    = spec.conversion == 'd' || spec.conversion == 'i';
+        char *target     = out + written;
+        size_t remaining = outSize - written;
+        int result       = 0;
+
+        if (spec.argType == __PICO_LOG_ARG_STRING || spec.argType == __PICO_LOG_ARG_WIDE_STRING) {
+            char str[PICO_LOG_BINARY_MAX_RECORD_SIZE];
+            uint32_t length = 0;
+            __PICO_LOG_BINARY_READ(uint32_t, length);
+            if (length > (size_t)(inEnd - in)) {
+                length = (uint32_t)(inEnd - in);
+            }
+            memcpy(str, in, length);
+            str[length] = '\0';
+            in += length;
+            result = snprintf(target, remaining, specText, str);
+        } else if (spec.argType == __PICO_LOG_ARG_DOUBLE || spec.argType == __PICO_LOG_ARG_LONG_DOUBLE) {
+            double value = 0.0;
+            __PICO_LOG_BINARY_READ(double, value);
+            result = snprintf(target, remaining, specText, value);
+        } else {
+            __PICO_LOG_BINARY_READ(uint64_t, raw);
+            switch (spec.argType) {
+                case __PICO_LOG_ARG_INT:
+                    result = isSigned ? snprintf(target, remaining, specText, (int)raw) : snprintf(target, remaining, specText, (unsigned int)raw);
+                    break;
+                case __PICO_LOG_ARG_LONG:
+                    result = isSigned ? snprintf(target, remaining, specText, (long)raw) : snprintf(target, remaining, specText, (unsigned long)raw);
+                    break;
+                case __PICO_LOG_ARG_LLONG:
+                    result = isSigned ? snprintf(target, remaining, specText, (long long)raw) : snprintf(target, remaining, specText, (unsigned long long)raw);
+                    break;
+                case __PICO_LOG_ARG_INTMAX:
+                    result = isSigned ? snprintf(target, remaining, specText, (intmax_t)raw) : snprintf(target, remaining, specText, (uintmax_t)raw);
+                    break;
+                case __PICO_LOG_ARG_SIZE:
+                    result = snprintf(target, remaining, specText, (size_t)raw);
+                    break;
+                case __PICO_LOG_ARG_PTRDIFF:
+                    result = snprintf(target, remaining, specText, (ptrdiff_t)raw);
+                    break;
+                case __PICO_LOG_ARG_POINTER:
+                    // %n has nothing to print
+                    result = spec.conversion == 'p' ? snprintf(target, remaining, specText, (void *)(uintptr_t)raw) : 0;
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        if (result > 0) {
+            written += (size_t)result < remaining ? (size_t)result : remaining - 1;
+        }
+    }
+#undef __PICO_LOG_BINARY_READ
+
+    out[written] = '\0';
+    return written;
+}
+
+bool picoLogDecodeBinary(const char *filePath, picoLogFormat format, picoLogCustomLogger callback, void *userData)
+{
+    FILE *file = fopen(filePath, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    uint32_t header[3] = {0};
+    if (fread(header, sizeof(header), 1, file) != 1 || header[0] != PICO_LOG_BINARY_MAGIC ||
+        header[1] != PICO_LOG_BINARY_VERSION || header[2] != PICO_LOG_BINARY_BYTE_ORDER) {
+        fclose(file);
+        return false;
+    }
+
+    __picoLogBinarySite_t *sites = NULL;
+    uint32_t siteCapacity        = 0;
+    bool success                 = true;
+
+    static uint8_t payload[PICO_LOG_BINARY_MAX_RECORD_SIZE];
+    static char message[PICO_LOG_MAX_MESSAGE_LENGTH];
+    static char formattedMessage[PICO_LOG_MAX_MESSAGE_LENGTH * 2];
+
+    uint8_t recordHeader[4];
+    while (fread(recordHeader, sizeof(recordHeader), 1, file) == 1) {
+        if (recordHeader[0] == PICO_LOG_BINARY_RECORD_SITE) {
+            uint32_t fields[2];
+            if (fread(fields, sizeof(fields), 1, file) != 1) {
+                success = false;
+                break;
+            }
+
+            // the writer never hands out more ids than that, anything above is a corrupt file
+            uint32_t id = fields[0];
+            if (id >= PICO_LOG_BINARY_MAX_SITES) {
+                success = false;
+                break;
+            }
+            if (id >= siteCapacity) {
+                uint32_t newCapacity            = siteCapacity ? siteCapacity * 2 : 64;
+                newCapacity                     = newCapacity > id ? newCapacity : id + 1;
+                __picoLogBinarySite_t *newSites = (__picoLogBinarySite_t *)PICO_MALLOC(sizeof(__picoLogBinarySite_t) * newCapacity);
+                if (newSites == NULL) {
+                    success = false;
+                    break;
+                }
+                memset(newSites, 0, sizeof(__picoLogBinarySite_t) * newCapacity);
+                if (sites != NULL) {
+                    memcpy(newSites, sites, sizeof(__picoLogBinarySite_t) * siteCapacity);
+                    PICO_FREE(sites);
+                }
+                sites        = newSites;
+                siteCapacity = newCapacity;
+            }
+
+            __picoLogBinarySite_t *site = &sites[id];
+            char *strings[4]            = {NULL, NULL, NULL, NULL};
+            for (uint32_t i = 0; i < 4 && success; i++) {
+                success = __picoLogBinaryReadString(file, &strings[i]);
+            }
+            if (!success) {
+                for (uint32_t i = 0; i < 4; i++) {
+                    PICO_FREE(strings[i]);
+                }
+                break;
+            }
+            // a repeated id replaces the earlier definition
+            PICO_FREE((void *)site->format);
+            PICO_FREE((void *)site->tag);
+            PICO_FREE((void *)site->file);
+            PICO_FREE((void *)site->function);
+            site->id           = id;
+            site->preformatted = recordHeader[1] != 0;
+            site->line         = fields[1];
+            site->format       = strings[0];
+            site->tag          = strings[1];
+            site->file         = strings[2];
+            site->function     = strings[3];
+        } else if (recordHeader[0] == PICO_LOG_BINARY_RECORD_MESSAGE) {
+            uint8_t fields[16];
+            if (fread(fields, sizeof(fields), 1, file) != 1) {
+                success = false;
+                break;
+            }
+
+            // exactly one level bit, as the writer stores it
+            picoLogLevel level = (picoLogLevel)recordHeader[1];
+            if (level == 0 || (level & (level - 1)) != 0 || (level & ~PICO_LOG_LEVEL_ALL) != 0) {
+                success = false;
+                break;
+            }
+
+            uint32_t siteId, payloadSize;
+            uint64_t microseconds;
+            memcpy(&siteId, fields, sizeof(siteId));
+            memcpy(&microseconds, fields + 4, sizeof(microseconds));
+            memcpy(&payloadSize, fields + 12, sizeof(payloadSize));
+            if (payloadSize > sizeof(payload) || fread(payload, 1, payloadSize, file) != payloadSize) {
+                success = false;
+                break;
+            }
+
+            const __picoLogBinarySite_t *site = siteId < siteCapacity && sites[siteId].format != NULL ? &sites[siteId] : NULL;
+            __picoLogBinaryRenderMessage(site, payload, payloadSize, message, sizeof(message));
+
+            time_t seconds               = (time_t)(microseconds / 1000000);
+            struct tm *tm                = localtime(&seconds);
+            picoLogTimeStamp_t timestamp = {0};
+            if (tm != NULL) {
+                timestamp.year   = tm->tm_year + 1900;
+                timestamp.month  = tm->tm_mon + 1;
+                timestamp.day    = tm->tm_mday;
+                timestamp.hour   = tm->tm_hour;
+                timestamp.minute = tm->tm_min;
+                timestamp.second = tm->tm_sec;
+            }
+            timestamp.millisecond = (uint32_t)(microseconds / 1000 % 1000);
+
+            picoLogCodeLocation_t location = {site ? site->file : NULL, site ? site->function : NULL, site ? site->line : 0};
+            picoLogEntry_t entry           = {0};
+            entry.level                    = level;
+            entry.tag                      = site ? site->tag : NULL;
+            entry.message                  = message;
+            entry.location                 = &location;
+            entry.timestamp                = &timestamp;
+            __picoLogFormatMessage(&entry, format, formattedMessage, sizeof(formattedMessage));
+
+            callback(entry.level, entry.tag, formattedMessage, entry.location, entry.timestamp, userData);
+        } else {
+            success = false;
+            break;
+        }
+    }
+
+    for (uint32_t i = 0; i < siteCapacity; i++) {
+        PICO_FREE((void *)sites[i].format);
+        PICO_FREE((void *)sites[i].tag);
+        PICO_FREE((void *)sites[i].file);
+        PICO_FREE((void *)sites[i].function);
+    }
+    PICO_FREE(sites);
+    fclose(file);
+    return success;
+}
+
+// Drops the targets that do not take this level
+static picoLogTarget __picoLogFilterTargets(picoLogTarget target, picoLogLevel level, const picoLogLevel *targetLevels)
+{
+    for (uint32_t i = 0; i < PICO_LOG_TARGET_COUNT; i++) {
+        if (!(level & targetLevels[i])) {
+            target = (picoLogTarget)(target & ~(1u << i));
+        }
+    }
+    return target;
+}
+
+#ifdef PICO_LOG_ASYNC
+static const char *__picoLogAsyncCopyString(__picoLogAsyncRecord_t *record, size_t *used, const char *text)
+{
+    if (text == NULL) {
+        return NULL;
+    }
+    size_t available = sizeof(record->location) - *used;
+    if (available == 0) {
+        return "";
+    }
+    size_t length = strlen(text);
+    length        = length < available - 1 ? length : available - 1;
+    char *copy    = record->location + *used;
+    memcpy(copy, text, length);
+    copy[length] = '\0';
+    *used += length + 1;
+    return copy;
+}
+
+// The writer's own queue, set on the writer thread only. Loggers it calls already run
+// under the lock, whatever they log goes through the queue and never waits on the writer.
+static PICO_LOG_THREAD_LOCAL __picoLogAsyncState_t *__picoLogAsyncWriterQueue;
+
+// Claims the next slot and fills in everything but the message, returns NULL
+// when the message has to be dropped. The slot goes to the writer once published.
+static __picoLogAsyncRecord_t *__picoLogAsyncClaim(__picoLogAsyncState_t *async, picoLogEntry entry, picoLogFormat format, picoLogTarget target)
+{
+    __picoLogAsyncRecord_t *record = NULL;
+    uint64_t position              = PICO_LOG_ATOMIC_LOAD(&async->enqueuePosition);
+    for (;;) {
+        record       = &async->records[position & (PICO_LOG_ASYNC_QUEUE_SIZE - 1)];
+        int64_t diff = (int64_t)PICO_LOG_ATOMIC_LOAD(&record->sequence) - (int64_t)position;
+        if (diff == 0) {
+            if (PICO_LOG_ATOMIC_CAS(&async->enqueuePosition, position, position + 1)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // the queue is full, only the writer can make room
+            if (async->overflowPolicy != PICO_LOG_ASYNC_OVERFLOW_BLOCK || __picoLogAsyncWriterQueue != NULL) {
+                PICO_LOG_ATOMIC_ADD(&__picoLogGlobalContext->asyncDroppedCount, 1);
+                return NULL;
+            }
+            PICO_LOG_SLEEP_MS(0);
+        }
+        position = PICO_LOG_ATOMIC_LOAD(&async->enqueuePosition);
+    }
+
+    record->level     = entry->level;
+    record->format    = format;
+    record->target    = target;
+    record->line      = entry->location->line;
+    record->timestamp = *entry->timestamp;
+    if (target == PICO_LOG_TARGET_BINARY) {
+        // binary sites are keyed by these pointers and keep them anyway
+        record->tag      = entry->tag;
+        record->file     = entry->location->file;
+        record->function = entry->location->function;
+    } else {
+        // the caller's strings may be gone by the time the writer gets to the record
+        size_t used      = 0;
+        record->tag      = __picoLogAsyncCopyString(record, &used, entry->tag);
+        record->file     = __picoLogAsyncCopyString(record, &used, entry->location->file);
+        record->function = __picoLogAsyncCopyString(record, &used, entry->location->function);
+    }
+    return record;
+}
+
+static void __picoLogAsyncPublish(__picoLogAsyncRecord_t *record)
+{
+    PICO_LOG_ATOMIC_STORE(&record->sequence, PICO_LOG_ATOMIC_LOAD(&record->sequence) + 1);
+}
+
+static void __picoLogAsyncEnqueue(__picoLogAsyncState_t *async, picoLogEntry entry, picoLogFormat format, picoLogTarget target, const char *messageFormat, va_list args)
+{
+    __picoLogAsyncRecord_t *record = __picoLogAsyncClaim(async, entry, format, target);
+    if (record == NULL) {
+        return;
+    }
+
+    vsnprintf(record->message, sizeof(record->message), messageFormat, args);
+    __picoLogAsyncPublish(record);
+}
+
+// Binary records carry the raw arguments, the writer looks up the site and writes them out
+static void __picoLogAsyncEnqueueBinary(__picoLogAsyncState_t *async, picoLogEntry entry, const char *messageFormat, va_list args)
+{
+    __picoLogAsyncRecord_t *record = __picoLogAsyncClaim(async, entry, PICO_LOG_FORMAT_DEFAULT, PICO_LOG_TARGET_BINARY);
+    if (record == NULL) {
+        return;
+    }
+
+    uint8_t argTypes[PICO_LOG_BINARY_MAX_ARGS];
+    uint32_t argCount    = 0;
+    uint8_t *payload     = (uint8_t *)record->message;
+    record->binaryFormat = messageFormat;
+    record->microseconds = __picoLogGetWallClockMicroseconds();
+    record->preformatted = !__picoLogBinaryBuildSignature(messageFormat, argTypes, &argCount);
+    uint8_t *end         = __picoLogBinaryEncodePayload(payload, payload + sizeof(record->message), messageFormat,
+                                                        argTypes, argCount, record->preformatted, args);
+    record->payloadSize  = (uint32_t)(end - payload);
+    __picoLogAsyncPublish(record);
+}
+
+static void __picoLogAsyncEnqueueBinaryText(__picoLogAsyncState_t *async, picoLogEntry entry, const char *messageFormat, ...)
+{
+    va_list args;
+    va_start(args, messageFormat);
+    __picoLogAsyncEnqueueBinary(async, entry, messageFormat, args);
+    va_end(args);
+}
+
+// Runs on the writer thread with the lock held
+static void __picoLogAsyncWriteBinary(const __picoLogAsyncRecord_t *record)
+{
+    if (__picoLogGlobalContext->binaryLoggerStackTop == 0) {
+        return;
+    }
+
+    picoLogCodeLocation_t location = {record->file, record->function, record->line};
+    picoLogEntry_t entry           = {0};
+    entry.level                    = record->level;
+    entry.tag                      = record->tag;
+    entry.location                 = &location;
+
+    __picoLogBinarySite_t *site = __picoLogBinaryGetSite(&entry, record->binaryFormat);
+    const uint8_t *payload      = (const uint8_t *)record->message;
+    uint32_t payloadSize        = record->payloadSize;
+
+    // the site table is full, raw arguments mean nothing to the decoder without a site
+    uint8_t text[PICO_LOG_ASYNC_MAX_MESSAGE_LENGTH + sizeof(uint32_t)];
+    if (site == NULL && !record->preformatted) {
+        __picoLogBinarySite_t scratch = {0};
+        scratch.format                = record->binaryFormat;
+        char message[PICO_LOG_ASYNC_MAX_MESSAGE_LENGTH];
+        __picoLogBinaryRenderMessage(&scratch, payload, payloadSize, message, sizeof(message));
+        payload     = text;
+        payloadSize = (uint32_t)(__picoLogBinaryEncodeString(text, text + sizeof(text), message) - text);
+    }
+
+    __picoLogBinaryWriteMessage(record->level, site ? site->id : PICO_LOG_BINARY_UNKNOWN_SITE, record->microseconds, payload, payloadSize);
+}
+
+// Lock-free front half of picoLog while the writer runs. Returns NULL when the
+// caller has to take the locked path, otherwise the queue with the producer count
+// held until __picoLogAsyncEnd; *target is 0 when the message is filtered out.
+static __picoLogAsyncState_t *__picoLogAsyncBegin(picoLogLevel level, const char *tag, picoLogTarget *target, picoLogFormat *format)
+{
+    picoLogContext context = __picoLogGlobalContext;
+    if (PICO_LOG_ATOMIC_LOAD_PTR(&context->async) == NULL && __picoLogAsyncWriterQueue == NULL) {
+        return NULL;
+    }
+
+    // the count has to be up before async and config are read, picoLogStopAsync
+    // and __picoLogReclaimConfigs check it after replacing them
+    PICO_LOG_ATOMIC_ADD32(&context->asyncProducers, 1);
+    __picoLogAsyncState_t *async    = (__picoLogAsyncState_t *)PICO_LOG_ATOMIC_LOAD_PTR(&context->async);
+    const __picoLogConfig_t *config = (const __picoLogConfig_t *)PICO_LOG_ATOMIC_LOAD_PTR(&context->config);
+    if (__picoLogAsyncWriterQueue != NULL) {
+        // the writer keeps its queue while it drains after picoLogStopAsync,
+        // without a snapshot its messages are dropped rather than taking the lock
+        async = __picoLogAsyncWriterQueue;
+        if (config == NULL) {
+            PICO_LOG_ATOMIC_ADD(&__picoLogGlobalContext->asyncDroppedCount, 1);
+            *target = 0;
+            return async;
+        }
+    }
+    if (async == NULL || config == NULL) {
+        PICO_LOG_ATOMIC_ADD32(&context->asyncProducers, (uint32_t)-1);
+        return NULL;
+    }
+
+    // thread overrides are only ever touched by this thread
+    const __picoLogThreadOverrides_t *overrides = &__picoLogThreadOverrides;
+    picoLogLevel currentLevel                   = overrides->levelStackTop > 0 ? overrides->levelStack[overrides->levelStackTop - 1] : config->level;
+    const __picoLogTagFilter_t *filter          = overrides->tagFilterStackTop > 0 ? overrides->tagFilterStack[overrides->tagFilterStackTop - 1] : config->tagFilter;
+
+    *target = 0;
+    *format = config->format;
+    if ((level & currentLevel) && (filter == NULL || tag == NULL || __picoLogTagFilterAllows(filter, tag))) {
+        *target = __picoLogFilterTargets(config->target, level, config->targetLevels);
+    }
+    return async;
+}
+
+static void __picoLogAsyncEnd(void)
+{
+    PICO_LOG_ATOMIC_ADD32(&__picoLogGlobalContext->asyncProducers, (uint32_t)-1);
+}
+
+static void __picoLogAsyncDispatch(__picoLogAsyncState_t *async, picoLogEntry entry, picoLogFormat format, picoLogTarget target)
+{
+    entry->message = __picoLogFormatMessage(entry, format, async->formattedMessage, sizeof(async->formattedMessage));
+
+    // the custom and file logger stacks and the crash ring can change under us,
+    // console output does not need the lock
+    if (target & (PICO_LOG_TARGET_CUSTOM | PICO_LOG_TARGET_FILE | PICO_LOG_TARGET_RING)) {
+        PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        __picoLogDispatchToCustomLoggers(entry, target);
+        __picoLogDispatchToFileLoggers(entry, target);
+        __picoLogDispatchToCrashRing(entry, target);
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    }
+    __picoLogDispatchToConsoleLoggers(entry, target);
+}
+
+static uint32_t __picoLogAsyncDrainBatch(__picoLogAsyncState_t *async)
+{
+    uint32_t processed = 0;
+    while (processed < PICO_LOG_ASYNC_BATCH_SIZE) {
+        uint64_t position              = async->dequeuePosition;
+        __picoLogAsyncRecord_t *record = &async->records[position & (PICO_LOG_ASYNC_QUEUE_SIZE - 1)];
+        if (PICO_LOG_ATOMIC_LOAD(&record->sequence) != position + 1) {
+            break;
+        }
+
+        if (record->target == PICO_LOG_TARGET_BINARY) {
+            PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+            __picoLogAsyncWriteBinary(record);
+            PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        } else {
+            picoLogCodeLocation_t location = {record->file, record->function, record->line};
+            picoLogEntry_t entry           = {0};
+            entry.level                    = record->level;
+            entry.tag                      = record->tag;
+            entry.message                  = record->message;
+            entry.location                 = &location;
+            entry.timestamp                = &record->timestamp;
+            __picoLogAsyncDispatch(async, &entry, record->format, record->target);
+        }
+
+        PICO_LOG_ATOMIC_STORE(&record->sequence, position + PICO_LOG_ASYNC_QUEUE_SIZE);
+        async->dequeuePosition = position + 1;
+        processed++;
+    }
+
+    uint64_t dropped = PICO_LOG_ATOMIC_LOAD(&__picoLogGlobalContext->asyncDroppedCount);
+    if (async->overflowPolicy == PICO_LOG_ASYNC_OVERFLOW_COUNT_DROPPED && dropped != async->reportedDropCount) {
+        char message[128];
+        snprintf(message, sizeof(message), "picoLog async queue overflow, dropped %llu messages",
+                 (unsigned long long)(dropped - async->reportedDropCount));
+        async->reportedDropCount = dropped;
+
+        picoLogTimeStamp_t timestamp;
+        __picoLogGetCurrentTimestamp(&timestamp);
+
+        picoLogCodeLocation_t location = {PICO_LOG_FILE, PICO_LOG_FUNC, PICO_LOG_LINE};
+        picoLogEntry_t entry           = {0};
+        entry.level                    = PICO_LOG_LEVEL_WARN;
+        entry.tag                      = "picoLog";
+        entry.message                  = message;
+        entry.location                 = &location;
+        entry.timestamp                = &timestamp;
+        __picoLogAsyncDispatch(async, &entry, PICO_LOG_FORMAT_DEFAULT, (picoLogTarget)(PICO_LOG_TARGET_ALL & ~PICO_LOG_TARGET_BINARY));
+        processed++;
+    }
+
+    if (processed > 0) {
+        fflush(stdout);
+    }
+    return processed;
+}
+
+static PICO_LOG_THREAD_RETURN_TYPE __picoLogAsyncWriterMain(void *arg)
+{
+    __picoLogAsyncState_t *async = (__picoLogAsyncState_t *)arg;
+    __picoLogAsyncWriterQueue    = async;
+    while (PICO_LOG_ATOMIC_LOAD(&async->running)) {
+        if (__picoLogAsyncDrainBatch(async) == 0) {
+            // nothing new is coming in, do not let buffered file output go stale
+            PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+            __picoLogFlushFileLoggers(true);
+            PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+            PICO_LOG_SLEEP_MS(PICO_LOG_ASYNC_POLL_INTERVAL_MS);
+        }
+    }
+    while (__picoLogAsyncDrainBatch(async) > 0) {
+    }
+    return PICO_LOG_THREAD_RETURN_VALUE;
+}
+
+bool picoLogStartAsync(picoLogAsyncOverflowPolicy overflowPolicy)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogStartAsync called but context is NULL");
+        return false;
+    }
+
+    if (PICO_LOG_ATOMIC_LOAD_PTR(&__picoLogGlobalContext->async) != NULL) {
+        return true;
+    }
+
+    __picoLogAsyncState_t *async = (__picoLogAsyncState_t *)PICO_MALLOC(sizeof(__picoLogAsyncState_t));
+    if (async == NULL) {
+        return false;
+    }
+    memset(async, 0, sizeof(__picoLogAsyncState_t));
+
+    for (uint64_t i = 0; i < PICO_LOG_ASYNC_QUEUE_SIZE; i++) {
+        async->records[i].sequence = i;
+    }
+    async->overflowPolicy    = overflowPolicy;
+    async->running           = 1;
+    async->reportedDropCount = PICO_LOG_ATOMIC_LOAD(&__picoLogGlobalContext->asyncDroppedCount);
+
+    if (!PICO_LOG_THREAD_CREATE(async->writerThread, __picoLogAsyncWriterMain, async)) {
+        PICO_FREE(async);
+        return false;
+    }
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    PICO_LOG_ATOMIC_STORE_PTR(&__picoLogGlobalContext->async, async);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    return true;
+}
+
+void picoLogStopAsync(void)
+{
+    if (__picoLogGlobalContext == NULL || PICO_LOG_ATOMIC_LOAD_PTR(&__picoLogGlobalContext->async) == NULL) {
+        return;
+    }
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    __picoLogAsyncState_t *async = (__picoLogAsyncState_t *)PICO_LOG_ATOMIC_LOAD_PTR(&__picoLogGlobalContext->async);
+    PICO_LOG_ATOMIC_STORE_PTR(&__picoLogGlobalContext->async, NULL);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+
+    // producers that picked up the queue before it was detached finish their push first
+    while (PICO_LOG_ATOMIC_LOAD32(&__picoLogGlobalContext->asyncProducers) != 0) {
+        PICO_LOG_SLEEP_MS(0);
+    }
+
+    PICO_LOG_ATOMIC_STORE(&async->running, 0);
+    PICO_LOG_THREAD_JOIN(async->writerThread);
+    fflush(stdout);
+    PICO_FREE(async);
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    __picoLogReclaimConfigs();
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+uint64_t picoLogGetDroppedCount(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        return 0;
+    }
+    return PICO_LOG_ATOMIC_LOAD(&__picoLogGlobalContext->asyncDroppedCount);
+}
+#endif // PICO_LOG_ASYNC
+
+bool picoLogContextCreate(void)
+{
+    if (__picoLogGlobalContext != NULL) {
+        PICO_WARN("picoLogContextCreate called but context already exists");
+        return true;
+    }
+    __picoLogGlobalContext = (picoLogContext)PICO_MALLOC(sizeof(picoLogContext_t));
+    if (__picoLogGlobalContext == NULL) {
+        return false;
+    }
+    memset(__picoLogGlobalContext, 0, sizeof(picoLogContext_t));
+
+    // Initialize stacks
+    if (!__PICO_LOG_GROW_STACK(levelStack) || !__PICO_LOG_GROW_STACK(tagFilterStack) ||
+        !__PICO_LOG_GROW_STACK(targetStack) || !__PICO_LOG_GROW_STACK(formatStack)) {
+        PICO_FREE(__picoLogGlobalContext->levelStack);
+        PICO_FREE(__picoLogGlobalContext->tagFilterStack);
+        PICO_FREE(__picoLogGlobalContext->targetStack);
+        PICO_FREE(__picoLogGlobalContext->formatStack);
+        PICO_FREE(__picoLogGlobalContext);
+        __picoLogGlobalContext = NULL;
+        return false;
+    }
+
+    __picoLogGlobalContext->levelStack[0] = PICO_LOG_LEVEL_ALL;
+    __picoLogGlobalContext->levelStackTop = 1;
+
+    __picoLogGlobalContext->tagFilterStack[0] = NULL; // no filter
+    __picoLogGlobalContext->tagFilterStackTop = 1;
+
+    __picoLogGlobalContext->targetStack[0] = PICO_LOG_TARGET_CONSOLE;
+    __picoLogGlobalContext->targetStackTop = 1;
+
+    __picoLogGlobalContext->formatStack[0] = PICO_LOG_FORMAT_DEFAULT;
+    __picoLogGlobalContext->formatStackTop = 1;
+
+    for (uint32_t i = 0; i < PICO_LOG_TARGET_COUNT; i++) {
+        __picoLogGlobalContext->targetLevels[i] = PICO_LOG_LEVEL_ALL;
+    }
+
+    __picoLogGlobalContext->generation = __picoLogDetachedGeneration + 1;
+    __picoLogGeneration                = &__picoLogGlobalContext->generation;
+
+    PICO_LOG_INIT_MUTEX(__picoLogGlobalContext->mutex);
+    __picoLogPublishConfig(NULL);
+
+    return true;
+}
+
+void picoLogShutdown(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogShutdown called but context is NULL");
+        return;
+    }
+
+#ifdef PICO_LOG_ASYNC
+    picoLogStopAsync();
+#endif
+    picoLogStopCrashRing();
+
+    for (uint32_t i = 0; i < __picoLogGlobalContext->fileLoggerStackTop; i++) {
+        __picoLogFreeFileRotation(__picoLogReleaseFileLogger(i));
+    }
+
+    for (uint32_t i = 0; i < __picoLogGlobalContext->binaryLoggerStackTop; i++) {
+        __picoLogBinaryCloseLogger(i);
+    }
+
+    for (uint32_t i = 0; i < __picoLogGlobalContext->tagFilterStackTop; i++) {
+        PICO_FREE(__picoLogGlobalContext->tagFilterStack[i]);
+    }
+    PICO_FREE(__picoLogGlobalContext->binarySites);
+#ifdef PICO_LOG_ASYNC
+    __picoLogReclaimConfigs();
+    PICO_FREE(__picoLogGlobalContext->config);
+#endif
+
+    PICO_FREE(__picoLogGlobalContext->levelStack);
+    PICO_FREE(__picoLogGlobalContext->tagFilterStack);
+    PICO_FREE(__picoLogGlobalContext->targetStack);
+    PICO_FREE(__picoLogGlobalContext->formatStack);
+    PICO_FREE(__picoLogGlobalContext->customLoggerStack);
+    PICO_FREE(__picoLogGlobalContext->fileLoggerStack);
+    PICO_FREE(__picoLogGlobalContext->binaryLoggerStack);
+
+    PICO_LOG_DESTROY_MUTEX(__picoLogGlobalContext->mutex);
+
+    __picoLogDetachedGeneration = __picoLogGlobalContext->generation + 1;
+    __picoLogGeneration         = &__picoLogDetachedGeneration;
+
+    PICO_FREE(__picoLogGlobalContext);
+    __picoLogGlobalContext = NULL;
+}
+
+picoLogContext picoLogGetContext(void)
+{
+    return __picoLogGlobalContext;
+}
+
+void picoLogSetContext(picoLogContext context)
+{
+    if (__picoLogGlobalContext != NULL) {
+        PICO_WARN("picoLogSetContext called but context already exists");
+        return;
+    }
+
+    __picoLogGlobalContext = context;
+    if (context != NULL) {
+        // the sites of this module follow the generation of the shared context
+        __picoLogGeneration = &context->generation;
+    }
+}
+
+void picoLogPushLevel(picoLogLevel level)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPushLevel called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (!__PICO_LOG_GROW_STACK(levelStack)) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPushLevel stack overflow");
+        return;
+    }
+    __picoLogGlobalContext->levelStack[__picoLogGlobalContext->levelStackTop++] = level;
+    __picoLogPublishConfig(NULL);
+    __picoLogInvalidateCallSites();
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPopLevel(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPopLevel called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogGlobalContext->levelStackTop == 0) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPopLevel stack underflow");
+        return;
+    }
+    __picoLogGlobalContext->levelStackTop--;
+    __picoLogPublishConfig(NULL);
+    __picoLogInvalidateCallSites();
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPushTagFilter(const char *tags)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPushTagFilter called but context is NULL");
+        return;
+    }
+
+    bool failed                  = false;
+    __picoLogTagFilter_t *filter = __picoLogCompileTagFilter(tags, &failed);
+    if (failed) {
+        PICO_ERROR("picoLogPushTagFilter failed to allocate the filter");
+        return;
+    }
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (!__PICO_LOG_GROW_STACK(tagFilterStack)) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_FREE(filter);
+        PICO_ERROR("picoLogPushTagFilter stack overflow");
+        return;
+    }
+    __picoLogGlobalContext->tagFilterStack[__picoLogGlobalContext->tagFilterStackTop++] = filter;
+    __picoLogPublishConfig(NULL);
+    __picoLogInvalidateCallSites();
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPopTagFilter(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPopTagFilter called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogGlobalContext->tagFilterStackTop == 0) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPopTagFilter stack underflow");
+        return;
+    }
+    __picoLogPublishConfig(__picoLogGlobalContext->tagFilterStack[--__picoLogGlobalContext->tagFilterStackTop]);
+    __picoLogInvalidateCallSites();
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPushTarget(picoLogTarget target)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPushTarget called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (!__PICO_LOG_GROW_STACK(targetStack)) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPushTarget stack overflow");
+        return;
+    }
+    __picoLogGlobalContext->targetStack[__picoLogGlobalContext->targetStackTop++] = target;
+    __picoLogPublishConfig(NULL);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPopTarget(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPopTarget called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogGlobalContext->targetStackTop == 0) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPopTarget stack underflow");
+        return;
+    }
+    __picoLogGlobalContext->targetStackTop--;
+    __picoLogPublishConfig(NULL);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPushFormat(picoLogFormat format)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPushFormat called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (!__PICO_LOG_GROW_STACK(formatStack)) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPushFormat stack overflow");
+        return;
+    }
+    __picoLogGlobalContext->formatStack[__picoLogGlobalContext->formatStackTop++] = format;
+    __picoLogPublishConfig(NULL);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPopFormat(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPopFormat called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogGlobalContext->formatStackTop == 0) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPopFormat stack underflow");
+        return;
+    }
+    __picoLogGlobalContext->formatStackTop--;
+    __picoLogPublishConfig(NULL);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPushCustomLogger(picoLogCustomLogger logger, void *userData)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPushCustomLogger called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (!__PICO_LOG_GROW_STACK(customLoggerStack)) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPushCustomLogger stack overflow");
+        return;
+    }
+    __picoLogGlobalContext->customLoggerStack[__picoLogGlobalContext->customLoggerStackTop].logger   = logger;
+    __picoLogGlobalContext->customLoggerStack[__picoLogGlobalContext->customLoggerStackTop].userData = userData;
+    __picoLogGlobalContext->customLoggerStackTop++;
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPopCustomLogger(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPopCustomLogger called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogGlobalContext->customLoggerStackTop == 0) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPopCustomLogger stack underflow");
+        return;
+    }
+    __picoLogGlobalContext->customLoggerStackTop--;
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPushFileLogger(const char *filePath)
+{
+    picoLogPushFileLoggerEx(filePath, NULL);
+}
+
+void picoLogPushFileLoggerEx(const char *filePath, const picoLogFileRotation_t *rotation)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPushFileLogger called but context is NULL");
+        return;
+    }
+
+    __picoLogFileRotationState_t *rotationState = NULL;
+    if (rotation != NULL) {
+        rotationState = (__picoLogFileRotationState_t *)PICO_MALLOC(sizeof(__picoLogFileRotationState_t));
+        if (rotationState == NULL) {
+            PICO_ERROR("picoLogPushFileLoggerEx failed to allocate rotation state");
+            return;
+        }
+        memset(rotationState, 0, sizeof(__picoLogFileRotationState_t));
+        rotationState->policy = *rotation;
+        if (rotation->compressor != NULL && rotation->compressedSuffix != NULL) {
+            strncpy(rotationState->compressedSuffix, rotation->compressedSuffix, PICO_LOG_MAX_COMPRESSED_SUFFIX - 1);
+        }
+        rotationState->policy.compressedSuffix = rotationState->compressedSuffix;
+        snprintf(rotationState->filePath, sizeof(rotationState->filePath), "%s", filePath);
+    }
+
+    size_t pathLength = strlen(filePath);
+    char *path        = (char *)PICO_MALLOC(pathLength + 1);
+    if (path == NULL) {
+        PICO_FREE(rotationState);
+        PICO_ERROR("picoLogPushFileLoggerEx failed to allocate the path");
+        return;
+    }
+    memcpy(path, filePath, pathLength + 1);
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (!__PICO_LOG_GROW_STACK(fileLoggerStack)) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_FREE(path);
+        PICO_FREE(rotationState);
+        PICO_ERROR("picoLogPushFileLogger stack overflow");
+        return;
+    }
+    uint32_t index                = __picoLogGlobalContext->fileLoggerStackTop++;
+    __picoLogFileLogger_t *logger = &__picoLogGlobalContext->fileLoggerStack[index];
+    memset(logger, 0, sizeof(__picoLogFileLogger_t));
+    logger->path     = path;
+    logger->rotation = rotationState;
+    __picoLogOpenFileLogger(index);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPopFileLogger(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPopFileLogger called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogGlobalContext->fileLoggerStackTop == 0) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPopFileLogger stack underflow");
+        return;
+    }
+    __picoLogFileRotationState_t *rotation = __picoLogReleaseFileLogger(--__picoLogGlobalContext->fileLoggerStackTop);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+
+    // a running compression is waited for without holding up other threads
+    __picoLogFreeFileRotation(rotation);
+}
+
+void picoLogPushBinaryLogger(const char *filePath)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPushBinaryLogger called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (!__PICO_LOG_GROW_STACK(binaryLoggerStack)) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPushBinaryLogger stack overflow");
+        return;
+    }
+    // an entry is pushed even if the file fails to open so pops stay balanced
+    __picoLogBinaryOpenLogger(__picoLogGlobalContext->binaryLoggerStackTop++, filePath);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogPopBinaryLogger(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogPopBinaryLogger called but context is NULL");
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogGlobalContext->binaryLoggerStackTop == 0) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        PICO_ERROR("picoLogPopBinaryLogger stack underflow");
+        return;
+    }
+    __picoLogBinaryCloseLogger(--__picoLogGlobalContext->binaryLoggerStackTop);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogFlush(void)
+{
+    if (__picoLogGlobalContext == NULL) {
+        return;
+    }
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    __picoLogFlushFileLoggers(false);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+void picoLogSetTargetLevels(picoLogTarget targets, picoLogLevel levels)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogSetTargetLevels called but context is NULL");
+        return;
+    }
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    for (uint32_t i = 0; i < PICO_LOG_TARGET_COUNT; i++) {
+        if (targets & (1u << i)) {
+            __picoLogGlobalContext->targetLevels[i] = levels;
+        }
+    }
+    __picoLogPublishConfig(NULL);
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+bool picoLogStartCrashRing(size_t sizeBytes, const char *backingPath)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_WARN("picoLogStartCrashRing called but context is NULL");
+        return false;
+    }
+
+    if (__picoLogGlobalContext->crashRing != NULL) {
+        PICO_WARN("picoLogStartCrashRing called but the crash ring is already running");
+        return false;
+    }
+
+    if (sizeBytes == 0) {
+        return false;
+    }
+
+    __picoLogCrashRing_t *ring = (__picoLogCrashRing_t *)PICO_MALLOC(sizeof(__picoLogCrashRing_t));
+    if (ring == NULL) {
+        return false;
+    }
+    memset(ring, 0, sizeof(__picoLogCrashRing_t));
+    ring->mappingSize = sizeof(__picoLogCrashRingHeader_t) + sizeBytes;
+
+    void *memory = NULL;
+#if defined(_WIN32) || defined(_WIN64)
+    ring->file = INVALID_HANDLE_VALUE;
+    if (backingPath != NULL) {
+        ring->mapped = true;
+        ring->file   = CreateFileA(backingPath, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (ring->file != INVALID_HANDLE_VALUE) {
+            ring->mapping = CreateFileMappingA(ring->file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)ring->mappingSize >> 32), (DWORD)ring->mappingSize, NULL);
+        }
+        if (ring->mapping != NULL) {
+            memory = MapViewOfFile(ring->mapping, FILE_MAP_ALL_ACCESS, 0, 0, ring->mappingSize);
+        }
+    }
+#else
+    ring->file = -1;
+    if (backingPath != NULL) {
+        ring->mapped = true;
+        ring->file   = open(backingPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (ring->file >= 0 && ftruncate(ring->file, (off_t)ring->mappingSize) == 0) {
+            memory = mmap(NULL, ring->mappingSize, PROT_READ | PROT_WRITE, MAP_SHARED, ring->file, 0);
+            memory = memory != MAP_FAILED ? memory : NULL;
+        }
+    }
+#endif
+    if (backingPath == NULL) {
+        memory = PICO_MALLOC(ring->mappingSize);
+    }
+
+    if (memory == NULL) {
+        PICO_WARN("picoLogStartCrashRing could not allocate %zu bytes", ring->mappingSize);
+        __picoLogReleaseCrashRing(ring);
+        return false;
+    }
+
+    // touch every page now rather than in the middle of logging
+    memset(memory, 0, ring->mappingSize);
+    ring->header = (__picoLogCrashRingHeader_t *)memory;
+    ring->data   = (uint8_t *)(ring->header + 1);
+    memcpy(ring->header->magic, PICO_LOG_CRASH_RING_MAGIC, sizeof(ring->header->magic));
+    ring->header->size = sizeBytes;
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    __picoLogGlobalContext->crashRing = ring;
     PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    return true;
 }
 
-void picoLogPopLevel(void)
+void picoLogStopCrashRing(void)
 {
     if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPopLevel called but context is NULL");
         return;
     }
+
     PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->levelStackTop == 0) {
-        PICO_ERROR("picoLogPopLevel stack underflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-        return;
-    }
-    __picoLogGlobalContext->levelStackTop--;
+    __picoLogCrashRing_t *ring        = __picoLogGlobalContext->crashRing;
+    __picoLogGlobalContext->crashRing = NULL;
     PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+
+    if (ring != NULL) {
+        __picoLogReleaseCrashRing(ring);
+    }
 }
 
-void picoLogPushTagFilter(const char *tags)
+bool picoLogDumpCrashRing(const char *path)
 {
-    if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPushTagFilter called but context is NULL");
-        return;
+    picoLogContext context     = __picoLogGlobalContext;
+    __picoLogCrashRing_t *ring = context != NULL ? context->crashRing : NULL;
+    if (ring == NULL || path == NULL || path[0] == '\0') {
+        return false;
     }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->tagFilterStackTop >= PICO_LOG_CONFIG_STACK_SIZE) {
-        PICO_ERROR("picoLogPushTagFilter stack overflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-        return;
+
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE file = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
     }
-    strncpy(__picoLogGlobalContext->tagFilterStack[__picoLogGlobalContext->tagFilterStackTop++], tags, 255);
-    __picoLogGlobalContext->tagFilterStack[__picoLogGlobalContext->tagFilterStackTop - 1][255] = '\0';
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    bool success = __picoLogCrashRingUnroll(ring->header, ring->data, __picoLogCrashRingHandleSink, file);
+    CloseHandle(file);
+#else
+    int file = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (file < 0) {
+        return false;
+    }
+    bool success = __picoLogCrashRingUnroll(ring->header, ring->data, __picoLogCrashRingDescriptorSink, &file);
+    close(file);
+#endif
+    return success;
 }
 
-void picoLogPopTagFilter(void)
+bool picoLogDumpCrashRingFile(const char *ringPath, const char *outputPath)
 {
-    if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPopTagFilter called but context is NULL");
-        return;
+    FILE *input = fopen(ringPath, "rb");
+    if (input == NULL) {
+        return false;
     }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->tagFilterStackTop == 0) {
-        PICO_ERROR("picoLogPopTagFilter stack underflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-        return;
+
+    __picoLogCrashRingHeader_t header;
+    uint8_t *data = NULL;
+    bool success  = fread(&header, sizeof(header), 1, input) == 1 &&
+                   memcmp(header.magic, PICO_LOG_CRASH_RING_MAGIC, sizeof(header.magic)) == 0 &&
+                   header.size > 0 && header.size <= SIZE_MAX;
+    if (success) {
+        data    = (uint8_t *)PICO_MALLOC((size_t)header.size);
+        success = data != NULL && fread(data, 1, (size_t)header.size, input) == header.size;
     }
-    __picoLogGlobalContext->tagFilterStackTop--;
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    fclose(input);
+
+    if (success) {
+        FILE *output = fopen(outputPath, "wb");
+        success      = output != NULL && __picoLogCrashRingUnroll(&header, data, __picoLogCrashRingFileSink, output);
+        if (output != NULL) {
+            success = fclose(output) == 0 && success;
+        }
+    }
+
+    PICO_FREE(data);
+    return success;
 }
 
-void picoLogPushTarget(picoLogTarget target)
+bool picoLogInstallCrashHandler(const char *dumpPath)
 {
-    if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPushTarget called but context is NULL");
-        return;
+    if (dumpPath == NULL || strlen(dumpPath) >= sizeof(__picoLogCrashDumpPath)) {
+        return false;
     }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->targetStackTop >= PICO_LOG_CONFIG_STACK_SIZE) {
-        PICO_ERROR("picoLogPushTarget stack overflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-        return;
+    memcpy(__picoLogCrashDumpPath, dumpPath, strlen(dumpPath) + 1);
+
+#if defined(_WIN32) || defined(_WIN64)
+    __picoLogPreviousExceptionFilter = SetUnhandledExceptionFilter(__picoLogCrashExceptionFilter);
+    __picoLogPreviousAbortHandler    = signal(SIGABRT, __picoLogCrashAbortHandler);
+#else
+    // without an alternate stack a stack overflow leaves the handler nowhere to run
+    static void *alternateStack = NULL;
+    stack_t current;
+    if (sigaltstack(NULL, &current) == 0 && (current.ss_flags & SS_DISABLE)) {
+        if (alternateStack == NULL) {
+            alternateStack = PICO_MALLOC(PICO_LOG_CRASH_STACK_SIZE);
+        }
+        if (alternateStack != NULL) {
+            stack_t stack;
+            memset(&stack, 0, sizeof(stack));
+            stack.ss_sp   = alternateStack;
+            stack.ss_size = PICO_LOG_CRASH_STACK_SIZE;
+            sigaltstack(&stack, NULL);
+        }
     }
-    __picoLogGlobalContext->targetStack[__picoLogGlobalContext->targetStackTop++] = target;
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = __picoLogCrashSignalHandler;
+    action.sa_flags   = SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    for (size_t i = 0; i < sizeof(__picoLogCrashSignals) / sizeof(__picoLogCrashSignals[0]); i++) {
+        if (sigaction(__picoLogCrashSignals[i], &action, &__picoLogPreviousCrashActions[i]) != 0) {
+            return false;
+        }
+    }
+#endif
+    return true;
 }
 
-void picoLogPopTarget(void)
+#ifdef PICO_LOG_HAS_THREAD_EXIT
+static pthread_once_t __picoLogThreadExitOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t __picoLogThreadExitKey;
+static bool __picoLogThreadExitKeyValid       = false;
+
+// Runs as the thread exits, its thread local overrides are still intact at that point
+static void __picoLogThreadExit(void *value)
 {
-    if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPopTarget called but context is NULL");
-        return;
+    __picoLogThreadOverrides_t *overrides = (__picoLogThreadOverrides_t *)value;
+    uint32_t count                        = overrides->levelStackTop + overrides->tagFilterStackTop;
+    while (overrides->tagFilterStackTop > 0) {
+        PICO_FREE(overrides->tagFilterStack[--overrides->tagFilterStackTop]);
     }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->targetStackTop == 0) {
-        PICO_ERROR("picoLogPopTarget stack underflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-        return;
+    overrides->levelStackTop = 0;
+
+    // overrides pushed into a context that is gone no longer count anywhere
+    if (count > 0 && overrides->context && overrides->context == __picoLogGlobalContext) {
+        PICO_LOG_ATOMIC_ADD32(&__picoLogGlobalContext->activeThreadOverrides, (uint32_t)-(int32_t)count);
+        __picoLogInvalidateCallSites();
     }
-    __picoLogGlobalContext->targetStackTop--;
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    overrides->context = NULL;
 }
 
-void picoLogPushFormat(picoLogFormat format)
+static void __picoLogCreateThreadExitKey(void)
 {
-    if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPushFormat called but context is NULL");
-        return;
-    }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->formatStackTop >= PICO_LOG_CONFIG_STACK_SIZE) {
-        PICO_ERROR("picoLogPushFormat stack overflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-        return;
-    }
-    __picoLogGlobalContext->formatStack[__picoLogGlobalContext->formatStackTop++] = format;
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    __picoLogThreadExitKeyValid = pthread_key_create(&__picoLogThreadExitKey, __picoLogThreadExit) == 0;
 }
+#endif
 
-void picoLogPopFormat(void)
+static void __picoLogThreadOverrideChanged(int32_t delta)
 {
-    if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPopFormat called but context is NULL");
-        return;
-    }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->formatStackTop == 0) {
-        PICO_ERROR("picoLogPopFormat stack underflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-        return;
+    if (delta > 0) {
+        __picoLogThreadOverrides.context = __picoLogGlobalContext;
+#ifdef PICO_LOG_HAS_THREAD_EXIT
+        pthread_once(&__picoLogThreadExitOnce, __picoLogCreateThreadExitKey);
+        if (__picoLogThreadExitKeyValid) {
+            pthread_setspecific(__picoLogThreadExitKey, &__picoLogThreadOverrides);
+        }
+#endif
     }
-    __picoLogGlobalContext->formatStackTop--;
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    // the count has to be visible before the generation moves, see picoLogRefreshCallSite
+    PICO_LOG_ATOMIC_ADD32(&__picoLogGlobalContext->activeThreadOverrides, (uint32_t)delta);
+    __picoLogInvalidateCallSites();
 }
 
-void picoLogPushCustomLogger(picoLogCustomLogger logger, void *userData)
+void picoLogPushThreadLevel(picoLogLevel level)
 {
     if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPushCustomLogger called but context is NULL");
+        PICO_WARN("picoLogPushThreadLevel called but context is NULL");
         return;
     }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->customLoggerStackTop >= PICO_LOG_CONFIG_STACK_SIZE) {
-        PICO_ERROR("picoLogPushCustomLogger stack overflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogThreadOverrides.levelStackTop >= PICO_LOG_THREAD_STACK_SIZE) {
+        PICO_ERROR("picoLogPushThreadLevel stack overflow");
         return;
     }
-    __picoLogGlobalContext->customLoggerStack[__picoLogGlobalContext->customLoggerStackTop]         = logger;
-    __picoLogGlobalContext->customLoggerUserDataStack[__picoLogGlobalContext->customLoggerStackTop] = userData;
-    __picoLogGlobalContext->customLoggerStackTop++;
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    __picoLogThreadOverrides.levelStack[__picoLogThreadOverrides.levelStackTop++] = level;
+    __picoLogThreadOverrideChanged(1);
 }
 
-void picoLogPopCustomLogger(void)
+void picoLogPopThreadLevel(void)
 {
     if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPopCustomLogger called but context is NULL");
+        PICO_WARN("picoLogPopThreadLevel called but context is NULL");
         return;
     }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->customLoggerStackTop == 0) {
-        PICO_ERROR("picoLogPopCustomLogger stack underflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogThreadOverrides.levelStackTop == 0) {
+        PICO_ERROR("picoLogPopThreadLevel stack underflow");
         return;
     }
-    __picoLogGlobalContext->customLoggerStackTop--;
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    __picoLogThreadOverrides.levelStackTop--;
+    __picoLogThreadOverrideChanged(-1);
 }
 
-void picoLogPushFileLogger(const char *filePath)
+void picoLogPushThreadTagFilter(const char *tags)
 {
     if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPushFileLogger called but context is NULL");
+        PICO_WARN("picoLogPushThreadTagFilter called but context is NULL");
         return;
     }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->logFilesStackTop >= PICO_LOG_CONFIG_STACK_SIZE) {
-        PICO_ERROR("picoLogPushFileLogger stack overflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogThreadOverrides.tagFilterStackTop >= PICO_LOG_THREAD_STACK_SIZE) {
+        PICO_ERROR("picoLogPushThreadTagFilter stack overflow");
         return;
     }
-    strncpy(__picoLogGlobalContext->logFilePaths[__picoLogGlobalContext->logFilesStackTop++], filePath, PICO_LOG_MAX_PATH - 1);
-    __picoLogGlobalContext->logFilePaths[__picoLogGlobalContext->logFilesStackTop - 1][PICO_LOG_MAX_PATH - 1] = '\0';
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+
+    bool failed                  = false;
+    __picoLogTagFilter_t *filter = __picoLogCompileTagFilter(tags, &failed);
+    if (failed) {
+        PICO_ERROR("picoLogPushThreadTagFilter failed to allocate the filter");
+        return;
+    }
+    __picoLogThreadOverrides.tagFilterStack[__picoLogThreadOverrides.tagFilterStackTop++] = filter;
+    __picoLogThreadOverrideChanged(1);
 }
 
-void picoLogPopFileLogger(void)
+void picoLogPopThreadTagFilter(void)
 {
     if (__picoLogGlobalContext == NULL) {
-        PICO_WARN("picoLogPopFileLogger called but context is NULL");
+        PICO_WARN("picoLogPopThreadTagFilter called but context is NULL");
         return;
     }
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
-    if (__picoLogGlobalContext->logFilesStackTop == 0) {
-        PICO_ERROR("picoLogPopFileLogger stack underflow");
-        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    if (__picoLogThreadOverrides.tagFilterStackTop == 0) {
+        PICO_ERROR("picoLogPopThreadTagFilter stack underflow");
         return;
     }
-    __picoLogGlobalContext->logFilesStackTop--;
-    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    PICO_FREE(__picoLogThreadOverrides.tagFilterStack[--__picoLogThreadOverrides.tagFilterStackTop]);
+    __picoLogThreadOverrideChanged(-1);
 }
 
 void picoLogPushFromEnvironment(void)
@@ -781,47 +4046,321 @@ void picoLogPushFromEnvironment(void)
     }
 }
 
+bool picoLogRefreshCallSite(volatile uint32_t *siteState, picoLogLevel level, const char *tag)
+{
+    if (__picoLogGlobalContext == NULL) {
+        PICO_LOG_RELAXED_STORE(*siteState, __picoLogDetachedGeneration << 1);
+        return false;
+    }
+
+#ifdef PICO_LOG_ASYNC
+    // the writer already holds the lock, picoLog does the filtering for it
+    if (__picoLogAsyncWriterQueue != NULL) {
+        return true;
+    }
+#endif
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    // read first so the result can never be newer than its generation
+    uint32_t generation = PICO_LOG_ATOMIC_LOAD32(&__picoLogGlobalContext->generation);
+    bool enabled        = (level & __picoLogGetCurrentLevel()) && __picoLogIsTagAllowed(tag);
+    // a thread override makes the answer depend on the calling thread, the
+    // shared site word can then only say "ask picoLog"
+    bool cached = enabled || PICO_LOG_ATOMIC_LOAD32(&__picoLogGlobalContext->activeThreadOverrides) != 0;
+    PICO_LOG_RELAXED_STORE(*siteState, (generation << 1) | (cached ? 1u : 0u));
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    return enabled;
+}
+
+bool picoLogRateLimitAcquire(picoLogRateLimit_t *rateLimit, uint32_t maxCount, uint32_t intervalMs, picoLogLevel level, const char *tag, const char *file, const char *function, uint32_t line)
+{
+    if (__picoLogGlobalContext == NULL) {
+        return false;
+    }
+
+    uint64_t now = __picoLogGetMonotonicMs();
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+    uint32_t suppressed = 0;
+    if (rateLimit->windowStartMs == 0 || now - rateLimit->windowStartMs >= intervalMs) {
+        rateLimit->windowStartMs = now;
+        rateLimit->count         = 0;
+    }
+
+    bool allowed = rateLimit->count < maxCount;
+    if (allowed) {
+        rateLimit->count++;
+        suppressed            = rateLimit->suppressed;
+        rateLimit->suppressed = 0;
+    } else {
+        rateLimit->suppressed++;
+    }
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+
+    if (suppressed > 0) {
+        picoLog(level, tag, file, function, line, "%u messages suppressed by the rate limit", suppressed);
+    }
+    return allowed;
+}
+
+// xorshift32, seeded per thread from its own address and the clock
+static PICO_LOG_THREAD_LOCAL uint32_t __picoLogSampleState;
+
+bool picoLogSample(double probability)
+{
+    if (probability >= 1.0) {
+        return true;
+    }
+    if (!(probability > 0.0)) {
+        return false;
+    }
+
+    uint32_t x = __picoLogSampleState;
+    if (x == 0) {
+        x = (uint32_t)(uintptr_t)&__picoLogSampleState ^ ((uint32_t)__picoLogGetMonotonicMs() * 2654435761u);
+        x = x != 0 ? x : 0x9E3779B9u;
+    }
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    __picoLogSampleState = x;
+
+    return (double)x < probability * 4294967296.0;
+}
+
 void picoLog(picoLogLevel level, const char *tag, const char *file, const char *function, uint32_t line, const char *format, ...)
 {
     if (__picoLogGlobalContext == NULL) {
         return;
     }
 
-    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+#ifdef PICO_LOG_ASYNC
+    picoLogTarget asyncTarget    = 0;
+    picoLogFormat asyncFormat    = PICO_LOG_FORMAT_DEFAULT;
+    __picoLogAsyncState_t *async = __picoLogAsyncBegin(level, tag, &asyncTarget, &asyncFormat);
+    if (async != NULL) {
+        if (asyncTarget != 0) {
+            picoLogCodeLocation_t location = {file, function, line};
+            picoLogTimeStamp_t timestamp;
+            __picoLogGetCurrentTimestamp(&timestamp);
+            picoLogEntry_t entry = {0};
+            entry.level          = level;
+            entry.tag            = tag;
+            entry.location       = &location;
+            entry.timestamp      = &timestamp;
+
+            va_list args;
+            if (asyncTarget & PICO_LOG_TARGET_BINARY) {
+                va_start(args, format);
+                __picoLogAsyncEnqueueBinary(async, &entry, format, args);
+                va_end(args);
+            }
+            asyncTarget = (picoLogTarget)(asyncTarget & ~PICO_LOG_TARGET_BINARY);
+            if (asyncTarget != 0) {
+                va_start(args, format);
+                __picoLogAsyncEnqueue(async, &entry, asyncFormat, asyncTarget, format, args);
+                va_end(args);
+            }
+        }
+        __picoLogAsyncEnd();
+        return;
+    }
+#endif
 
-    static char messageBuffer[PICO_LOG_MAX_MESSAGE_LENGTH];
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
 
     if (!(level & __picoLogGetCurrentLevel())) {
         PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
         return;
     }
 
-    const char *currentTagFilter = __picoLogGetCurrentTagFilter();
-    if (currentTagFilter[0] != '\0' && tag != NULL && strstr(currentTagFilter, tag) == NULL) {
+    if (!__picoLogIsTagAllowed(tag)) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        return;
+    }
+
+    picoLogCodeLocation_t location = {file, function, line};
+    picoLogEntry_t entry           = {0};
+    entry.level                    = level;
+    entry.tag                      = tag;
+    entry.location                 = &location;
+
+    picoLogFormat currentFormat = __picoLogGetCurrentFormat();
+    picoLogTarget currentTarget = __picoLogFilterTargets(__picoLogGetCurrentTarget(), level, __picoLogGlobalContext->targetLevels);
+    if (currentTarget == 0) {
         PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
         return;
     }
 
+    // binary records skip formatting entirely, they are written right here
+    if (currentTarget & PICO_LOG_TARGET_BINARY) {
+        va_list args;
+        va_start(args, format);
+        __picoLogDispatchToBinaryLoggers(&entry, format, args);
+        va_end(args);
+
+        currentTarget = (picoLogTarget)(currentTarget & ~PICO_LOG_TARGET_BINARY);
+        if (currentTarget == 0) {
+            PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+            return;
+        }
+    }
+
+    picoLogTimeStamp_t timestamp;
+    __picoLogGetCurrentTimestamp(&timestamp);
+    entry.timestamp = &timestamp;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(__picoLogMessageBuffer, sizeof(__picoLogMessageBuffer), format, args);
+    va_end(args);
+
+    entry.message = __picoLogMessageBuffer;
+    entry.message = __picoLogFormatMessage(&entry, currentFormat, __picoLogFormattedMessage, sizeof(__picoLogFormattedMessage));
+
+    __picoLogDispatchToCustomLoggers(&entry, currentTarget);
+    __picoLogDispatchToFileLoggers(&entry, currentTarget);
+    __picoLogDispatchToCrashRing(&entry, currentTarget);
+    __picoLogDispatchToConsoleLoggers(&entry, currentTarget);
+
+    // Clear message buffer for next use
+    __picoLogMessageBuffer[0] = '\0';
+
+    PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+}
+
+static void __picoLogDispatchTextToBinaryLoggers(picoLogEntry entry, const char *format, ...)
+{
     va_list args;
     va_start(args, format);
-    vsnprintf(messageBuffer, PICO_LOG_MAX_MESSAGE_LENGTH, format, args);
+    __picoLogDispatchToBinaryLoggers(entry, format, args);
     va_end(args);
+}
+
+#ifdef PICO_LOG_ASYNC
+static void __picoLogAsyncEnqueueFields(__picoLogAsyncState_t *async, picoLogEntry entry, picoLogFormat format, picoLogTarget target, const picoLogField_t *fields, uint32_t fieldCount)
+{
+    __picoLogWriter_t writer;
+
+    // binary loggers store the message with its fields as one string argument
+    if (target & PICO_LOG_TARGET_BINARY) {
+        char text[PICO_LOG_ASYNC_MAX_MESSAGE_LENGTH];
+        __picoLogWriterInit(&writer, text, sizeof(text));
+        __picoLogWriteString(&writer, entry->message);
+        __picoLogWriteLogfmtFields(&writer, fields, fieldCount);
+        __picoLogAsyncEnqueueBinaryText(async, entry, "%s", text);
+
+        target = (picoLogTarget)(target & ~PICO_LOG_TARGET_BINARY);
+        if (target == 0) {
+            return;
+        }
+    }
+
+    // structured records are complete once written, the writer thread only copies them out
+    bool structured                = format == PICO_LOG_FORMAT_JSON || format == PICO_LOG_FORMAT_LOGFMT;
+    __picoLogAsyncRecord_t *record = __picoLogAsyncClaim(async, entry, structured ? PICO_LOG_FORMAT_MESSAGE_ONLY : format, target);
+    if (record == NULL) {
+        return;
+    }
+    __picoLogWriterInit(&writer, record->message, sizeof(record->message));
+    if (structured) {
+        __picoLogWriteRecord(&writer, entry, format, fields, fieldCount);
+    } else {
+        __picoLogWriteString(&writer, entry->message);
+        __picoLogWriteLogfmtFields(&writer, fields, fieldCount);
+    }
+    __picoLogAsyncPublish(record);
+}
+#endif
 
+void picoLogFields(picoLogLevel level, const char *tag, const char *file, const char *function, uint32_t line, const char *message, const picoLogField_t *fields, uint32_t fieldCount)
+{
+    if (__picoLogGlobalContext == NULL) {
+        return;
+    }
+
+#ifdef PICO_LOG_ASYNC
+    picoLogTarget asyncTarget    = 0;
+    picoLogFormat asyncFormat    = PICO_LOG_FORMAT_DEFAULT;
+    __picoLogAsyncState_t *async = __picoLogAsyncBegin(level, tag, &asyncTarget, &asyncFormat);
+    if (async != NULL) {
+        if (asyncTarget != 0) {
+            picoLogCodeLocation_t location = {file, function, line};
+            picoLogTimeStamp_t timestamp;
+            __picoLogGetCurrentTimestamp(&timestamp);
+            picoLogEntry_t entry = {0};
+            entry.level          = level;
+            entry.tag            = tag;
+            entry.message        = message ? message : "";
+            entry.location       = &location;
+            entry.timestamp      = &timestamp;
+            __picoLogAsyncEnqueueFields(async, &entry, asyncFormat, asyncTarget, fields, fieldCount);
+        }
+        __picoLogAsyncEnd();
+        return;
+    }
+#endif
+
+    PICO_LOG_BEGIN_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+
+    if (!(level & __picoLogGetCurrentLevel()) || !__picoLogIsTagAllowed(tag)) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        return;
+    }
+
+    picoLogCodeLocation_t location = {file, function, line};
     picoLogEntry_t entry           = {0};
     entry.level                    = level;
     entry.tag                      = tag;
-    entry.message                  = messageBuffer;
-    picoLogCodeLocation_t location = {file, function, line};
+    entry.message                  = message ? message : "";
     entry.location                 = &location;
-    entry.timestamp                = __picoLogGetCurrentTimestamp();
-    entry.message                  = __picoLogFormatMessage(&entry);
 
-    __picoLogDispatchToCustomLoggers(&entry);
-    __picoLogDispatchToFileLoggers(&entry);
-    __picoLogDispatchToConsoleLoggers(&entry);
+    picoLogFormat currentFormat = __picoLogGetCurrentFormat();
+    picoLogTarget currentTarget = __picoLogFilterTargets(__picoLogGetCurrentTarget(), level, __picoLogGlobalContext->targetLevels);
+    if (currentTarget == 0) {
+        PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+        return;
+    }
+    bool structured             = currentFormat == PICO_LOG_FORMAT_JSON || currentFormat == PICO_LOG_FORMAT_LOGFMT;
+
+    __picoLogWriter_t writer;
 
-    // Clear message buffer for next use
-    messageBuffer[0] = '\0';
+    // binary loggers store the message with its fields as one string argument
+    if (currentTarget & PICO_LOG_TARGET_BINARY) {
+        __picoLogWriterInit(&writer, __picoLogMessageBuffer, sizeof(__picoLogMessageBuffer));
+        __picoLogWriteString(&writer, entry.message);
+        __picoLogWriteLogfmtFields(&writer, fields, fieldCount);
+        __picoLogDispatchTextToBinaryLoggers(&entry, "%s", __picoLogMessageBuffer);
+
+        currentTarget = (picoLogTarget)(currentTarget & ~PICO_LOG_TARGET_BINARY);
+        if (currentTarget == 0) {
+            PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
+            return;
+        }
+    }
+
+    picoLogTimeStamp_t timestamp;
+    __picoLogGetCurrentTimestamp(&timestamp);
+    entry.timestamp = &timestamp;
+
+    if (structured) {
+        __picoLogWriterInit(&writer, __picoLogFormattedMessage, sizeof(__picoLogFormattedMessage));
+        __picoLogWriteRecord(&writer, &entry, currentFormat, fields, fieldCount);
+        entry.message = __picoLogFormattedMessage;
+    } else {
+        __picoLogWriterInit(&writer, __picoLogMessageBuffer, sizeof(__picoLogMessageBuffer));
+        __picoLogWriteString(&writer, entry.message);
+        __picoLogWriteLogfmtFields(&writer, fields, fieldCount);
+        entry.message = __picoLogMessageBuffer;
+        entry.message = __picoLogFormatMessage(&entry, currentFormat, __picoLogFormattedMessage, sizeof(__picoLogFormattedMessage));
+    }
+
+    __picoLogDispatchToCustomLoggers(&entry, currentTarget);
+    __picoLogDispatchToFileLoggers(&entry, currentTarget);
+    __picoLogDispatchToCrashRing(&entry, currentTarget);
+    __picoLogDispatchToConsoleLoggers(&entry, currentTarget);
+
+    __picoLogMessageBuffer[0] = '\0';
 
     PICO_LOG_END_CRITICAL_SECTION(__picoLogGlobalContext->mutex);
 }
@@ -861,6 +4400,8 @@ const char *picoLogFormatToString(picoLogFormat format)
             return "VERBOSE";
         case PICO_LOG_FORMAT_JSON:
             return "JSON";
+        case PICO_LOG_FORMAT_LOGFMT:
+            return "LOGFMT";
         default:
             return "UNKNOWN";
     }
@@ -875,6 +4416,10 @@ const char *picoLogTargetToString(picoLogTarget target)
             return "FILE";
         case PICO_LOG_TARGET_CUSTOM:
             return "CUSTOM";
+        case PICO_LOG_TARGET_BINARY:
+            return "BINARY";
+        case PICO_LOG_TARGET_RING:
+            return "RING";
         case PICO_LOG_TARGET_ALL:
             return "ALL";
         default:
@@ -915,6 +4460,8 @@ picoLogFormat picoLogStringToFormat(const char *formatStr)
         return PICO_LOG_FORMAT_VERBOSE;
     } else if (strcmp(formatStr, "JSON") == 0) {
         return PICO_LOG_FORMAT_JSON;
+    } else if (strcmp(formatStr, "LOGFMT") == 0) {
+        return PICO_LOG_FORMAT_LOGFMT;
     } else {
         return PICO_LOG_FORMAT_DEFAULT; // Default to DEFAULT for unknown strings
     }
@@ -928,6 +4475,10 @@ picoLogTarget picoLogStringToTarget(const char *targetStr)
         return PICO_LOG_TARGET_FILE;
     } else if (strcmp(targetStr, "CUSTOM") == 0) {
         return PICO_LOG_TARGET_CUSTOM;
+    } else if (strcmp(targetStr, "BINARY") == 0) {
+        return PICO_LOG_TARGET_BINARY;
+    } else if (strcmp(targetStr, "RING") == 0) {
+        return PICO_LOG_TARGET_RING;
     } else if (strcmp(targetStr, "ALL") == 0) {
         return PICO_LOG_TARGET_ALL;
     } else {
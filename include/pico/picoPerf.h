@@ -31,10 +31,68 @@ SOFTWARE.
 #define PICO_PERF_IF_ENABLED(...) __VA_ARGS__
 #endif
 
+// Define PICO_PERF_USE_TSC to read the CPU timestamp counter (rdtsc on x86, cntvct on ARM64)
+// in picoPerfNow instead of the OS monotonic clock. On x86 the counter frequency is calibrated
+// against the monotonic clock once, and CPUs without an invariant TSC fall back to the OS clock.
+#ifndef PICO_PERF_TSC_CALIBRATION_MS
+#define PICO_PERF_TSC_CALIBRATION_MS 10
+#endif
+
+// Define PICO_PERF_HW_COUNTERS on Linux to capture cycles, instructions, L1D, LLC and branch
+// misses per scope through perf_event_open, reports (stats reports included, from per site
+// sums) then add IPC and misses per thousand instructions, and streamed scopes carry the raw
+// counts. Every scope costs two extra read syscalls, and counters read as zero where the
+// kernel refuses them (perf_event_paranoid, seccomp, VMs without a virtual PMU). Each thread
+// holds its counter fds until it exits, at most PICO_PERF_HW_COUNTER_MAX_THREADS threads hold
+// them at once and the ones past that read zero.
+#ifndef PICO_PERF_HW_COUNTER_MAX_THREADS
+#define PICO_PERF_HW_COUNTER_MAX_THREADS 64
+#endif
+
+// Define PICO_PERF_SAMPLING on Linux with glibc to enable picoPerfStartSampling, a SIGPROF timer
+// then captures the call stack of whichever thread is burning CPU, no instrumentation needed.
+// Stacks come from glibc backtrace, or from a frame pointer walk with
+// PICO_PERF_SAMPLING_FRAME_POINTERS which is cheaper but needs every module built with
+// -fno-omit-frame-pointer. The walk stays within the stack bounds of threads that called into
+// picoPerf or picoPerfStartSampling, other threads only get the interrupted instruction.
+// Link with -rdynamic to see the executable's own function names.
+#ifndef PICO_PERF_SAMPLE_MAX_DEPTH
+#define PICO_PERF_SAMPLE_MAX_DEPTH 64
+#endif
+
+#ifndef PICO_PERF_SAMPLE_MAX_STACKS
+#define PICO_PERF_SAMPLE_MAX_STACKS 4096 // distinct stacks, must be a power of two
+#endif
+
+// Define PICO_PERF_STREAMING to enable picoPerfStartStreaming, a background thread then
+// drains completed scopes from bounded per thread buffers into a compact binary stream
+#ifndef PICO_PERF_STREAM_BUFFER_SIZE
+#define PICO_PERF_STREAM_BUFFER_SIZE 16384 // entries per thread, must be a power of two
+#endif
+
+#ifndef PICO_PERF_STREAM_FLUSH_INTERVAL_MS
+#define PICO_PERF_STREAM_FLUSH_INTERVAL_MS 50
+#endif
+
+#ifndef PICO_PERF_STREAM_WRITE_BUFFER_SIZE
+#define PICO_PERF_STREAM_WRITE_BUFFER_SIZE (64 * 1024)
+#endif
+
+// Maximum number of completed scopes kept per record
 #ifndef PICO_PERF_MAX_SCOPES
 #define PICO_PERF_MAX_SCOPES 1024 * 4
 #endif
 
+// Maximum nesting depth of open scopes
+#ifndef PICO_PERF_MAX_DEPTH
+#define PICO_PERF_MAX_DEPTH 256
+#endif
+
+// Maximum number of distinct call sites (name, file, function, line), at most 65535
+#ifndef PICO_PERF_MAX_SITES
+#define PICO_PERF_MAX_SITES 1024
+#endif
+
 #ifndef PICO_PERF_MAX_RECORDS
 #define PICO_PERF_MAX_RECORDS 16
 #endif
@@ -43,6 +101,11 @@ SOFTWARE.
 #define PICO_PERF_MAX_NAME_LENGTH 64
 #endif
 
+// Maximum number of benchmarks registered with picoPerfBenchRegister
+#ifndef PICO_PERF_BENCH_MAX
+#define PICO_PERF_BENCH_MAX 256
+#endif
+
 #if defined(__clang__) || defined(__APPLE__)
 #define PICO_PERF_FUNC     __func__
 #define PICO_PERF_FILE     __FILE__
@@ -62,21 +125,60 @@ SOFTWARE.
 #error "Unsupported compiler"
 #endif
 
-#define PICO_PERF_PUSH_SCOPE(name)     PICO_PERF_IF_ENABLED(picoPerfPushScope(name, PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
-#define PICO_PERF_POP_SCOPE()          PICO_PERF_IF_ENABLED(picoPerfPopScope(PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
-#define PICO_PERF_POP_N_SCOPES(n)      PICO_PERF_IF_ENABLED(picoPerfPopNScopes(n, PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
-#define PICO_PERF_BEGIN_RECORD()       PICO_PERF_IF_ENABLED(picoPerfBeginRecord())
-#define PICO_PERF_END_RECORD()         PICO_PERF_IF_ENABLED(picoPerfEndRecord())
-#define PICO_PERF_GET_REPORT(out, fmt) PICO_PERF_IF_ENABLED(picoPerfGetReport(out, fmt))
-#define PICO_PERF_SLEEP(ms)            PICO_PERF_IF_ENABLED(picoPerfSleep(ms))
-#define PICO_PERF_CREATE_CONTEXT()     PICO_PERF_IF_ENABLED(picoPerfCreateContext())
-#define PICO_PERF_DESTROY_CONTEXT()    PICO_PERF_IF_ENABLED(picoPerfDestroyContext())
+// Each call site interns its metadata once and caches the site id in a static, so the
+// scope name passed to PICO_PERF_PUSH_SCOPE must be constant for that call site
+#define PICO_PERF_AT_SITE(call) PICO_PERF_IF_ENABLED(do {  \
+    static uint32_t __picoPerfSite = 0;                    \
+    call;                                                  \
+} while (0))
+
+#define PICO_PERF_PUSH_SCOPE(name)           PICO_PERF_AT_SITE(picoPerfPushScopeAtSite(&__picoPerfSite, name, PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
+#define PICO_PERF_POP_SCOPE()                PICO_PERF_AT_SITE(picoPerfPopScopeAtSite(&__picoPerfSite, PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
+#define PICO_PERF_POP_N_SCOPES(n)            PICO_PERF_AT_SITE(picoPerfPopNScopesAtSite(&__picoPerfSite, n, PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
+#define PICO_PERF_COUNTER(name, value)       PICO_PERF_AT_SITE(picoPerfCounterAtSite(&__picoPerfSite, name, (double)(value), PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
+#define PICO_PERF_FLOW_BEGIN(name, id)       PICO_PERF_AT_SITE(picoPerfFlowAtSite(&__picoPerfSite, name, id, PICO_PERF_FLOW_PHASE_BEGIN, PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
+#define PICO_PERF_FLOW_STEP(name, id)        PICO_PERF_AT_SITE(picoPerfFlowAtSite(&__picoPerfSite, name, id, PICO_PERF_FLOW_PHASE_STEP, PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
+#define PICO_PERF_FLOW_END(name, id)         PICO_PERF_AT_SITE(picoPerfFlowAtSite(&__picoPerfSite, name, id, PICO_PERF_FLOW_PHASE_END, PICO_PERF_FILE, PICO_PERF_FUNC, PICO_PERF_LINE))
+#define PICO_PERF_SET_THREAD_NAME(name)      PICO_PERF_IF_ENABLED(picoPerfSetThreadName(name))
+#define PICO_PERF_BEGIN_RECORD()             PICO_PERF_IF_ENABLED(picoPerfBeginRecord())
+#define PICO_PERF_END_RECORD()               PICO_PERF_IF_ENABLED(picoPerfEndRecord())
+#define PICO_PERF_GET_REPORT(out, fmt)       PICO_PERF_IF_ENABLED(picoPerfGetReport(out, fmt))
+#define PICO_PERF_ENABLE_STATS(enabled)      PICO_PERF_IF_ENABLED(picoPerfEnableStats(enabled))
+#define PICO_PERF_GET_STATS_REPORT(out, fmt) PICO_PERF_IF_ENABLED(picoPerfGetStatsReport(out, fmt))
+#define PICO_PERF_ENABLE_ALLOCS(enabled)     PICO_PERF_IF_ENABLED(picoPerfEnableAllocationTracking(enabled))
+#define PICO_PERF_GET_ALLOC_REPORT(out, fmt) PICO_PERF_IF_ENABLED(picoPerfGetAllocationReport(out, fmt))
+#define PICO_PERF_SLEEP(ms)                  PICO_PERF_IF_ENABLED(picoPerfSleep(ms))
+#define PICO_PERF_CREATE_CONTEXT()           PICO_PERF_IF_ENABLED(picoPerfCreateContext())
+#define PICO_PERF_DESTROY_CONTEXT()          PICO_PERF_IF_ENABLED(picoPerfDestroyContext())
+
+// Define PICO_PERF_TRACK_ALLOCATIONS and include picoPerf.h before any other pico header to
+// route their PICO_MALLOC, PICO_REALLOC and PICO_FREE through picoPerf. While
+// picoPerfEnableAllocationTracking is on, every block is attributed to the innermost scope open
+// on the calling thread. Tracked blocks and picoPerf's own memory come from the allocator below.
+#ifndef PICO_PERF_SYSTEM_MALLOC
+#define PICO_PERF_SYSTEM_MALLOC(sz)       malloc(sz)
+#define PICO_PERF_SYSTEM_REALLOC(ptr, sz) realloc(ptr, sz)
+#define PICO_PERF_SYSTEM_FREE(ptr)        free(ptr)
+#endif
+
+#if defined(PICO_PERF_TRACK_ALLOCATIONS) && !defined(PICO_PERF_DISABLE)
+#if defined(PICO_MALLOC) || defined(PICO_REALLOC)
+#error "PICO_PERF_TRACK_ALLOCATIONS needs picoPerf.h included first, customize PICO_PERF_SYSTEM_MALLOC instead"
+#endif
+#define PICO_MALLOC(sz)       picoPerfMalloc(sz)
+#define PICO_FREE(ptr)        picoPerfFree(ptr)
+#define PICO_REALLOC(ptr, sz) picoPerfRealloc(ptr, sz)
+#endif
 
 #ifndef PICO_MALLOC
 #define PICO_MALLOC(sz) malloc(sz)
 #define PICO_FREE(ptr)  free(ptr)
 #endif
 
+#ifndef PICO_REALLOC
+#define PICO_REALLOC(ptr, sz) realloc(ptr, sz)
+#endif
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -86,8 +188,16 @@ typedef enum {
     PICO_PERF_REPORT_FORMAT_CSV,
     PICO_PERF_REPORT_FORMAT_JSON,
     PICO_PERF_REPORT_FORMAT_XML,
+    PICO_PERF_REPORT_FORMAT_CHROME_TRACE, // Trace Event Format, opens in chrome://tracing and Perfetto
 } picoPerfReportFormat;
 
+// Flow events link scopes across threads, e.g. a packet handed from a demuxer to a decoder
+typedef enum {
+    PICO_PERF_FLOW_PHASE_BEGIN,
+    PICO_PERF_FLOW_PHASE_STEP,
+    PICO_PERF_FLOW_PHASE_END,
+} picoPerfFlowPhase;
+
 typedef struct {
     uint16_t year;
     uint8_t month;
@@ -105,11 +215,50 @@ typedef struct {
     uint32_t line;
 } picoPerfCodeLocation_t;
 
+typedef enum {
+    PICO_PERF_HW_COUNTER_CYCLES,
+    PICO_PERF_HW_COUNTER_INSTRUCTIONS,
+    PICO_PERF_HW_COUNTER_L1D_MISSES, // L1 data cache read misses
+    PICO_PERF_HW_COUNTER_LLC_MISSES, // last level cache misses
+    PICO_PERF_HW_COUNTER_BRANCH_MISSES,
+    PICO_PERF_HW_COUNTER_COUNT,
+} picoPerfHwCounter;
+
 typedef struct picoPerfContext_t picoPerfContext_t;
 typedef picoPerfContext_t *picoPerfContext;
 
 typedef uint64_t picoPerfTime;
 
+// Aggregated durations of one push site, all times in ticks. Percentiles come from a
+// log-linear histogram and are accurate to about 3%.
+typedef struct {
+    const char *name;
+    picoPerfCodeLocation_t location;
+    uint64_t count;
+    picoPerfTime totalTime;
+    picoPerfTime meanTime;
+    picoPerfTime minTime;
+    picoPerfTime maxTime;
+    picoPerfTime p50Time;
+    picoPerfTime p99Time;
+    picoPerfTime p999Time;
+    uint64_t counters[PICO_PERF_HW_COUNTER_COUNT]; // summed over all calls, zero without PICO_PERF_HW_COUNTERS
+} picoPerfScopeStats_t;
+
+// Heap use of one push site, counting the blocks allocated while it was the innermost open
+// scope of its thread, site 0 ("unknown") collects allocations outside any scope. A
+// reallocation counts as a free at the site that owned the block and an allocation here.
+typedef struct {
+    const char *name;
+    picoPerfCodeLocation_t location;
+    uint64_t allocationCount;
+    uint64_t freeCount;
+    uint64_t bytesAllocated; // churn, every allocation counts in full
+    uint64_t bytesFreed;
+    uint64_t liveBytes;
+    uint64_t peakLiveBytes;
+} picoPerfAllocationStats_t;
+
 bool picoPerfCreateContext(void);
 void picoPerfDestroyContext(void);
 picoPerfContext picoPerfGetContext(void);
@@ -131,211 +280,1205 @@ void picoPerfEndRecord(void);
 void picoPerfPushScope(const char *name, const char *file, const char *function, uint32_t line);
 void picoPerfPopScope(const char *file, const char *function, uint32_t line);
 void picoPerfPopNScopes(int count, const char *file, const char *function, uint32_t line); // -1 for all
+
+// Same as above, but the call site is looked up once and cached in *siteCache (a zero
+// initialized static per call site), the file and function strings must outlive the context
+void picoPerfPushScopeAtSite(uint32_t *siteCache, const char *name, const char *file, const char *function, uint32_t line);
+void picoPerfPopScopeAtSite(uint32_t *siteCache, const char *file, const char *function, uint32_t line);
+void picoPerfPopNScopesAtSite(uint32_t *siteCache, int count, const char *file, const char *function, uint32_t line);
+
+// Counter samples and flow steps are recorded like scopes, only while a record is active.
+// Flow steps attach to the scope that is open on the calling thread.
+void picoPerfCounterAtSite(uint32_t *siteCache, const char *name, double value, const char *file, const char *function, uint32_t line);
+void picoPerfFlowAtSite(uint32_t *siteCache, const char *name, uint64_t id, picoPerfFlowPhase phase, const char *file, const char *function, uint32_t line);
+void picoPerfSetThreadName(const char *name); // names the calling thread's track in trace exports
+bool picoPerfHwCountersAvailable(void);       // true if the calling thread's hardware counters are running
+
+typedef enum {
+    PICO_PERF_STREAM_EVENT_SCOPE,
+    PICO_PERF_STREAM_EVENT_COUNTER,
+    PICO_PERF_STREAM_EVENT_FLOW,
+    PICO_PERF_STREAM_EVENT_DROPPED, // droppedCount events were lost because a thread buffer was full
+} picoPerfStreamEventType;
+
+// An event read back from a stream, strings stay valid for the duration of the callback only
+typedef struct {
+    picoPerfStreamEventType type;
+    const char *name;
+    const char *parentName;              // scopes only, "ROOT" at depth 0
+    picoPerfCodeLocation_t location;     // where the scope was pushed or the mark was taken
+    picoPerfCodeLocation_t endLocation;  // scopes only
+    uint64_t threadId;
+    const char *threadName;              // empty unless picoPerfSetThreadName was called
+    uint32_t depth;
+    int64_t timeNs;                      // relative to the start of the stream
+    uint64_t durationNs;                 // scopes only
+    double counterValue;
+    uint64_t flowId;
+    picoPerfFlowPhase flowPhase;
+    uint64_t droppedCount;
+    picoPerfTimeStamp timestamp;         // wall clock at timeNs
+    uint64_t counters[PICO_PERF_HW_COUNTER_COUNT]; // scopes only, zero unless written with PICO_PERF_HW_COUNTERS
+} picoPerfStreamEvent_t;
+
+typedef void (*picoPerfStreamCallback)(const picoPerfStreamEvent_t *event, void *userData);
+
+// Returns the number of bytes written, anything short of size stops the stream
+typedef size_t (*picoPerfStreamWriter)(const void *data, size_t size, void *userData);
+
+#ifdef PICO_PERF_STREAMING
+// Scopes, counters and flow steps completed on any thread are written out every
+// PICO_PERF_STREAM_FLUSH_INTERVAL_MS, independent of records. Each thread buffers at most
+// PICO_PERF_STREAM_BUFFER_SIZE entries, anything past that is dropped and counted.
+// The writer runs on the background thread, e.g. a wrapper around picoStreamWrite.
+bool picoPerfStartStreaming(picoPerfStreamWriter writer, void *userData);
+bool picoPerfStartStreamingToFile(const char *filePath);
+void picoPerfStopStreaming(void); // drains everything that was buffered before returning
+uint64_t picoPerfGetStreamDroppedCount(void);
+#endif
+
+// Reads a stream written by picoPerfStartStreaming and hands every event to callback.
+// Returns false if the file is not a picoPerf stream or ends in the middle of a block,
+// everything before the truncation has been delivered by then.
+bool picoPerfDecodeStream(const char *filePath, picoPerfStreamCallback callback, void *userData);
+
 void picoPerfGetReport(FILE *output, picoPerfReportFormat format);
 
+// Stats mode folds every completed scope into per site aggregates instead of storing it,
+// for hot loops that run millions of times. It works with or without an active record.
+void picoPerfEnableStats(bool enabled);
+void picoPerfResetStats(void);
+// Fills at most maxCount entries sorted by total time and returns the number of sites with samples
+size_t picoPerfGetStats(picoPerfScopeStats_t *stats, size_t maxCount);
+void picoPerfGetStatsReport(FILE *output, picoPerfReportFormat format); // CHROME_TRACE falls back to JSON
+
+// Tracked replacements for malloc, realloc and free, blocks carry a 16 byte header and must be
+// released through picoPerfFree or picoPerfRealloc. Blocks allocated while tracking is off or
+// before the context exists are valid but not counted.
+void *picoPerfMalloc(size_t size);
+void *picoPerfRealloc(void *ptr, size_t size); // a size of 0 frees ptr and returns NULL
+void picoPerfFree(void *ptr);
+void picoPerfEnableAllocationTracking(bool enabled);
+// Fills at most maxCount entries sorted by bytes allocated and returns the number of sites with allocations
+size_t picoPerfGetAllocationStats(picoPerfAllocationStats_t *stats, size_t maxCount);
+picoPerfAllocationStats_t picoPerfGetAllocationTotals(void); // all sites together, name is "total"
+void picoPerfGetAllocationReport(FILE *output, picoPerfReportFormat format); // CHROME_TRACE falls back to JSON
+
+// Samples the CPU time of the whole process at about frequencyHz, the kernel rounds the interval
+// up to its tick. Identical stacks are folded together as they arrive, stacks past
+// PICO_PERF_SAMPLE_MAX_STACKS are dropped and counted. Starting again clears earlier samples.
+// Returns false without PICO_PERF_SAMPLING or when something else handles SIGPROF.
+bool picoPerfStartSampling(uint32_t frequencyHz);
+void picoPerfStopSampling(void);
+uint64_t picoPerfGetSampleCount(uint64_t *droppedCount); // droppedCount may be NULL
+// Writes one "outermost;...;innermost count" line per stack, the input of flamegraph.pl
+void picoPerfWriteFoldedStacks(FILE *output);
+
+// Runs the measured operation iterations times and returns the bytes it processed, or 0
+typedef uint64_t (*picoPerfBenchFunc)(uint64_t iterations, void *userData);
+
+typedef struct {
+    double minTimeSeconds;   // iterations are calibrated so one repeat runs at least this long
+    uint32_t warmupRepeats;
+    uint32_t repeats;
+    double outlierThreshold; // repeats more than this many deviations (MAD) off the median are dropped, 0 keeps all
+    const char *filter;      // runs only benchmarks whose name contains it, NULL for all
+} picoPerfBenchConfig_t;
+
+// Times are per iteration, throughput is derived from the median
+typedef struct {
+    const char *name;
+    uint64_t iterations; // per repeat
+    uint32_t repeats;    // kept after outlier rejection
+    uint32_t rejected;
+    double medianNs;
+    double meanNs;
+    double minNs;
+    double maxNs;
+    double stddevNs;
+    double opsPerSecond;
+    double bytesPerSecond; // 0 when the benchmark reports no bytes
+} picoPerfBenchResult_t;
+
+// Benchmarks do not need a context, only the clock
+picoPerfBenchConfig_t picoPerfBenchDefaultConfig(void);
+bool picoPerfBenchRegister(const char *name, picoPerfBenchFunc func, void *userData);
+size_t picoPerfBenchRun(const picoPerfBenchConfig_t *config); // NULL for the defaults, returns the number of benchmarks run
+const picoPerfBenchResult_t *picoPerfBenchGetResults(size_t *count);
+void picoPerfBenchReport(FILE *output, picoPerfReportFormat format); // CHROME_TRACE falls back to JSON
+// Compares the last run against a JSON report of an earlier one. A benchmark whose median is
+// more than tolerance (0.1 for 10%) slower is a regression, so is one in the baseline that
+// passes the last run's filter but did not run. Returns the number of regressions, or -1 if
+// the baseline cannot be read.
+int picoPerfBenchCompare(const char *baselinePath, double tolerance, FILE *output);
+// Command line driver, arguments not starting with -- are left to the caller:
+// --filter=TEXT --repeats=N --warmup=N --min-time=SECONDS --json=PATH --baseline=PATH --tolerance=FRACTION
+// Returns 1 when no benchmark ran or on a failed baseline comparison, so a build target running
+// it fails on regressions.
+int picoPerfBenchMain(int argc, char **argv);
+
 #if defined(PICO_IMPLEMENTATION) && !defined(PICO_PERF_IMPLEMENTATION)
 #define PICO_PERF_IMPLEMENTATION
 #endif
 
 #if defined(PICO_PERF_IMPLEMENTATION) && !defined(PICO_PERF_DISABLE)
 
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #if defined(_WIN32) || defined(_WIN64)
-#define PICO_PERF_MAX_PATH MAX_PATH
 #include <Windows.h>
 #elif defined(__unix__) || defined(__APPLE__)
-#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/time.h>
-#define PICO_PERF_MAX_PATH PATH_MAX
+#include <unistd.h>
+// a pthread key destructor hands the state of an exiting thread back
+#define PICO_PERF_HAS_THREAD_EXIT
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(PICO_PERF_HW_COUNTERS)
+#include <linux/perf_event.h>
+#define PICO_PERF_HAS_HW_COUNTERS
+#endif
+#endif
 #else
 #error "Unsupported platform for picoPerf"
 #endif
 
+#if defined(PICO_PERF_SAMPLING) && defined(__linux__) && defined(__GLIBC__)
+#include <execinfo.h>
+#include <signal.h>
+#define PICO_PERF_HAS_SAMPLING
+#if (PICO_PERF_SAMPLE_MAX_STACKS & (PICO_PERF_SAMPLE_MAX_STACKS - 1)) != 0
+#error "PICO_PERF_SAMPLE_MAX_STACKS must be a power of two"
+#endif
+#endif
+
+// picoPerf's own memory never goes through the tracked allocator
+#ifdef PICO_PERF_TRACK_ALLOCATIONS
+#define __PICO_PERF_MALLOC(sz)       PICO_PERF_SYSTEM_MALLOC(sz)
+#define __PICO_PERF_REALLOC(ptr, sz) PICO_PERF_SYSTEM_REALLOC(ptr, sz)
+#define __PICO_PERF_FREE(ptr)        PICO_PERF_SYSTEM_FREE(ptr)
+#else
+#define __PICO_PERF_MALLOC(sz)       PICO_MALLOC(sz)
+#define __PICO_PERF_REALLOC(ptr, sz) PICO_REALLOC(ptr, sz)
+#define __PICO_PERF_FREE(ptr)        PICO_FREE(ptr)
+#endif
+
+#if defined(PICO_PERF_USE_TSC)
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define PICO_PERF_TSC_X86
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PICO_PERF_TSC_X86
+#elif defined(__aarch64__) && (defined(__GNUC__) || defined(__clang__))
+#define PICO_PERF_TSC_ARM64
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define PICO_PERF_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__) || defined(__clang__)
+#define PICO_PERF_THREAD_LOCAL __thread
+#else
+#define PICO_PERF_THREAD_LOCAL _Thread_local
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+#define PICO_PERF_ATOMIC_LOAD32(ptr)                     ((uint32_t)InterlockedCompareExchange((volatile LONG *)(ptr), 0, 0))
+#define PICO_PERF_ATOMIC_STORE32(ptr, value)             InterlockedExchange((volatile LONG *)(ptr), (LONG)(value))
+#define PICO_PERF_ATOMIC_ADD32(ptr, value)               ((uint32_t)InterlockedExchangeAdd((volatile LONG *)(ptr), (LONG)(value)))
+#define PICO_PERF_ATOMIC_EXCHANGE32(ptr, value)          ((uint32_t)InterlockedExchange((volatile LONG *)(ptr), (LONG)(value)))
+#define PICO_PERF_ATOMIC_LOAD_PTR(ptr)                   InterlockedCompareExchangePointer((PVOID volatile *)(ptr), NULL, NULL)
+#define PICO_PERF_ATOMIC_CAS_PTR(ptr, expected, desired) (InterlockedCompareExchangePointer((PVOID volatile *)(ptr), (desired), (expected)) == (expected))
+#define PICO_PERF_ATOMIC_STORE_PTR(ptr, value)           InterlockedExchangePointer((PVOID volatile *)(ptr), (value))
+#define PICO_PERF_ATOMIC_OR32(ptr, value)                ((uint32_t)InterlockedOr((volatile LONG *)(ptr), (LONG)(value)))
+#define PICO_PERF_ATOMIC_AND32(ptr, value)               ((uint32_t)InterlockedAnd((volatile LONG *)(ptr), (LONG)(value)))
+#define PICO_PERF_ATOMIC_ADD64(ptr, value)               ((uint64_t)InterlockedExchangeAdd64((volatile LONG64 *)(ptr), (LONG64)(value)))
+#define PICO_PERF_ATOMIC_CAS64(ptr, expected, desired)   (InterlockedCompareExchange64((volatile LONG64 *)(ptr), (LONG64)(desired), (LONG64)(expected)) == (LONG64)(expected))
+// single writer counters, aligned accesses are atomic on every Windows target
+#define PICO_PERF_RELAXED_LOAD32(ptr)                    (*(volatile uint32_t *)(ptr))
+#define PICO_PERF_RELAXED_STORE32(ptr, value)            (*(volatile uint32_t *)(ptr) = (value))
+#define PICO_PERF_RELAXED_LOAD64(ptr)                    (*(volatile uint64_t *)(ptr))
+#define PICO_PERF_RELAXED_STORE64(ptr, value)            (*(volatile uint64_t *)(ptr) = (value))
+#else
+#define PICO_PERF_ATOMIC_LOAD32(ptr)                     __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define PICO_PERF_ATOMIC_STORE32(ptr, value)             __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#define PICO_PERF_ATOMIC_ADD32(ptr, value)               __atomic_fetch_add((ptr), (value), __ATOMIC_ACQ_REL)
+#define PICO_PERF_ATOMIC_EXCHANGE32(ptr, value)          __atomic_exchange_n((ptr), (value), __ATOMIC_ACQUIRE)
+#define PICO_PERF_ATOMIC_LOAD_PTR(ptr)                   __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define PICO_PERF_ATOMIC_CAS_PTR(ptr, expected, desired) __sync_bool_compare_and_swap((ptr), (expected), (desired))
+#define PICO_PERF_ATOMIC_STORE_PTR(ptr, value)           __atomic_store_n((ptr), (value), __ATOMIC_RELEASE)
+#define PICO_PERF_ATOMIC_OR32(ptr, value)                __atomic_fetch_or((ptr), (value), __ATOMIC_ACQ_REL)
+#define PICO_PERF_ATOMIC_AND32(ptr, value)               __atomic_fetch_and((ptr), (value), __ATOMIC_ACQ_REL)
+#define PICO_PERF_ATOMIC_ADD64(ptr, value)               __atomic_fetch_add((ptr), (value), __ATOMIC_RELAXED)
+#define PICO_PERF_ATOMIC_CAS64(ptr, expected, desired)   __sync_bool_compare_and_swap((ptr), (expected), (desired))
+#define PICO_PERF_RELAXED_LOAD32(ptr)                    __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define PICO_PERF_RELAXED_STORE32(ptr, value)            __atomic_store_n((ptr), (value), __ATOMIC_RELAXED)
+#define PICO_PERF_RELAXED_LOAD64(ptr)                    __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#define PICO_PERF_RELAXED_STORE64(ptr, value)            __atomic_store_n((ptr), (value), __ATOMIC_RELAXED)
+#endif
+
+#ifdef PICO_PERF_HAS_SAMPLING
+// gregs indices are REG_RIP, REG_RSP and REG_RBP, whose names need _GNU_SOURCE
+#if defined(__x86_64__)
+#define __PICO_PERF_CONTEXT_PC(context) ((uintptr_t)(context)->uc_mcontext.gregs[16])
+#define __PICO_PERF_CONTEXT_SP(context) ((uintptr_t)(context)->uc_mcontext.gregs[15])
+#define __PICO_PERF_CONTEXT_FP(context) ((uintptr_t)(context)->uc_mcontext.gregs[10])
+#elif defined(__aarch64__)
+#define __PICO_PERF_CONTEXT_PC(context) ((uintptr_t)(context)->uc_mcontext.pc)
+#define __PICO_PERF_CONTEXT_SP(context) ((uintptr_t)(context)->uc_mcontext.sp)
+#define __PICO_PERF_CONTEXT_FP(context) ((uintptr_t)(context)->uc_mcontext.regs[29])
+#endif
+
+#if defined(PICO_PERF_SAMPLING_FRAME_POINTERS) && defined(__PICO_PERF_CONTEXT_FP)
+#define __PICO_PERF_SAMPLE_FRAME_POINTERS
+#endif
+#endif // PICO_PERF_HAS_SAMPLING
+
+#ifdef PICO_PERF_STREAMING
+#if (PICO_PERF_STREAM_BUFFER_SIZE & (PICO_PERF_STREAM_BUFFER_SIZE - 1)) != 0
+#error "PICO_PERF_STREAM_BUFFER_SIZE must be a power of two"
+#endif
+
+#if defined(_WIN32) || defined(_WIN64)
+#define PICO_PERF_THREAD_TYPE                    HANDLE
+#define PICO_PERF_THREAD_RETURN_TYPE             DWORD WINAPI
+#define PICO_PERF_THREAD_RETURN_VALUE            0
+#define PICO_PERF_THREAD_CREATE(thread, fn, arg) (((thread) = CreateThread(NULL, 0, (fn), (arg), 0, NULL)) != NULL)
+#define PICO_PERF_THREAD_JOIN(thread)            (WaitForSingleObject((thread), INFINITE), CloseHandle(thread))
+#else
+#define PICO_PERF_THREAD_TYPE                    pthread_t
+#define PICO_PERF_THREAD_RETURN_TYPE             void *
+#define PICO_PERF_THREAD_RETURN_VALUE            NULL
+#define PICO_PERF_THREAD_CREATE(thread, fn, arg) (pthread_create(&(thread), NULL, (fn), (arg)) == 0)
+#define PICO_PERF_THREAD_JOIN(thread)            pthread_join((thread), NULL)
+#endif
+#endif // PICO_PERF_STREAMING
+
+#if PICO_PERF_MAX_SITES > 65535 || PICO_PERF_MAX_DEPTH > 65535
+#error "PICO_PERF_MAX_SITES and PICO_PERF_MAX_DEPTH must fit in 16 bits"
+#endif
+
+#define PICO_PERF_SITE_BUCKETS (PICO_PERF_MAX_SITES * 2)
+
+// Interned call site, site 0 is reserved for "unknown"
 typedef struct {
-    char file[PICO_PERF_MAX_PATH];
-    char function[PICO_PERF_MAX_PATH];
+    char name[PICO_PERF_MAX_NAME_LENGTH];
+    const char *namePointer;
+    const char *file;
+    const char *function;
     uint32_t line;
-} __picoPerfRecordLocation_t;
+    uint32_t hash;
+} __picoPerfSite_t;
 
+// A completed scope, 24 bytes without hardware counters, everything else is looked up
+// through the site table
 typedef struct {
-    char name[PICO_PERF_MAX_NAME_LENGTH];
-    char parentName[PICO_PERF_MAX_NAME_LENGTH];
+    uint16_t siteId;
+    uint16_t endSiteId;
+    uint16_t parentSiteId; // 0 for root scopes
+    uint16_t depth;
     picoPerfTime startTime;
     picoPerfTime endTime;
-    __picoPerfRecordLocation_t startLocation;
-    __picoPerfRecordLocation_t endLocation;
-    picoPerfTimeStamp startTimestamp;
-    picoPerfTimeStamp endTimestamp;
-    int scopeDepth;
-} __picoPerfRecordItem_t;
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    uint64_t counters[PICO_PERF_HW_COUNTER_COUNT]; // deltas over the scope
+#endif
+} __picoPerfEvent_t;
+
+#define __PICO_PERF_MARK_COUNTER 0xFFFF
+#define __PICO_PERF_MARK_TAG     0xFFFFFFFFu
+
+// Counter sample or flow step, same size as a scope event so both share the chunk storage.
+// kind is a picoPerfFlowPhase or __PICO_PERF_MARK_COUNTER. tag overlaps the parent and depth
+// of a scope event and is always __PICO_PERF_MARK_TAG, a depth scopes never reach.
+typedef struct {
+    uint16_t siteId;
+    uint16_t kind;
+    uint32_t tag;
+    picoPerfTime time;
+    union {
+        double counterValue;
+        uint64_t flowId;
+    } value;
+} __picoPerfMark_t;
+
+typedef union {
+    __picoPerfEvent_t event;
+    __picoPerfMark_t mark;
+} __picoPerfEntry_t;
+
+typedef struct {
+    uint16_t siteId;
+    picoPerfTime startTime;
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    uint64_t counters[PICO_PERF_HW_COUNTER_COUNT];
+#endif
+} __picoPerfOpenScope_t;
+
+#define PICO_PERF_EVENT_CHUNK_SIZE 256
+
+typedef struct __picoPerfEventChunk_t {
+    __picoPerfEntry_t entries[PICO_PERF_EVENT_CHUNK_SIZE];
+    struct __picoPerfEventChunk_t *next;
+} __picoPerfEventChunk_t;
+
+// Entries of one thread for one record, appended by the owning thread only. Chunks are
+// never moved, so a reader that loads count can walk the first count events safely.
+typedef struct {
+    __picoPerfEventChunk_t *head;
+    __picoPerfEventChunk_t *tail;
+    volatile uint32_t count;
+} __picoPerfThreadRecord_t;
+
+// Log-linear histogram: values below 32 ticks get a bucket each, every power of two above
+// that is split into 16 buckets. Durations past 2^48 ticks land in the last bucket.
+#define __PICO_PERF_HISTOGRAM_SUB_BUCKETS 32
+#define __PICO_PERF_HISTOGRAM_BUCKETS     720
+
+// Aggregates of one site on one thread, written by the owning thread only
+typedef struct {
+    uint64_t count;
+    picoPerfTime totalTime;
+    picoPerfTime minTime;
+    picoPerfTime maxTime;
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    uint64_t counters[PICO_PERF_HW_COUNTER_COUNT];
+#endif
+    uint32_t buckets[__PICO_PERF_HISTOGRAM_BUCKETS];
+} __picoPerfSiteStats_t;
+
+#ifdef PICO_PERF_STREAMING
+// Single producer, single consumer ring between a thread and the stream flusher
+typedef struct {
+    volatile uint32_t head;    // written by the owning thread
+    volatile uint32_t tail;    // written by the flusher
+    volatile uint32_t dropped; // written by the owning thread
+    __picoPerfEntry_t entries[PICO_PERF_STREAM_BUFFER_SIZE];
+} __picoPerfStreamRing_t;
+#endif
+
+typedef struct __picoPerfThread_t {
+    struct __picoPerfThread_t *next;
+    uint64_t threadId;
+    uint32_t threadIndex;
+    uint32_t activeRecord; // the context activeRecord value the scope stack belongs to
+    volatile uint32_t exited; // the owner is gone, an empty state is handed to the next new thread
+    int scopeStackTop;
+    __picoPerfOpenScope_t scopeStack[PICO_PERF_MAX_DEPTH];
+    __picoPerfThreadRecord_t records[PICO_PERF_MAX_RECORDS];
+    __picoPerfThreadRecord_t marks[PICO_PERF_MAX_RECORDS];
+    char name[PICO_PERF_MAX_NAME_LENGTH]; // guarded by the site lock
+    volatile uint32_t statsEpoch;         // the context statsEpoch the stats belong to
+    __picoPerfSiteStats_t *volatile stats[PICO_PERF_MAX_SITES]; // allocated on first use
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    int hwCounterFds[PICO_PERF_HW_COUNTER_COUNT]; // -1 where the kernel refused the counter
+    uint8_t hwCounterOrder[PICO_PERF_HW_COUNTER_COUNT]; // group read position to counter
+    uint32_t hwCounterCount;
+#endif
+#ifdef PICO_PERF_STREAMING
+    __picoPerfStreamRing_t *volatile streamRing;
+    // the fields below belong to the flusher
+    uint32_t streamSession;
+    uint32_t streamDropped;
+    uint32_t streamHead;
+    picoPerfTime streamPreviousTime;
+    char streamName[PICO_PERF_MAX_NAME_LENGTH];
+#endif
+} __picoPerfThread_t;
 
 typedef struct {
     picoPerfTime startTime;
     picoPerfTime endTime;
-    __picoPerfRecordItem_t items[PICO_PERF_MAX_SCOPES];
-    size_t itemCount;
+    uint64_t startWallNs; // wall clock at startTime in nanoseconds since the unix epoch
 } __picoPerfRecord_t;
 typedef __picoPerfRecord_t *__picoPerfRecord;
 
+// A record event together with the thread that produced it, used while reporting
+typedef struct {
+    const __picoPerfEvent_t *event;
+    const __picoPerfThread_t *thread;
+    uint32_t sequence;
+} __picoPerfMergedEvent_t;
+
+#ifdef PICO_PERF_HAS_SAMPLING
+// One distinct call stack, frames[0] is the innermost. Signal handlers claim a free slot by
+// setting hash, fill in the frames and then set ready, after that only count changes.
+typedef struct {
+    volatile uint64_t hash; // 0 while the slot is free
+    volatile uint32_t ready;
+    uint32_t depth;
+    volatile uint64_t count;
+    void *frames[PICO_PERF_SAMPLE_MAX_DEPTH];
+} __picoPerfSampleStack_t;
+
+typedef struct {
+    volatile uint32_t running;
+    volatile uint32_t activeHandlers;
+    volatile uint64_t sampleCount;
+    volatile uint64_t droppedCount;
+    __picoPerfSampleStack_t stacks[PICO_PERF_SAMPLE_MAX_STACKS];
+} __picoPerfSampler_t;
+#endif
+
+#define __PICO_PERF_MODE_STREAMING   0x1
+#define __PICO_PERF_MODE_STATS       0x2
+#define __PICO_PERF_MODE_ALLOCATIONS 0x4 // keeps scope stacks current for attribution
+
+// Allocation counters of one site, shared by all threads
+typedef struct {
+    volatile uint64_t allocationCount;
+    volatile uint64_t freeCount;
+    volatile uint64_t bytesAllocated;
+    volatile uint64_t bytesFreed;
+    volatile uint64_t liveBytes;
+    volatile uint64_t peakLiveBytes;
+} __picoPerfAllocationSite_t;
+
+// Prepended to every block from picoPerfMalloc, 16 bytes so the payload keeps malloc's alignment
+typedef struct {
+    uint64_t size;
+    uint32_t siteId;
+    uint32_t generation; // context generation that counted the block, 0 if it was not counted
+} __picoPerfAllocationHeader_t;
+
 struct picoPerfContext_t {
-    __picoPerfRecord records;
+    __picoPerfRecord_t records[PICO_PERF_MAX_RECORDS];
     size_t recordHead;
     size_t recordCount;
+    volatile uint32_t activeRecord; // recordHead + 1 while recording, 0 otherwise
 
-    __picoPerfRecord_t currentRecord;
-    __picoPerfRecordItem_t scopeStack[PICO_PERF_MAX_SCOPES];
-    int scopeStackTop;
+    __picoPerfThread_t *volatile threads;
+    volatile uint32_t threadCount;
+    volatile uint32_t hwCounterThreads; // threads currently holding counter fds
+
+    __picoPerfSite_t sites[PICO_PERF_MAX_SITES];
+    uint16_t siteBuckets[PICO_PERF_SITE_BUCKETS];
+    uint32_t siteCount;
+    volatile uint32_t siteLock;
+    uint32_t generation;
 
-    bool recording;
+    volatile uint32_t modes; // __PICO_PERF_MODE_* bits
+    volatile uint32_t statsEpoch;
+
+    __picoPerfAllocationSite_t allocationSites[PICO_PERF_MAX_SITES];
+    __picoPerfAllocationSite_t allocationTotals;
+#ifdef PICO_PERF_STREAMING
+    struct __picoPerfStream_t *stream;
+    uint32_t streamSession;
+#endif
+#ifdef PICO_PERF_HAS_SAMPLING
+    __picoPerfSampler_t *sampler;
+#endif
 };
 
+typedef struct {
+    uint32_t generation;
+    __picoPerfThread_t *thread;
+} __picoPerfThreadCache_t;
+
 static picoPerfContext __picoPerfGlobalContext = NULL;
+static uint32_t __picoPerfGenerationCounter   = 0;
 
-static const char *__picoPerfEscapeString(const char *str)
-{
-    static char escaped[PICO_PERF_MAX_NAME_LENGTH * 2];
-    size_t j = 0;
-    for (size_t i = 0; str[i] != '\0' && j < sizeof(escaped) - 1; i++) {
-        if (str[i] == '\"' || str[i] == '\\') {
-            if (j < sizeof(escaped) - 2) {
-                escaped[j++] = '\\';
-                escaped[j++] = str[i];
-            } else {
-                break;
-            }
-        } else if (str[i] >= 0 && str[i] <= 0x1F) {
-            if (j < sizeof(escaped) - 7) {
-                snprintf(&escaped[j], 7, "\\u%04x", (unsigned char)str[i]);
-                j += 6;
-            } else {
-                break;
-            }
-        } else {
-            escaped[j++] = str[i];
-        }
-    }
-    escaped[j] = '\0';
-    return escaped;
-}
+static PICO_PERF_THREAD_LOCAL __picoPerfThreadCache_t __picoPerfThreadCache;
 
-static void __picoPerfGetReportText(FILE *output)
+#ifdef __PICO_PERF_SAMPLE_FRAME_POINTERS
+// glibc only declares it with _GNU_SOURCE
+extern int pthread_getattr_np(pthread_t thread, pthread_attr_t *attr);
+
+// Stack of the calling thread, the frame pointer walk in the signal handler never leaves it.
+// Both stay 0 on threads that never registered, those are not walked at all.
+static PICO_PERF_THREAD_LOCAL uintptr_t __picoPerfStackLow;
+static PICO_PERF_THREAD_LOCAL uintptr_t __picoPerfStackHigh;
+
+static void __picoPerfCacheStackBounds(void)
 {
-    if (!__picoPerfGlobalContext || !output) {
+    if (__picoPerfStackHigh != 0) {
         return;
     }
 
-    fprintf(output, "picoPerf Performance Report\n");
-    fprintf(output, "Total Records: %zu\n", __picoPerfGlobalContext->recordCount);
-
-    for (size_t recordIdx = 0; recordIdx < __picoPerfGlobalContext->recordCount; recordIdx++) {
-        __picoPerfRecord_t *record = &__picoPerfGlobalContext->records[recordIdx];
-        fprintf(output, "--- Record %zu ---\n", recordIdx + 1);
-        fprintf(output, "Items: %zu\n\n", record->itemCount);
-
-        for (size_t itemIdx = 0; itemIdx < record->itemCount; itemIdx++) {
-            __picoPerfRecordItem_t *item = &record->items[itemIdx];
-
-            for (int i = 0; i < item->scopeDepth; i++) {
-                fprintf(output, "  ");
-            }
+    pthread_attr_t attr;
+    if (pthread_getattr_np(pthread_self(), &attr) != 0) {
+        return;
+    }
+    void *base  = NULL;
+    size_t size = 0;
+    if (pthread_attr_getstack(&attr, &base, &size) == 0 && base != NULL) {
+        __picoPerfStackLow  = (uintptr_t)base;
+        __picoPerfStackHigh = (uintptr_t)base + size;
+    }
+    pthread_attr_destroy(&attr);
+}
+#endif
 
-            char durationBuf[64];
-            picoPerfFormatDuration(item->endTime - item->startTime, durationBuf, sizeof(durationBuf));
+static uint64_t __picoPerfCurrentThreadId(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    return (uint64_t)GetCurrentThreadId();
+#elif defined(__linux__)
+    return (uint64_t)syscall(SYS_gettid);
+#elif defined(__APPLE__)
+    uint64_t threadId = 0;
+    pthread_threadid_np(NULL, &threadId);
+    return threadId;
+#else
+    return (uint64_t)(uintptr_t)pthread_self();
+#endif
+}
 
-            fprintf(output, "[%zu] %s[>%s]: %s\n", itemIdx, item->name, item->parentName, durationBuf);
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} __picoPerfHwCounterEvents[PICO_PERF_HW_COUNTER_COUNT] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+};
 
-            for (int i = 0; i < item->scopeDepth; i++) {
-                fprintf(output, "  ");
-            }
-            fprintf(output, "  Start: %s:%u in %s() at %04u-%02u-%02u %02u:%02u:%02u.%03u\n",
-                    item->startLocation.file, item->startLocation.line, item->startLocation.function,
-                    item->startTimestamp.year, item->startTimestamp.month, item->startTimestamp.day,
-                    item->startTimestamp.hour, item->startTimestamp.minute, item->startTimestamp.second,
-                    item->startTimestamp.millisecond);
+// Opens the counters of the calling thread as one group, so a single read returns all of them
+static void __picoPerfOpenHwCounters(picoPerfContext context, __picoPerfThread_t *thread)
+{
+    thread->hwCounterCount = 0;
+    for (uint32_t i = 0; i < PICO_PERF_HW_COUNTER_COUNT; i++) {
+        thread->hwCounterFds[i] = -1;
+    }
+    if (PICO_PERF_ATOMIC_ADD32(&context->hwCounterThreads, 1) >= PICO_PERF_HW_COUNTER_MAX_THREADS) {
+        PICO_PERF_ATOMIC_ADD32(&context->hwCounterThreads, (uint32_t)-1);
+        return;
+    }
 
-            for (int i = 0; i < item->scopeDepth; i++) {
-                fprintf(output, "  ");
-            }
-            fprintf(output, "  End:   %s:%u in %s() at %04u-%02u-%02u %02u:%02u:%02u.%03u\n",
-                    item->endLocation.file, item->endLocation.line, item->endLocation.function,
-                    item->endTimestamp.year, item->endTimestamp.month, item->endTimestamp.day,
-                    item->endTimestamp.hour, item->endTimestamp.minute, item->endTimestamp.second,
-                    item->endTimestamp.millisecond);
+    int leader = -1;
+    for (uint32_t i = 0; i < PICO_PERF_HW_COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = __picoPerfHwCounterEvents[i].type;
+        attr.config         = __picoPerfHwCounterEvents[i].config;
+        attr.read_format    = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
 
-            for (int i = 0; i < item->scopeDepth; i++) {
-                fprintf(output, "  ");
-            }
-            fprintf(output, "  Depth: %d\n", item->scopeDepth);
+        int fd                  = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC);
+        thread->hwCounterFds[i] = fd;
+        if (fd < 0) {
+            continue;
+        }
+        if (leader < 0) {
+            leader = fd;
+        }
+        thread->hwCounterOrder[thread->hwCounterCount++] = (uint8_t)i;
+    }
+    if (thread->hwCounterCount == 0) {
+        PICO_PERF_ATOMIC_ADD32(&context->hwCounterThreads, (uint32_t)-1);
+    }
+}
 
-            fprintf(output, "\n");
+static void __picoPerfCloseHwCounters(picoPerfContext context, __picoPerfThread_t *thread)
+{
+    for (uint32_t i = 0; i < PICO_PERF_HW_COUNTER_COUNT; i++) {
+        if (thread->hwCounterFds[i] >= 0) {
+            close(thread->hwCounterFds[i]);
+            thread->hwCounterFds[i] = -1;
         }
-        fprintf(output, "\n");
+    }
+    if (thread->hwCounterCount > 0) {
+        thread->hwCounterCount = 0;
+        PICO_PERF_ATOMIC_ADD32(&context->hwCounterThreads, (uint32_t)-1);
     }
 }
 
-static void __picoPerfGetReportCSV(FILE *output)
+static void __picoPerfReadHwCounters(const __picoPerfThread_t *thread, uint64_t *counters)
 {
-    if (!__picoPerfGlobalContext || !output) {
+    uint64_t buffer[1 + PICO_PERF_HW_COUNTER_COUNT];
+    memset(counters, 0, sizeof(uint64_t) * PICO_PERF_HW_COUNTER_COUNT);
+    if (thread->hwCounterCount == 0) {
         return;
     }
 
-    fprintf(output, "RecordIndex,ItemIndex,Name,ParentName,ScopeDepth,StartTime,EndTime,DurationSeconds,DurationMilliseconds,DurationMicroseconds,DurationNanoseconds,");
-    fprintf(output, "StartFile,StartFunction,StartLine,StartTimestamp,");
-    fprintf(output, "EndFile,EndFunction,EndLine,EndTimestamp\n");
+    // the group leader is the first counter that opened
+    int leader = thread->hwCounterFds[thread->hwCounterOrder[0]];
+    ssize_t size = read(leader, buffer, sizeof(uint64_t) * (1 + thread->hwCounterCount));
+    if (size < (ssize_t)sizeof(uint64_t) || buffer[0] > thread->hwCounterCount) {
+        return;
+    }
+    for (uint64_t i = 0; i < buffer[0]; i++) {
+        counters[thread->hwCounterOrder[i]] = buffer[1 + i];
+    }
+}
+#endif
 
-    for (size_t recordIdx = 0; recordIdx < __picoPerfGlobalContext->recordCount; recordIdx++) {
-        __picoPerfRecord_t *record = &__picoPerfGlobalContext->records[recordIdx];
+static void __picoPerfLockSites(picoPerfContext context)
+{
+    while (PICO_PERF_ATOMIC_EXCHANGE32(&context->siteLock, 1) != 0) {
+    }
+}
 
-        for (size_t itemIdx = 0; itemIdx < record->itemCount; itemIdx++) {
-            __picoPerfRecordItem_t *item = &record->items[itemIdx];
+static void __picoPerfUnlockSites(picoPerfContext context)
+{
+    PICO_PERF_ATOMIC_STORE32(&context->siteLock, 0);
+}
 
-            double durationSec = picoPerfDurationSeconds(item->startTime, item->endTime);
-            double durationMs  = picoPerfDurationMilliseconds(item->startTime, item->endTime);
-            double durationUs  = picoPerfDurationMicroseconds(item->startTime, item->endTime);
-            double durationNs  = picoPerfDurationNanoseconds(item->startTime, item->endTime);
+#ifdef PICO_PERF_HAS_THREAD_EXIT
+static pthread_once_t __picoPerfThreadExitOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t __picoPerfThreadExitKey;
+static bool __picoPerfThreadExitKeyValid       = false;
 
-            fprintf(output, "%zu,%zu,\"%s\",\"%s\",%d,%llu,%llu,%.9f,%.6f,%.3f,%.0f,",
-                    recordIdx, itemIdx, __picoPerfEscapeString(item->name), __picoPerfEscapeString(item->parentName), item->scopeDepth,
-                    (unsigned long long)item->startTime, (unsigned long long)item->endTime,
-                    durationSec, durationMs, durationUs, durationNs);
+// Runs as the thread exits, its thread local cache is still intact at that point
+static void __picoPerfThreadExit(void *value)
+{
+    __picoPerfThreadCache_t *cache = (__picoPerfThreadCache_t *)value;
+    picoPerfContext context        = __picoPerfGlobalContext;
+    if (!context || !cache->thread || cache->generation != context->generation) {
+        return;
+    }
 
-            fprintf(output, "\"%s\",\"%s\",%u,\"%04u-%02u-%02u %02u:%02u:%02u.%03u\",",
-                    __picoPerfEscapeString(item->startLocation.file), __picoPerfEscapeString(item->startLocation.function), item->startLocation.line,
-                    item->startTimestamp.year, item->startTimestamp.month, item->startTimestamp.day,
-                    item->startTimestamp.hour, item->startTimestamp.minute, item->startTimestamp.second,
-                    item->startTimestamp.millisecond);
+    __picoPerfThread_t *thread = cache->thread;
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    __picoPerfCloseHwCounters(context, thread);
+#endif
+    cache->thread     = NULL;
+    cache->generation = 0;
+    PICO_PERF_ATOMIC_STORE32(&thread->exited, 1);
+}
 
-            fprintf(output, "\"%s\",\"%s\",%u,\"%04u-%02u-%02u %02u:%02u:%02u.%03u\"\n",
-                    __picoPerfEscapeString(item->endLocation.file), __picoPerfEscapeString(item->endLocation.function), item->endLocation.line,
-                    item->endTimestamp.year, item->endTimestamp.month, item->endTimestamp.day,
-                    item->endTimestamp.hour, item->endTimestamp.minute, item->endTimestamp.second,
-                    item->endTimestamp.millisecond);
+static void __picoPerfCreateThreadExitKey(void)
+{
+    __picoPerfThreadExitKeyValid = pthread_key_create(&__picoPerfThreadExitKey, __picoPerfThreadExit) == 0;
+}
+
+// An exited state that never recorded anything can be handed over as is, the ones holding
+// events or stats stay with their thread id for the reports
+static __picoPerfThread_t *__picoPerfAdoptExitedThread(picoPerfContext context)
+{
+    for (__picoPerfThread_t *thread = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads); thread; thread = thread->next) {
+        if (PICO_PERF_ATOMIC_LOAD32(&thread->exited) == 0) {
+            continue;
+        }
+        bool empty = true;
+        for (size_t i = 0; i < PICO_PERF_MAX_RECORDS && empty; i++) {
+            empty = thread->records[i].count == 0 && thread->marks[i].count == 0;
+        }
+        for (size_t i = 0; i < PICO_PERF_MAX_SITES && empty; i++) {
+            empty = thread->stats[i] == NULL;
+        }
+#ifdef PICO_PERF_STREAMING
+        empty = empty && thread->streamRing == NULL;
+#endif
+        // a concurrent adopter that got there first leaves exited at 0
+        if (empty && PICO_PERF_ATOMIC_EXCHANGE32(&thread->exited, 0) == 1) {
+            return thread;
         }
     }
+    return NULL;
 }
+#endif
 
-static void __picoPerfGetReportJSON(FILE *output)
+// Slow path, runs once per thread and context. Thread states live until the context is
+// destroyed, but with thread exit hooks an empty state is reused by the next new thread.
+static __picoPerfThread_t *__picoPerfRegisterThread(picoPerfContext context)
 {
-    if (!__picoPerfGlobalContext || !output) {
-        return;
+    __picoPerfThread_t *thread = NULL;
+#ifdef PICO_PERF_HAS_THREAD_EXIT
+    pthread_once(&__picoPerfThreadExitOnce, __picoPerfCreateThreadExitKey);
+    thread = __picoPerfAdoptExitedThread(context);
+    if (thread) {
+        __picoPerfLockSites(context);
+        thread->name[0] = '\0';
+        __picoPerfUnlockSites(context);
+        thread->activeRecord  = 0;
+        thread->scopeStackTop = 0;
+        thread->threadId      = __picoPerfCurrentThreadId();
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        __picoPerfOpenHwCounters(context, thread);
+#endif
     }
+#endif
+    if (!thread) {
+        thread = (__picoPerfThread_t *)__PICO_PERF_MALLOC(sizeof(__picoPerfThread_t));
+        if (!thread) {
+            return NULL;
+        }
+        memset(thread, 0, sizeof(__picoPerfThread_t));
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        __picoPerfOpenHwCounters(context, thread);
+#endif
+        thread->threadId    = __picoPerfCurrentThreadId();
+        thread->threadIndex = PICO_PERF_ATOMIC_ADD32(&context->threadCount, 1);
 
-    fprintf(output, "{\n");
-    fprintf(output, "  \"totalRecords\": %zu,\n", __picoPerfGlobalContext->recordCount);
-    fprintf(output, "  \"records\": [\n");
+        __picoPerfThread_t *head;
+        do {
+            head         = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads);
+            thread->next = head;
+        } while (!PICO_PERF_ATOMIC_CAS_PTR(&context->threads, head, thread));
+    }
+
+    __picoPerfThreadCache.generation = context->generation;
+    __picoPerfThreadCache.thread     = thread;
+#ifdef __PICO_PERF_SAMPLE_FRAME_POINTERS
+    __picoPerfCacheStackBounds();
+#endif
+#ifdef PICO_PERF_HAS_THREAD_EXIT
+    if (__picoPerfThreadExitKeyValid) {
+        pthread_setspecific(__picoPerfThreadExitKey, &__picoPerfThreadCache);
+    }
+#endif
+    return thread;
+}
+
+static inline __picoPerfThread_t *__picoPerfGetThread(picoPerfContext context)
+{
+    if (__picoPerfThreadCache.generation == context->generation) {
+        return __picoPerfThreadCache.thread;
+    }
+    return __picoPerfRegisterThread(context);
+}
+
+static uint32_t __picoPerfHashString(uint32_t hash, const char *str)
+{
+    while (*str) {
+        hash ^= (uint8_t)*str++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint16_t __picoPerfInternSite(const char *name, const char *file, const char *function, uint32_t line)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+
+    name     = name ? name : "";
+    file     = file ? file : "unknown";
+    function = function ? function : "unknown";
+
+    uint32_t hash = __picoPerfHashString(2166136261u, name);
+    hash          = __picoPerfHashString(hash, function);
+    hash          = (hash ^ line) * 16777619u;
+
+    uint32_t bucket = hash % PICO_PERF_SITE_BUCKETS;
+    while (context->siteBuckets[bucket] != 0) {
+        __picoPerfSite_t *site = &context->sites[context->siteBuckets[bucket]];
+        if (site->hash == hash && site->line == line &&
+            strncmp(site->name, name, PICO_PERF_MAX_NAME_LENGTH - 1) == 0 &&
+            strcmp(site->function, function) == 0 && strcmp(site->file, file) == 0) {
+            return context->siteBuckets[bucket];
+        }
+        bucket = (bucket + 1) % PICO_PERF_SITE_BUCKETS;
+    }
+
+    if (context->siteCount >= PICO_PERF_MAX_SITES) {
+        return 0;
+    }
+
+    uint16_t siteId        = (uint16_t)context->siteCount++;
+    __picoPerfSite_t *site = &context->sites[siteId];
+    strncpy(site->name, name, PICO_PERF_MAX_NAME_LENGTH - 1);
+    site->namePointer            = name;
+    site->file                   = file;
+    site->function               = function;
+    site->line                   = line;
+    site->hash                   = hash;
+    context->siteBuckets[bucket] = siteId;
+    return siteId;
+}
+
+// Cache layout is (generation << 16) | siteId so caches from an older context are ignored
+static uint16_t __picoPerfResolveSite(uint32_t *siteCache, const char *name, const char *file, const char *function, uint32_t line)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    uint32_t cached         = siteCache ? PICO_PERF_ATOMIC_LOAD32(siteCache) : 0;
+
+    if ((cached >> 16) == context->generation) {
+        uint16_t siteId = (uint16_t)(cached & 0xFFFF);
+        if (!name || context->sites[siteId].namePointer == name) {
+            return siteId;
+        }
+    }
+
+    __picoPerfLockSites(context);
+    uint16_t siteId = __picoPerfInternSite(name, file, function, line);
+    __picoPerfUnlockSites(context);
+
+    if (siteCache && siteId != 0) {
+        PICO_PERF_ATOMIC_STORE32(siteCache, (context->generation << 16) | siteId);
+    }
+    return siteId;
+}
+
+static uint64_t __picoPerfWallClockNanoseconds(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    FILETIME ft;
+    GetSystemTimeAsFileTime(&ft);
+    uint64_t ticks = ((uint64_t)ft.dwHighDateTime << 32) | (uint64_t)ft.dwLowDateTime;
+    return (ticks - 116444736000000000ULL) * 100ULL;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static picoPerfTimeStamp __picoPerfTimestampFromWallClock(uint64_t nanoseconds)
+{
+    picoPerfTimeStamp ts = {0};
+#if defined(_WIN32) || defined(_WIN64)
+    uint64_t ticks = nanoseconds / 100ULL + 116444736000000000ULL;
+    FILETIME ft, localFt;
+    SYSTEMTIME st;
+    ft.dwLowDateTime  = (DWORD)(ticks & 0xFFFFFFFF);
+    ft.dwHighDateTime = (DWORD)(ticks >> 32);
+    FileTimeToLocalFileTime(&ft, &localFt);
+    FileTimeToSystemTime(&localFt, &st);
+    ts.year   = st.wYear;
+    ts.month  = (uint8_t)st.wMonth;
+    ts.day    = (uint8_t)st.wDay;
+    ts.hour   = (uint8_t)st.wHour;
+    ts.minute = (uint8_t)st.wMinute;
+    ts.second = (uint8_t)st.wSecond;
+#else
+    time_t seconds = (time_t)(nanoseconds / 1000000000ULL);
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    ts.year   = (uint16_t)(tm.tm_year + 1900);
+    ts.month  = (uint8_t)(tm.tm_mon + 1);
+    ts.day    = (uint8_t)tm.tm_mday;
+    ts.hour   = (uint8_t)tm.tm_hour;
+    ts.minute = (uint8_t)tm.tm_min;
+    ts.second = (uint8_t)tm.tm_sec;
+#endif
+    ts.millisecond = (uint16_t)((nanoseconds / 1000000ULL) % 1000ULL);
+    ts.nanosecond  = (uint32_t)(nanoseconds % 1000000ULL);
+    return ts;
+}
+
+static uint64_t __picoPerfTicksToNanoseconds(picoPerfTime ticks)
+{
+    uint64_t freq = picoPerfFrequency();
+    if (freq == 1000000000ULL || freq == 0) {
+        return ticks;
+    }
+    return (ticks / freq) * 1000000000ULL + ((ticks % freq) * 1000000000ULL) / freq;
+}
+
+// Wall clock timestamps are derived from the record anchor at report time only
+static picoPerfTimeStamp __picoPerfRecordTimestamp(const __picoPerfRecord_t *record, picoPerfTime time)
+{
+    return __picoPerfTimestampFromWallClock(record->startWallNs + __picoPerfTicksToNanoseconds(time - record->startTime));
+}
+
+static const char *__picoPerfParentName(const __picoPerfEvent_t *item)
+{
+    return item->parentSiteId ? __picoPerfGlobalContext->sites[item->parentSiteId].name : "ROOT";
+}
+
+static int __picoPerfCompareMergedEvents(const void *a, const void *b)
+{
+    const __picoPerfMergedEvent_t *left  = (const __picoPerfMergedEvent_t *)a;
+    const __picoPerfMergedEvent_t *right = (const __picoPerfMergedEvent_t *)b;
+
+    if (left->event->endTime != right->event->endTime) {
+        return left->event->endTime < right->event->endTime ? -1 : 1;
+    }
+    if (left->thread->threadIndex != right->thread->threadIndex) {
+        return left->thread->threadIndex < right->thread->threadIndex ? -1 : 1;
+    }
+    return left->sequence < right->sequence ? -1 : (left->sequence > right->sequence ? 1 : 0);
+}
+
+// Gathers the events every thread produced for a record, in the order the scopes ended.
+// The result must be freed with __PICO_PERF_FREE.
+static __picoPerfMergedEvent_t *__picoPerfMergeRecord(size_t recordIdx, size_t *count)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    *count                  = 0;
+
+    size_t capacity = 0;
+    for (__picoPerfThread_t *thread = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads); thread; thread = thread->next) {
+        capacity += PICO_PERF_ATOMIC_LOAD32(&thread->records[recordIdx].count);
+    }
+    if (capacity == 0) {
+        return NULL;
+    }
+
+    __picoPerfMergedEvent_t *merged = (__picoPerfMergedEvent_t *)__PICO_PERF_MALLOC(sizeof(__picoPerfMergedEvent_t) * capacity);
+    if (!merged) {
+        return NULL;
+    }
+
+    for (__picoPerfThread_t *thread = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads); thread; thread = thread->next) {
+        __picoPerfThreadRecord_t *record = &thread->records[recordIdx];
+        uint32_t eventCount              = PICO_PERF_ATOMIC_LOAD32(&record->count);
+        __picoPerfEventChunk_t *chunk    = record->head;
+
+        for (uint32_t i = 0; i < eventCount && *count < capacity; i++) {
+            if (i > 0 && i % PICO_PERF_EVENT_CHUNK_SIZE == 0) {
+                chunk = chunk->next;
+            }
+            merged[*count].event    = &chunk->entries[i % PICO_PERF_EVENT_CHUNK_SIZE].event;
+            merged[*count].thread   = thread;
+            merged[*count].sequence = i;
+            (*count)++;
+        }
+    }
+
+    qsort(merged, *count, sizeof(__picoPerfMergedEvent_t), __picoPerfCompareMergedEvents);
+    return merged;
+}
+
+static const char *__picoPerfEscapeString(const char *str)
+{
+    static char escaped[PICO_PERF_MAX_NAME_LENGTH * 2];
+    size_t j = 0;
+    for (size_t i = 0; str[i] != '\0' && j < sizeof(escaped) - 1; i++) {
+        if (str[i] == '\"' || str[i] == '\\') {
+            if (j < sizeof(escaped) - 2) {
+                escaped[j++] = '\\';
+                escaped[j++] = str[i];
+            } else {
+                break;
+            }
+        } else if (str[i] >= 0 && str[i] <= 0x1F) {
+            if (j < sizeof(escaped) - 7) {
+                snprintf(&escaped[j], 7, "\\u%04x", (unsigned char)str[i]);
+                j += 6;
+            } else {
+                break;
+            }
+        } else {
+            escaped[j++] = str[i];
+        }
+    }
+    escaped[j] = '\0';
+    return escaped;
+}
+
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+// Writes the counters of a scope, or the sums of a site, with IPC and misses per thousand
+// instructions (MPKI)
+static void __picoPerfWriteCounters(FILE *output, const uint64_t *counters, picoPerfReportFormat format, const char *indent)
+{
+    unsigned long long cycles       = (unsigned long long)counters[PICO_PERF_HW_COUNTER_CYCLES];
+    unsigned long long instructions = (unsigned long long)counters[PICO_PERF_HW_COUNTER_INSTRUCTIONS];
+    unsigned long long l1dMisses    = (unsigned long long)counters[PICO_PERF_HW_COUNTER_L1D_MISSES];
+    unsigned long long llcMisses    = (unsigned long long)counters[PICO_PERF_HW_COUNTER_LLC_MISSES];
+    unsigned long long branchMisses = (unsigned long long)counters[PICO_PERF_HW_COUNTER_BRANCH_MISSES];
+    double ipc                      = cycles ? (double)instructions / (double)cycles : 0.0;
+    double perKilo                  = instructions ? 1000.0 / (double)instructions : 0.0;
+
+    switch (format) {
+        case PICO_PERF_REPORT_FORMAT_TEXT:
+            fprintf(output, "%s  Counters: %llu cycles, %llu instructions, IPC %.2f\n", indent, cycles, instructions, ipc);
+            fprintf(output, "%s  Misses: L1D %llu (%.2f MPKI), LLC %llu (%.2f MPKI), branch %llu (%.2f MPKI)\n", indent,
+                    l1dMisses, (double)l1dMisses * perKilo, llcMisses, (double)llcMisses * perKilo,
+                    branchMisses, (double)branchMisses * perKilo);
+            break;
+        case PICO_PERF_REPORT_FORMAT_CSV:
+            fprintf(output, ",%llu,%llu,%.4f,%llu,%.4f,%llu,%.4f,%llu,%.4f", cycles, instructions, ipc,
+                    l1dMisses, (double)l1dMisses * perKilo, llcMisses, (double)llcMisses * perKilo,
+                    branchMisses, (double)branchMisses * perKilo);
+            break;
+        case PICO_PERF_REPORT_FORMAT_JSON:
+            fprintf(output, "%s\"counters\": {\n", indent);
+            fprintf(output, "%s  \"cycles\": %llu,\n", indent, cycles);
+            fprintf(output, "%s  \"instructions\": %llu,\n", indent, instructions);
+            fprintf(output, "%s  \"ipc\": %.4f,\n", indent, ipc);
+            fprintf(output, "%s  \"l1dMisses\": %llu,\n", indent, l1dMisses);
+            fprintf(output, "%s  \"l1dMpki\": %.4f,\n", indent, (double)l1dMisses * perKilo);
+            fprintf(output, "%s  \"llcMisses\": %llu,\n", indent, llcMisses);
+            fprintf(output, "%s  \"llcMpki\": %.4f,\n", indent, (double)llcMisses * perKilo);
+            fprintf(output, "%s  \"branchMisses\": %llu,\n", indent, branchMisses);
+            fprintf(output, "%s  \"branchMpki\": %.4f\n", indent, (double)branchMisses * perKilo);
+            fprintf(output, "%s},\n", indent);
+            break;
+        case PICO_PERF_REPORT_FORMAT_XML:
+            fprintf(output, "%s<Counters>\n", indent);
+            fprintf(output, "%s  <Cycles>%llu</Cycles>\n", indent, cycles);
+            fprintf(output, "%s  <Instructions>%llu</Instructions>\n", indent, instructions);
+            fprintf(output, "%s  <IPC>%.4f</IPC>\n", indent, ipc);
+            fprintf(output, "%s  <L1DMisses>%llu</L1DMisses>\n", indent, l1dMisses);
+            fprintf(output, "%s  <L1DMPKI>%.4f</L1DMPKI>\n", indent, (double)l1dMisses * perKilo);
+            fprintf(output, "%s  <LLCMisses>%llu</LLCMisses>\n", indent, llcMisses);
+            fprintf(output, "%s  <LLCMPKI>%.4f</LLCMPKI>\n", indent, (double)llcMisses * perKilo);
+            fprintf(output, "%s  <BranchMisses>%llu</BranchMisses>\n", indent, branchMisses);
+            fprintf(output, "%s  <BranchMPKI>%.4f</BranchMPKI>\n", indent, (double)branchMisses * perKilo);
+            fprintf(output, "%s</Counters>\n", indent);
+            break;
+        case PICO_PERF_REPORT_FORMAT_CHROME_TRACE:
+            fprintf(output, ",\"cycles\":%llu,\"instructions\":%llu,\"ipc\":%.4f,\"l1dMisses\":%llu,\"llcMisses\":%llu,\"branchMisses\":%llu",
+                    cycles, instructions, ipc, l1dMisses, llcMisses, branchMisses);
+            break;
+    }
+}
+#endif
+
+static void __picoPerfGetReportText(FILE *output)
+{
+    if (!__picoPerfGlobalContext || !output) {
+        return;
+    }
+
+    fprintf(output, "picoPerf Performance Report\n");
+    fprintf(output, "Total Records: %zu\n", __picoPerfGlobalContext->recordCount);
+
+    for (size_t recordIdx = 0; recordIdx < __picoPerfGlobalContext->recordCount; recordIdx++) {
+        __picoPerfRecord_t *record     = &__picoPerfGlobalContext->records[recordIdx];
+        size_t itemCount               = 0;
+        __picoPerfMergedEvent_t *items = __picoPerfMergeRecord(recordIdx, &itemCount);
+        fprintf(output, "--- Record %zu ---\n", recordIdx + 1);
+        fprintf(output, "Items: %zu\n\n", itemCount);
+
+        for (size_t itemIdx = 0; itemIdx < itemCount; itemIdx++) {
+            const __picoPerfEvent_t *item     = items[itemIdx].event;
+            unsigned long long threadId       = (unsigned long long)items[itemIdx].thread->threadId;
+            const __picoPerfSite_t *site      = &__picoPerfGlobalContext->sites[item->siteId];
+            const __picoPerfSite_t *endSite   = &__picoPerfGlobalContext->sites[item->endSiteId];
+            picoPerfTimeStamp startTimestamp = __picoPerfRecordTimestamp(record, item->startTime);
+            picoPerfTimeStamp endTimestamp   = __picoPerfRecordTimestamp(record, item->endTime);
+            int scopeDepth                   = (int)item->depth;
+
+            for (int i = 0; i < scopeDepth; i++) {
+                fprintf(output, "  ");
+            }
+
+            char durationBuf[64];
+            picoPerfFormatDuration(item->endTime - item->startTime, durationBuf, sizeof(durationBuf));
+
+            fprintf(output, "[%zu] %s[>%s]: %s\n", itemIdx, site->name, __picoPerfParentName(item), durationBuf);
+
+            for (int i = 0; i < scopeDepth; i++) {
+                fprintf(output, "  ");
+            }
+            fprintf(output, "  Start: %s:%u in %s() at %04u-%02u-%02u %02u:%02u:%02u.%03u\n",
+                    site->file, site->line, site->function,
+                    startTimestamp.year, startTimestamp.month, startTimestamp.day,
+                    startTimestamp.hour, startTimestamp.minute, startTimestamp.second,
+                    startTimestamp.millisecond);
+
+            for (int i = 0; i < scopeDepth; i++) {
+                fprintf(output, "  ");
+            }
+            fprintf(output, "  End:   %s:%u in %s() at %04u-%02u-%02u %02u:%02u:%02u.%03u\n",
+                    endSite->file, endSite->line, endSite->function,
+                    endTimestamp.year, endTimestamp.month, endTimestamp.day,
+                    endTimestamp.hour, endTimestamp.minute, endTimestamp.second,
+                    endTimestamp.millisecond);
+
+            for (int i = 0; i < scopeDepth; i++) {
+                fprintf(output, "  ");
+            }
+            fprintf(output, "  Depth: %d\n", scopeDepth);
+
+            for (int i = 0; i < scopeDepth; i++) {
+                fprintf(output, "  ");
+            }
+            fprintf(output, "  Thread: %llu\n", threadId);
+
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+            char indent[64];
+            snprintf(indent, sizeof(indent), "%*s", scopeDepth < 31 ? scopeDepth * 2 : 62, "");
+            __picoPerfWriteCounters(output, item->counters, PICO_PERF_REPORT_FORMAT_TEXT, indent);
+#endif
+
+            fprintf(output, "\n");
+        }
+        fprintf(output, "\n");
+        __PICO_PERF_FREE(items);
+    }
+}
+
+static void __picoPerfGetReportCSV(FILE *output)
+{
+    if (!__picoPerfGlobalContext || !output) {
+        return;
+    }
+
+    fprintf(output, "RecordIndex,ItemIndex,Name,ParentName,ScopeDepth,StartTime,EndTime,DurationSeconds,DurationMilliseconds,DurationMicroseconds,DurationNanoseconds,");
+    fprintf(output, "StartFile,StartFunction,StartLine,StartTimestamp,");
+    fprintf(output, "EndFile,EndFunction,EndLine,EndTimestamp,ThreadId");
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    fprintf(output, ",Cycles,Instructions,IPC,L1DMisses,L1DMPKI,LLCMisses,LLCMPKI,BranchMisses,BranchMPKI");
+#endif
+    fprintf(output, "\n");
+
+    for (size_t recordIdx = 0; recordIdx < __picoPerfGlobalContext->recordCount; recordIdx++) {
+        __picoPerfRecord_t *record     = &__picoPerfGlobalContext->records[recordIdx];
+        size_t itemCount               = 0;
+        __picoPerfMergedEvent_t *items = __picoPerfMergeRecord(recordIdx, &itemCount);
+
+        for (size_t itemIdx = 0; itemIdx < itemCount; itemIdx++) {
+            const __picoPerfEvent_t *item     = items[itemIdx].event;
+            unsigned long long threadId       = (unsigned long long)items[itemIdx].thread->threadId;
+            const __picoPerfSite_t *site      = &__picoPerfGlobalContext->sites[item->siteId];
+            const __picoPerfSite_t *endSite   = &__picoPerfGlobalContext->sites[item->endSiteId];
+            picoPerfTimeStamp startTimestamp = __picoPerfRecordTimestamp(record, item->startTime);
+            picoPerfTimeStamp endTimestamp   = __picoPerfRecordTimestamp(record, item->endTime);
+            int scopeDepth                   = (int)item->depth;
+
+            double durationSec = picoPerfDurationSeconds(item->startTime, item->endTime);
+            double durationMs  = picoPerfDurationMilliseconds(item->startTime, item->endTime);
+            double durationUs  = picoPerfDurationMicroseconds(item->startTime, item->endTime);
+            double durationNs  = picoPerfDurationNanoseconds(item->startTime, item->endTime);
+
+            fprintf(output, "%zu,%zu,\"%s\",\"%s\",%d,%llu,%llu,%.9f,%.6f,%.3f,%.0f,",
+                    recordIdx, itemIdx, __picoPerfEscapeString(site->name), __picoPerfEscapeString(__picoPerfParentName(item)), scopeDepth,
+                    (unsigned long long)item->startTime, (unsigned long long)item->endTime,
+                    durationSec, durationMs, durationUs, durationNs);
+
+            fprintf(output, "\"%s\",\"%s\",%u,\"%04u-%02u-%02u %02u:%02u:%02u.%03u\",",
+                    __picoPerfEscapeString(site->file), __picoPerfEscapeString(site->function), site->line,
+                    startTimestamp.year, startTimestamp.month, startTimestamp.day,
+                    startTimestamp.hour, startTimestamp.minute, startTimestamp.second,
+                    startTimestamp.millisecond);
+
+            fprintf(output, "\"%s\",\"%s\",%u,\"%04u-%02u-%02u %02u:%02u:%02u.%03u\",%llu",
+                    __picoPerfEscapeString(endSite->file), __picoPerfEscapeString(endSite->function), endSite->line,
+                    endTimestamp.year, endTimestamp.month, endTimestamp.day,
+                    endTimestamp.hour, endTimestamp.minute, endTimestamp.second,
+                    endTimestamp.millisecond, threadId);
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+            __picoPerfWriteCounters(output, item->counters, PICO_PERF_REPORT_FORMAT_CSV, "");
+#endif
+            fprintf(output, "\n");
+        }
+        __PICO_PERF_FREE(items);
+    }
+}
+
+static void __picoPerfGetReportJSON(FILE *output)
+{
+    if (!__picoPerfGlobalContext || !output) {
+        return;
+    }
+
+    fprintf(output, "{\n");
+    fprintf(output, "  \"totalRecords\": %zu,\n", __picoPerfGlobalContext->recordCount);
+    fprintf(output, "  \"records\": [\n");
 
     for (size_t recordIdx = 0; recordIdx < __picoPerfGlobalContext->recordCount; recordIdx++) {
-        __picoPerfRecord_t *record = &__picoPerfGlobalContext->records[recordIdx];
+        __picoPerfRecord_t *record     = &__picoPerfGlobalContext->records[recordIdx];
+        size_t itemCount               = 0;
+        __picoPerfMergedEvent_t *items = __picoPerfMergeRecord(recordIdx, &itemCount);
 
         fprintf(output, "    {\n");
         fprintf(output, "      \"recordIndex\": %zu,\n", recordIdx);
-        fprintf(output, "      \"itemCount\": %zu,\n", record->itemCount);
+        fprintf(output, "      \"itemCount\": %zu,\n", itemCount);
         fprintf(output, "      \"items\": [\n");
 
-        for (size_t itemIdx = 0; itemIdx < record->itemCount; itemIdx++) {
-            __picoPerfRecordItem_t *item = &record->items[itemIdx];
+        for (size_t itemIdx = 0; itemIdx < itemCount; itemIdx++) {
+            const __picoPerfEvent_t *item     = items[itemIdx].event;
+            unsigned long long threadId       = (unsigned long long)items[itemIdx].thread->threadId;
+            const __picoPerfSite_t *site      = &__picoPerfGlobalContext->sites[item->siteId];
+            const __picoPerfSite_t *endSite   = &__picoPerfGlobalContext->sites[item->endSiteId];
+            picoPerfTimeStamp startTimestamp = __picoPerfRecordTimestamp(record, item->startTime);
+            picoPerfTimeStamp endTimestamp   = __picoPerfRecordTimestamp(record, item->endTime);
+            int scopeDepth                   = (int)item->depth;
 
             double durationSec = picoPerfDurationSeconds(item->startTime, item->endTime);
             double durationMs  = picoPerfDurationMilliseconds(item->startTime, item->endTime);
@@ -344,9 +1487,13 @@ static void __picoPerfGetReportJSON(FILE *output)
 
             fprintf(output, "        {\n");
             fprintf(output, "          \"itemIndex\": %zu,\n", itemIdx);
-            fprintf(output, "          \"name\": \"%s\",\n", __picoPerfEscapeString(item->name));
-            fprintf(output, "          \"parentName\": \"%s\",\n", __picoPerfEscapeString(item->parentName));
-            fprintf(output, "          \"scopeDepth\": %d,\n", item->scopeDepth);
+            fprintf(output, "          \"name\": \"%s\",\n", __picoPerfEscapeString(site->name));
+            fprintf(output, "          \"parentName\": \"%s\",\n", __picoPerfEscapeString(__picoPerfParentName(item)));
+            fprintf(output, "          \"scopeDepth\": %d,\n", scopeDepth);
+            fprintf(output, "          \"threadId\": %llu,\n", threadId);
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+            __picoPerfWriteCounters(output, item->counters, PICO_PERF_REPORT_FORMAT_JSON, "          ");
+#endif
             fprintf(output, "          \"startTime\": %llu,\n", (unsigned long long)item->startTime);
             fprintf(output, "          \"endTime\": %llu,\n", (unsigned long long)item->endTime);
             fprintf(output, "          \"duration\": {\n");
@@ -356,27 +1503,28 @@ static void __picoPerfGetReportJSON(FILE *output)
             fprintf(output, "            \"nanoseconds\": %.0f\n", durationNs);
             fprintf(output, "          },\n");
             fprintf(output, "          \"start\": {\n");
-            fprintf(output, "            \"file\": \"%s\",\n", __picoPerfEscapeString(item->startLocation.file));
-            fprintf(output, "            \"function\": \"%s\",\n", __picoPerfEscapeString(item->startLocation.function));
-            fprintf(output, "            \"line\": %u,\n", item->startLocation.line);
+            fprintf(output, "            \"file\": \"%s\",\n", __picoPerfEscapeString(site->file));
+            fprintf(output, "            \"function\": \"%s\",\n", __picoPerfEscapeString(site->function));
+            fprintf(output, "            \"line\": %u,\n", site->line);
             fprintf(output, "            \"timestamp\": \"%04u-%02u-%02u %02u:%02u:%02u.%03u\"\n",
-                    item->startTimestamp.year, item->startTimestamp.month, item->startTimestamp.day,
-                    item->startTimestamp.hour, item->startTimestamp.minute, item->startTimestamp.second,
-                    item->startTimestamp.millisecond);
+                    startTimestamp.year, startTimestamp.month, startTimestamp.day,
+                    startTimestamp.hour, startTimestamp.minute, startTimestamp.second,
+                    startTimestamp.millisecond);
             fprintf(output, "          },\n");
             fprintf(output, "          \"end\": {\n");
-            fprintf(output, "            \"file\": \"%s\",\n", __picoPerfEscapeString(item->endLocation.file));
-            fprintf(output, "            \"function\": \"%s\",\n", __picoPerfEscapeString(item->endLocation.function));
-            fprintf(output, "            \"line\": %u,\n", item->endLocation.line);
+            fprintf(output, "            \"file\": \"%s\",\n", __picoPerfEscapeString(endSite->file));
+            fprintf(output, "            \"function\": \"%s\",\n", __picoPerfEscapeString(endSite->function));
+            fprintf(output, "            \"line\": %u,\n", endSite->line);
             fprintf(output, "            \"timestamp\": \"%04u-%02u-%02u %02u:%02u:%02u.%03u\"\n",
-                    item->endTimestamp.year, item->endTimestamp.month, item->endTimestamp.day,
-                    item->endTimestamp.hour, item->endTimestamp.minute, item->endTimestamp.second,
-                    item->endTimestamp.millisecond);
+                    endTimestamp.year, endTimestamp.month, endTimestamp.day,
+                    endTimestamp.hour, endTimestamp.minute, endTimestamp.second,
+                    endTimestamp.millisecond);
             fprintf(output, "          }\n");
-            fprintf(output, "        }%s\n", (itemIdx < record->itemCount - 1) ? "," : "");
+            fprintf(output, "        }%s\n", (itemIdx < itemCount - 1) ? "," : "");
         }
 
         fprintf(output, "      ]\n");
+        __PICO_PERF_FREE(items);
         fprintf(output, "    }%s\n", (recordIdx < __picoPerfGlobalContext->recordCount - 1) ? "," : "");
     }
 
@@ -398,364 +1546,2799 @@ static void __picoPerfGetReportXML(FILE *output)
     fprintf(output, "  <Records>\n");
 
     for (size_t recordIdx = 0; recordIdx < __picoPerfGlobalContext->recordCount; recordIdx++) {
-        __picoPerfRecord_t *record = &__picoPerfGlobalContext->records[recordIdx];
+        __picoPerfRecord_t *record     = &__picoPerfGlobalContext->records[recordIdx];
+        size_t itemCount               = 0;
+        __picoPerfMergedEvent_t *items = __picoPerfMergeRecord(recordIdx, &itemCount);
 
         fprintf(output, "    <Record index=\"%zu\">\n", recordIdx);
-        fprintf(output, "      <ItemCount>%zu</ItemCount>\n", record->itemCount);
+        fprintf(output, "      <ItemCount>%zu</ItemCount>\n", itemCount);
         fprintf(output, "      <Items>\n");
 
-        for (size_t itemIdx = 0; itemIdx < record->itemCount; itemIdx++) {
-            __picoPerfRecordItem_t *item = &record->items[itemIdx];
+        for (size_t itemIdx = 0; itemIdx < itemCount; itemIdx++) {
+            const __picoPerfEvent_t *item     = items[itemIdx].event;
+            unsigned long long threadId       = (unsigned long long)items[itemIdx].thread->threadId;
+            const __picoPerfSite_t *site      = &__picoPerfGlobalContext->sites[item->siteId];
+            const __picoPerfSite_t *endSite   = &__picoPerfGlobalContext->sites[item->endSiteId];
+            picoPerfTimeStamp startTimestamp = __picoPerfRecordTimestamp(record, item->startTime);
+            picoPerfTimeStamp endTimestamp   = __picoPerfRecordTimestamp(record, item->endTime);
+            int scopeDepth                   = (int)item->depth;
+
+            double durationSec = picoPerfDurationSeconds(item->startTime, item->endTime);
+            double durationMs  = picoPerfDurationMilliseconds(item->startTime, item->endTime);
+            double durationUs  = picoPerfDurationMicroseconds(item->startTime, item->endTime);
+            double durationNs  = picoPerfDurationNanoseconds(item->startTime, item->endTime);
+
+            fprintf(output, "        <Item index=\"%zu\">\n", itemIdx);
+            fprintf(output, "          <Name>%s</Name>\n", site->name);
+            fprintf(output, "          <ParentName>%s</ParentName>\n", __picoPerfParentName(item));
+            fprintf(output, "          <ScopeDepth>%d</ScopeDepth>\n", scopeDepth);
+            fprintf(output, "          <ThreadId>%llu</ThreadId>\n", threadId);
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+            __picoPerfWriteCounters(output, item->counters, PICO_PERF_REPORT_FORMAT_XML, "          ");
+#endif
+            fprintf(output, "          <StartTime>%llu</StartTime>\n", (unsigned long long)item->startTime);
+            fprintf(output, "          <EndTime>%llu</EndTime>\n", (unsigned long long)item->endTime);
+            fprintf(output, "          <Duration>\n");
+            fprintf(output, "            <Seconds>%.9f</Seconds>\n", durationSec);
+            fprintf(output, "            <Milliseconds>%.6f</Milliseconds>\n", durationMs);
+            fprintf(output, "            <Microseconds>%.3f</Microseconds>\n", durationUs);
+            fprintf(output, "            <Nanoseconds>%.0f</Nanoseconds>\n", durationNs);
+            fprintf(output, "          </Duration>\n");
+            fprintf(output, "          <Start>\n");
+            fprintf(output, "            <File>%s</File>\n", site->file);
+            fprintf(output, "            <Function>%s</Function>\n", site->function);
+            fprintf(output, "            <Line>%u</Line>\n", site->line);
+            fprintf(output, "            <Timestamp>%04u-%02u-%02u %02u:%02u:%02u.%03u</Timestamp>\n",
+                    startTimestamp.year, startTimestamp.month, startTimestamp.day,
+                    startTimestamp.hour, startTimestamp.minute, startTimestamp.second,
+                    startTimestamp.millisecond);
+            fprintf(output, "          </Start>\n");
+            fprintf(output, "          <End>\n");
+            fprintf(output, "            <File>%s</File>\n", endSite->file);
+            fprintf(output, "            <Function>%s</Function>\n", endSite->function);
+            fprintf(output, "            <Line>%u</Line>\n", endSite->line);
+            fprintf(output, "            <Timestamp>%04u-%02u-%02u %02u:%02u:%02u.%03u</Timestamp>\n",
+                    endTimestamp.year, endTimestamp.month, endTimestamp.day,
+                    endTimestamp.hour, endTimestamp.minute, endTimestamp.second,
+                    endTimestamp.millisecond);
+            fprintf(output, "          </End>\n");
+            fprintf(output, "        </Item>\n");
+        }
+
+        fprintf(output, "      </Items>\n");
+        __PICO_PERF_FREE(items);
+        fprintf(output, "    </Record>\n");
+    }
+
+    fprintf(output, "  </Records>\n");
+    fprintf(output, "</PicoPerfReport>\n");
+}
+
+static void __picoPerfWriteJsonString(FILE *output, const char *str)
+{
+    fputc('"', output);
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+        if (c == '"' || c == '\\') {
+            fputc('\\', output);
+            fputc(c, output);
+        } else if (c <= 0x1F) {
+            fprintf(output, "\\u%04x", c);
+        } else {
+            fputc(c, output);
+        }
+    }
+    fputc('"', output);
+}
+
+// Trace event timestamps are microseconds, relative to the start of the first record
+static double __picoPerfTraceTime(picoPerfTime time)
+{
+    picoPerfTime base = __picoPerfGlobalContext->records[0].startTime;
+    if (time < base) {
+        return 0.0;
+    }
+    return (double)__picoPerfTicksToNanoseconds(time - base) / 1000.0;
+}
+
+static void __picoPerfWriteTraceSite(FILE *output, const __picoPerfSite_t *site)
+{
+    fprintf(output, "\"file\":");
+    __picoPerfWriteJsonString(output, site->file);
+    fprintf(output, ",\"function\":");
+    __picoPerfWriteJsonString(output, site->function);
+    fprintf(output, ",\"line\":%u", site->line);
+}
+
+static void __picoPerfGetReportChromeTrace(FILE *output)
+{
+    if (!__picoPerfGlobalContext || !output) {
+        return;
+    }
+
+    picoPerfContext context = __picoPerfGlobalContext;
+#if defined(_WIN32) || defined(_WIN64)
+    unsigned long processId = (unsigned long)GetCurrentProcessId();
+#else
+    unsigned long processId = (unsigned long)getpid();
+#endif
+
+    fprintf(output, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(output, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":0,\"args\":{\"name\":\"picoPerf\"}},\n", processId);
+    fprintf(output, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":0,\"args\":{\"name\":\"Records\"}}", processId);
+
+    // one track per thread, ordered by registration
+    for (__picoPerfThread_t *thread = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads); thread; thread = thread->next) {
+        char threadName[PICO_PERF_MAX_NAME_LENGTH];
+        if (thread->name[0] != '\0') {
+            snprintf(threadName, sizeof(threadName), "%s", thread->name);
+        } else {
+            snprintf(threadName, sizeof(threadName), "Thread %u", thread->threadIndex);
+        }
+        fprintf(output, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%llu,\"args\":{\"name\":", processId, (unsigned long long)thread->threadId);
+        __picoPerfWriteJsonString(output, threadName);
+        fprintf(output, "}}");
+        fprintf(output, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%llu,\"args\":{\"sort_index\":%u}}",
+                processId, (unsigned long long)thread->threadId, thread->threadIndex + 1);
+    }
+
+    for (size_t recordIdx = 0; recordIdx < context->recordCount; recordIdx++) {
+        __picoPerfRecord_t *record = &context->records[recordIdx];
+        fprintf(output, ",\n{\"name\":\"Record %zu\",\"cat\":\"record\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":0}",
+                recordIdx + 1, __picoPerfTraceTime(record->startTime),
+                (double)__picoPerfTicksToNanoseconds(record->endTime - record->startTime) / 1000.0, processId);
+
+        size_t itemCount               = 0;
+        __picoPerfMergedEvent_t *items = __picoPerfMergeRecord(recordIdx, &itemCount);
+        for (size_t itemIdx = 0; itemIdx < itemCount; itemIdx++) {
+            const __picoPerfEvent_t *item  = items[itemIdx].event;
+            const __picoPerfSite_t *site   = &context->sites[item->siteId];
+
+            fprintf(output, ",\n{\"name\":");
+            __picoPerfWriteJsonString(output, site->name);
+            fprintf(output, ",\"cat\":\"scope\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%llu,\"args\":{",
+                    __picoPerfTraceTime(item->startTime),
+                    (double)__picoPerfTicksToNanoseconds(item->endTime - item->startTime) / 1000.0,
+                    processId, (unsigned long long)items[itemIdx].thread->threadId);
+            __picoPerfWriteTraceSite(output, site);
+            fprintf(output, ",\"depth\":%u,\"record\":%zu", item->depth, recordIdx);
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+            __picoPerfWriteCounters(output, item->counters, PICO_PERF_REPORT_FORMAT_CHROME_TRACE, "");
+#endif
+            fprintf(output, "}}");
+        }
+        __PICO_PERF_FREE(items);
+
+        for (__picoPerfThread_t *thread = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads); thread; thread = thread->next) {
+            __picoPerfThreadRecord_t *marks = &thread->marks[recordIdx];
+            uint32_t markCount              = PICO_PERF_ATOMIC_LOAD32(&marks->count);
+            __picoPerfEventChunk_t *chunk   = marks->head;
+
+            for (uint32_t i = 0; i < markCount; i++) {
+                if (i > 0 && i % PICO_PERF_EVENT_CHUNK_SIZE == 0) {
+                    chunk = chunk->next;
+                }
+                const __picoPerfMark_t *mark = &chunk->entries[i % PICO_PERF_EVENT_CHUNK_SIZE].mark;
+                const __picoPerfSite_t *site = &context->sites[mark->siteId];
+
+                fprintf(output, ",\n{\"name\":");
+                __picoPerfWriteJsonString(output, site->name);
+                if (mark->kind == __PICO_PERF_MARK_COUNTER) {
+                    fprintf(output, ",\"cat\":\"counter\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%llu,\"args\":{",
+                            __picoPerfTraceTime(mark->time), processId, (unsigned long long)thread->threadId);
+                    __picoPerfWriteJsonString(output, site->name);
+                    fprintf(output, ":%.17g}}", mark->value.counterValue);
+                } else {
+                    // flow ends bind to the enclosing scope instead of the next one
+                    static const char *phases[] = {"s", "t", "f"};
+                    fprintf(output, ",\"cat\":\"flow\",\"ph\":\"%s\",%s\"id\":\"0x%llx\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%llu}",
+                            phases[mark->kind], mark->kind == PICO_PERF_FLOW_PHASE_BEGIN ? "" : "\"bp\":\"e\",",
+                            (unsigned long long)mark->value.flowId, __picoPerfTraceTime(mark->time), processId,
+                            (unsigned long long)thread->threadId);
+                }
+            }
+        }
+    }
+
+    fprintf(output, "\n]}\n");
+}
+
+bool picoPerfCreateContext(void)
+{
+    if (__picoPerfGlobalContext != NULL) {
+        return false;
+    }
+
+    __picoPerfGlobalContext = (picoPerfContext)__PICO_PERF_MALLOC(sizeof(picoPerfContext_t));
+    if (!__picoPerfGlobalContext) {
+        return false;
+    }
+    memset(__picoPerfGlobalContext, 0, sizeof(picoPerfContext_t));
+
+
+    // skip generation 0 so a zeroed site cache never matches
+    __picoPerfGenerationCounter = (__picoPerfGenerationCounter + 1) & 0xFFFF;
+    if (__picoPerfGenerationCounter == 0) {
+        __picoPerfGenerationCounter = 1;
+    }
+    __picoPerfGlobalContext->generation = __picoPerfGenerationCounter;
+
+#ifdef PICO_PERF_HAS_TSC
+    // calibrate here, on the creating thread, instead of inside the first scope
+    if (__picoPerfTscState == 0) {
+        __picoPerfCalibrateTsc();
+    }
+#endif
+
+    __picoPerfSite_t *unknownSite = &__picoPerfGlobalContext->sites[0];
+    snprintf(unknownSite->name, sizeof(unknownSite->name), "unknown");
+    unknownSite->file             = "unknown";
+    unknownSite->function         = "unknown";
+    __picoPerfGlobalContext->siteCount = 1;
+    return true;
+}
+
+void picoPerfDestroyContext(void)
+{
+    if (!__picoPerfGlobalContext) {
+        return;
+    }
+
+#ifdef PICO_PERF_STREAMING
+    picoPerfStopStreaming();
+#endif
+#ifdef PICO_PERF_HAS_SAMPLING
+    picoPerfStopSampling();
+    __PICO_PERF_FREE(__picoPerfGlobalContext->sampler);
+#endif
+
+    __picoPerfThread_t *thread = __picoPerfGlobalContext->threads;
+    while (thread) {
+        __picoPerfThread_t *nextThread = thread->next;
+#ifdef PICO_PERF_STREAMING
+        __PICO_PERF_FREE(thread->streamRing);
+#endif
+        for (size_t i = 0; i < PICO_PERF_MAX_SITES; i++) {
+            __PICO_PERF_FREE(thread->stats[i]);
+        }
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        __picoPerfCloseHwCounters(__picoPerfGlobalContext, thread);
+#endif
+        for (size_t i = 0; i < PICO_PERF_MAX_RECORDS * 2; i++) {
+            __picoPerfThreadRecord_t *record = i < PICO_PERF_MAX_RECORDS ? &thread->records[i] : &thread->marks[i - PICO_PERF_MAX_RECORDS];
+            __picoPerfEventChunk_t *chunk    = record->head;
+            while (chunk) {
+                __picoPerfEventChunk_t *nextChunk = chunk->next;
+                __PICO_PERF_FREE(chunk);
+                chunk = nextChunk;
+            }
+        }
+        __PICO_PERF_FREE(thread);
+        thread = nextThread;
+    }
+    __PICO_PERF_FREE(__picoPerfGlobalContext);
+    __picoPerfGlobalContext = NULL;
+}
+
+picoPerfContext picoPerfGetContext(void)
+{
+    return __picoPerfGlobalContext;
+}
+
+void picoPerfSetContext(picoPerfContext context)
+{
+    if (__picoPerfGlobalContext != NULL) {
+        return;
+    }
+
+    __picoPerfGlobalContext = context;
+}
+
+picoPerfTimeStamp picoPerfGetCurrentTimestamp(void)
+{
+    return __picoPerfTimestampFromWallClock(__picoPerfWallClockNanoseconds());
+}
+
+static picoPerfTime __picoPerfMonotonicNow(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (picoPerfTime)counter.QuadPart;
+#elif defined(__unix__) || defined(__APPLE__)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (picoPerfTime)ts.tv_sec * 1000000000LL + (picoPerfTime)ts.tv_nsec;
+#else
+#error "Unsupported platform for the picoPerf monotonic clock"
+#endif
+}
+
+static uint64_t __picoPerfMonotonicFrequency(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return (uint64_t)freq.QuadPart;
+#elif defined(__unix__) || defined(__APPLE__)
+    return 1000000000LL; // Nanoseconds
+#else
+#error "Unsupported platform for the picoPerf monotonic clock frequency"
+#endif
+}
+
+#if defined(PICO_PERF_TSC_X86) || defined(PICO_PERF_TSC_ARM64)
+#define PICO_PERF_HAS_TSC
+
+// 0 until the first calibration, then 1 if the counter is used and -1 if it is not
+static int __picoPerfTscState          = 0;
+static uint64_t __picoPerfTscFrequency = 0;
+
+static inline uint64_t __picoPerfReadTsc(void)
+{
+#if defined(PICO_PERF_TSC_X86)
+    return (uint64_t)__rdtsc();
+#else
+    uint64_t value;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#endif
+}
+
+static void __picoPerfCalibrateTsc(void)
+{
+#if defined(PICO_PERF_TSC_X86)
+    // CPUID 0x80000007 EDX bit 8, the counter runs at a constant rate across P and C states
+    bool invariant = false;
+#if defined(_MSC_VER)
+    int info[4] = {0};
+    __cpuid(info, 0x80000000);
+    if ((unsigned int)info[0] >= 0x80000007u) {
+        __cpuid(info, 0x80000007);
+        invariant = (info[3] & (1 << 8)) != 0;
+    }
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007u, &eax, &ebx, &ecx, &edx)) {
+        invariant = (edx & (1u << 8)) != 0;
+    }
+#endif
+    if (!invariant) {
+        __picoPerfTscState = -1;
+        return;
+    }
+
+    uint64_t monotonicFrequency = __picoPerfMonotonicFrequency();
+    picoPerfTime monotonicStart = __picoPerfMonotonicNow();
+    uint64_t tscStart           = __picoPerfReadTsc();
+    picoPerfTime monotonicEnd   = monotonicStart;
+    uint64_t tscEnd             = tscStart;
+    uint64_t calibrationTicks   = monotonicFrequency * PICO_PERF_TSC_CALIBRATION_MS / 1000;
+
+    // spin rather than sleep so the core does not change frequency or get descheduled
+    while (monotonicEnd - monotonicStart < calibrationTicks) {
+        monotonicEnd = __picoPerfMonotonicNow();
+        tscEnd       = __picoPerfReadTsc();
+    }
+
+    double seconds = (double)(monotonicEnd - monotonicStart) / (double)monotonicFrequency;
+    if (tscEnd <= tscStart || seconds <= 0.0) {
+        __picoPerfTscState = -1;
+        return;
+    }
+    __picoPerfTscFrequency = (uint64_t)((double)(tscEnd - tscStart) / seconds + 0.5);
+#else
+    uint64_t frequency;
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(frequency));
+    __picoPerfTscFrequency = frequency;
+#endif
+    __picoPerfTscState = __picoPerfTscFrequency > 0 ? 1 : -1;
+}
+#endif // PICO_PERF_TSC_X86 || PICO_PERF_TSC_ARM64
+
+picoPerfTime picoPerfNow(void)
+{
+#ifdef PICO_PERF_HAS_TSC
+    if (__picoPerfTscState > 0) {
+        return (picoPerfTime)__picoPerfReadTsc();
+    }
+    if (__picoPerfTscState == 0) {
+        __picoPerfCalibrateTsc();
+        return picoPerfNow();
+    }
+#endif
+    return __picoPerfMonotonicNow();
+}
+
+uint64_t picoPerfFrequency(void)
+{
+#ifdef PICO_PERF_HAS_TSC
+    if (__picoPerfTscState == 0) {
+        __picoPerfCalibrateTsc();
+    }
+    if (__picoPerfTscState > 0) {
+        return __picoPerfTscFrequency;
+    }
+#endif
+    return __picoPerfMonotonicFrequency();
+}
+
+double picoPerfDurationSeconds(picoPerfTime start, picoPerfTime end)
+{
+    uint64_t freq = picoPerfFrequency();
+    if (freq == 0) {
+        return 0.0;
+    }
+    return (double)(end - start) / (double)freq;
+}
+
+double picoPerfDurationMilliseconds(picoPerfTime start, picoPerfTime end)
+{
+    return picoPerfDurationSeconds(start, end) * 1000.0;
+}
+
+double picoPerfDurationMicroseconds(picoPerfTime start, picoPerfTime end)
+{
+    return picoPerfDurationSeconds(start, end) * 1000000.0;
+}
+
+double picoPerfDurationNanoseconds(picoPerfTime start, picoPerfTime end)
+{
+    return picoPerfDurationSeconds(start, end) * 1000000000.0;
+}
+
+void picoPerfFormatDuration(picoPerfTime duration, char *buffer, size_t bufferSize)
+{
+    if (bufferSize == 0) {
+        return;
+    }
+
+    uint64_t freq = picoPerfFrequency();
+    if (freq == 0) {
+        snprintf(buffer, bufferSize, "0s");
+        return;
+    }
+
+    double seconds = (double)duration / (double)freq;
+
+    if (seconds >= 1.0) {
+        snprintf(buffer, bufferSize, "%.3fs", seconds);
+    } else if (seconds >= 0.001) {
+        snprintf(buffer, bufferSize, "%.3fms", seconds * 1000.0);
+    } else if (seconds >= 0.000001) {
+        snprintf(buffer, bufferSize, "%.3fµs", seconds * 1000000.0);
+    } else {
+        snprintf(buffer, bufferSize, "%.3fns", seconds * 1000000000.0);
+    }
+}
+
+void picoPerfSleep(uint32_t milliseconds)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    Sleep(milliseconds);
+#elif defined(__unix__) || defined(__APPLE__)
+    struct timespec ts;
+    ts.tv_sec  = milliseconds / 1000;
+    ts.tv_nsec = (milliseconds % 1000) * 1000000;
+    // signals such as the sampling timer cut the sleep short, sleep the rest
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+#else
+#error "Unsupported platform for picoPerfSleep"
+#endif
+}
+
+bool picoPerfBeginRecord(void)
+{
+    if (!__picoPerfGlobalContext || PICO_PERF_ATOMIC_LOAD32(&__picoPerfGlobalContext->activeRecord) != 0) {
+        return false;
+    }
+
+    if (__picoPerfGlobalContext->recordCount >= PICO_PERF_MAX_RECORDS) {
+        return false;
+    }
+
+    __picoPerfRecord_t *record = &__picoPerfGlobalContext->records[__picoPerfGlobalContext->recordHead];
+    record->startWallNs        = __picoPerfWallClockNanoseconds();
+    record->startTime          = picoPerfNow();
+    record->endTime            = record->startTime;
+
+    // threads notice the new value and reset their scope stacks lazily
+    PICO_PERF_ATOMIC_STORE32(&__picoPerfGlobalContext->activeRecord, (uint32_t)__picoPerfGlobalContext->recordHead + 1);
+    return true;
+}
+
+void picoPerfEndRecord(void)
+{
+    if (!__picoPerfGlobalContext || PICO_PERF_ATOMIC_LOAD32(&__picoPerfGlobalContext->activeRecord) == 0) {
+        return;
+    }
+
+    PICO_PERF_ATOMIC_STORE32(&__picoPerfGlobalContext->activeRecord, 0);
+    __picoPerfGlobalContext->records[__picoPerfGlobalContext->recordHead].endTime = picoPerfNow();
+    __picoPerfGlobalContext->recordHead                                           = (__picoPerfGlobalContext->recordHead + 1) % PICO_PERF_MAX_RECORDS;
+
+    if (__picoPerfGlobalContext->recordCount < PICO_PERF_MAX_RECORDS) {
+        __picoPerfGlobalContext->recordCount++;
+    }
+}
+
+// Returns the calling thread state with its scope stack synced to the active record, or
+// NULL when nothing is being recorded, streamed or aggregated
+static __picoPerfThread_t *__picoPerfGetRecordingThread(uint32_t *activeRecord, uint32_t *modes)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    if (!context) {
+        return NULL;
+    }
+
+    *activeRecord = PICO_PERF_ATOMIC_LOAD32(&context->activeRecord);
+    *modes        = PICO_PERF_ATOMIC_LOAD32(&context->modes);
+    if (*activeRecord == 0 && *modes == 0) {
+        return NULL;
+    }
+
+    __picoPerfThread_t *thread = __picoPerfGetThread(context);
+    if (thread && *activeRecord != 0 && thread->activeRecord != *activeRecord) {
+        thread->activeRecord = *activeRecord;
+        // while streaming or aggregating, scopes opened before the record began are still open
+        if (*modes == 0) {
+            thread->scopeStackTop = 0;
+        }
+    }
+    return thread;
+}
+
+static bool __picoPerfAppendEntry(__picoPerfThreadRecord_t *record, const __picoPerfEntry_t *entry)
+{
+    uint32_t count = record->count;
+    if (count >= PICO_PERF_MAX_SCOPES) {
+        return false;
+    }
+
+    if (count % PICO_PERF_EVENT_CHUNK_SIZE == 0) {
+        __picoPerfEventChunk_t *chunk = record->tail ? record->tail->next : record->head;
+        if (!chunk) {
+            chunk = (__picoPerfEventChunk_t *)__PICO_PERF_MALLOC(sizeof(__picoPerfEventChunk_t));
+            if (!chunk) {
+                return false;
+            }
+            chunk->next = NULL;
+            if (record->tail) {
+                record->tail->next = chunk;
+            } else {
+                record->head = chunk;
+            }
+        }
+        record->tail = chunk;
+    }
+
+    record->tail->entries[count % PICO_PERF_EVENT_CHUNK_SIZE] = *entry;
+    PICO_PERF_ATOMIC_STORE32(&record->count, count + 1);
+    return true;
+}
+
+#ifdef PICO_PERF_STREAMING
+static void __picoPerfStreamPush(__picoPerfThread_t *thread, const __picoPerfEntry_t *entry)
+{
+    __picoPerfStreamRing_t *ring = thread->streamRing;
+    if (!ring) {
+        ring = (__picoPerfStreamRing_t *)__PICO_PERF_MALLOC(sizeof(__picoPerfStreamRing_t));
+        if (!ring) {
+            return;
+        }
+        ring->head    = 0;
+        ring->tail    = 0;
+        ring->dropped = 0;
+        PICO_PERF_ATOMIC_STORE_PTR(&thread->streamRing, ring);
+    }
+
+    uint32_t head = ring->head;
+    if (head - PICO_PERF_ATOMIC_LOAD32(&ring->tail) >= PICO_PERF_STREAM_BUFFER_SIZE) {
+        PICO_PERF_ATOMIC_STORE32(&ring->dropped, ring->dropped + 1);
+        return;
+    }
+
+    ring->entries[head & (PICO_PERF_STREAM_BUFFER_SIZE - 1)] = *entry;
+    PICO_PERF_ATOMIC_STORE32(&ring->head, head + 1);
+}
+#endif
+
+static void __picoPerfPublishEntry(__picoPerfThread_t *thread, uint32_t activeRecord, uint32_t modes, bool isMark, const __picoPerfEntry_t *entry)
+{
+    if (activeRecord != 0 && thread->activeRecord == activeRecord) {
+        __picoPerfAppendEntry(isMark ? &thread->marks[activeRecord - 1] : &thread->records[activeRecord - 1], entry);
+    }
+#ifdef PICO_PERF_STREAMING
+    if (modes & __PICO_PERF_MODE_STREAMING) {
+        __picoPerfStreamPush(thread, entry);
+    }
+#else
+    (void)modes;
+#endif
+}
+
+static uint32_t __picoPerfHistogramBucket(picoPerfTime ticks)
+{
+    if (ticks < __PICO_PERF_HISTOGRAM_SUB_BUCKETS) {
+        return (uint32_t)ticks;
+    }
+
+#if defined(_MSC_VER)
+    unsigned long msb = 0;
+    _BitScanReverse64(&msb, ticks);
+#else
+    uint32_t msb = 63 - (uint32_t)__builtin_clzll(ticks);
+#endif
+    // keep the top five bits, the leading one picks the half and the rest the sub bucket
+    uint32_t shift  = (uint32_t)msb - 4;
+    uint32_t bucket = shift * (__PICO_PERF_HISTOGRAM_SUB_BUCKETS / 2) + (uint32_t)(ticks >> shift);
+    return bucket < __PICO_PERF_HISTOGRAM_BUCKETS ? bucket : __PICO_PERF_HISTOGRAM_BUCKETS - 1;
+}
+
+static void __picoPerfUpdateStats(__picoPerfThread_t *thread, const __picoPerfEvent_t *event)
+{
+    uint16_t siteId       = event->siteId;
+    picoPerfTime duration = event->endTime - event->startTime;
+
+    // a reset bumps the epoch, every thread then clears its own stats on the next update
+    uint32_t epoch = PICO_PERF_ATOMIC_LOAD32(&__picoPerfGlobalContext->statsEpoch);
+    if (thread->statsEpoch != epoch) {
+        for (size_t i = 0; i < PICO_PERF_MAX_SITES; i++) {
+            if (thread->stats[i]) {
+                memset(thread->stats[i], 0, sizeof(__picoPerfSiteStats_t));
+                thread->stats[i]->minTime = UINT64_MAX;
+            }
+        }
+        PICO_PERF_ATOMIC_STORE32(&thread->statsEpoch, epoch);
+    }
+
+    __picoPerfSiteStats_t *stats = thread->stats[siteId];
+    if (!stats) {
+        stats = (__picoPerfSiteStats_t *)__PICO_PERF_MALLOC(sizeof(__picoPerfSiteStats_t));
+        if (!stats) {
+            return;
+        }
+        memset(stats, 0, sizeof(__picoPerfSiteStats_t));
+        stats->minTime = UINT64_MAX;
+        PICO_PERF_ATOMIC_STORE_PTR(&thread->stats[siteId], stats);
+    }
+
+    uint32_t bucket = __picoPerfHistogramBucket(duration);
+    PICO_PERF_RELAXED_STORE32(&stats->buckets[bucket], stats->buckets[bucket] + 1);
+    PICO_PERF_RELAXED_STORE64(&stats->count, stats->count + 1);
+    PICO_PERF_RELAXED_STORE64(&stats->totalTime, stats->totalTime + duration);
+    if (duration < stats->minTime) {
+        PICO_PERF_RELAXED_STORE64(&stats->minTime, duration);
+    }
+    if (duration > stats->maxTime) {
+        PICO_PERF_RELAXED_STORE64(&stats->maxTime, duration);
+    }
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    for (uint32_t i = 0; i < PICO_PERF_HW_COUNTER_COUNT; i++) {
+        PICO_PERF_RELAXED_STORE64(&stats->counters[i], stats->counters[i] + event->counters[i]);
+    }
+#endif
+}
+
+void picoPerfPushScopeAtSite(uint32_t *siteCache, const char *name, const char *file, const char *function, uint32_t line)
+{
+    uint32_t activeRecord      = 0;
+    uint32_t modes             = 0;
+    __picoPerfThread_t *thread = __picoPerfGetRecordingThread(&activeRecord, &modes);
+    if (!thread || thread->scopeStackTop >= PICO_PERF_MAX_DEPTH) {
+        return;
+    }
+
+    __picoPerfOpenScope_t *scope = &thread->scopeStack[thread->scopeStackTop];
+    scope->siteId                = __picoPerfResolveSite(siteCache, name ? name : "", file, function, line);
+    thread->scopeStackTop++;
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    __picoPerfReadHwCounters(thread, scope->counters);
+#endif
+    scope->startTime = picoPerfNow();
+}
+
+void picoPerfPopScopeAtSite(uint32_t *siteCache, const char *file, const char *function, uint32_t line)
+{
+    picoPerfTime endTime = picoPerfNow();
+
+    uint32_t activeRecord      = 0;
+    uint32_t modes             = 0;
+    __picoPerfThread_t *thread = __picoPerfGetRecordingThread(&activeRecord, &modes);
+    if (!thread || thread->scopeStackTop <= 0) {
+        return;
+    }
+
+    int top                      = thread->scopeStackTop - 1;
+    __picoPerfOpenScope_t *scope = &thread->scopeStack[top];
+
+    __picoPerfEntry_t entry;
+    entry.event.siteId       = scope->siteId;
+    entry.event.endSiteId    = __picoPerfResolveSite(siteCache, NULL, file, function, line);
+    entry.event.parentSiteId = top > 0 ? thread->scopeStack[top - 1].siteId : 0;
+    entry.event.depth        = (uint16_t)top;
+    entry.event.startTime    = scope->startTime;
+    entry.event.endTime      = endTime;
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    __picoPerfReadHwCounters(thread, entry.event.counters);
+    for (uint32_t i = 0; i < PICO_PERF_HW_COUNTER_COUNT; i++) {
+        entry.event.counters[i] -= scope->counters[i];
+    }
+#endif
+
+    // the scope is closed even when the record is full, so nesting stays intact
+    thread->scopeStackTop = top;
+    __picoPerfPublishEntry(thread, activeRecord, modes, false, &entry);
+    if (modes & __PICO_PERF_MODE_STATS) {
+        __picoPerfUpdateStats(thread, &entry.event);
+    }
+}
+
+void picoPerfPopNScopesAtSite(uint32_t *siteCache, int count, const char *file, const char *function, uint32_t line)
+{
+    uint32_t activeRecord      = 0;
+    uint32_t modes             = 0;
+    __picoPerfThread_t *thread = __picoPerfGetRecordingThread(&activeRecord, &modes);
+    if (!thread) {
+        return;
+    }
+
+    if (count < 0) {
+        count = thread->scopeStackTop;
+    }
+
+    for (int i = 0; i < count; i++) {
+        picoPerfPopScopeAtSite(siteCache, file, function, line);
+    }
+}
+
+static void __picoPerfAppendMark(uint32_t *siteCache, const char *name, uint16_t kind, const char *file, const char *function, uint32_t line, double counterValue, uint64_t flowId)
+{
+    picoPerfTime time = picoPerfNow();
+
+    uint32_t activeRecord      = 0;
+    uint32_t modes             = 0;
+    __picoPerfThread_t *thread = __picoPerfGetRecordingThread(&activeRecord, &modes);
+    if (!thread) {
+        return;
+    }
+
+    __picoPerfEntry_t entry;
+    entry.mark.siteId   = __picoPerfResolveSite(siteCache, name ? name : "", file, function, line);
+    entry.mark.kind     = kind;
+    entry.mark.tag      = __PICO_PERF_MARK_TAG;
+    entry.mark.time     = time;
+    if (kind == __PICO_PERF_MARK_COUNTER) {
+        entry.mark.value.counterValue = counterValue;
+    } else {
+        entry.mark.value.flowId = flowId;
+    }
+    __picoPerfPublishEntry(thread, activeRecord, modes, true, &entry);
+}
+
+void picoPerfCounterAtSite(uint32_t *siteCache, const char *name, double value, const char *file, const char *function, uint32_t line)
+{
+    __picoPerfAppendMark(siteCache, name, __PICO_PERF_MARK_COUNTER, file, function, line, value, 0);
+}
+
+void picoPerfFlowAtSite(uint32_t *siteCache, const char *name, uint64_t id, picoPerfFlowPhase phase, const char *file, const char *function, uint32_t line)
+{
+    __picoPerfAppendMark(siteCache, name, (uint16_t)phase, file, function, line, 0.0, id);
+}
+
+void picoPerfSetThreadName(const char *name)
+{
+    if (!__picoPerfGlobalContext || !name) {
+        return;
+    }
+
+    __picoPerfThread_t *thread = __picoPerfGetThread(__picoPerfGlobalContext);
+    if (thread) {
+        __picoPerfLockSites(__picoPerfGlobalContext);
+        strncpy(thread->name, name, PICO_PERF_MAX_NAME_LENGTH - 1);
+        __picoPerfUnlockSites(__picoPerfGlobalContext);
+    }
+}
+
+bool picoPerfHwCountersAvailable(void)
+{
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    __picoPerfThread_t *thread = __picoPerfGlobalContext ? __picoPerfGetThread(__picoPerfGlobalContext) : NULL;
+    return thread && thread->hwCounterCount > 0;
+#else
+    return false;
+#endif
+}
+
+void picoPerfPushScope(const char *name, const char *file, const char *function, uint32_t line)
+{
+    picoPerfPushScopeAtSite(NULL, name, file, function, line);
+}
+
+void picoPerfPopScope(const char *file, const char *function, uint32_t line)
+{
+    picoPerfPopScopeAtSite(NULL, file, function, line);
+}
+
+void picoPerfPopNScopes(int count, const char *file, const char *function, uint32_t line)
+{
+    picoPerfPopNScopesAtSite(NULL, count, file, function, line);
+}
+
+void picoPerfEnableStats(bool enabled)
+{
+    if (!__picoPerfGlobalContext) {
+        return;
+    }
+
+    if (enabled) {
+        PICO_PERF_ATOMIC_OR32(&__picoPerfGlobalContext->modes, __PICO_PERF_MODE_STATS);
+    } else {
+        PICO_PERF_ATOMIC_AND32(&__picoPerfGlobalContext->modes, ~(uint32_t)__PICO_PERF_MODE_STATS);
+    }
+}
+
+void picoPerfResetStats(void)
+{
+    if (__picoPerfGlobalContext) {
+        PICO_PERF_ATOMIC_ADD32(&__picoPerfGlobalContext->statsEpoch, 1);
+    }
+}
+
+// Value at the given quantile, taken as the middle of its bucket and clamped to the observed range
+static picoPerfTime __picoPerfHistogramQuantile(const __picoPerfSiteStats_t *stats, double quantile)
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < __PICO_PERF_HISTOGRAM_BUCKETS; i++) {
+        total += stats->buckets[i];
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(quantile * (double)total + 0.999999);
+    target          = target < 1 ? 1 : target;
+    uint64_t seen   = 0;
+    uint32_t bucket = 0;
+    for (; bucket < __PICO_PERF_HISTOGRAM_BUCKETS - 1; bucket++) {
+        seen += stats->buckets[bucket];
+        if (seen >= target) {
+            break;
+        }
+    }
+
+    picoPerfTime value = bucket;
+    if (bucket >= __PICO_PERF_HISTOGRAM_SUB_BUCKETS) {
+        uint32_t shift = bucket / (__PICO_PERF_HISTOGRAM_SUB_BUCKETS / 2) - 1;
+        picoPerfTime lower = (picoPerfTime)(bucket - shift * (__PICO_PERF_HISTOGRAM_SUB_BUCKETS / 2)) << shift;
+        value              = lower + (((picoPerfTime)1 << shift) >> 1);
+    }
+    value = value < stats->minTime ? stats->minTime : value;
+    value = value > stats->maxTime ? stats->maxTime : value;
+    return value;
+}
+
+static int __picoPerfCompareStats(const void *a, const void *b)
+{
+    const picoPerfScopeStats_t *statsA = (const picoPerfScopeStats_t *)a;
+    const picoPerfScopeStats_t *statsB = (const picoPerfScopeStats_t *)b;
+    if (statsA->totalTime != statsB->totalTime) {
+        return statsA->totalTime > statsB->totalTime ? -1 : 1;
+    }
+    return 0;
+}
+
+// Merges the stats of every thread into one entry per site, sorted by total time.
+// Returns an array the caller frees with __PICO_PERF_FREE, or NULL when there are no samples.
+static picoPerfScopeStats_t *__picoPerfCollectStats(size_t *count)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    *count                  = 0;
+
+    __picoPerfLockSites(context);
+    uint32_t siteCount = context->siteCount;
+    __picoPerfUnlockSites(context);
+
+    picoPerfScopeStats_t *result  = (picoPerfScopeStats_t *)__PICO_PERF_MALLOC(sizeof(picoPerfScopeStats_t) * siteCount);
+    __picoPerfSiteStats_t *merged = (__picoPerfSiteStats_t *)__PICO_PERF_MALLOC(sizeof(__picoPerfSiteStats_t));
+    if (!result || !merged) {
+        __PICO_PERF_FREE(result);
+        __PICO_PERF_FREE(merged);
+        return NULL;
+    }
+
+    uint32_t epoch              = PICO_PERF_ATOMIC_LOAD32(&context->statsEpoch);
+    __picoPerfThread_t *threads = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads);
+    for (uint32_t siteId = 0; siteId < siteCount; siteId++) {
+        memset(merged, 0, sizeof(__picoPerfSiteStats_t));
+        merged->minTime = UINT64_MAX;
+
+        for (__picoPerfThread_t *thread = threads; thread; thread = thread->next) {
+            const __picoPerfSiteStats_t *stats = (const __picoPerfSiteStats_t *)PICO_PERF_ATOMIC_LOAD_PTR(&thread->stats[siteId]);
+            if (!stats || PICO_PERF_ATOMIC_LOAD32(&thread->statsEpoch) != epoch) {
+                continue;
+            }
+
+            picoPerfTime minTime = PICO_PERF_RELAXED_LOAD64(&stats->minTime);
+            picoPerfTime maxTime = PICO_PERF_RELAXED_LOAD64(&stats->maxTime);
+            merged->count += PICO_PERF_RELAXED_LOAD64(&stats->count);
+            merged->totalTime += PICO_PERF_RELAXED_LOAD64(&stats->totalTime);
+            merged->minTime = minTime < merged->minTime ? minTime : merged->minTime;
+            merged->maxTime = maxTime > merged->maxTime ? maxTime : merged->maxTime;
+            for (uint32_t i = 0; i < __PICO_PERF_HISTOGRAM_BUCKETS; i++) {
+                merged->buckets[i] += PICO_PERF_RELAXED_LOAD32(&stats->buckets[i]);
+            }
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+            for (uint32_t i = 0; i < PICO_PERF_HW_COUNTER_COUNT; i++) {
+                merged->counters[i] += PICO_PERF_RELAXED_LOAD64(&stats->counters[i]);
+            }
+#endif
+        }
+
+        if (merged->count == 0) {
+            continue;
+        }
+
+        const __picoPerfSite_t *site = &context->sites[siteId];
+        picoPerfScopeStats_t *entry  = &result[(*count)++];
+        entry->name                  = site->name;
+        entry->location.file         = site->file;
+        entry->location.function     = site->function;
+        entry->location.line         = site->line;
+        entry->count                 = merged->count;
+        entry->totalTime             = merged->totalTime;
+        entry->meanTime              = merged->totalTime / merged->count;
+        entry->minTime               = merged->minTime;
+        entry->maxTime               = merged->maxTime;
+        entry->p50Time               = __picoPerfHistogramQuantile(merged, 0.5);
+        entry->p99Time               = __picoPerfHistogramQuantile(merged, 0.99);
+        entry->p999Time              = __picoPerfHistogramQuantile(merged, 0.999);
+        memset(entry->counters, 0, sizeof(entry->counters));
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        memcpy(entry->counters, merged->counters, sizeof(entry->counters));
+#endif
+    }
+    __PICO_PERF_FREE(merged);
+
+    if (*count == 0) {
+        __PICO_PERF_FREE(result);
+        return NULL;
+    }
+    qsort(result, *count, sizeof(picoPerfScopeStats_t), __picoPerfCompareStats);
+    return result;
+}
+
+size_t picoPerfGetStats(picoPerfScopeStats_t *stats, size_t maxCount)
+{
+    if (!__picoPerfGlobalContext) {
+        return 0;
+    }
+
+    size_t count                   = 0;
+    picoPerfScopeStats_t *collected = __picoPerfCollectStats(&count);
+    if (stats && collected) {
+        memcpy(stats, collected, sizeof(picoPerfScopeStats_t) * (count < maxCount ? count : maxCount));
+    }
+    __PICO_PERF_FREE(collected);
+    return count;
+}
+
+// Stream layout: "PICOPRF1", frequency, start ticks and start wall clock (ns since the
+// unix epoch) as varints, followed by blocks that each start with a type byte
+#define __PICO_PERF_STREAM_MAGIC        "PICOPRF1"
+#define __PICO_PERF_STREAM_BLOCK_SITE    1 // id, line, name, file, function
+#define __PICO_PERF_STREAM_BLOCK_THREAD  2 // index, thread id, name
+#define __PICO_PERF_STREAM_BLOCK_ENTRIES 3 // thread index, count, entries
+#define __PICO_PERF_STREAM_BLOCK_DROPPED 4 // thread index, newly dropped count
+
+// Entry kinds inside an entries block, times are zigzag deltas from the previous entry of the thread
+#define __PICO_PERF_STREAM_ENTRY_SCOPE   0 // site, end site, parent site, depth, end delta, duration
+#define __PICO_PERF_STREAM_ENTRY_COUNTER 1 // site, time delta, value as 8 little endian bytes
+#define __PICO_PERF_STREAM_ENTRY_FLOW    2 // + phase: site, time delta, flow id
+#define __PICO_PERF_STREAM_ENTRY_SCOPE_COUNTERS 5 // scope fields, then a varint per picoPerfHwCounter
+
+#ifdef PICO_PERF_STREAMING
+
+typedef struct __picoPerfStream_t {
+    picoPerfStreamWriter writer;
+    void *userData;
+    FILE *file; // owned when streaming to a path
+    PICO_PERF_THREAD_TYPE flusherThread;
+    volatile uint32_t running;
+    uint32_t session;
+    uint32_t sitesWritten;
+    uint64_t droppedCount;
+    picoPerfTime startTime;
+    bool failed;
+    size_t bufferSize;
+    uint8_t buffer[PICO_PERF_STREAM_WRITE_BUFFER_SIZE];
+} __picoPerfStream_t;
+
+static void __picoPerfStreamFlushBuffer(__picoPerfStream_t *stream)
+{
+    if (stream->bufferSize > 0 && !stream->failed) {
+        stream->failed = stream->writer(stream->buffer, stream->bufferSize, stream->userData) != stream->bufferSize;
+    }
+    stream->bufferSize = 0;
+}
+
+static void __picoPerfStreamWriteBytes(__picoPerfStream_t *stream, const void *data, size_t size)
+{
+    const uint8_t *bytes = (const uint8_t *)data;
+    while (size > 0) {
+        if (stream->bufferSize == PICO_PERF_STREAM_WRITE_BUFFER_SIZE) {
+            __picoPerfStreamFlushBuffer(stream);
+        }
+        size_t chunk = PICO_PERF_STREAM_WRITE_BUFFER_SIZE - stream->bufferSize;
+        chunk        = chunk < size ? chunk : size;
+        memcpy(stream->buffer + stream->bufferSize, bytes, chunk);
+        stream->bufferSize += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+static void __picoPerfStreamWriteVarint(__picoPerfStream_t *stream, uint64_t value)
+{
+    uint8_t bytes[10];
+    size_t size = 0;
+    do {
+        bytes[size] = (uint8_t)(value & 0x7F);
+        value >>= 7;
+        if (value) {
+            bytes[size] |= 0x80;
+        }
+        size++;
+    } while (value);
+    __picoPerfStreamWriteBytes(stream, bytes, size);
+}
+
+static void __picoPerfStreamWriteDelta(__picoPerfStream_t *stream, picoPerfTime time, picoPerfTime *previous)
+{
+    int64_t delta = (int64_t)(time - *previous);
+    *previous     = time;
+    __picoPerfStreamWriteVarint(stream, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+}
+
+static void __picoPerfStreamWriteString(__picoPerfStream_t *stream, const char *str)
+{
+    size_t length = strlen(str);
+    __picoPerfStreamWriteVarint(stream, length);
+    __picoPerfStreamWriteBytes(stream, str, length);
+}
+
+static void __picoPerfStreamWriteEntry(__picoPerfStream_t *stream, __picoPerfThread_t *thread, const __picoPerfEntry_t *entry)
+{
+    if (entry->mark.tag != __PICO_PERF_MARK_TAG) {
+        const __picoPerfEvent_t *event = &entry->event;
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        __picoPerfStreamWriteVarint(stream, __PICO_PERF_STREAM_ENTRY_SCOPE_COUNTERS);
+#else
+        __picoPerfStreamWriteVarint(stream, __PICO_PERF_STREAM_ENTRY_SCOPE);
+#endif
+        __picoPerfStreamWriteVarint(stream, event->siteId);
+        __picoPerfStreamWriteVarint(stream, event->endSiteId);
+        __picoPerfStreamWriteVarint(stream, event->parentSiteId);
+        __picoPerfStreamWriteVarint(stream, event->depth);
+        __picoPerfStreamWriteDelta(stream, event->endTime, &thread->streamPreviousTime);
+        __picoPerfStreamWriteVarint(stream, event->endTime - event->startTime);
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        for (uint32_t i = 0; i < PICO_PERF_HW_COUNTER_COUNT; i++) {
+            __picoPerfStreamWriteVarint(stream, event->counters[i]);
+        }
+#endif
+        return;
+    }
+
+    const __picoPerfMark_t *mark = &entry->mark;
+    if (mark->kind == __PICO_PERF_MARK_COUNTER) {
+        uint8_t bytes[8];
+        uint64_t bits;
+        memcpy(&bits, &mark->value.counterValue, sizeof(bits));
+        for (int i = 0; i < 8; i++) {
+            bytes[i] = (uint8_t)(bits >> (i * 8));
+        }
+        __picoPerfStreamWriteVarint(stream, __PICO_PERF_STREAM_ENTRY_COUNTER);
+        __picoPerfStreamWriteVarint(stream, mark->siteId);
+        __picoPerfStreamWriteDelta(stream, mark->time, &thread->streamPreviousTime);
+        __picoPerfStreamWriteBytes(stream, bytes, sizeof(bytes));
+    } else {
+        __picoPerfStreamWriteVarint(stream, __PICO_PERF_STREAM_ENTRY_FLOW + mark->kind);
+        __picoPerfStreamWriteVarint(stream, mark->siteId);
+        __picoPerfStreamWriteDelta(stream, mark->time, &thread->streamPreviousTime);
+        __picoPerfStreamWriteVarint(stream, mark->value.flowId);
+    }
+}
+
+// Drains every thread ring. Ring heads are sampled first, so the sites and thread names
+// written before the entries cover everything the entries refer to.
+static void __picoPerfStreamFlush(__picoPerfStream_t *stream)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    __picoPerfThread_t *threads = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads);
+
+    for (__picoPerfThread_t *thread = threads; thread; thread = thread->next) {
+        __picoPerfStreamRing_t *ring = (__picoPerfStreamRing_t *)PICO_PERF_ATOMIC_LOAD_PTR(&thread->streamRing);
+        thread->streamHead           = ring ? PICO_PERF_ATOMIC_LOAD32(&ring->head) : 0;
+    }
+
+    __picoPerfLockSites(context);
+    uint32_t siteCount = context->siteCount;
+    for (; stream->sitesWritten < siteCount; stream->sitesWritten++) {
+        const __picoPerfSite_t *site = &context->sites[stream->sitesWritten];
+        __picoPerfStreamWriteVarint(stream, __PICO_PERF_STREAM_BLOCK_SITE);
+        __picoPerfStreamWriteVarint(stream, stream->sitesWritten);
+        __picoPerfStreamWriteVarint(stream, site->line);
+        __picoPerfStreamWriteString(stream, site->name);
+        __picoPerfStreamWriteString(stream, site->file);
+        __picoPerfStreamWriteString(stream, site->function);
+    }
+    for (__picoPerfThread_t *thread = threads; thread; thread = thread->next) {
+        bool announced = thread->streamSession == stream->session;
+        if (!announced || strcmp(thread->streamName, thread->name) != 0) {
+            if (!announced) {
+                thread->streamSession      = stream->session;
+                thread->streamPreviousTime = stream->startTime;
+            }
+            memcpy(thread->streamName, thread->name, sizeof(thread->streamName));
+            __picoPerfStreamWriteVarint(stream, __PICO_PERF_STREAM_BLOCK_THREAD);
+            __picoPerfStreamWriteVarint(stream, thread->threadIndex);
+            __picoPerfStreamWriteVarint(stream, thread->threadId);
+            __picoPerfStreamWriteString(stream, thread->streamName);
+        }
+    }
+    __picoPerfUnlockSites(context);
+
+    for (__picoPerfThread_t *thread = threads; thread; thread = thread->next) {
+        __picoPerfStreamRing_t *ring = (__picoPerfStreamRing_t *)PICO_PERF_ATOMIC_LOAD_PTR(&thread->streamRing);
+        if (!ring) {
+            continue;
+        }
+
+        uint32_t tail = ring->tail;
+        if (thread->streamHead != tail) {
+            __picoPerfStreamWriteVarint(stream, __PICO_PERF_STREAM_BLOCK_ENTRIES);
+            __picoPerfStreamWriteVarint(stream, thread->threadIndex);
+            __picoPerfStreamWriteVarint(stream, thread->streamHead - tail);
+            for (; tail != thread->streamHead; tail++) {
+                __picoPerfStreamWriteEntry(stream, thread, &ring->entries[tail & (PICO_PERF_STREAM_BUFFER_SIZE - 1)]);
+            }
+            PICO_PERF_ATOMIC_STORE32(&ring->tail, tail);
+        }
+
+        uint32_t dropped = PICO_PERF_ATOMIC_LOAD32(&ring->dropped);
+        if (dropped != thread->streamDropped) {
+            __picoPerfStreamWriteVarint(stream, __PICO_PERF_STREAM_BLOCK_DROPPED);
+            __picoPerfStreamWriteVarint(stream, thread->threadIndex);
+            __picoPerfStreamWriteVarint(stream, dropped - thread->streamDropped);
+            stream->droppedCount += dropped - thread->streamDropped;
+            thread->streamDropped = dropped;
+        }
+    }
+
+    __picoPerfStreamFlushBuffer(stream);
+}
+
+static PICO_PERF_THREAD_RETURN_TYPE __picoPerfStreamFlusherMain(void *arg)
+{
+    __picoPerfStream_t *stream = (__picoPerfStream_t *)arg;
+    while (PICO_PERF_ATOMIC_LOAD32(&stream->running)) {
+        __picoPerfStreamFlush(stream);
+        picoPerfSleep(PICO_PERF_STREAM_FLUSH_INTERVAL_MS);
+    }
+    __picoPerfStreamFlush(stream);
+    return PICO_PERF_THREAD_RETURN_VALUE;
+}
+
+static size_t __picoPerfStreamFileWriter(const void *data, size_t size, void *userData)
+{
+    return fwrite(data, 1, size, (FILE *)userData);
+}
+
+bool picoPerfStartStreaming(picoPerfStreamWriter writer, void *userData)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    if (!context || !writer || context->stream) {
+        return false;
+    }
+
+    __picoPerfStream_t *stream = (__picoPerfStream_t *)__PICO_PERF_MALLOC(sizeof(__picoPerfStream_t));
+    if (!stream) {
+        return false;
+    }
+    memset(stream, 0, sizeof(__picoPerfStream_t));
+    stream->writer    = writer;
+    stream->userData  = userData;
+    stream->session   = ++context->streamSession;
+    stream->running   = 1;
+    stream->startTime = picoPerfNow();
+
+    // entries left over from an earlier session are skipped
+    for (__picoPerfThread_t *thread = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads); thread; thread = thread->next) {
+        __picoPerfStreamRing_t *ring = (__picoPerfStreamRing_t *)PICO_PERF_ATOMIC_LOAD_PTR(&thread->streamRing);
+        if (ring) {
+            PICO_PERF_ATOMIC_STORE32(&ring->tail, PICO_PERF_ATOMIC_LOAD32(&ring->head));
+            thread->streamDropped = PICO_PERF_ATOMIC_LOAD32(&ring->dropped);
+        }
+    }
+
+    __picoPerfStreamWriteBytes(stream, __PICO_PERF_STREAM_MAGIC, 8);
+    __picoPerfStreamWriteVarint(stream, picoPerfFrequency());
+    __picoPerfStreamWriteVarint(stream, stream->startTime);
+    __picoPerfStreamWriteVarint(stream, __picoPerfWallClockNanoseconds());
+    __picoPerfStreamFlushBuffer(stream);
+
+    if (stream->failed || !PICO_PERF_THREAD_CREATE(stream->flusherThread, __picoPerfStreamFlusherMain, stream)) {
+        __PICO_PERF_FREE(stream);
+        return false;
+    }
+
+    context->stream = stream;
+    PICO_PERF_ATOMIC_OR32(&context->modes, __PICO_PERF_MODE_STREAMING);
+    return true;
+}
+
+bool picoPerfStartStreamingToFile(const char *filePath)
+{
+    if (!__picoPerfGlobalContext || __picoPerfGlobalContext->stream || !filePath) {
+        return false;
+    }
+
+    FILE *file = fopen(filePath, "wb");
+    if (!file) {
+        return false;
+    }
+
+    if (!picoPerfStartStreaming(__picoPerfStreamFileWriter, file)) {
+        fclose(file);
+        return false;
+    }
+    __picoPerfGlobalContext->stream->file = file;
+    return true;
+}
+
+void picoPerfStopStreaming(void)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    if (!context || !context->stream) {
+        return;
+    }
+
+    __picoPerfStream_t *stream = context->stream;
+    PICO_PERF_ATOMIC_AND32(&context->modes, ~(uint32_t)__PICO_PERF_MODE_STREAMING);
+    PICO_PERF_ATOMIC_STORE32(&stream->running, 0);
+    PICO_PERF_THREAD_JOIN(stream->flusherThread);
+
+    if (stream->file) {
+        fclose(stream->file);
+    }
+    context->stream = NULL;
+    __PICO_PERF_FREE(stream);
+}
+
+uint64_t picoPerfGetStreamDroppedCount(void)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    if (!context) {
+        return 0;
+    }
+
+    // the flusher only folds drops in periodically, so count straight from the rings
+    uint64_t dropped = 0;
+    for (__picoPerfThread_t *thread = (__picoPerfThread_t *)PICO_PERF_ATOMIC_LOAD_PTR(&context->threads); thread; thread = thread->next) {
+        __picoPerfStreamRing_t *ring = (__picoPerfStreamRing_t *)PICO_PERF_ATOMIC_LOAD_PTR(&thread->streamRing);
+        if (ring) {
+            dropped += PICO_PERF_ATOMIC_LOAD32(&ring->dropped);
+        }
+    }
+    return dropped;
+}
+
+#endif // PICO_PERF_STREAMING
+
+typedef struct {
+    char *name;
+    char *file;
+    char *function;
+    uint32_t line;
+} __picoPerfDecodedSite_t;
+
+typedef struct {
+    bool known;
+    uint64_t threadId;
+    char *name;
+    picoPerfTime previousTime;
+} __picoPerfDecodedThread_t;
+
+typedef struct {
+    FILE *file;
+    bool truncated;
+    uint64_t frequency;
+    picoPerfTime startTime;
+    uint64_t startWallNs;
+    __picoPerfDecodedSite_t *sites;
+    size_t siteCapacity;
+    __picoPerfDecodedThread_t *threads;
+    size_t threadCapacity;
+} __picoPerfDecoder_t;
+
+static uint64_t __picoPerfDecodeVarint(__picoPerfDecoder_t *decoder)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int c = fgetc(decoder->file);
+        if (c == EOF) {
+            decoder->truncated = true;
+            return 0;
+        }
+        value |= (uint64_t)(c & 0x7F) << shift;
+        if ((c & 0x80) == 0) {
+            break;
+        }
+    }
+    return value;
+}
+
+static char *__picoPerfDecodeString(__picoPerfDecoder_t *decoder)
+{
+    uint64_t length = __picoPerfDecodeVarint(decoder);
+    if (decoder->truncated || length > 65536) {
+        decoder->truncated = true;
+        return NULL;
+    }
+
+    char *str = (char *)__PICO_PERF_MALLOC((size_t)length + 1);
+    if (!str || fread(str, 1, (size_t)length, decoder->file) != length) {
+        __PICO_PERF_FREE(str);
+        decoder->truncated = true;
+        return NULL;
+    }
+    str[length] = '\0';
+    return str;
+}
+
+// Grows a decoder table so index fits, new slots are zeroed
+static bool __picoPerfDecoderReserve(void **table, size_t *capacity, size_t elementSize, uint64_t index)
+{
+    if (index < *capacity) {
+        return true;
+    }
+    if (index > 0xFFFFFF) {
+        return false;
+    }
+
+    size_t newCapacity = *capacity ? *capacity : 64;
+    while (newCapacity <= index) {
+        newCapacity *= 2;
+    }
+    void *grown = __PICO_PERF_REALLOC(*table, newCapacity * elementSize);
+    if (!grown) {
+        return false;
+    }
+    memset((uint8_t *)grown + *capacity * elementSize, 0, (newCapacity - *capacity) * elementSize);
+    *table    = grown;
+    *capacity = newCapacity;
+    return true;
+}
+
+static const __picoPerfDecodedSite_t *__picoPerfDecoderSite(__picoPerfDecoder_t *decoder, uint64_t siteId)
+{
+    static const __picoPerfDecodedSite_t unknown = {(char *)"unknown", (char *)"unknown", (char *)"unknown", 0};
+    if (siteId >= decoder->siteCapacity || !decoder->sites[siteId].name) {
+        return &unknown;
+    }
+    return &decoder->sites[siteId];
+}
+
+static int64_t __picoPerfDecoderTime(__picoPerfDecoder_t *decoder, picoPerfTime time)
+{
+    if (decoder->frequency == 0) {
+        return 0;
+    }
+    int64_t ticks = (int64_t)(time - decoder->startTime);
+    return (int64_t)((double)ticks * 1000000000.0 / (double)decoder->frequency);
+}
+
+static bool __picoPerfDecodeEntries(__picoPerfDecoder_t *decoder, picoPerfStreamCallback callback, void *userData)
+{
+    uint64_t threadIndex = __picoPerfDecodeVarint(decoder);
+    uint64_t count       = __picoPerfDecodeVarint(decoder);
+    if (decoder->truncated || !__picoPerfDecoderReserve((void **)&decoder->threads, &decoder->threadCapacity, sizeof(__picoPerfDecodedThread_t), threadIndex)) {
+        return false;
+    }
+
+    __picoPerfDecodedThread_t *thread = &decoder->threads[threadIndex];
+    for (uint64_t i = 0; i < count; i++) {
+        picoPerfStreamEvent_t event;
+        memset(&event, 0, sizeof(event));
+        event.threadId   = thread->threadId;
+        event.threadName = thread->name ? thread->name : "";
+
+        uint64_t kind                       = __picoPerfDecodeVarint(decoder);
+        const __picoPerfDecodedSite_t *site = __picoPerfDecoderSite(decoder, __picoPerfDecodeVarint(decoder));
+        event.name                          = site->name;
+        event.location.file                 = site->file;
+        event.location.function             = site->function;
+        event.location.line                 = site->line;
+
+        bool scope = kind == __PICO_PERF_STREAM_ENTRY_SCOPE || kind == __PICO_PERF_STREAM_ENTRY_SCOPE_COUNTERS;
+        if (scope) {
+            const __picoPerfDecodedSite_t *endSite = __picoPerfDecoderSite(decoder, __picoPerfDecodeVarint(decoder));
+            uint64_t parentSiteId                  = __picoPerfDecodeVarint(decoder);
+            event.type                             = PICO_PERF_STREAM_EVENT_SCOPE;
+            event.parentName                       = parentSiteId ? __picoPerfDecoderSite(decoder, parentSiteId)->name : "ROOT";
+            event.endLocation.file                 = endSite->file;
+            event.endLocation.function             = endSite->function;
+            event.endLocation.line                 = endSite->line;
+            event.depth                            = (uint32_t)__picoPerfDecodeVarint(decoder);
+        }
+
+        uint64_t zigzag = __picoPerfDecodeVarint(decoder);
+        thread->previousTime += (picoPerfTime)((zigzag >> 1) ^ (~(zigzag & 1) + 1));
+        picoPerfTime time = thread->previousTime;
+
+        if (scope) {
+            uint64_t duration = __picoPerfDecodeVarint(decoder);
+            event.timeNs      = __picoPerfDecoderTime(decoder, time - duration);
+            event.durationNs  = (uint64_t)(__picoPerfDecoderTime(decoder, time) - event.timeNs);
+            for (uint32_t c = 0; kind == __PICO_PERF_STREAM_ENTRY_SCOPE_COUNTERS && c < PICO_PERF_HW_COUNTER_COUNT; c++) {
+                event.counters[c] = __picoPerfDecodeVarint(decoder);
+            }
+        } else if (kind == __PICO_PERF_STREAM_ENTRY_COUNTER) {
+            uint8_t bytes[8];
+            uint64_t bits = 0;
+            if (fread(bytes, 1, sizeof(bytes), decoder->file) != sizeof(bytes)) {
+                decoder->truncated = true;
+            }
+            for (int b = 0; b < 8; b++) {
+                bits |= (uint64_t)bytes[b] << (b * 8);
+            }
+            memcpy(&event.counterValue, &bits, sizeof(bits));
+            event.type   = PICO_PERF_STREAM_EVENT_COUNTER;
+            event.timeNs = __picoPerfDecoderTime(decoder, time);
+        } else if (kind <= __PICO_PERF_STREAM_ENTRY_FLOW + PICO_PERF_FLOW_PHASE_END) {
+            event.type      = PICO_PERF_STREAM_EVENT_FLOW;
+            event.flowPhase = (picoPerfFlowPhase)(kind - __PICO_PERF_STREAM_ENTRY_FLOW);
+            event.flowId    = __picoPerfDecodeVarint(decoder);
+            event.timeNs    = __picoPerfDecoderTime(decoder, time);
+        } else {
+            return false;
+        }
+
+        if (decoder->truncated) {
+            return false;
+        }
+        int64_t wallNs  = (int64_t)decoder->startWallNs + event.timeNs;
+        event.timestamp = __picoPerfTimestampFromWallClock(wallNs > 0 ? (uint64_t)wallNs : 0);
+        callback(&event, userData);
+    }
+    return true;
+}
+
+bool picoPerfDecodeStream(const char *filePath, picoPerfStreamCallback callback, void *userData)
+{
+    if (!filePath || !callback) {
+        return false;
+    }
+
+    __picoPerfDecoder_t decoder;
+    memset(&decoder, 0, sizeof(decoder));
+    decoder.file = fopen(filePath, "rb");
+    if (!decoder.file) {
+        return false;
+    }
+
+    char magic[8];
+    bool ok = fread(magic, 1, sizeof(magic), decoder.file) == sizeof(magic) && memcmp(magic, __PICO_PERF_STREAM_MAGIC, sizeof(magic)) == 0;
+    if (ok) {
+        decoder.frequency   = __picoPerfDecodeVarint(&decoder);
+        decoder.startTime   = __picoPerfDecodeVarint(&decoder);
+        decoder.startWallNs = __picoPerfDecodeVarint(&decoder);
+        ok                  = !decoder.truncated;
+    }
+
+    int blockType;
+    while (ok && (blockType = fgetc(decoder.file)) != EOF) {
+        if (blockType == __PICO_PERF_STREAM_BLOCK_SITE) {
+            uint64_t siteId = __picoPerfDecodeVarint(&decoder);
+            uint32_t line   = (uint32_t)__picoPerfDecodeVarint(&decoder);
+            char *name      = __picoPerfDecodeString(&decoder);
+            char *file      = __picoPerfDecodeString(&decoder);
+            char *function  = __picoPerfDecodeString(&decoder);
+            ok              = !decoder.truncated && __picoPerfDecoderReserve((void **)&decoder.sites, &decoder.siteCapacity, sizeof(__picoPerfDecodedSite_t), siteId);
+            if (ok) {
+                __picoPerfDecodedSite_t *site = &decoder.sites[siteId];
+                __PICO_PERF_FREE(site->name);
+                __PICO_PERF_FREE(site->file);
+                __PICO_PERF_FREE(site->function);
+                site->name     = name;
+                site->file     = file;
+                site->function = function;
+                site->line     = line;
+            } else {
+                __PICO_PERF_FREE(name);
+                __PICO_PERF_FREE(file);
+                __PICO_PERF_FREE(function);
+            }
+        } else if (blockType == __PICO_PERF_STREAM_BLOCK_THREAD) {
+            uint64_t threadIndex = __picoPerfDecodeVarint(&decoder);
+            uint64_t threadId    = __picoPerfDecodeVarint(&decoder);
+            char *name           = __picoPerfDecodeString(&decoder);
+            ok                   = !decoder.truncated && __picoPerfDecoderReserve((void **)&decoder.threads, &decoder.threadCapacity, sizeof(__picoPerfDecodedThread_t), threadIndex);
+            if (ok) {
+                __picoPerfDecodedThread_t *thread = &decoder.threads[threadIndex];
+                if (!thread->known) {
+                    thread->known        = true;
+                    thread->previousTime = decoder.startTime;
+                }
+                __PICO_PERF_FREE(thread->name);
+                thread->threadId = threadId;
+                thread->name     = name;
+            } else {
+                __PICO_PERF_FREE(name);
+            }
+        } else if (blockType == __PICO_PERF_STREAM_BLOCK_ENTRIES) {
+            ok = __picoPerfDecodeEntries(&decoder, callback, userData);
+        } else if (blockType == __PICO_PERF_STREAM_BLOCK_DROPPED) {
+            uint64_t threadIndex = __picoPerfDecodeVarint(&decoder);
+            uint64_t dropped     = __picoPerfDecodeVarint(&decoder);
+            ok                   = !decoder.truncated;
+            if (ok) {
+                picoPerfStreamEvent_t event;
+                memset(&event, 0, sizeof(event));
+                event.type         = PICO_PERF_STREAM_EVENT_DROPPED;
+                event.name         = "dropped";
+                event.threadName   = "";
+                event.droppedCount = dropped;
+                if (threadIndex < decoder.threadCapacity) {
+                    event.threadId   = decoder.threads[threadIndex].threadId;
+                    event.threadName = decoder.threads[threadIndex].name ? decoder.threads[threadIndex].name : "";
+                }
+                callback(&event, userData);
+            }
+        } else {
+            ok = false;
+        }
+    }
+
+    for (size_t i = 0; i < decoder.siteCapacity; i++) {
+        __PICO_PERF_FREE(decoder.sites[i].name);
+        __PICO_PERF_FREE(decoder.sites[i].file);
+        __PICO_PERF_FREE(decoder.sites[i].function);
+    }
+    for (size_t i = 0; i < decoder.threadCapacity; i++) {
+        __PICO_PERF_FREE(decoder.threads[i].name);
+    }
+    __PICO_PERF_FREE(decoder.sites);
+    __PICO_PERF_FREE(decoder.threads);
+    fclose(decoder.file);
+    return ok;
+}
+
+void picoPerfGetReport(FILE *output, picoPerfReportFormat format)
+{
+    if (!__picoPerfGlobalContext || !output) {
+        return;
+    }
+
+    switch (format) {
+        case PICO_PERF_REPORT_FORMAT_TEXT:
+            __picoPerfGetReportText(output);
+            break;
+        case PICO_PERF_REPORT_FORMAT_CSV:
+            __picoPerfGetReportCSV(output);
+            break;
+        case PICO_PERF_REPORT_FORMAT_JSON:
+            __picoPerfGetReportJSON(output);
+            break;
+        case PICO_PERF_REPORT_FORMAT_XML:
+            __picoPerfGetReportXML(output);
+            break;
+        case PICO_PERF_REPORT_FORMAT_CHROME_TRACE:
+            __picoPerfGetReportChromeTrace(output);
+            break;
+        default:
+            __picoPerfGetReportText(output);
+            break;
+    }
+}
+
+static void __picoPerfGetStatsReportText(FILE *output, const picoPerfScopeStats_t *stats, size_t count)
+{
+    fprintf(output, "picoPerf Scope Statistics\n");
+    fprintf(output, "Total Sites: %zu\n\n", count);
+
+    for (size_t i = 0; i < count; i++) {
+        char total[64], mean[64], minimum[64], maximum[64], p50[64], p99[64], p999[64];
+        picoPerfFormatDuration(stats[i].totalTime, total, sizeof(total));
+        picoPerfFormatDuration(stats[i].meanTime, mean, sizeof(mean));
+        picoPerfFormatDuration(stats[i].minTime, minimum, sizeof(minimum));
+        picoPerfFormatDuration(stats[i].maxTime, maximum, sizeof(maximum));
+        picoPerfFormatDuration(stats[i].p50Time, p50, sizeof(p50));
+        picoPerfFormatDuration(stats[i].p99Time, p99, sizeof(p99));
+        picoPerfFormatDuration(stats[i].p999Time, p999, sizeof(p999));
+
+        fprintf(output, "[%zu] %s: %llu calls, %s total\n", i, stats[i].name, (unsigned long long)stats[i].count, total);
+        fprintf(output, "  Mean: %s  Min: %s  Max: %s\n", mean, minimum, maximum);
+        fprintf(output, "  P50: %s  P99: %s  P999: %s\n", p50, p99, p999);
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        __picoPerfWriteCounters(output, stats[i].counters, PICO_PERF_REPORT_FORMAT_TEXT, "");
+#endif
+        fprintf(output, "  At: %s:%u in %s()\n\n", stats[i].location.file, stats[i].location.line, stats[i].location.function);
+    }
+}
+
+static void __picoPerfGetStatsReportCSV(FILE *output, const picoPerfScopeStats_t *stats, size_t count)
+{
+    fprintf(output, "Name,File,Function,Line,Count,TotalNanoseconds,MeanNanoseconds,MinNanoseconds,MaxNanoseconds,");
+    fprintf(output, "P50Nanoseconds,P99Nanoseconds,P999Nanoseconds");
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+    fprintf(output, ",Cycles,Instructions,IPC,L1DMisses,L1DMPKI,LLCMisses,LLCMPKI,BranchMisses,BranchMPKI");
+#endif
+    fprintf(output, "\n");
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(output, "\"%s\",", __picoPerfEscapeString(stats[i].name));
+        fprintf(output, "\"%s\",", __picoPerfEscapeString(stats[i].location.file));
+        fprintf(output, "\"%s\",%u,%llu,", __picoPerfEscapeString(stats[i].location.function), stats[i].location.line, (unsigned long long)stats[i].count);
+        fprintf(output, "%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f",
+                picoPerfDurationNanoseconds(0, stats[i].totalTime), picoPerfDurationNanoseconds(0, stats[i].meanTime),
+                picoPerfDurationNanoseconds(0, stats[i].minTime), picoPerfDurationNanoseconds(0, stats[i].maxTime),
+                picoPerfDurationNanoseconds(0, stats[i].p50Time), picoPerfDurationNanoseconds(0, stats[i].p99Time),
+                picoPerfDurationNanoseconds(0, stats[i].p999Time));
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        __picoPerfWriteCounters(output, stats[i].counters, PICO_PERF_REPORT_FORMAT_CSV, "");
+#endif
+        fprintf(output, "\n");
+    }
+}
+
+static void __picoPerfGetStatsReportJSON(FILE *output, const picoPerfScopeStats_t *stats, size_t count)
+{
+    fprintf(output, "{\n");
+    fprintf(output, "  \"totalSites\": %zu,\n", count);
+    fprintf(output, "  \"sites\": [\n");
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(output, "    {\n");
+        fprintf(output, "      \"name\": \"%s\",\n", __picoPerfEscapeString(stats[i].name));
+        fprintf(output, "      \"file\": \"%s\",\n", __picoPerfEscapeString(stats[i].location.file));
+        fprintf(output, "      \"function\": \"%s\",\n", __picoPerfEscapeString(stats[i].location.function));
+        fprintf(output, "      \"line\": %u,\n", stats[i].location.line);
+        fprintf(output, "      \"count\": %llu,\n", (unsigned long long)stats[i].count);
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        __picoPerfWriteCounters(output, stats[i].counters, PICO_PERF_REPORT_FORMAT_JSON, "      ");
+#endif
+        fprintf(output, "      \"nanoseconds\": {\n");
+        fprintf(output, "        \"total\": %.0f,\n", picoPerfDurationNanoseconds(0, stats[i].totalTime));
+        fprintf(output, "        \"mean\": %.0f,\n", picoPerfDurationNanoseconds(0, stats[i].meanTime));
+        fprintf(output, "        \"min\": %.0f,\n", picoPerfDurationNanoseconds(0, stats[i].minTime));
+        fprintf(output, "        \"max\": %.0f,\n", picoPerfDurationNanoseconds(0, stats[i].maxTime));
+        fprintf(output, "        \"p50\": %.0f,\n", picoPerfDurationNanoseconds(0, stats[i].p50Time));
+        fprintf(output, "        \"p99\": %.0f,\n", picoPerfDurationNanoseconds(0, stats[i].p99Time));
+        fprintf(output, "        \"p999\": %.0f\n", picoPerfDurationNanoseconds(0, stats[i].p999Time));
+        fprintf(output, "      }\n");
+        fprintf(output, "    }%s\n", (i < count - 1) ? "," : "");
+    }
+
+    fprintf(output, "  ]\n");
+    fprintf(output, "}\n");
+}
+
+static void __picoPerfGetStatsReportXML(FILE *output, const picoPerfScopeStats_t *stats, size_t count)
+{
+    fprintf(output, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(output, "<PicoPerfStats>\n");
+    fprintf(output, "  <Summary>\n");
+    fprintf(output, "    <TotalSites>%zu</TotalSites>\n", count);
+    fprintf(output, "  </Summary>\n");
+    fprintf(output, "  <Sites>\n");
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(output, "    <Site index=\"%zu\">\n", i);
+        fprintf(output, "      <Name>%s</Name>\n", stats[i].name);
+        fprintf(output, "      <File>%s</File>\n", stats[i].location.file);
+        fprintf(output, "      <Function>%s</Function>\n", stats[i].location.function);
+        fprintf(output, "      <Line>%u</Line>\n", stats[i].location.line);
+        fprintf(output, "      <Count>%llu</Count>\n", (unsigned long long)stats[i].count);
+#ifdef PICO_PERF_HAS_HW_COUNTERS
+        __picoPerfWriteCounters(output, stats[i].counters, PICO_PERF_REPORT_FORMAT_XML, "      ");
+#endif
+        fprintf(output, "      <Nanoseconds>\n");
+        fprintf(output, "        <Total>%.0f</Total>\n", picoPerfDurationNanoseconds(0, stats[i].totalTime));
+        fprintf(output, "        <Mean>%.0f</Mean>\n", picoPerfDurationNanoseconds(0, stats[i].meanTime));
+        fprintf(output, "        <Min>%.0f</Min>\n", picoPerfDurationNanoseconds(0, stats[i].minTime));
+        fprintf(output, "        <Max>%.0f</Max>\n", picoPerfDurationNanoseconds(0, stats[i].maxTime));
+        fprintf(output, "        <P50>%.0f</P50>\n", picoPerfDurationNanoseconds(0, stats[i].p50Time));
+        fprintf(output, "        <P99>%.0f</P99>\n", picoPerfDurationNanoseconds(0, stats[i].p99Time));
+        fprintf(output, "        <P999>%.0f</P999>\n", picoPerfDurationNanoseconds(0, stats[i].p999Time));
+        fprintf(output, "      </Nanoseconds>\n");
+        fprintf(output, "    </Site>\n");
+    }
+
+    fprintf(output, "  </Sites>\n");
+    fprintf(output, "</PicoPerfStats>\n");
+}
+
+void picoPerfGetStatsReport(FILE *output, picoPerfReportFormat format)
+{
+    if (!__picoPerfGlobalContext || !output) {
+        return;
+    }
+
+    size_t count                = 0;
+    picoPerfScopeStats_t *stats = __picoPerfCollectStats(&count);
+
+    switch (format) {
+        case PICO_PERF_REPORT_FORMAT_CSV:
+            __picoPerfGetStatsReportCSV(output, stats, count);
+            break;
+        case PICO_PERF_REPORT_FORMAT_JSON:
+        case PICO_PERF_REPORT_FORMAT_CHROME_TRACE:
+            __picoPerfGetStatsReportJSON(output, stats, count);
+            break;
+        case PICO_PERF_REPORT_FORMAT_XML:
+            __picoPerfGetStatsReportXML(output, stats, count);
+            break;
+        default:
+            __picoPerfGetStatsReportText(output, stats, count);
+            break;
+    }
+    __PICO_PERF_FREE(stats);
+}
+
+static void __picoPerfCountAllocation(__picoPerfAllocationSite_t *site, uint64_t size)
+{
+    PICO_PERF_ATOMIC_ADD64(&site->allocationCount, 1);
+    PICO_PERF_ATOMIC_ADD64(&site->bytesAllocated, size);
+    uint64_t live = PICO_PERF_ATOMIC_ADD64(&site->liveBytes, size) + size;
+    uint64_t peak = PICO_PERF_RELAXED_LOAD64(&site->peakLiveBytes);
+    while (live > peak && !PICO_PERF_ATOMIC_CAS64(&site->peakLiveBytes, peak, live)) {
+        peak = PICO_PERF_RELAXED_LOAD64(&site->peakLiveBytes);
+    }
+}
+
+static void __picoPerfCountFree(__picoPerfAllocationSite_t *site, uint64_t size)
+{
+    PICO_PERF_ATOMIC_ADD64(&site->freeCount, 1);
+    PICO_PERF_ATOMIC_ADD64(&site->bytesFreed, size);
+    PICO_PERF_ATOMIC_ADD64(&site->liveBytes, (uint64_t)0 - size);
+}
+
+// Stamps a fresh block and counts it against the innermost open scope of the calling thread
+static void __picoPerfTrackAllocation(__picoPerfAllocationHeader_t *header, size_t size)
+{
+    header->size       = size;
+    header->siteId     = 0;
+    header->generation = 0;
+
+    picoPerfContext context = __picoPerfGlobalContext;
+    if (!context || !(PICO_PERF_ATOMIC_LOAD32(&context->modes) & __PICO_PERF_MODE_ALLOCATIONS)) {
+        return;
+    }
+
+    __picoPerfThread_t *thread = __picoPerfGetThread(context);
+    if (thread && thread->scopeStackTop > 0) {
+        header->siteId = thread->scopeStack[thread->scopeStackTop - 1].siteId;
+    }
+    header->generation = context->generation;
+    __picoPerfCountAllocation(&context->allocationSites[header->siteId], size);
+    __picoPerfCountAllocation(&context->allocationTotals, size);
+}
+
+// Frees are counted whenever the block was counted, even if tracking has been turned off since
+static void __picoPerfTrackFree(const __picoPerfAllocationHeader_t *header)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    if (!context || header->generation != context->generation) {
+        return;
+    }
+
+    __picoPerfCountFree(&context->allocationSites[header->siteId], header->size);
+    __picoPerfCountFree(&context->allocationTotals, header->size);
+}
+
+void *picoPerfMalloc(size_t size)
+{
+    if (size > SIZE_MAX - sizeof(__picoPerfAllocationHeader_t)) {
+        return NULL;
+    }
+
+    __picoPerfAllocationHeader_t *header = (__picoPerfAllocationHeader_t *)PICO_PERF_SYSTEM_MALLOC(sizeof(__picoPerfAllocationHeader_t) + size);
+    if (!header) {
+        return NULL;
+    }
+    __picoPerfTrackAllocation(header, size);
+    return header + 1;
+}
+
+void *picoPerfRealloc(void *ptr, size_t size)
+{
+    if (!ptr) {
+        return picoPerfMalloc(size);
+    }
+    if (size == 0) {
+        picoPerfFree(ptr);
+        return NULL;
+    }
+    if (size > SIZE_MAX - sizeof(__picoPerfAllocationHeader_t)) {
+        return NULL;
+    }
+
+    __picoPerfAllocationHeader_t previous = ((__picoPerfAllocationHeader_t *)ptr)[-1];
+    __picoPerfAllocationHeader_t *header  = (__picoPerfAllocationHeader_t *)PICO_PERF_SYSTEM_REALLOC((__picoPerfAllocationHeader_t *)ptr - 1, sizeof(__picoPerfAllocationHeader_t) + size);
+    if (!header) {
+        return NULL; // the old block is untouched and stays counted
+    }
+    __picoPerfTrackFree(&previous);
+    __picoPerfTrackAllocation(header, size);
+    return header + 1;
+}
+
+void picoPerfFree(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    __picoPerfAllocationHeader_t *header = (__picoPerfAllocationHeader_t *)ptr - 1;
+    __picoPerfTrackFree(header);
+    PICO_PERF_SYSTEM_FREE(header);
+}
+
+void picoPerfEnableAllocationTracking(bool enabled)
+{
+    if (!__picoPerfGlobalContext) {
+        return;
+    }
+
+    if (enabled) {
+        PICO_PERF_ATOMIC_OR32(&__picoPerfGlobalContext->modes, __PICO_PERF_MODE_ALLOCATIONS);
+    } else {
+        PICO_PERF_ATOMIC_AND32(&__picoPerfGlobalContext->modes, ~(uint32_t)__PICO_PERF_MODE_ALLOCATIONS);
+    }
+}
+
+static void __picoPerfReadAllocationSite(const __picoPerfAllocationSite_t *site, picoPerfAllocationStats_t *stats)
+{
+    stats->allocationCount = PICO_PERF_RELAXED_LOAD64(&site->allocationCount);
+    stats->freeCount       = PICO_PERF_RELAXED_LOAD64(&site->freeCount);
+    stats->bytesAllocated  = PICO_PERF_RELAXED_LOAD64(&site->bytesAllocated);
+    stats->bytesFreed      = PICO_PERF_RELAXED_LOAD64(&site->bytesFreed);
+    stats->liveBytes       = PICO_PERF_RELAXED_LOAD64(&site->liveBytes);
+    stats->peakLiveBytes   = PICO_PERF_RELAXED_LOAD64(&site->peakLiveBytes);
+}
+
+static int __picoPerfCompareAllocationStats(const void *a, const void *b)
+{
+    const picoPerfAllocationStats_t *statsA = (const picoPerfAllocationStats_t *)a;
+    const picoPerfAllocationStats_t *statsB = (const picoPerfAllocationStats_t *)b;
+    if (statsA->bytesAllocated != statsB->bytesAllocated) {
+        return statsA->bytesAllocated > statsB->bytesAllocated ? -1 : 1;
+    }
+    return 0;
+}
+
+// One entry per site that allocated anything, sorted by bytes allocated.
+// Returns an array the caller frees with __PICO_PERF_FREE, or NULL when nothing was counted.
+static picoPerfAllocationStats_t *__picoPerfCollectAllocationStats(size_t *count)
+{
+    picoPerfContext context = __picoPerfGlobalContext;
+    *count                  = 0;
+
+    __picoPerfLockSites(context);
+    uint32_t siteCount = context->siteCount;
+    __picoPerfUnlockSites(context);
+
+    picoPerfAllocationStats_t *result = (picoPerfAllocationStats_t *)__PICO_PERF_MALLOC(sizeof(picoPerfAllocationStats_t) * siteCount);
+    if (!result) {
+        return NULL;
+    }
+
+    for (uint32_t siteId = 0; siteId < siteCount; siteId++) {
+        picoPerfAllocationStats_t *entry = &result[*count];
+        __picoPerfReadAllocationSite(&context->allocationSites[siteId], entry);
+        if (entry->allocationCount == 0) {
+            continue;
+        }
+
+        const __picoPerfSite_t *site = &context->sites[siteId];
+        entry->name                  = site->name;
+        entry->location.file         = site->file;
+        entry->location.function     = site->function;
+        entry->location.line         = site->line;
+        (*count)++;
+    }
+
+    if (*count == 0) {
+        __PICO_PERF_FREE(result);
+        return NULL;
+    }
+    qsort(result, *count, sizeof(picoPerfAllocationStats_t), __picoPerfCompareAllocationStats);
+    return result;
+}
+
+size_t picoPerfGetAllocationStats(picoPerfAllocationStats_t *stats, size_t maxCount)
+{
+    if (!__picoPerfGlobalContext) {
+        return 0;
+    }
+
+    size_t count                        = 0;
+    picoPerfAllocationStats_t *collected = __picoPerfCollectAllocationStats(&count);
+    if (stats && collected) {
+        memcpy(stats, collected, sizeof(picoPerfAllocationStats_t) * (count < maxCount ? count : maxCount));
+    }
+    __PICO_PERF_FREE(collected);
+    return count;
+}
+
+picoPerfAllocationStats_t picoPerfGetAllocationTotals(void)
+{
+    picoPerfAllocationStats_t totals;
+    memset(&totals, 0, sizeof(totals));
+    totals.name              = "total";
+    totals.location.file     = "";
+    totals.location.function = "";
+    if (__picoPerfGlobalContext) {
+        __picoPerfReadAllocationSite(&__picoPerfGlobalContext->allocationTotals, &totals);
+    }
+    return totals;
+}
+
+static void __picoPerfGetAllocationReportText(FILE *output, const picoPerfAllocationStats_t *totals, const picoPerfAllocationStats_t *stats, size_t count)
+{
+    fprintf(output, "picoPerf Allocations\n");
+    fprintf(output, "Total: %llu allocations, %llu frees, %llu bytes allocated\n", (unsigned long long)totals->allocationCount,
+            (unsigned long long)totals->freeCount, (unsigned long long)totals->bytesAllocated);
+    fprintf(output, "Live: %llu bytes  Peak: %llu bytes\n", (unsigned long long)totals->liveBytes, (unsigned long long)totals->peakLiveBytes);
+    fprintf(output, "Total Sites: %zu\n\n", count);
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(output, "[%zu] %s: %llu allocations, %llu bytes allocated\n", i, stats[i].name,
+                (unsigned long long)stats[i].allocationCount, (unsigned long long)stats[i].bytesAllocated);
+        fprintf(output, "  Frees: %llu (%llu bytes)  Live: %llu bytes  Peak: %llu bytes\n", (unsigned long long)stats[i].freeCount,
+                (unsigned long long)stats[i].bytesFreed, (unsigned long long)stats[i].liveBytes, (unsigned long long)stats[i].peakLiveBytes);
+        fprintf(output, "  At: %s:%u in %s()\n\n", stats[i].location.file, stats[i].location.line, stats[i].location.function);
+    }
+}
+
+static void __picoPerfGetAllocationReportCSV(FILE *output, const picoPerfAllocationStats_t *totals, const picoPerfAllocationStats_t *stats, size_t count)
+{
+    fprintf(output, "Name,File,Function,Line,Allocations,Frees,BytesAllocated,BytesFreed,LiveBytes,PeakLiveBytes\n");
+
+    for (size_t i = 0; i <= count; i++) {
+        const picoPerfAllocationStats_t *entry = i < count ? &stats[i] : totals;
+        fprintf(output, "\"%s\",", __picoPerfEscapeString(entry->name));
+        fprintf(output, "\"%s\",", __picoPerfEscapeString(entry->location.file));
+        fprintf(output, "\"%s\",%u,", __picoPerfEscapeString(entry->location.function), entry->location.line);
+        fprintf(output, "%llu,%llu,%llu,%llu,%llu,%llu\n", (unsigned long long)entry->allocationCount, (unsigned long long)entry->freeCount,
+                (unsigned long long)entry->bytesAllocated, (unsigned long long)entry->bytesFreed, (unsigned long long)entry->liveBytes,
+                (unsigned long long)entry->peakLiveBytes);
+    }
+}
+
+static void __picoPerfWriteAllocationCountsJSON(FILE *output, const picoPerfAllocationStats_t *entry, const char *indent)
+{
+    fprintf(output, "%s\"allocations\": %llu,\n", indent, (unsigned long long)entry->allocationCount);
+    fprintf(output, "%s\"frees\": %llu,\n", indent, (unsigned long long)entry->freeCount);
+    fprintf(output, "%s\"bytesAllocated\": %llu,\n", indent, (unsigned long long)entry->bytesAllocated);
+    fprintf(output, "%s\"bytesFreed\": %llu,\n", indent, (unsigned long long)entry->bytesFreed);
+    fprintf(output, "%s\"liveBytes\": %llu,\n", indent, (unsigned long long)entry->liveBytes);
+    fprintf(output, "%s\"peakLiveBytes\": %llu\n", indent, (unsigned long long)entry->peakLiveBytes);
+}
+
+static void __picoPerfGetAllocationReportJSON(FILE *output, const picoPerfAllocationStats_t *totals, const picoPerfAllocationStats_t *stats, size_t count)
+{
+    fprintf(output, "{\n");
+    fprintf(output, "  \"totals\": {\n");
+    __picoPerfWriteAllocationCountsJSON(output, totals, "    ");
+    fprintf(output, "  },\n");
+    fprintf(output, "  \"totalSites\": %zu,\n", count);
+    fprintf(output, "  \"sites\": [\n");
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(output, "    {\n");
+        fprintf(output, "      \"name\": \"%s\",\n", __picoPerfEscapeString(stats[i].name));
+        fprintf(output, "      \"file\": \"%s\",\n", __picoPerfEscapeString(stats[i].location.file));
+        fprintf(output, "      \"function\": \"%s\",\n", __picoPerfEscapeString(stats[i].location.function));
+        fprintf(output, "      \"line\": %u,\n", stats[i].location.line);
+        __picoPerfWriteAllocationCountsJSON(output, &stats[i], "      ");
+        fprintf(output, "    }%s\n", (i < count - 1) ? "," : "");
+    }
+
+    fprintf(output, "  ]\n");
+    fprintf(output, "}\n");
+}
+
+static void __picoPerfWriteAllocationCountsXML(FILE *output, const picoPerfAllocationStats_t *entry, const char *indent)
+{
+    fprintf(output, "%s<Allocations>%llu</Allocations>\n", indent, (unsigned long long)entry->allocationCount);
+    fprintf(output, "%s<Frees>%llu</Frees>\n", indent, (unsigned long long)entry->freeCount);
+    fprintf(output, "%s<BytesAllocated>%llu</BytesAllocated>\n", indent, (unsigned long long)entry->bytesAllocated);
+    fprintf(output, "%s<BytesFreed>%llu</BytesFreed>\n", indent, (unsigned long long)entry->bytesFreed);
+    fprintf(output, "%s<LiveBytes>%llu</LiveBytes>\n", indent, (unsigned long long)entry->liveBytes);
+    fprintf(output, "%s<PeakLiveBytes>%llu</PeakLiveBytes>\n", indent, (unsigned long long)entry->peakLiveBytes);
+}
+
+static void __picoPerfGetAllocationReportXML(FILE *output, const picoPerfAllocationStats_t *totals, const picoPerfAllocationStats_t *stats, size_t count)
+{
+    fprintf(output, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(output, "<PicoPerfAllocations>\n");
+    fprintf(output, "  <Summary>\n");
+    fprintf(output, "    <TotalSites>%zu</TotalSites>\n", count);
+    __picoPerfWriteAllocationCountsXML(output, totals, "    ");
+    fprintf(output, "  </Summary>\n");
+    fprintf(output, "  <Sites>\n");
+
+    for (size_t i = 0; i < count; i++) {
+        fprintf(output, "    <Site index=\"%zu\">\n", i);
+        fprintf(output, "      <Name>%s</Name>\n", stats[i].name);
+        fprintf(output, "      <File>%s</File>\n", stats[i].location.file);
+        fprintf(output, "      <Function>%s</Function>\n", stats[i].location.function);
+        fprintf(output, "      <Line>%u</Line>\n", stats[i].location.line);
+        __picoPerfWriteAllocationCountsXML(output, &stats[i], "      ");
+        fprintf(output, "    </Site>\n");
+    }
+
+    fprintf(output, "  </Sites>\n");
+    fprintf(output, "</PicoPerfAllocations>\n");
+}
+
+void picoPerfGetAllocationReport(FILE *output, picoPerfReportFormat format)
+{
+    if (!__picoPerfGlobalContext || !output) {
+        return;
+    }
+
+    size_t count                     = 0;
+    picoPerfAllocationStats_t *stats = __picoPerfCollectAllocationStats(&count);
+    picoPerfAllocationStats_t totals = picoPerfGetAllocationTotals();
+
+    switch (format) {
+        case PICO_PERF_REPORT_FORMAT_CSV:
+            __picoPerfGetAllocationReportCSV(output, &totals, stats, count);
+            break;
+        case PICO_PERF_REPORT_FORMAT_JSON:
+        case PICO_PERF_REPORT_FORMAT_CHROME_TRACE:
+            __picoPerfGetAllocationReportJSON(output, &totals, stats, count);
+            break;
+        case PICO_PERF_REPORT_FORMAT_XML:
+            __picoPerfGetAllocationReportXML(output, &totals, stats, count);
+            break;
+        default:
+            __picoPerfGetAllocationReportText(output, &totals, stats, count);
+            break;
+    }
+    __PICO_PERF_FREE(stats);
+}
+
+#ifdef PICO_PERF_HAS_SAMPLING
+static __picoPerfSampler_t *volatile __picoPerfActiveSampler = NULL;
+
+// Runs inside the signal handler, so only plain loads and stores, no libc
+static uint32_t __picoPerfCaptureStack(const ucontext_t *context, void **frames)
+{
+#ifdef __PICO_PERF_SAMPLE_FRAME_POINTERS
+    uintptr_t stackPointer = __PICO_PERF_CONTEXT_SP(context);
+    uintptr_t framePointer = __PICO_PERF_CONTEXT_FP(context);
+    uintptr_t stackLow     = __picoPerfStackLow > stackPointer ? __picoPerfStackLow : stackPointer;
+    uintptr_t stackHigh    = __picoPerfStackHigh;
+    uint32_t depth         = 0;
+    frames[depth++]        = (void *)__PICO_PERF_CONTEXT_PC(context);
+    // every frame is { previous frame pointer, return address } and lives above the last one
+    // inside the thread's stack, anything else means the chain ran through code built without
+    // frame pointers
+    while (depth < PICO_PERF_SAMPLE_MAX_DEPTH && framePointer >= stackLow && stackHigh >= 2 * sizeof(uintptr_t) &&
+           framePointer <= stackHigh - 2 * sizeof(uintptr_t) && (framePointer & (sizeof(void *) - 1)) == 0) {
+        const uintptr_t *frame = (const uintptr_t *)framePointer;
+        if (frame[1] == 0) {
+            break;
+        }
+        frames[depth++] = (void *)frame[1];
+        if (frame[0] <= framePointer) {
+            break;
+        }
+        framePointer = frame[0];
+    }
+    return depth;
+#else
+    // room for this function, the handler and the kernel's signal trampoline
+    void *buffer[PICO_PERF_SAMPLE_MAX_DEPTH + 4];
+    int count = backtrace(buffer, PICO_PERF_SAMPLE_MAX_DEPTH + 4);
+    int first = count < 3 ? count : 3;
+#ifdef __PICO_PERF_CONTEXT_PC
+    void *interrupted = (void *)__PICO_PERF_CONTEXT_PC(context);
+    for (int i = 0; i < count && i < 8; i++) {
+        if (buffer[i] == interrupted) {
+            first = i;
+            break;
+        }
+    }
+#else
+    (void)context;
+#endif
+    uint32_t depth = 0;
+    for (int i = first; i < count && depth < PICO_PERF_SAMPLE_MAX_DEPTH; i++) {
+        frames[depth++] = buffer[i];
+    }
+    return depth;
+#endif
+}
+
+static void __picoPerfRecordSample(__picoPerfSampler_t *sampler, void **frames, uint32_t depth)
+{
+    __atomic_fetch_add(&sampler->sampleCount, 1, __ATOMIC_RELAXED);
+
+    uint64_t hash = 14695981039346656037ull;
+    for (uint32_t i = 0; i < depth; i++) {
+        hash = (hash ^ (uint64_t)(uintptr_t)frames[i]) * 1099511628211ull;
+    }
+    hash |= 1; // 0 marks a free slot
+
+    for (uint32_t probe = 0; probe < 64; probe++) {
+        __picoPerfSampleStack_t *stack = &sampler->stacks[(hash + probe) & (PICO_PERF_SAMPLE_MAX_STACKS - 1)];
+        uint64_t slotHash              = __atomic_load_n(&stack->hash, __ATOMIC_ACQUIRE);
+        if (slotHash == 0) {
+            if (__sync_bool_compare_and_swap(&stack->hash, 0, hash)) {
+                for (uint32_t i = 0; i < depth; i++) {
+                    stack->frames[i] = frames[i];
+                }
+                stack->depth = depth;
+                stack->count = 1;
+                PICO_PERF_ATOMIC_STORE32(&stack->ready, 1);
+                return;
+            }
+            slotHash = __atomic_load_n(&stack->hash, __ATOMIC_ACQUIRE);
+        }
+        // a slot another thread is still filling is skipped, the stack may then get a second
+        // slot further on, which the folded output merges anyway
+        if (slotHash != hash || !PICO_PERF_ATOMIC_LOAD32(&stack->ready) || stack->depth != depth) {
+            continue;
+        }
+        uint32_t i = 0;
+        while (i < depth && stack->frames[i] == frames[i]) {
+            i++;
+        }
+        if (i == depth) {
+            __atomic_fetch_add(&stack->count, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    __atomic_fetch_add(&sampler->droppedCount, 1, __ATOMIC_RELAXED);
+}
 
-            double durationSec = picoPerfDurationSeconds(item->startTime, item->endTime);
-            double durationMs  = picoPerfDurationMilliseconds(item->startTime, item->endTime);
-            double durationUs  = picoPerfDurationMicroseconds(item->startTime, item->endTime);
-            double durationNs  = picoPerfDurationNanoseconds(item->startTime, item->endTime);
+static void __picoPerfSampleSignalHandler(int signalNumber, siginfo_t *info, void *context)
+{
+    (void)signalNumber;
+    (void)info;
 
-            fprintf(output, "        <Item index=\"%zu\">\n", itemIdx);
-            fprintf(output, "          <Name>%s</Name>\n", item->name);
-            fprintf(output, "          <ParentName>%s</ParentName>\n", item->parentName);
-            fprintf(output, "          <ScopeDepth>%d</ScopeDepth>\n", item->scopeDepth);
-            fprintf(output, "          <StartTime>%llu</StartTime>\n", (unsigned long long)item->startTime);
-            fprintf(output, "          <EndTime>%llu</EndTime>\n", (unsigned long long)item->endTime);
-            fprintf(output, "          <Duration>\n");
-            fprintf(output, "            <Seconds>%.9f</Seconds>\n", durationSec);
-            fprintf(output, "            <Milliseconds>%.6f</Milliseconds>\n", durationMs);
-            fprintf(output, "            <Microseconds>%.3f</Microseconds>\n", durationUs);
-            fprintf(output, "            <Nanoseconds>%.0f</Nanoseconds>\n", durationNs);
-            fprintf(output, "          </Duration>\n");
-            fprintf(output, "          <Start>\n");
-            fprintf(output, "            <File>%s</File>\n", item->startLocation.file);
-            fprintf(output, "            <Function>%s</Function>\n", item->startLocation.function);
-            fprintf(output, "            <Line>%u</Line>\n", item->startLocation.line);
-            fprintf(output, "            <Timestamp>%04u-%02u-%02u %02u:%02u:%02u.%03u</Timestamp>\n",
-                    item->startTimestamp.year, item->startTimestamp.month, item->startTimestamp.day,
-                    item->startTimestamp.hour, item->startTimestamp.minute, item->startTimestamp.second,
-                    item->startTimestamp.millisecond);
-            fprintf(output, "          </Start>\n");
-            fprintf(output, "          <End>\n");
-            fprintf(output, "            <File>%s</File>\n", item->endLocation.file);
-            fprintf(output, "            <Function>%s</Function>\n", item->endLocation.function);
-            fprintf(output, "            <Line>%u</Line>\n", item->endLocation.line);
-            fprintf(output, "            <Timestamp>%04u-%02u-%02u %02u:%02u:%02u.%03u</Timestamp>\n",
-                    item->endTimestamp.year, item->endTimestamp.month, item->endTimestamp.day,
-                    item->endTimestamp.hour, item->endTimestamp.minute, item->endTimestamp.second,
-                    item->endTimestamp.millisecond);
-            fprintf(output, "          </End>\n");
-            fprintf(output, "        </Item>\n");
+    int savedErrno               = errno;
+    __picoPerfSampler_t *sampler = PICO_PERF_ATOMIC_LOAD_PTR(&__picoPerfActiveSampler);
+    if (sampler) {
+        PICO_PERF_ATOMIC_ADD32(&sampler->activeHandlers, 1);
+        if (PICO_PERF_ATOMIC_LOAD32(&sampler->running)) {
+            void *frames[PICO_PERF_SAMPLE_MAX_DEPTH];
+            uint32_t depth = __picoPerfCaptureStack((const ucontext_t *)context, frames);
+            __picoPerfRecordSample(sampler, frames, depth);
         }
+        PICO_PERF_ATOMIC_ADD32(&sampler->activeHandlers, (uint32_t)-1);
+    }
+    errno = savedErrno;
+}
 
-        fprintf(output, "      </Items>\n");
-        fprintf(output, "    </Record>\n");
+// backtrace_symbols gives "module(function+0x1f) [0x...]", "module(+0x1f) [0x...]" for
+// symbols that are not exported, or just "[0x...]"
+static void __picoPerfWriteFrameName(FILE *output, const char *symbol, void *address)
+{
+    const char *open  = symbol ? strchr(symbol, '(') : NULL;
+    const char *close = open ? strchr(open, ')') : NULL;
+    if (!open || !close) {
+        fprintf(output, "%p", address);
+        return;
     }
 
-    fprintf(output, "  </Records>\n");
-    fprintf(output, "</PicoPerfReport>\n");
+    const char *name = open + 1;
+    const char *end  = name;
+    while (end < close && *end != '+') {
+        end++;
+    }
+    if (end == name) {
+        // no symbol, fall back to the module file name and the offset into it
+        const char *module = symbol;
+        for (const char *c = symbol; c < open; c++) {
+            if (*c == '/') {
+                module = c + 1;
+            }
+        }
+        fwrite(module, 1, (size_t)(open - module), output);
+        fwrite(name, 1, (size_t)(close - name), output);
+        return;
+    }
+    for (const char *c = name; c < end; c++) {
+        fputc(*c == ';' ? ':' : *c, output); // ';' separates frames
+    }
 }
+#endif // PICO_PERF_HAS_SAMPLING
 
-bool picoPerfCreateContext(void)
+bool picoPerfStartSampling(uint32_t frequencyHz)
 {
-    if (__picoPerfGlobalContext != NULL) {
+#ifdef PICO_PERF_HAS_SAMPLING
+    if (!__picoPerfGlobalContext || frequencyHz == 0) {
         return false;
     }
 
-    __picoPerfGlobalContext = (picoPerfContext)PICO_MALLOC(sizeof(picoPerfContext_t));
-    if (!__picoPerfGlobalContext) {
+    __picoPerfSampler_t *sampler = __picoPerfGlobalContext->sampler;
+    if (sampler && PICO_PERF_ATOMIC_LOAD32(&sampler->running)) {
         return false;
     }
-    memset(__picoPerfGlobalContext, 0, sizeof(picoPerfContext_t));
 
-    __picoPerfGlobalContext->records = (__picoPerfRecord)PICO_MALLOC(sizeof(__picoPerfRecord_t) * PICO_PERF_MAX_RECORDS);
-    if (!__picoPerfGlobalContext->records) {
-        PICO_FREE(__picoPerfGlobalContext);
-        __picoPerfGlobalContext = NULL;
+    struct sigaction action;
+    if (sigaction(SIGPROF, NULL, &action) != 0) {
+        return false;
+    }
+    bool ownHandler  = (action.sa_flags & SA_SIGINFO) && action.sa_sigaction == __picoPerfSampleSignalHandler;
+    bool freeHandler = !(action.sa_flags & SA_SIGINFO) && (action.sa_handler == SIG_DFL || action.sa_handler == SIG_IGN);
+    if (!ownHandler && !freeHandler) {
+        return false;
+    }
+
+    if (!sampler) {
+        sampler = (__picoPerfSampler_t *)__PICO_PERF_MALLOC(sizeof(__picoPerfSampler_t));
+        if (!sampler) {
+            return false;
+        }
+        __picoPerfGlobalContext->sampler = sampler;
+    }
+    memset(sampler, 0, sizeof(__picoPerfSampler_t));
+
+#ifndef __PICO_PERF_SAMPLE_FRAME_POINTERS
+    // the first backtrace call loads libgcc_s, which must not happen inside the handler
+    void *warmup[4];
+    backtrace(warmup, 4);
+#else
+    __picoPerfCacheStackBounds();
+#endif
+
+    if (!ownHandler) {
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = __picoPerfSampleSignalHandler;
+        action.sa_flags     = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, NULL) != 0) {
+            return false;
+        }
+    }
+
+    PICO_PERF_ATOMIC_STORE32(&sampler->running, 1);
+    PICO_PERF_ATOMIC_STORE_PTR(&__picoPerfActiveSampler, sampler);
+
+    uint32_t intervalUs = 1000000 / frequencyHz;
+    struct itimerval timer;
+    timer.it_interval.tv_sec  = intervalUs / 1000000;
+    timer.it_interval.tv_usec = intervalUs > 0 ? intervalUs % 1000000 : 1;
+    timer.it_value            = timer.it_interval;
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        PICO_PERF_ATOMIC_STORE32(&sampler->running, 0);
+        PICO_PERF_ATOMIC_STORE_PTR(&__picoPerfActiveSampler, NULL);
         return false;
     }
-    memset(__picoPerfGlobalContext->records, 0, sizeof(__picoPerfRecord_t) * PICO_PERF_MAX_RECORDS);
     return true;
+#else
+    (void)frequencyHz;
+    return false;
+#endif
 }
 
-void picoPerfDestroyContext(void)
+void picoPerfStopSampling(void)
 {
-    if (!__picoPerfGlobalContext) {
+#ifdef PICO_PERF_HAS_SAMPLING
+    __picoPerfSampler_t *sampler = __picoPerfGlobalContext ? __picoPerfGlobalContext->sampler : NULL;
+    if (!sampler || !PICO_PERF_ATOMIC_LOAD32(&sampler->running)) {
         return;
     }
 
-    PICO_FREE(__picoPerfGlobalContext->records);
-    PICO_FREE(__picoPerfGlobalContext);
-    __picoPerfGlobalContext = NULL;
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+
+    // the handler stays installed, a SIGPROF still pending would otherwise kill the process
+    PICO_PERF_ATOMIC_STORE32(&sampler->running, 0);
+    PICO_PERF_ATOMIC_STORE_PTR(&__picoPerfActiveSampler, NULL);
+    while (PICO_PERF_ATOMIC_LOAD32(&sampler->activeHandlers) != 0) {
+        sched_yield();
+    }
+#endif
 }
 
-picoPerfContext picoPerfGetContext(void)
+uint64_t picoPerfGetSampleCount(uint64_t *droppedCount)
 {
-    return __picoPerfGlobalContext;
+#ifdef PICO_PERF_HAS_SAMPLING
+    __picoPerfSampler_t *sampler = __picoPerfGlobalContext ? __picoPerfGlobalContext->sampler : NULL;
+    if (droppedCount) {
+        *droppedCount = sampler ? __atomic_load_n(&sampler->droppedCount, __ATOMIC_RELAXED) : 0;
+    }
+    return sampler ? __atomic_load_n(&sampler->sampleCount, __ATOMIC_RELAXED) : 0;
+#else
+    if (droppedCount) {
+        *droppedCount = 0;
+    }
+    return 0;
+#endif
 }
 
-void picoPerfSetContext(picoPerfContext context)
+void picoPerfWriteFoldedStacks(FILE *output)
 {
-    if (__picoPerfGlobalContext != NULL) {
+#ifdef PICO_PERF_HAS_SAMPLING
+    __picoPerfSampler_t *sampler = __picoPerfGlobalContext ? __picoPerfGlobalContext->sampler : NULL;
+    if (!sampler || !output) {
         return;
     }
 
-    __picoPerfGlobalContext = context;
-}
+    for (size_t i = 0; i < PICO_PERF_SAMPLE_MAX_STACKS; i++) {
+        const __picoPerfSampleStack_t *stack = &sampler->stacks[i];
+        if (!PICO_PERF_ATOMIC_LOAD32(&stack->ready) || stack->depth == 0) {
+            continue;
+        }
 
-picoPerfTimeStamp picoPerfGetCurrentTimestamp(void)
-{
-    picoPerfTimeStamp ts = {0};
-#if defined(_WIN32) || defined(_WIN64)
-    SYSTEMTIME st;
-    GetLocalTime(&st);
-    ts.year        = st.wYear;
-    ts.month       = (uint8_t)st.wMonth;
-    ts.day         = (uint8_t)st.wDay;
-    ts.hour        = (uint8_t)st.wHour;
-    ts.minute      = (uint8_t)st.wMinute;
-    ts.second      = (uint8_t)st.wSecond;
-    ts.millisecond = (uint16_t)st.wMilliseconds;
-    ts.nanosecond  = 0; // Windows does not provide nanosecond precision
-#elif defined(__unix__) || defined(__APPLE__)
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    struct tm *tm  = localtime(&tv.tv_sec);
-    ts.year        = tm->tm_year + 1900;
-    ts.month       = tm->tm_mon + 1;
-    ts.day         = tm->tm_mday;
-    ts.hour        = tm->tm_hour;
-    ts.minute      = tm->tm_min;
-    ts.second      = tm->tm_sec;
-    ts.millisecond = tv.tv_usec / 1000;
-    ts.nanosecond  = (tv.tv_usec % 1000) * 1000;
+        // allocated by glibc with malloc, so it goes back through free
+        char **symbols = backtrace_symbols(stack->frames, (int)stack->depth);
+        for (uint32_t j = stack->depth; j-- > 0;) {
+            __picoPerfWriteFrameName(output, symbols ? symbols[j] : NULL, stack->frames[j]);
+            fputc(j > 0 ? ';' : ' ', output);
+        }
+        fprintf(output, "%llu\n", (unsigned long long)__atomic_load_n(&stack->count, __ATOMIC_RELAXED));
+        free(symbols);
+    }
 #else
-#error "Unsupported platform for time functions"
+    (void)output;
 #endif
+}
 
-    return ts;
+typedef struct {
+    char name[128];
+    picoPerfBenchFunc func;
+    void *userData;
+} __picoPerfBenchmark_t;
+
+static __picoPerfBenchmark_t __picoPerfBenchmarks[PICO_PERF_BENCH_MAX];
+static size_t __picoPerfBenchmarkCount = 0;
+static picoPerfBenchResult_t __picoPerfBenchResults[PICO_PERF_BENCH_MAX];
+static size_t __picoPerfBenchResultCount = 0;
+static char __picoPerfBenchFilter[128]; // of the last run, baseline entries it excludes are not missing
+
+picoPerfBenchConfig_t picoPerfBenchDefaultConfig(void)
+{
+    picoPerfBenchConfig_t config;
+    config.minTimeSeconds   = 0.05;
+    config.warmupRepeats    = 1;
+    config.repeats          = 10;
+    config.outlierThreshold = 3.0;
+    config.filter           = NULL;
+    return config;
 }
 
-picoPerfTime picoPerfNow(void)
+bool picoPerfBenchRegister(const char *name, picoPerfBenchFunc func, void *userData)
 {
-#if defined(_WIN32) || defined(_WIN64)
-    LARGE_INTEGER counter;
-    QueryPerformanceCounter(&counter);
-    return (picoPerfTime)counter.QuadPart;
-#elif defined(__unix__) || defined(__APPLE__)
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (picoPerfTime)ts.tv_sec * 1000000000LL + (picoPerfTime)ts.tv_nsec;
-#else
-#error "Unsupported platform for picoPerfNow"
-#endif
+    if (!name || !func || __picoPerfBenchmarkCount >= PICO_PERF_BENCH_MAX) {
+        return false;
+    }
+
+    __picoPerfBenchmark_t *benchmark = &__picoPerfBenchmarks[__picoPerfBenchmarkCount++];
+    snprintf(benchmark->name, sizeof(benchmark->name), "%s", name);
+    benchmark->func     = func;
+    benchmark->userData = userData;
+    return true;
 }
 
-uint64_t picoPerfFrequency(void)
+static int __picoPerfCompareDoubles(const void *a, const void *b)
 {
-#if defined(_WIN32) || defined(_WIN64)
-    LARGE_INTEGER freq;
-    QueryPerformanceFrequency(&freq);
-    return (uint64_t)freq.QuadPart;
-#elif defined(__unix__) || defined(__APPLE__)
-    return 1000000000LL; // Nanoseconds
-#else
-#error "Unsupported platform for picoPerfFrequency"
-#endif
+    double valueA = *(const double *)a;
+    double valueB = *(const double *)b;
+    return (valueA > valueB) - (valueA < valueB);
 }
 
-double picoPerfDurationSeconds(picoPerfTime start, picoPerfTime end)
+// Newton iteration from above, keeps the header free of libm
+static double __picoPerfSqrt(double value)
 {
-    uint64_t freq = picoPerfFrequency();
-    if (freq == 0) {
+    if (value <= 0.0) {
         return 0.0;
     }
-    return (double)(end - start) / (double)freq;
-}
 
-double picoPerfDurationMilliseconds(picoPerfTime start, picoPerfTime end)
-{
-    return picoPerfDurationSeconds(start, end) * 1000.0;
+    double root = value > 1.0 ? value : 1.0;
+    for (int i = 0; i < 128; i++) {
+        double next = 0.5 * (root + value / root);
+        if (next >= root) {
+            break;
+        }
+        root = next;
+    }
+    return root;
 }
 
-double picoPerfDurationMicroseconds(picoPerfTime start, picoPerfTime end)
+// Median of a sorted array
+static double __picoPerfMedian(const double *values, size_t count)
 {
-    return picoPerfDurationSeconds(start, end) * 1000000.0;
+    if (count == 0) {
+        return 0.0;
+    }
+    return (count % 2) ? values[count / 2] : (values[count / 2 - 1] + values[count / 2]) * 0.5;
 }
 
-double picoPerfDurationNanoseconds(picoPerfTime start, picoPerfTime end)
+static double __picoPerfBenchTime(const __picoPerfBenchmark_t *benchmark, uint64_t iterations, uint64_t *bytes)
 {
-    return picoPerfDurationSeconds(start, end) * 1000000000.0;
+    picoPerfTime start = picoPerfNow();
+    uint64_t processed = benchmark->func(iterations, benchmark->userData);
+    picoPerfTime end   = picoPerfNow();
+    if (bytes) {
+        *bytes = processed;
+    }
+    return picoPerfDurationSeconds(start, end);
 }
 
-void picoPerfFormatDuration(picoPerfTime duration, char *buffer, size_t bufferSize)
+static bool __picoPerfBenchRunOne(const __picoPerfBenchmark_t *benchmark, const picoPerfBenchConfig_t *config, picoPerfBenchResult_t *result)
 {
-    if (bufferSize == 0) {
-        return;
+    // grow the iteration count until one repeat is long enough to swamp the clock overhead
+    uint64_t iterations = 1;
+    for (;;) {
+        double elapsed = __picoPerfBenchTime(benchmark, iterations, NULL);
+        if (elapsed >= config->minTimeSeconds || iterations >= ((uint64_t)1 << 40)) {
+            break;
+        }
+        double scale = elapsed > 0.0 ? config->minTimeSeconds * 1.2 / elapsed : 100.0;
+        scale        = scale < 2.0 ? 2.0 : (scale > 100.0 ? 100.0 : scale);
+        iterations   = (uint64_t)((double)iterations * scale);
     }
 
-    uint64_t freq = picoPerfFrequency();
-    if (freq == 0) {
-        snprintf(buffer, bufferSize, "0s");
-        return;
+    for (uint32_t i = 0; i < config->warmupRepeats; i++) {
+        __picoPerfBenchTime(benchmark, iterations, NULL);
     }
 
-    double seconds = (double)duration / (double)freq;
+    uint32_t repeats   = config->repeats > 0 ? config->repeats : 1;
+    double *samples    = (double *)__PICO_PERF_MALLOC(sizeof(double) * repeats * 2);
+    if (!samples) {
+        return false;
+    }
+    double *deviations = samples + repeats;
 
-    if (seconds >= 1.0) {
-        snprintf(buffer, bufferSize, "%.3fs", seconds);
-    } else if (seconds >= 0.001) {
-        snprintf(buffer, bufferSize, "%.3fms", seconds * 1000.0);
-    } else if (seconds >= 0.000001) {
-        snprintf(buffer, bufferSize, "%.3fµs", seconds * 1000000.0);
-    } else {
-        snprintf(buffer, bufferSize, "%.3fns", seconds * 1000000000.0);
+    uint64_t totalBytes = 0;
+    for (uint32_t i = 0; i < repeats; i++) {
+        uint64_t bytes = 0;
+        samples[i]     = __picoPerfBenchTime(benchmark, iterations, &bytes) * 1e9 / (double)iterations;
+        totalBytes += bytes;
     }
-}
+    qsort(samples, repeats, sizeof(double), __picoPerfCompareDoubles);
 
-void picoPerfSleep(uint32_t milliseconds)
-{
-#if defined(_WIN32) || defined(_WIN64)
-    Sleep(milliseconds);
-#elif defined(__unix__) || defined(__APPLE__)
-    struct timespec ts;
-    ts.tv_sec  = milliseconds / 1000;
-    ts.tv_nsec = (milliseconds % 1000) * 1000000;
-    nanosleep(&ts, NULL);
-#else
-#error "Unsupported platform for picoPerfSleep"
-#endif
-}
+    // median absolute deviation, scaled to match a standard deviation for normal noise
+    double median = __picoPerfMedian(samples, repeats);
+    for (uint32_t i = 0; i < repeats; i++) {
+        deviations[i] = samples[i] > median ? samples[i] - median : median - samples[i];
+    }
+    qsort(deviations, repeats, sizeof(double), __picoPerfCompareDoubles);
+    double mad = __picoPerfMedian(deviations, repeats) * 1.4826;
 
-bool picoPerfBeginRecord(void)
-{
-    if (!__picoPerfGlobalContext || __picoPerfGlobalContext->recording) {
-        return false;
+    size_t kept = 0;
+    for (uint32_t i = 0; i < repeats; i++) {
+        double deviation = samples[i] > median ? samples[i] - median : median - samples[i];
+        if (config->outlierThreshold <= 0.0 || mad <= 0.0 || deviation <= config->outlierThreshold * mad) {
+            samples[kept++] = samples[i];
+        }
     }
 
-    if (__picoPerfGlobalContext->recordCount >= PICO_PERF_MAX_RECORDS) {
-        return false;
+    double sum = 0.0;
+    for (size_t i = 0; i < kept; i++) {
+        sum += samples[i];
+    }
+    double mean     = sum / (double)kept;
+    double variance = 0.0;
+    for (size_t i = 0; i < kept; i++) {
+        variance += (samples[i] - mean) * (samples[i] - mean);
     }
 
-    __picoPerfGlobalContext->recording     = true;
-    __picoPerfGlobalContext->scopeStackTop = 0;
+    result->name       = benchmark->name;
+    result->iterations = iterations;
+    result->repeats    = (uint32_t)kept;
+    result->rejected   = repeats - (uint32_t)kept;
+    result->medianNs   = __picoPerfMedian(samples, kept);
+    result->meanNs     = mean;
+    result->minNs      = samples[0];
+    result->maxNs      = samples[kept - 1];
+    result->stddevNs   = kept > 1 ? __picoPerfSqrt(variance / (double)(kept - 1)) : 0.0;
 
-    memset(&__picoPerfGlobalContext->records[__picoPerfGlobalContext->recordHead], 0, sizeof(__picoPerfRecord_t));
-    memset(&__picoPerfGlobalContext->currentRecord, 0, sizeof(__picoPerfRecord_t));
+    double bytesPerIteration = (double)totalBytes / ((double)iterations * (double)repeats);
+    result->opsPerSecond     = result->medianNs > 0.0 ? 1e9 / result->medianNs : 0.0;
+    result->bytesPerSecond   = bytesPerIteration * result->opsPerSecond;
 
+    __PICO_PERF_FREE(samples);
     return true;
 }
 
-void picoPerfEndRecord(void)
+size_t picoPerfBenchRun(const picoPerfBenchConfig_t *config)
 {
-    if (!__picoPerfGlobalContext || !__picoPerfGlobalContext->recording) {
-        return;
-    }
-
-    __picoPerfGlobalContext->recording                                    = false;
-    __picoPerfGlobalContext->records[__picoPerfGlobalContext->recordHead] = __picoPerfGlobalContext->currentRecord;
-    __picoPerfGlobalContext->recordHead                                   = (__picoPerfGlobalContext->recordHead + 1) % PICO_PERF_MAX_RECORDS;
+    picoPerfBenchConfig_t defaults = picoPerfBenchDefaultConfig();
+    config                         = config ? config : &defaults;
 
-    if (__picoPerfGlobalContext->recordCount < PICO_PERF_MAX_RECORDS) {
-        __picoPerfGlobalContext->recordCount++;
+    __picoPerfBenchResultCount = 0;
+    snprintf(__picoPerfBenchFilter, sizeof(__picoPerfBenchFilter), "%s", config->filter ? config->filter : "");
+    for (size_t i = 0; i < __picoPerfBenchmarkCount; i++) {
+        const __picoPerfBenchmark_t *benchmark = &__picoPerfBenchmarks[i];
+        if (config->filter && !strstr(benchmark->name, config->filter)) {
+            continue;
+        }
+        if (__picoPerfBenchRunOne(benchmark, config, &__picoPerfBenchResults[__picoPerfBenchResultCount])) {
+            __picoPerfBenchResultCount++;
+        }
     }
+    return __picoPerfBenchResultCount;
 }
 
-void picoPerfPushScope(const char *name, const char *file, const char *function, uint32_t line)
+const picoPerfBenchResult_t *picoPerfBenchGetResults(size_t *count)
 {
-    if (!__picoPerfGlobalContext || !__picoPerfGlobalContext->recording) {
-        return;
+    if (count) {
+        *count = __picoPerfBenchResultCount;
     }
+    return __picoPerfBenchResults;
+}
 
-    if (__picoPerfGlobalContext->scopeStackTop >= PICO_PERF_MAX_SCOPES) {
+void picoPerfBenchReport(FILE *output, picoPerfReportFormat format)
+{
+    if (!output) {
         return;
     }
 
-    __picoPerfRecordItem_t *item = &__picoPerfGlobalContext->scopeStack[__picoPerfGlobalContext->scopeStackTop];
-    memset(item, 0, sizeof(__picoPerfRecordItem_t));
+    const picoPerfBenchResult_t *results = __picoPerfBenchResults;
+    size_t count                         = __picoPerfBenchResultCount;
 
-    strncpy(item->name, name, PICO_PERF_MAX_NAME_LENGTH - 1);
-    item->startTime          = picoPerfNow();
-    item->startLocation.line = line;
-    strncpy(item->startLocation.file, file ? file : "unknown", PICO_PERF_MAX_PATH - 1);
-    strncpy(item->startLocation.function, function ? function : "unknown", PICO_PERF_MAX_PATH - 1);
-    item->startTimestamp = picoPerfGetCurrentTimestamp();
-    item->scopeDepth     = __picoPerfGlobalContext->scopeStackTop;
-
-    if (__picoPerfGlobalContext->scopeStackTop > 0) {
-        __picoPerfRecordItem_t *parentItem = &__picoPerfGlobalContext->scopeStack[__picoPerfGlobalContext->scopeStackTop - 1];
-        strncpy(item->parentName, parentItem->name, PICO_PERF_MAX_NAME_LENGTH - 1);
-    } else {
-        snprintf(item->parentName, PICO_PERF_MAX_NAME_LENGTH - 1, "ROOT");
+    switch (format) {
+        case PICO_PERF_REPORT_FORMAT_CSV:
+            fprintf(output, "Name,Iterations,Repeats,Rejected,MedianNanoseconds,MeanNanoseconds,MinNanoseconds,MaxNanoseconds,StddevNanoseconds,OpsPerSecond,BytesPerSecond\n");
+            for (size_t i = 0; i < count; i++) {
+                fprintf(output, "\"%s\",%llu,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                        __picoPerfEscapeString(results[i].name), (unsigned long long)results[i].iterations, results[i].repeats, results[i].rejected,
+                        results[i].medianNs, results[i].meanNs, results[i].minNs, results[i].maxNs, results[i].stddevNs,
+                        results[i].opsPerSecond, results[i].bytesPerSecond);
+            }
+            break;
+        case PICO_PERF_REPORT_FORMAT_JSON:
+        case PICO_PERF_REPORT_FORMAT_CHROME_TRACE:
+            fprintf(output, "{\n");
+            fprintf(output, "  \"totalBenchmarks\": %zu,\n", count);
+            fprintf(output, "  \"benchmarks\": [\n");
+            for (size_t i = 0; i < count; i++) {
+                fprintf(output, "    {\n");
+                fprintf(output, "      \"name\": ");
+                __picoPerfWriteJsonString(output, results[i].name);
+                fprintf(output, ",\n");
+                fprintf(output, "      \"iterations\": %llu,\n", (unsigned long long)results[i].iterations);
+                fprintf(output, "      \"repeats\": %u,\n", results[i].repeats);
+                fprintf(output, "      \"rejected\": %u,\n", results[i].rejected);
+                fprintf(output, "      \"nanosecondsPerOp\": {\n");
+                fprintf(output, "        \"median\": %.3f,\n", results[i].medianNs);
+                fprintf(output, "        \"mean\": %.3f,\n", results[i].meanNs);
+                fprintf(output, "        \"min\": %.3f,\n", results[i].minNs);
+                fprintf(output, "        \"max\": %.3f,\n", results[i].maxNs);
+                fprintf(output, "        \"stddev\": %.3f\n", results[i].stddevNs);
+                fprintf(output, "      },\n");
+                fprintf(output, "      \"opsPerSecond\": %.3f,\n", results[i].opsPerSecond);
+                fprintf(output, "      \"bytesPerSecond\": %.3f\n", results[i].bytesPerSecond);
+                fprintf(output, "    }%s\n", (i < count - 1) ? "," : "");
+            }
+            fprintf(output, "  ]\n");
+            fprintf(output, "}\n");
+            break;
+        case PICO_PERF_REPORT_FORMAT_XML:
+            fprintf(output, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+            fprintf(output, "<PicoPerfBenchmarks>\n");
+            fprintf(output, "  <Summary>\n");
+            fprintf(output, "    <TotalBenchmarks>%zu</TotalBenchmarks>\n", count);
+            fprintf(output, "  </Summary>\n");
+            fprintf(output, "  <Benchmarks>\n");
+            for (size_t i = 0; i < count; i++) {
+                fprintf(output, "    <Benchmark index=\"%zu\">\n", i);
+                fprintf(output, "      <Name>%s</Name>\n", results[i].name);
+                fprintf(output, "      <Iterations>%llu</Iterations>\n", (unsigned long long)results[i].iterations);
+                fprintf(output, "      <Repeats>%u</Repeats>\n", results[i].repeats);
+                fprintf(output, "      <Rejected>%u</Rejected>\n", results[i].rejected);
+                fprintf(output, "      <NanosecondsPerOp>\n");
+                fprintf(output, "        <Median>%.3f</Median>\n", results[i].medianNs);
+                fprintf(output, "        <Mean>%.3f</Mean>\n", results[i].meanNs);
+                fprintf(output, "        <Min>%.3f</Min>\n", results[i].minNs);
+                fprintf(output, "        <Max>%.3f</Max>\n", results[i].maxNs);
+                fprintf(output, "        <Stddev>%.3f</Stddev>\n", results[i].stddevNs);
+                fprintf(output, "      </NanosecondsPerOp>\n");
+                fprintf(output, "      <OpsPerSecond>%.3f</OpsPerSecond>\n", results[i].opsPerSecond);
+                fprintf(output, "      <BytesPerSecond>%.3f</BytesPerSecond>\n", results[i].bytesPerSecond);
+                fprintf(output, "    </Benchmark>\n");
+            }
+            fprintf(output, "  </Benchmarks>\n");
+            fprintf(output, "</PicoPerfBenchmarks>\n");
+            break;
+        default:
+            fprintf(output, "%-40s %12s %12s %8s %14s %12s %8s\n", "BENCHMARK", "ITERATIONS", "ns/op", "+/-%", "ops/s", "MB/s", "REPEATS");
+            for (size_t i = 0; i < count; i++) {
+                double spread = results[i].medianNs > 0.0 ? results[i].stddevNs * 100.0 / results[i].medianNs : 0.0;
+                fprintf(output, "%-40s %12llu %12.2f %8.2f %14.0f %12.2f %5u/%u\n",
+                        results[i].name, (unsigned long long)results[i].iterations, results[i].medianNs, spread,
+                        results[i].opsPerSecond, results[i].bytesPerSecond / (1024.0 * 1024.0),
+                        results[i].repeats, results[i].repeats + results[i].rejected);
+            }
+            break;
     }
+}
 
-    __picoPerfGlobalContext->scopeStackTop++;
+// Reads a JSON string starting at the opening quote, returns the position after the closing one
+static const char *__picoPerfParseJsonString(const char *cursor, char *buffer, size_t bufferSize)
+{
+    size_t length = 0;
+    for (cursor++; *cursor && *cursor != '"'; cursor++) {
+        if (*cursor == '\\' && cursor[1]) {
+            cursor++;
+        }
+        if (length + 1 < bufferSize) {
+            buffer[length++] = *cursor;
+        }
+    }
+    buffer[length] = '\0';
+    return *cursor ? cursor + 1 : cursor;
 }
 
-void picoPerfPopScope(const char *file, const char *function, uint32_t line)
+int picoPerfBenchCompare(const char *baselinePath, double tolerance, FILE *output)
 {
-    if (!__picoPerfGlobalContext || !__picoPerfGlobalContext->recording) {
-        return;
+    FILE *file = baselinePath ? fopen(baselinePath, "rb") : NULL;
+    if (!file) {
+        return -1;
     }
 
-    if (__picoPerfGlobalContext->scopeStackTop <= 0) {
-        return;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char *json = size > 0 ? (char *)__PICO_PERF_MALLOC((size_t)size + 1) : NULL;
+    if (!json || fread(json, 1, (size_t)size, file) != (size_t)size) {
+        __PICO_PERF_FREE(json);
+        fclose(file);
+        return -1;
     }
+    json[size] = '\0';
+    fclose(file);
 
-    if (__picoPerfGlobalContext->currentRecord.itemCount >= PICO_PERF_MAX_SCOPES) {
-        return;
+    if (output) {
+        fprintf(output, "Baseline %s, tolerance %.1f%%\n", baselinePath, tolerance * 100.0);
+        fprintf(output, "%-40s %12s %12s %9s  %s\n", "BENCHMARK", "BASELINE", "CURRENT", "CHANGE", "STATUS");
     }
 
-    __picoPerfGlobalContext->scopeStackTop--;
+    int regressions = 0;
+    for (size_t i = 0; i < __picoPerfBenchResultCount; i++) {
+        const picoPerfBenchResult_t *result = &__picoPerfBenchResults[i];
+
+        // the baseline is a picoPerfBenchReport JSON, every name is followed by its median
+        double baseline    = 0.0;
+        const char *cursor = json;
+        while ((cursor = strstr(cursor, "\"name\"")) != NULL) {
+            char name[128];
+            cursor = strchr(cursor + 6, '"');
+            if (!cursor) {
+                break;
+            }
+            cursor = __picoPerfParseJsonString(cursor, name, sizeof(name));
+            if (strcmp(name, result->name) == 0) {
+                const char *median = strstr(cursor, "\"median\":");
+                const char *next   = strstr(cursor, "\"name\"");
+                if (median && (!next || median < next)) {
+                    baseline = strtod(median + 9, NULL);
+                }
+                break;
+            }
+        }
+
+        if (baseline <= 0.0) {
+            if (output) {
+                fprintf(output, "%-40s %12s %12.2f %9s  new\n", result->name, "-", result->medianNs, "-");
+            }
+            continue;
+        }
+
+        double change      = (result->medianNs - baseline) / baseline;
+        const char *status = "ok";
+        if (change > tolerance) {
+            status = "REGRESSION";
+            regressions++;
+        } else if (change < -tolerance) {
+            status = "faster";
+        }
+        if (output) {
+            fprintf(output, "%-40s %12.2f %12.2f %+8.1f%%  %s\n", result->name, baseline, result->medianNs, change * 100.0, status);
+        }
+    }
 
-    __picoPerfRecordItem_t *stackItem = &__picoPerfGlobalContext->scopeStack[__picoPerfGlobalContext->scopeStackTop];
+    // a benchmark that vanished, e.g. because its setup failed, must not pass silently
+    const char *cursor = json;
+    while ((cursor = strstr(cursor, "\"name\"")) != NULL) {
+        char name[128];
+        cursor = strchr(cursor + 6, '"');
+        if (!cursor) {
+            break;
+        }
+        cursor = __picoPerfParseJsonString(cursor, name, sizeof(name));
+        if (__picoPerfBenchFilter[0] && !strstr(name, __picoPerfBenchFilter)) {
+            continue;
+        }
 
-    stackItem->endTime          = picoPerfNow();
-    stackItem->endLocation.line = line;
-    strncpy(stackItem->endLocation.file, file ? file : "unknown", PICO_PERF_MAX_PATH - 1);
-    strncpy(stackItem->endLocation.function, function ? function : "unknown", PICO_PERF_MAX_PATH - 1);
-    stackItem->endTimestamp = picoPerfGetCurrentTimestamp();
+        bool found = false;
+        for (size_t i = 0; i < __picoPerfBenchResultCount && !found; i++) {
+            found = strcmp(name, __picoPerfBenchResults[i].name) == 0;
+        }
+        if (!found) {
+            regressions++;
+            if (output) {
+                fprintf(output, "%-40s %12s %12s %9s  MISSING\n", name, "-", "-", "-");
+            }
+        }
+    }
 
-    __picoPerfRecordItem_t *recordItem = &__picoPerfGlobalContext->currentRecord.items[__picoPerfGlobalContext->currentRecord.itemCount];
-    memcpy(recordItem, stackItem, sizeof(__picoPerfRecordItem_t));
-    __picoPerfGlobalContext->currentRecord.itemCount++;
+    __PICO_PERF_FREE(json);
+    return regressions;
 }
 
-void picoPerfPopNScopes(int count, const char *file, const char *function, uint32_t line)
+int picoPerfBenchMain(int argc, char **argv)
 {
-    if (!__picoPerfGlobalContext || !__picoPerfGlobalContext->recording) {
-        return;
-    }
+    picoPerfBenchConfig_t config = picoPerfBenchDefaultConfig();
+    const char *jsonPath         = NULL;
+    const char *baselinePath     = NULL;
+    double tolerance             = 0.1;
 
-    if (count < 0) {
-        count = __picoPerfGlobalContext->scopeStackTop;
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--filter=", 9) == 0) {
+            config.filter = arg + 9;
+        } else if (strncmp(arg, "--repeats=", 10) == 0) {
+            config.repeats = (uint32_t)strtoul(arg + 10, NULL, 10);
+        } else if (strncmp(arg, "--warmup=", 9) == 0) {
+            config.warmupRepeats = (uint32_t)strtoul(arg + 9, NULL, 10);
+        } else if (strncmp(arg, "--min-time=", 11) == 0) {
+            config.minTimeSeconds = strtod(arg + 11, NULL);
+        } else if (strncmp(arg, "--json=", 7) == 0) {
+            jsonPath = arg + 7;
+        } else if (strncmp(arg, "--baseline=", 11) == 0) {
+            baselinePath = arg + 11;
+        } else if (strncmp(arg, "--tolerance=", 12) == 0) {
+            tolerance = strtod(arg + 12, NULL);
+        } else if (strncmp(arg, "--", 2) == 0) {
+            fprintf(stderr, "unknown option %s\n", arg);
+            return 1;
+        }
     }
 
-    for (int i = 0; i < count; i++) {
-        picoPerfPopScope(file, function, line);
+    size_t ran = picoPerfBenchRun(&config);
+    picoPerfBenchReport(stdout, PICO_PERF_REPORT_FORMAT_TEXT);
+    if (ran == 0) {
+        fprintf(stderr, "no benchmarks ran%s%s\n", config.filter ? " for filter " : "", config.filter ? config.filter : "");
+        return 1;
     }
-}
 
-void picoPerfGetReport(FILE *output, picoPerfReportFormat format)
-{
-    if (!__picoPerfGlobalContext || !output) {
-        return;
+    if (jsonPath) {
+        FILE *file = fopen(jsonPath, "w");
+        if (!file) {
+            fprintf(stderr, "failed to write %s\n", jsonPath);
+            return 1;
+        }
+        picoPerfBenchReport(file, PICO_PERF_REPORT_FORMAT_JSON);
+        fclose(file);
     }
 
-    switch (format) {
-        case PICO_PERF_REPORT_FORMAT_TEXT:
-            __picoPerfGetReportText(output);
-            break;
-        case PICO_PERF_REPORT_FORMAT_CSV:
-            __picoPerfGetReportCSV(output);
-            break;
-        case PICO_PERF_REPORT_FORMAT_JSON:
-            __picoPerfGetReportJSON(output);
-            break;
-        case PICO_PERF_REPORT_FORMAT_XML:
-            __picoPerfGetReportXML(output);
-            break;
-        default:
-            __picoPerfGetReportText(output);
-            break;
+    if (baselinePath) {
+        printf("\n");
+        int regressions = picoPerfBenchCompare(baselinePath, tolerance, stdout);
+        if (regressions < 0) {
+            fprintf(stderr, "failed to read baseline %s\n", baselinePath);
+            return 1;
+        }
+        if (regressions > 0) {
+            printf("%d benchmark%s regressed\n", regressions, regressions == 1 ? "" : "s");
+            return 1;
+        }
     }
+    return 0;
 }
 
 #endif // PICO_PERF_IMPLEMENTATION
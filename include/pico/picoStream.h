@@ -38,6 +38,30 @@ SOFTWARE.
 #endif
 #endif
 
+// Use preadv/pwritev for scatter/gather I/O on file streams, other
+// platforms fall back to one read/write call per vector
+#ifndef PICO_STREAM_ENABLE_VECTORED_SYSCALLS
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__)
+#define PICO_STREAM_ENABLE_VECTORED_SYSCALLS 1
+#else
+#define PICO_STREAM_ENABLE_VECTORED_SYSCALLS 0
+#endif
+#endif
+
+// SSE2/AVX2 byte scanning for line reads, AVX2 is used when the translation
+// unit is compiled with it enabled (-mavx2 or /arch:AVX2)
+#ifndef PICO_STREAM_ENABLE_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PICO_STREAM_ENABLE_SIMD 1
+#else
+#define PICO_STREAM_ENABLE_SIMD 0
+#endif
+#endif
+
+#ifndef PICO_STREAM_MAX_IO_VECTORS
+#define PICO_STREAM_MAX_IO_VECTORS 64
+#endif
+
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -69,9 +93,18 @@ typedef struct {
     int64_t (*tell)(void *userData);
     void (*flush)(void *userData);
     void (*destroy)(void *userData);
+    // optional, needed for picoStreamReadAt/picoStreamWriteAt on custom streams
+    size_t (*readAt)(void *userData, int64_t offset, void *buffer, size_t size);
+    size_t (*writeAt)(void *userData, int64_t offset, const void *buffer, size_t size);
 } picoStreamCustom_t;
 typedef picoStreamCustom_t *picoStreamCustom;
 
+typedef struct {
+    void *buffer;
+    size_t size;
+} picoStreamIOVec_t;
+typedef picoStreamIOVec_t *picoStreamIOVec;
+
 picoStream picoStreamFromCustom(picoStreamCustom_t customStream, bool canRead, bool canWrite);
 picoStream picoStreamFromFile(FILE *file, bool canRead, bool canWrite, bool ownFileHandle);
 picoStream picoStreamFromFilePath(const char *filePath, bool canRead, bool canWrite);
@@ -84,6 +117,21 @@ void picoStreamDestroy(picoStream stream);
 
 size_t picoStreamRead(picoStream stream, void *buffer, size_t size);
 size_t picoStreamWrite(picoStream stream, const void *buffer, size_t size);
+// Scatter/gather variants of picoStreamRead/picoStreamWrite, the vectors are
+// transferred in order as one contiguous range. Returns the total number of bytes
+// transferred and stops at the first short read/write.
+size_t picoStreamReadV(picoStream stream, const picoStreamIOVec_t *vectors, size_t vectorCount);
+size_t picoStreamWriteV(picoStream stream, const picoStreamIOVec_t *vectors, size_t vectorCount);
+// Positional read/write at an absolute offset. These neither use nor move the stream
+// cursor, so several threads can work on disjoint ranges of one shared stream.
+// File streams go straight to the descriptor, so call picoStreamFlush after
+// sequential writes before reading the same range back positionally. On Windows
+// positional calls on a file stream hold the FILE lock while they restore the
+// cursor, so they do not overlap each other there.
+size_t picoStreamReadAt(picoStream stream, int64_t offset, void *buffer, size_t size);
+size_t picoStreamWriteAt(picoStream stream, int64_t offset, const void *buffer, size_t size);
+// Size of the underlying source in bytes, -1 if it is not known (custom streams)
+int64_t picoStreamGetSize(picoStream stream);
 int picoStreamSeek(picoStream stream, int64_t offset, picoStreamSeekOrigin origin);
 int64_t picoStreamTell(picoStream stream);
 bool picoStreamCanRead(picoStream stream);
@@ -123,6 +171,10 @@ size_t picoStreamReadString(picoStream stream, char *buffer, size_t maxLength);
 void picoStreamWriteString(picoStream stream, const char *string);
 
 size_t picoStreamReadLine(picoStream stream, char *buffer, size_t maxLength);
+// Zero-copy line iterator for memory and mapped streams. Points outLine at the next
+// line inside the backing buffer (not null-terminated, newline excluded) and moves
+// the cursor past it. Returns false at the end of the data or for other source types.
+bool picoStreamReadLineView(picoStream stream, const char **outLine, size_t *outLength);
 void picoStreamWriteLine(picoStream stream, const char *string);
 
 
@@ -148,6 +200,43 @@ bool picoStreamIsSystemLittleEndian(void);
 #endif
 #endif // PICO_STREAM_ENABLE_MAPPED
 
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <io.h>
+#include <windows.h>
+#define __PICO_STREAM_LOCK_FILE(file)   _lock_file(file)
+#define __PICO_STREAM_UNLOCK_FILE(file) _unlock_file(file)
+#define __PICO_STREAM_GETC(file)        _getc_nolock(file)
+#else
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#define __PICO_STREAM_LOCK_FILE(file)   flockfile(file)
+#define __PICO_STREAM_UNLOCK_FILE(file) funlockfile(file)
+#define __PICO_STREAM_GETC(file)        getc_unlocked(file)
+#endif
+
+#if PICO_STREAM_ENABLE_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif // PICO_STREAM_ENABLE_SIMD
+
+#if PICO_STREAM_ENABLE_VECTORED_SYSCALLS
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif // PICO_STREAM_ENABLE_VECTORED_SYSCALLS
+
 
 #define __PICO_STREAM_READ_IMPL(typeName, type)        \
     type picoStreamRead##typeName(picoStream stream)            \
@@ -254,6 +343,73 @@ static void __picoStreamWriteEndianess(picoStream stream, const void *value, siz
     picoStreamWrite(stream, buffer, size);
 }
 
+#if PICO_STREAM_ENABLE_SIMD
+static inline uint32_t __picoStreamCountTrailingZeros(uint32_t mask)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (uint32_t)index;
+#else
+    return (uint32_t)__builtin_ctz(mask);
+#endif
+}
+#endif // PICO_STREAM_ENABLE_SIMD
+
+static const uint8_t *__picoStreamFindByte(const uint8_t *data, size_t size, uint8_t value)
+{
+#if PICO_STREAM_ENABLE_SIMD
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i needle32 = _mm256_set1_epi8((char)value);
+    for (; i + 32 <= size; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(data + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32));
+        if (mask) {
+            return data + i + __picoStreamCountTrailingZeros(mask);
+        }
+    }
+#endif
+    __m128i needle16 = _mm_set1_epi8((char)value);
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(data + i));
+        uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16));
+        if (mask) {
+            return data + i + __picoStreamCountTrailingZeros(mask);
+        }
+    }
+    for (; i < size; i++) {
+        if (data[i] == value) {
+            return data + i;
+        }
+    }
+    return NULL;
+#else
+    return (const uint8_t *)memchr(data, value, size);
+#endif
+}
+
+// Returns the backing buffer of memory and mapped streams along with the cursor
+static uint8_t *__picoStreamGetDirectBuffer(picoStream stream, size_t *outSize, size_t **outPosition)
+{
+    switch (stream->type) {
+        case PICO_STREAM_SOURCE_TYPE_MEMORY:
+            *outSize     = stream->source.memory.size;
+            *outPosition = &stream->source.memory.position;
+            return stream->source.memory.buffer;
+
+#if PICO_STREAM_ENABLE_MAPPED
+        case PICO_STREAM_SOURCE_TYPE_MAPPED:
+            *outSize     = stream->source.mapped.size;
+            *outPosition = &stream->source.mapped.position;
+            return (uint8_t *)stream->source.mapped.base;
+#endif
+
+        default:
+            return NULL;
+    }
+}
+
 picoStream picoStreamFromCustom(picoStreamCustom_t customStream, bool canRead, bool canWrite)
 {
     if (!canRead && !canWrite) {
@@ -615,6 +771,338 @@ size_t picoStreamWrite(picoStream stream, const void *buffer, size_t size)
     return 0;
 }
 
+static size_t __picoStreamTransferVFallback(picoStream stream, const picoStreamIOVec_t *vectors, size_t vectorCount, bool write)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < vectorCount; i++) {
+        if (vectors[i].size == 0) {
+            continue;
+        }
+
+        size_t transferred = write ? picoStreamWrite(stream, vectors[i].buffer, vectors[i].size)
+                                   : picoStreamRead(stream, vectors[i].buffer, vectors[i].size);
+        total += transferred;
+        if (transferred != vectors[i].size) {
+            break;
+        }
+    }
+    return total;
+}
+
+static size_t __picoStreamTransferVMemory(uint8_t *base, size_t size, size_t *position, const picoStreamIOVec_t *vectors, size_t vectorCount, bool write)
+{
+    size_t total = 0;
+    for (size_t i = 0; i < vectorCount; i++) {
+        size_t available = size - *position;
+        size_t toCopy    = (vectors[i].size < available) ? vectors[i].size : available;
+        if (toCopy > 0) {
+            if (write) {
+                memcpy(base + *position, vectors[i].buffer, toCopy);
+            } else {
+                memcpy(vectors[i].buffer, base + *position, toCopy);
+            }
+            *position += toCopy;
+            total += toCopy;
+        }
+        if (toCopy != vectors[i].size) {
+            break;
+        }
+    }
+    return total;
+}
+
+#if PICO_STREAM_ENABLE_VECTORED_SYSCALLS
+static size_t __picoStreamTransferVFile(picoStream stream, const picoStreamIOVec_t *vectors, size_t vectorCount, bool write)
+{
+    FILE *file = stream->source.file;
+    long start = ftell(file);
+    if (start < 0 || fflush(file) != 0) {
+        return __picoStreamTransferVFallback(stream, vectors, vectorCount, write);
+    }
+
+    // the stdio buffer is empty after the flush, so the vectors can go straight to
+    // the descriptor at the logical stream position and the cursor is synced after
+    int fd       = fileno(file);
+    size_t total = 0;
+    size_t index = 0;
+    bool done    = false;
+    while (index < vectorCount && !done) {
+        struct iovec iov[PICO_STREAM_MAX_IO_VECTORS];
+        int iovCount         = 0;
+        size_t requested     = 0;
+        while (index < vectorCount && iovCount < PICO_STREAM_MAX_IO_VECTORS) {
+            if (vectors[index].size > 0) {
+                iov[iovCount].iov_base = vectors[index].buffer;
+                iov[iovCount].iov_len  = vectors[index].size;
+                requested += vectors[index].size;
+                iovCount++;
+            }
+            index++;
+        }
+        if (iovCount == 0) {
+            break;
+        }
+
+        ssize_t result;
+        do {
+            off_t offset = (off_t)start + (off_t)total;
+            result       = write ? pwritev(fd, iov, iovCount, offset) : preadv(fd, iov, iovCount, offset);
+        } while (result < 0 && errno == EINTR);
+
+        if (result <= 0) {
+            break;
+        }
+        total += (size_t)result;
+        done = (size_t)result != requested;
+    }
+
+    fseek(file, start + (long)total, SEEK_SET);
+    return total;
+}
+#endif // PICO_STREAM_ENABLE_VECTORED_SYSCALLS
+
+size_t picoStreamReadV(picoStream stream, const picoStreamIOVec_t *vectors, size_t vectorCount)
+{
+    if (!stream || !vectors || vectorCount == 0 || !stream->canRead) {
+        return 0;
+    }
+
+    switch (stream->type) {
+        case PICO_STREAM_SOURCE_TYPE_FILE:
+#if PICO_STREAM_ENABLE_VECTORED_SYSCALLS
+            if (stream->source.file) {
+                return __picoStreamTransferVFile(stream, vectors, vectorCount, false);
+            }
+#endif
+            break;
+
+        case PICO_STREAM_SOURCE_TYPE_MEMORY:
+            if (stream->source.memory.buffer) {
+                return __picoStreamTransferVMemory(stream->source.memory.buffer, stream->source.memory.size, &stream->source.memory.position, vectors, vectorCount, false);
+            }
+            return 0;
+
+#if PICO_STREAM_ENABLE_MAPPED
+        case PICO_STREAM_SOURCE_TYPE_MAPPED:
+            if (stream->source.mapped.base) {
+                return __picoStreamTransferVMemory((uint8_t *)stream->source.mapped.base, stream->source.mapped.size, &stream->source.mapped.position, vectors, vectorCount, false);
+            }
+            return 0;
+#endif
+
+        default:
+            break;
+    }
+
+    return __picoStreamTransferVFallback(stream, vectors, vectorCount, false);
+}
+
+size_t picoStreamWriteV(picoStream stream, const picoStreamIOVec_t *vectors, size_t vectorCount)
+{
+    if (!stream || !vectors || vectorCount == 0 || !stream->canWrite) {
+        return 0;
+    }
+
+    switch (stream->type) {
+        case PICO_STREAM_SOURCE_TYPE_FILE:
+#if PICO_STREAM_ENABLE_VECTORED_SYSCALLS
+            if (stream->source.file) {
+                return __picoStreamTransferVFile(stream, vectors, vectorCount, true);
+            }
+#endif
+            break;
+
+        case PICO_STREAM_SOURCE_TYPE_MEMORY:
+            if (stream->source.memory.buffer) {
+                return __picoStreamTransferVMemory(stream->source.memory.buffer, stream->source.memory.size, &stream->source.memory.position, vectors, vectorCount, true);
+            }
+            return 0;
+
+        default:
+            break;
+    }
+
+    return __picoStreamTransferVFallback(stream, vectors, vectorCount, true);
+}
+
+static size_t __picoStreamFileTransferAt(FILE *file, int64_t offset, void *buffer, size_t size, bool write)
+{
+    size_t total = 0;
+#ifdef _WIN32
+    HANDLE handle = (HANDLE)_get_osfhandle(_fileno(file));
+    if (handle == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+
+    // an explicit offset still moves the file pointer of a synchronous handle, the
+    // FILE position is saved and put back under the stream lock so the cursor stays put
+    _lock_file(file);
+    int64_t cursor = _ftelli64(file);
+    while (total < size) {
+        uint64_t position = (uint64_t)offset + total;
+        size_t remaining  = size - total;
+        DWORD chunk       = (remaining > 0x7FFFFFFF) ? 0x7FFFFFFF : (DWORD)remaining;
+        DWORD transferred = 0;
+        OVERLAPPED overlapped;
+        memset(&overlapped, 0, sizeof(overlapped));
+        overlapped.Offset     = (DWORD)(position & 0xFFFFFFFF);
+        overlapped.OffsetHigh = (DWORD)(position >> 32);
+
+        BOOL ok = write ? WriteFile(handle, (const uint8_t *)buffer + total, chunk, &transferred, &overlapped)
+                        : ReadFile(handle, (uint8_t *)buffer + total, chunk, &transferred, &overlapped);
+        if (!ok || transferred == 0) {
+            break;
+        }
+        total += transferred;
+    }
+    if (cursor >= 0) {
+        _fseeki64(file, cursor, SEEK_SET);
+    }
+    _unlock_file(file);
+#else
+    int fd = fileno(file);
+    while (total < size) {
+        ssize_t result = write ? pwrite(fd, (const uint8_t *)buffer + total, size - total, (off_t)(offset + (int64_t)total))
+                               : pread(fd, (uint8_t *)buffer + total, size - total, (off_t)(offset + (int64_t)total));
+        if (result < 0 && errno == EINTR) {
+            continue;
+        }
+        if (result <= 0) {
+            break;
+        }
+        total += (size_t)result;
+    }
+#endif
+    return total;
+}
+
+size_t picoStreamReadAt(picoStream stream, int64_t offset, void *buffer, size_t size)
+{
+    if (!stream || !buffer || size == 0 || offset < 0 || !stream->canRead) {
+        return 0;
+    }
+
+    switch (stream->type) {
+        case PICO_STREAM_SOURCE_TYPE_CUSTOM:
+            if (stream->source.custom.readAt) {
+                return stream->source.custom.readAt(stream->source.custom.userData, offset, buffer, size);
+            }
+            break;
+
+        case PICO_STREAM_SOURCE_TYPE_FILE:
+            if (stream->source.file) {
+                return __picoStreamFileTransferAt(stream->source.file, offset, buffer, size, false);
+            }
+            break;
+
+        case PICO_STREAM_SOURCE_TYPE_MEMORY:
+            if (stream->source.memory.buffer && (uint64_t)offset < stream->source.memory.size) {
+                size_t available = stream->source.memory.size - (size_t)offset;
+                size_t toRead    = (size < available) ? size : available;
+                memcpy(buffer, stream->source.memory.buffer + offset, toRead);
+                return toRead;
+            }
+            break;
+
+#if PICO_STREAM_ENABLE_MAPPED
+        case PICO_STREAM_SOURCE_TYPE_MAPPED:
+            if (stream->source.mapped.base && (uint64_t)offset < stream->source.mapped.size) {
+                size_t available = stream->source.mapped.size - (size_t)offset;
+                size_t toRead    = (size < available) ? size : available;
+                memcpy(buffer, (uint8_t *)stream->source.mapped.base + offset, toRead);
+                return toRead;
+            }
+            break;
+#endif
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+size_t picoStreamWriteAt(picoStream stream, int64_t offset, const void *buffer, size_t size)
+{
+    if (!stream || !buffer || size == 0 || offset < 0 || !stream->canWrite) {
+        return 0;
+    }
+
+    switch (stream->type) {
+        case PICO_STREAM_SOURCE_TYPE_CUSTOM:
+            if (stream->source.custom.writeAt) {
+                return stream->source.custom.writeAt(stream->source.custom.userData, offset, buffer, size);
+            }
+            break;
+
+        case PICO_STREAM_SOURCE_TYPE_FILE:
+            if (stream->source.file) {
+                return __picoStreamFileTransferAt(stream->source.file, offset, (void *)buffer, size, true);
+            }
+            break;
+
+        case PICO_STREAM_SOURCE_TYPE_MEMORY:
+            if (stream->source.memory.buffer && (uint64_t)offset < stream->source.memory.size) {
+                size_t available = stream->source.memory.size - (size_t)offset;
+                size_t toWrite   = (size < available) ? size : available;
+                memcpy(stream->source.memory.buffer + offset, buffer, toWrite);
+                return toWrite;
+            }
+            break;
+
+#if PICO_STREAM_ENABLE_MAPPED
+        case PICO_STREAM_SOURCE_TYPE_MAPPED:
+            break;
+#endif
+
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+int64_t picoStreamGetSize(picoStream stream)
+{
+    if (!stream) {
+        return -1;
+    }
+
+    switch (stream->type) {
+        case PICO_STREAM_SOURCE_TYPE_FILE:
+            if (stream->source.file) {
+#ifdef _WIN32
+                return (int64_t)_filelengthi64(_fileno(stream->source.file));
+#else
+                struct stat st;
+                if (fstat(fileno(stream->source.file), &st) == 0) {
+                    return (int64_t)st.st_size;
+                }
+#endif
+            }
+            break;
+
+        case PICO_STREAM_SOURCE_TYPE_MEMORY:
+            if (stream->source.memory.buffer) {
+                return (int64_t)stream->source.memory.size;
+            }
+            break;
+
+#if PICO_STREAM_ENABLE_MAPPED
+        case PICO_STREAM_SOURCE_TYPE_MAPPED:
+            if (stream->source.mapped.base) {
+                return (int64_t)stream->source.mapped.size;
+            }
+            break;
+#endif
+
+        default:
+            break;
+    }
+
+    return -1;
+}
+
 int picoStreamSeek(picoStream stream, int64_t offset, picoStreamSeekOrigin origin)
 {
     if (!stream) {
@@ -883,6 +1371,38 @@ size_t picoStreamReadLine(picoStream stream, char *buffer, size_t maxLength)
         return 0;
     }
 
+    size_t size         = 0;
+    size_t *position    = NULL;
+    const uint8_t *base = __picoStreamGetDirectBuffer(stream, &size, &position);
+    if (base) {
+        size_t available       = size - *position;
+        size_t limit           = (available < maxLength - 1) ? available : maxLength - 1;
+        const uint8_t *start   = base + *position;
+        const uint8_t *newline = __picoStreamFindByte(start, limit, '\n');
+        size_t count           = newline ? (size_t)(newline - start) : limit;
+        memcpy(buffer, start, count);
+        buffer[count] = '\0';
+        *position += count + (newline ? 1 : 0);
+        return count;
+    }
+
+    if (stream->type == PICO_STREAM_SOURCE_TYPE_FILE && stream->source.file) {
+        // one lock for the whole line, the count stays exact even with NULs in the line
+        FILE *file   = stream->source.file;
+        size_t count = 0;
+        __PICO_STREAM_LOCK_FILE(file);
+        while (count < maxLength - 1) {
+            int ch = __PICO_STREAM_GETC(file);
+            if (ch == EOF || ch == '\n') {
+                break;
+            }
+            buffer[count++] = (char)ch;
+        }
+        __PICO_STREAM_UNLOCK_FILE(file);
+        buffer[count] = '\0';
+        return count;
+    }
+
     size_t count = 0;
     while (count < maxLength - 1) {
         uint8_t ch;
@@ -896,6 +1416,30 @@ size_t picoStreamReadLine(picoStream stream, char *buffer, size_t maxLength)
     return count;
 }
 
+bool picoStreamReadLineView(picoStream stream, const char **outLine, size_t *outLength)
+{
+    if (!stream || !outLine || !outLength || !stream->canRead) {
+        return false;
+    }
+
+    size_t size         = 0;
+    size_t *position    = NULL;
+    const uint8_t *base = __picoStreamGetDirectBuffer(stream, &size, &position);
+    if (!base || *position >= size) {
+        return false;
+    }
+
+    const uint8_t *start   = base + *position;
+    size_t available       = size - *position;
+    const uint8_t *newline = __picoStreamFindByte(start, available, '\n');
+    size_t length          = newline ? (size_t)(newline - start) : available;
+
+    *outLine   = (const char *)start;
+    *outLength = length;
+    *position += length + (newline ? 1 : 0);
+    return true;
+}
+
 void picoStreamWriteLine(picoStream stream, const char *string)
 {
     if (!stream || !string || !stream->canWrite) {
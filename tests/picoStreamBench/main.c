@@ -0,0 +1,435 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PICO_IMPLEMENTATION
+#include "pico/picoPerf.h"
+#include "pico/picoStream.h"
+
+#define DEFAULT_DATA_SIZE_MB 16
+#define RANDOM_READ_COUNT    100000
+#define LINE_BUFFER_SIZE     1024
+
+typedef enum {
+    SOURCE_FILE,
+    SOURCE_MEMORY,
+    SOURCE_MAPPED,
+    SOURCE_CUSTOM,
+    SOURCE_COUNT
+} SourceKind;
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    size_t position;
+} CustomMemory;
+
+typedef struct {
+    const char *dataPath;
+    const char *scratchPath;
+    uint8_t *data;
+    size_t dataSize;
+    uint8_t *scratch;
+    uint64_t *offsets; // random read positions, valid for every RANDOM_SIZES entry
+} BenchContext;
+
+static const size_t BLOCK_SIZES[]  = {1, 16, 188, 4096, 65536};
+static const size_t RANDOM_SIZES[] = {188, 4096};
+
+static volatile uint64_t benchSink = 0;
+
+static const char *sourceName(SourceKind kind)
+{
+    switch (kind) {
+        case SOURCE_FILE:
+            return "FILE";
+        case SOURCE_MEMORY:
+            return "MEMORY";
+        case SOURCE_MAPPED:
+            return "MAPPED";
+        case SOURCE_CUSTOM:
+            return "CUSTOM";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+static size_t customRead(void *userData, void *buffer, size_t size)
+{
+    CustomMemory *memory = (CustomMemory *)userData;
+    size_t available     = memory->size - memory->position;
+    size_t toRead        = (size < available) ? size : available;
+    memcpy(buffer, memory->data + memory->position, toRead);
+    memory->position += toRead;
+    return toRead;
+}
+
+static size_t customWrite(void *userData, const void *buffer, size_t size)
+{
+    CustomMemory *memory = (CustomMemory *)userData;
+    size_t available     = memory->size - memory->position;
+    size_t toWrite       = (size < available) ? size : available;
+    memcpy(memory->data + memory->position, buffer, toWrite);
+    memory->position += toWrite;
+    return toWrite;
+}
+
+static int customSeek(void *userData, int64_t offset, picoStreamSeekOrigin origin)
+{
+    CustomMemory *memory = (CustomMemory *)userData;
+    int64_t base         = 0;
+    if (origin == PICO_STREAM_SEEK_CUR) {
+        base = (int64_t)memory->position;
+    } else if (origin == PICO_STREAM_SEEK_END) {
+        base = (int64_t)memory->size;
+    }
+    if (base + offset < 0 || base + offset > (int64_t)memory->size) {
+        return -1;
+    }
+    memory->position = (size_t)(base + offset);
+    return 0;
+}
+
+static int64_t customTell(void *userData)
+{
+    return (int64_t)((CustomMemory *)userData)->position;
+}
+
+static bool sourceSupports(SourceKind kind, bool write)
+{
+    if (kind == SOURCE_MAPPED) {
+        return PICO_STREAM_ENABLE_MAPPED && !write;
+    }
+    return true;
+}
+
+static picoStream openSource(BenchContext *ctx, SourceKind kind, bool write, CustomMemory *customMemory)
+{
+    switch (kind) {
+        case SOURCE_FILE:
+            return write ? picoStreamFromFilePath(ctx->scratchPath, false, true)
+                         : picoStreamFromFilePath(ctx->dataPath, true, false);
+        case SOURCE_MEMORY:
+            return write ? picoStreamFromMemory(ctx->scratch, ctx->dataSize, false, true, false)
+                         : picoStreamFromMemory(ctx->data, ctx->dataSize, true, false, false);
+#if PICO_STREAM_ENABLE_MAPPED
+        case SOURCE_MAPPED:
+            return write ? NULL : picoStreamFromFileMapped(ctx->dataPath);
+#endif
+        case SOURCE_CUSTOM: {
+            picoStreamCustom_t custom;
+            memset(&custom, 0, sizeof(custom));
+            customMemory->data     = write ? ctx->scratch : ctx->data;
+            customMemory->size     = ctx->dataSize;
+            customMemory->position = 0;
+            custom.userData        = customMemory;
+            custom.read            = customRead;
+            custom.write           = customWrite;
+            custom.seek            = customSeek;
+            custom.tell            = customTell;
+            return picoStreamFromCustom(custom, !write, write);
+        }
+        default:
+            return NULL;
+    }
+}
+
+typedef uint64_t (*BenchFunc)(BenchContext *ctx, picoStream stream, size_t blockSize, uint64_t iterations);
+
+typedef struct {
+    BenchContext *ctx;
+    char name[128];
+    picoStream stream; // opened once at registration so open and close stay out of the timings
+    CustomMemory custom;
+    size_t blockSize;
+    BenchFunc func;
+    bool failed;
+} BenchCase;
+
+static BenchCase benchCases[PICO_PERF_BENCH_MAX];
+static size_t benchCaseCount = 0;
+static size_t benchFailures  = 0;
+
+// Every iteration is one operation on a stream that wraps around at the end of the data set
+static uint64_t runCase(uint64_t iterations, void *userData)
+{
+    BenchCase *bench = (BenchCase *)userData;
+    picoStreamSeek(bench->stream, 0, PICO_STREAM_SEEK_SET);
+    uint64_t bytes = bench->func(bench->ctx, bench->stream, bench->blockSize, iterations);
+    if (bytes == 0) {
+        bench->failed = true;
+    }
+    return bytes;
+}
+
+static uint64_t benchSequentialRead(BenchContext *ctx, picoStream stream, size_t blockSize, uint64_t iterations)
+{
+    (void)ctx;
+    uint8_t *block    = (uint8_t *)malloc(blockSize);
+    uint64_t bytes    = 0;
+    uint64_t checksum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        size_t bytesRead = picoStreamRead(stream, block, blockSize);
+        if (bytesRead == 0) {
+            picoStreamSeek(stream, 0, PICO_STREAM_SEEK_SET);
+            bytesRead = picoStreamRead(stream, block, blockSize);
+        }
+        checksum += block[0];
+        bytes += bytesRead;
+    }
+
+    benchSink += checksum;
+    free(block);
+    return bytes;
+}
+
+static uint64_t benchRandomRead(BenchContext *ctx, picoStream stream, size_t blockSize, uint64_t iterations)
+{
+    uint8_t *block    = (uint8_t *)malloc(blockSize);
+    uint64_t bytes    = 0;
+    uint64_t checksum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        picoStreamSeek(stream, (int64_t)ctx->offsets[i % RANDOM_READ_COUNT], PICO_STREAM_SEEK_SET);
+        bytes += picoStreamRead(stream, block, blockSize);
+        checksum += block[0];
+    }
+
+    benchSink += checksum;
+    free(block);
+    return bytes;
+}
+
+static uint64_t benchTypedRead(BenchContext *ctx, picoStream stream, size_t blockSize, uint64_t iterations)
+{
+    (void)blockSize;
+    uint64_t valueCount = ctx->dataSize / sizeof(uint32_t);
+    uint64_t position   = 0;
+    uint64_t bytes      = 0;
+    uint64_t checksum   = 0;
+
+    // the stream position, not the call count, says how much was actually read
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (position == valueCount) {
+            int64_t consumed = picoStreamTell(stream);
+            bytes += consumed > 0 ? (uint64_t)consumed : 0;
+            picoStreamSeek(stream, 0, PICO_STREAM_SEEK_SET);
+            position = 0;
+        }
+        checksum += picoStreamReadU32(stream);
+        position++;
+    }
+
+    benchSink += checksum;
+    int64_t consumed = picoStreamTell(stream);
+    return bytes + (consumed > 0 ? (uint64_t)consumed : 0);
+}
+
+static uint64_t benchLineRead(BenchContext *ctx, picoStream stream, size_t blockSize, uint64_t iterations)
+{
+    (void)blockSize;
+    char line[LINE_BUFFER_SIZE];
+    uint64_t bytes    = 0;
+    uint64_t checksum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (picoStreamTell(stream) >= (int64_t)ctx->dataSize) {
+            bytes += ctx->dataSize;
+            picoStreamSeek(stream, 0, PICO_STREAM_SEEK_SET);
+        }
+        checksum += picoStreamReadLine(stream, line, sizeof(line));
+    }
+
+    benchSink += checksum;
+    return bytes + (uint64_t)picoStreamTell(stream);
+}
+
+static uint64_t benchLineView(BenchContext *ctx, picoStream stream, size_t blockSize, uint64_t iterations)
+{
+    (void)ctx;
+    (void)blockSize;
+    const char *line  = NULL;
+    size_t length     = 0;
+    uint64_t bytes    = 0;
+    uint64_t checksum = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (!picoStreamReadLineView(stream, &line, &length)) {
+            picoStreamSeek(stream, 0, PICO_STREAM_SEEK_SET);
+            if (!picoStreamReadLineView(stream, &line, &length)) {
+                break;
+            }
+        }
+        checksum += length;
+        bytes += length + 1;
+    }
+
+    benchSink += checksum;
+    return bytes;
+}
+
+static uint64_t benchSequentialWrite(BenchContext *ctx, picoStream stream, size_t blockSize, uint64_t iterations)
+{
+    uint64_t bytes    = 0;
+    uint64_t position = 0;
+
+    for (uint64_t i = 0; i < iterations; i++) {
+        if (position + blockSize > ctx->dataSize) {
+            picoStreamSeek(stream, 0, PICO_STREAM_SEEK_SET);
+            position = 0;
+        }
+        size_t written = picoStreamWrite(stream, ctx->data + position, blockSize);
+        position += blockSize;
+        bytes += written;
+    }
+    picoStreamFlush(stream);
+    return bytes;
+}
+
+static void registerCase(BenchContext *ctx, SourceKind kind, const char *operation, bool write, size_t blockSize, BenchFunc func)
+{
+    // sources that are not available in this build are skipped
+    if (!sourceSupports(kind, write) || benchCaseCount >= PICO_PERF_BENCH_MAX) {
+        return;
+    }
+
+    BenchCase *bench = &benchCases[benchCaseCount];
+    memset(bench, 0, sizeof(*bench));
+    if (blockSize > 0) {
+        snprintf(bench->name, sizeof(bench->name), "%s/%s/%zu", sourceName(kind), operation, blockSize);
+    } else {
+        snprintf(bench->name, sizeof(bench->name), "%s/%s", sourceName(kind), operation);
+    }
+
+    bench->stream = openSource(ctx, kind, write, &bench->custom);
+    if (!bench->stream) {
+        fprintf(stderr, "%s: failed to open the stream\n", bench->name);
+        benchFailures++;
+        return;
+    }
+
+    // so are operations the source cannot run
+    if (func(ctx, bench->stream, blockSize, 1) == 0) {
+        picoStreamDestroy(bench->stream);
+        return;
+    }
+
+    bench->ctx       = ctx;
+    bench->blockSize = blockSize;
+    bench->func      = func;
+    benchCaseCount++;
+    picoPerfBenchRegister(bench->name, runCase, bench);
+}
+
+static bool prepareData(BenchContext *ctx)
+{
+    ctx->data    = (uint8_t *)malloc(ctx->dataSize);
+    ctx->scratch = (uint8_t *)malloc(ctx->dataSize);
+    ctx->offsets = (uint64_t *)malloc(sizeof(uint64_t) * RANDOM_READ_COUNT);
+    if (!ctx->data || !ctx->scratch || !ctx->offsets) {
+        return false;
+    }
+
+    uint64_t offsetState = 0x9E3779B97F4A7C15ULL;
+    for (size_t i = 0; i < RANDOM_READ_COUNT; i++) {
+        offsetState ^= offsetState << 13;
+        offsetState ^= offsetState >> 7;
+        offsetState ^= offsetState << 17;
+        ctx->offsets[i] = offsetState % (ctx->dataSize - RANDOM_SIZES[sizeof(RANDOM_SIZES) / sizeof(RANDOM_SIZES[0]) - 1]);
+    }
+
+    // text lines of varying length so the same data works for the line benchmarks
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 ,.;:";
+    uint64_t state               = 0x2545F4914F6CDD1DULL;
+    size_t lineRemaining         = 0;
+    for (size_t i = 0; i < ctx->dataSize; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        if (lineRemaining == 0) {
+            lineRemaining = 16 + (size_t)(state % 160);
+            ctx->data[i]  = '\n';
+            continue;
+        }
+        ctx->data[i] = (uint8_t)alphabet[state % (sizeof(alphabet) - 1)];
+        lineRemaining--;
+    }
+    ctx->data[ctx->dataSize - 1] = '\n';
+
+    FILE *file = fopen(ctx->dataPath, "wb");
+    if (!file) {
+        return false;
+    }
+    bool ok = fwrite(ctx->data, 1, ctx->dataSize, file) == ctx->dataSize;
+    fclose(file);
+    return ok;
+}
+
+// usage: picoStreamBench [SIZE_MB] [DATA_PATH] [SCRATCH_PATH] [picoPerfBenchMain options]
+int main(int argc, char *argv[])
+{
+    BenchContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+
+    // positional arguments come first, the -- options are handled by picoPerfBenchMain
+    int positional = 1;
+    while (positional < argc && strncmp(argv[positional], "--", 2) != 0) {
+        positional++;
+    }
+
+    size_t sizeMB   = (positional > 1) ? (size_t)strtoul(argv[1], NULL, 10) : DEFAULT_DATA_SIZE_MB;
+    ctx.dataSize    = (sizeMB > 0 ? sizeMB : DEFAULT_DATA_SIZE_MB) * 1024 * 1024;
+    ctx.dataPath    = (positional > 2) ? argv[2] : "picoStreamBench.data";
+    ctx.scratchPath = (positional > 3) ? argv[3] : "picoStreamBench.scratch";
+
+    printf("picoStream benchmark: %zu MB data set\n\n", ctx.dataSize / (1024 * 1024));
+
+    if (!prepareData(&ctx)) {
+        fprintf(stderr, "Failed to prepare benchmark data\n");
+        free(ctx.data);
+        free(ctx.scratch);
+        free(ctx.offsets);
+        return 1;
+    }
+
+    for (int kind = 0; kind < SOURCE_COUNT; kind++) {
+        for (size_t i = 0; i < sizeof(BLOCK_SIZES) / sizeof(BLOCK_SIZES[0]); i++) {
+            registerCase(&ctx, (SourceKind)kind, "seq-read", false, BLOCK_SIZES[i], benchSequentialRead);
+        }
+        for (size_t i = 0; i < sizeof(RANDOM_SIZES) / sizeof(RANDOM_SIZES[0]); i++) {
+            registerCase(&ctx, (SourceKind)kind, "random-read", false, RANDOM_SIZES[i], benchRandomRead);
+        }
+        registerCase(&ctx, (SourceKind)kind, "typed-read-u32", false, 0, benchTypedRead);
+        registerCase(&ctx, (SourceKind)kind, "line-read", false, 0, benchLineRead);
+        registerCase(&ctx, (SourceKind)kind, "line-view", false, 0, benchLineView);
+        for (size_t i = 0; i < sizeof(BLOCK_SIZES) / sizeof(BLOCK_SIZES[0]); i++) {
+            registerCase(&ctx, (SourceKind)kind, "seq-write", true, BLOCK_SIZES[i], benchSequentialWrite);
+        }
+    }
+
+    argv[positional - 1] = argv[0];
+    int result           = picoPerfBenchMain(argc - positional + 1, argv + positional - 1);
+
+    printf("checksum: %" PRIu64 "\n", (uint64_t)benchSink);
+
+    for (size_t i = 0; i < benchCaseCount; i++) {
+        if (benchCases[i].failed) {
+            fprintf(stderr, "%s: no bytes processed\n", benchCases[i].name);
+            benchFailures++;
+        }
+        picoStreamDestroy(benchCases[i].stream);
+    }
+    if (benchFailures > 0) {
+        result = 1;
+    }
+
+    remove(ctx.dataPath);
+    remove(ctx.scratchPath);
+    free(ctx.data);
+    free(ctx.scratch);
+    free(ctx.offsets);
+    return result;
+}